@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,41 +7,170 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <wordexp.h>
-#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include "tsh.h"
 #include "tsh_cmd.h"
-
+#include "tsh_hash.h"
+#include "tsh_parse.h"
+#include "tsh_spawn.h"
+#include "tsh_input.h"
+#include "tsh_job.h"
+#include "tsh_rc.h"
+#include "tsh_cgroup.h"
+#include "tsh_place.h"
+#include "tsh_prio.h"
+#include "tsh_edit.h"
+#include "tsh_history.h"
+#include "tsh_expand.h"
+#include "tsh_var.h"
+#include "tsh_control.h"
+#include "tsh_zygote.h"
+#include "tsh_exec.h"
+
+// A builtin runs in the shell process when it is a lone foreground
+// command, and in a forked subshell otherwise, as in sh: "cd dir | cat"
+// or "export X=1 &" leave the shell as it was.
 TSH_command tsh_cmds[] =
 {
     { "help", "Display the list of supported command", tsh_help },
-    { "jobs", "Display the list of background process groups", tsh_jobs },
+    { "jobs", "Display the list of background process groups (-l: resource usage)", tsh_jobs },
     { "fg",   "Move specific process groups to foreground", tsh_fg },
     { "bg",   "Move specific process groups to background", tsh_bg },
-    { "export", "Set the given environment variable", tsh_export },
-    { "unset", "Unset the given environment variable", tsh_unset },
+    { "wait", "Wait for jobs to finish (wait [%job ...] [-n] [-t SECONDS])", tsh_wait },
+    { "export", "Export variables (export NAME=VALUE, export NAME)", tsh_export },
+    { "unset", "Remove shell variables", tsh_unset },
     { "cd", "Change current working directory", tsh_cd },
-    { "exit", "Exit TSH", tsh_exit }
+    { "hash", "List (-r: clear, -R: rebuild) the command path hash", tsh_hash },
+    { "set", "Show or change shell options (set pipesize SIZE, set spawnhelper on|off, set cgroup on|off, set autoplace off|cpu|node, set autoprio off|batch|idle)", tsh_set },
+    { "limit", "Show or change the cgroup limits of a job (limit %job cpu.max=50% memory.max=1G)", tsh_limit },
+    { "pin", "Show or change the CPUs of a job (pin %job [CPULIST | -n NODE])", tsh_pin },
+    { "prio", "Show or change the priority of a job (prio %job [nice=N] [sched=batch] [ioprio=be:7])", tsh_prio },
+    { "alias", "Define or list aliases (alias name=value)", tsh_alias },
+    { "unalias", "Remove aliases (-a: all of them)", tsh_unalias },
+    { "history", "List past commands (history [-s status] [-d dir] [-g text] [N])", tsh_history },
+    { "source", "Run the commands of a file in this shell", tsh_source },
+    { ".", "Run the commands of a file in this shell", tsh_source },
+    { "exit", "Exit TSH", tsh_exit },
+    { "true", "Return success", tsh_true },
+    { "false", "Return failure", tsh_false },
+    { "echo", "Write the arguments to standard output", tsh_echo },
+    { "printf", "Write formatted output", tsh_printf, tsh_printf_check },
+    { "cat", "Concatenate files to standard output", tsh_cat, tsh_cat_check },
+    { "test", "Evaluate a conditional expression", tsh_test },
+    { "[", "Evaluate a conditional expression", tsh_test },
+    { "parallel", "Run a command for every input item, N at a time", tsh_parallel },
+    { "break", "Leave the innermost N loops (break [N])", tsh_break },
+    { "continue", "Go on with the next round of the Nth loop (continue [N])", tsh_continue },
+    { "return", "Return from a function (return [STATUS])", tsh_return },
+    { "shift", "Drop the first N positional parameters (shift [N])", tsh_shift }
 };
 int tsh_cmd_num;
+extern char** environ;
 
-char *pwd;
 int tsh_pid;
-ProcessGroup** backgroundGroup;
+TSHOptions tsh_options;
 ProcessGroup* foregroundGroup;
 ProcessGroup* shellProcGroup;
 int stdin_fd;
 int stdout_fd;
-
-void signal_handler(int signum)
+Arena lineArena;
+int sigchld_fd;
+int atPrompt;
+int tsh_interactive;
+int last_status;
+LineEditor lineEditor;
+int useEditor;
+int isContinued;  // the prompt asks for the rest of a line
+static int forceBackground;            // run the next line as a background job
+static ProcessGroup* lastBackground;   // group of the last background job
+
+#ifndef TSH_BENCH
+int main(int argc, char* argv[])
 {
-    fprintf(stderr, "get signal!\n");
-}
+    const char* cmd_string = NULL;
+    const char* script = NULL;
+    const char* controlPath = NULL;
+    int noRC = 0;
+    int status;
+
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if (strcmp(argv[1], "--norc") == 0)
+            noRC = 1;
+        else if (strcmp(argv[1], "--control") == 0 && argc > 2)
+        {
+            controlPath = argv[2];
+            argc --;
+            argv ++;
+        }
+        else
+            break;
+        argc --;
+        argv ++;
+    }
+    if (argc > 1)
+    {
+        if (strcmp(argv[1], "-c") == 0)
+        {
+            if (argc < 3)
+            {
+                fprintf(stderr, "Usage: tsh [--norc] [--control <socket>] [-c <command> | <script>]\n");
+                return 2;
+            }
+            cmd_string = argv[2];
+
+            // Like sh -c: the words after the command are $0 $1 ...
+            if (argc > 3)
+            {
+                positional.num = argc - 4;
+                positional.args = argv + 3;
+            }
+        }
+        else
+        {
+            script = argv[1];
+            positional.num = argc - 2;
+            positional.args = argv + 1;
+        }
+    }
+
+    // Only a terminal on stdin gets the prompt and job control
+    tsh_interactive = (cmd_string == NULL && script == NULL && isatty(0));
 
-int main()
-{
     //Initialize the global variables
     initTSH();
+    if (!noRC)
+        loadRC();
+
+    // The helper is forked now, while the shell is small. The rc file
+    // or its snapshot may have turned it on.
+    if (tsh_options.spawnHelper && startZygote() == -1)
+        tsh_options.spawnHelper = 0;
+    if (controlPath != NULL && openControl(controlPath) == -1)
+        return 1;
+
+    // With a control socket, a command or a script only sets the shell
+    // up before it serves the socket
+    if (cmd_string != NULL)
+    {
+        status = runString(cmd_string);
+        return controlPath ? serveControl() : status;
+    }
+    if (script != NULL)
+    {
+        int fd = open(script, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            fprintf(stderr, "tsh: %s: %s\n", script, strerror(errno));
+            return 127;
+        }
+        // Read, not mapped: a script may be rewritten while it runs
+        status = runScript(fd);
+        return controlPath ? serveControl() : status;
+    }
+    if (!tsh_interactive)
+        return controlPath ? serveControl() : runScript(0);
 
     // Clear the screen and print welcome message
     printf("\e[2J\e[H");
@@ -52,775 +182,824 @@ int main()
     printf("-> Type \'help\' for supported command.\n");
     printf("\n");
 
-    // Infinite loop
+    return runInteractive();
+}
+#endif
+
+// Reactor: wait for input and for child status changes together,
+// so that background jobs are reaped the moment they change state.
+//
+int runInteractive()
+{
+    struct epoll_event ev;
+    int epfd;
+    int isEOF = 0;
+    char* pending = NULL;  // logical line continued with backslashes
+    size_t pending_len = 0;
+    LineBuffer command = { NULL, 0, 0 };  // lines of an unfinished command
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.fd = sigchld_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = 0;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &ev);
+    if (control.epfd != -1)
+    {
+        ev.events = EPOLLIN;
+        ev.data.fd = control.epfd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, control.epfd, &ev);
+    }
+
+    initLineEditor(&lineEditor, 0);
+    useEditor = 1;
+    openDefaultHistory();
+    showPrompt();
+
     while (1)
     {
-        char input[CMD_MAX_LEN];
+        struct epoll_event events[3];
+        int ev_num;
+        int ev_idx;
 
-        // Show the prompt
-        pwd = strdup(getenv("PWD"));
-        fprintf(stdout, "0486014 @ tsh [%s] $ ", pwd);
-        fflush(stdout);
-        free (pwd);
+        ev_num = epoll_wait(epfd, events, 3, -1);
+        if (ev_num == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("tsh: epoll_wait");
+            break;
+        }
 
-        // Read the command
-        if (fgets(input, CMD_MAX_LEN, stdin) != NULL)
+        for (ev_idx = 0 ; ev_idx < ev_num ; ev_idx ++)
         {
-            Command_handler* cmd_hdr;
-            int cmd_idx;
-            int cur_pgid = -1;
-            int prev_pipe[2] = {-1, -1};
-            int curr_pipe[2] = {-1, -1};
-            int num_system_cmd = 0;
-
-            // Parse all the command
-            cmd_hdr = parse_cmd_hdr(input);
-            check_cmd_hdr(cmd_hdr);
-
-            for (cmd_idx = 0 ; cmd_idx < cmd_hdr->cmd_num ; cmd_idx ++)
+            if (events[ev_idx].data.fd == sigchld_fd)
             {
-                pid_t child_pid;
-                Command* curr_cmd = cmd_hdr->cmds[cmd_idx];
-
-                pipe(curr_pipe);
+                struct signalfd_siginfo info;
+                while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info));
+
+                // Job notifications interrupt the prompt, show it again
+                if (reapChildren())
+                    showPrompt();
+                serveControlRequests();
+                if (!atPrompt)
+                    showPrompt();
+            }
+            else if (handleControlEvent(events[ev_idx].data.fd))
+            {
+                // A job started from the socket may have printed
+                if (!atPrompt)
+                    showPrompt();
+            }
+            else
+            {
+                char input[4096];
+                const char* data = input;
+                ssize_t n = read(0, input, sizeof(input));
+                size_t len;
+                char* line;
 
-                if (findTSHCommand(curr_cmd->args[0]))
+                if (n == -1 && errno == EINTR)
+                    continue;
+                if (n <= 0)
                 {
-                    // Check for pipe
-                    if (cmd_idx != 0)
-                    {
-                        close(0);
-                        dup2(prev_pipe[0], 0);
-                        close(prev_pipe[0]);
-                    }
-                    if (cmd_idx != cmd_hdr->cmd_num-1)
-                    {
-                        close(1);
-                        dup2(curr_pipe[1], 1);
-                        close(curr_pipe[1]);
-                    }
-                    processTSHCommand(curr_cmd);
-
-                    // Check for pipe
-                    if (cmd_idx != 0)
-                    {
-                        close(0);
-                        dup2(stdin_fd, 0);
-                    }
-                    if (cmd_idx != cmd_hdr->cmd_num-1)
-                    {
-                        close(1);
-                        dup2(stdout_fd, 1);
-                    }
-                    prev_pipe[0] = curr_pipe[0];
-
-                    /* build-in command */
-                    curr_cmd->pid = -1;
+                    if (n == -1)
+                        perror("tsh: read");
+                    isEOF = 1;
                 }
-                else
+                len = n > 0 ? n : 0;
+
+                while (!isEOF && (line = editorFeed(&lineEditor, &data, &len)) != NULL)
                 {
-                    num_system_cmd ++;
-                    if ((child_pid = fork()) == -1)
+                    char cwd[4096];
+                    struct timespec now;
+                    size_t line_len = strlen(line);
+                    size_t slashes = 0;
+
+                    if (lineEditor.isEOF)
                     {
-                        fprintf(stderr, "tsh: fork error.\n");
-                        exit(1);
+                        isEOF = 1;
+                        break;
                     }
-                    else if (child_pid == 0) // child
-                    {
-                        signal(SIGTTOU, signal_handler);
-                        // set pgid
-                        if (cur_pgid == -1)
-                            setpgid(0, 0);
-                        else
-                            setpgid(0, cur_pgid);
-
-                        // Check for pipe
-                        if (cmd_idx != 0)
-                        {
-                            close(0);
-                            dup2(prev_pipe[0], 0);
-                            close(prev_pipe[0]);
-                        }
-                        if (cmd_idx != cmd_hdr->cmd_num-1)
-                        {
-                            close(1);
-                            dup2(curr_pipe[1], 1);
-                            close(curr_pipe[1]);
-                        }
 
-                        // Check for redirect
-                        if (curr_cmd->inputFile != NULL)
-                        {
-                            close(0);
-                            open(curr_cmd->inputFile, O_RDONLY);
-                        }
-                        if (curr_cmd->outputFile != NULL)
-                        {
-                            // New file would have -rw-rw-r-- permission
-                            close(1);
-                            open(curr_cmd->outputFile, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-                        }
-
-                        // Execute the command
-                        if (curr_cmd->isPath == 1)
-                        {
-                            wordexp_t exp_cmd;
-                            if (checkCommandExpension(curr_cmd, &exp_cmd) == 0)
-                            {
-                                if (execv(exp_cmd.we_wordv[0], exp_cmd.we_wordv) == -1)
-                                {
-                                    switch (errno)
-                                    {
-                                        case ENOENT:
-                                            fprintf(stderr, "tsh: no such file or directory\n");
-                                            break;
-                                        default:
-                                            fprintf(stderr, "tsh: execv error: %s, %d\n", curr_cmd->args[0], errno);
-                                            break;
-                                    }
-                                }
-                            }
-                        }
-                        else
-                        {
-                            if (findSystemCommand(curr_cmd->args[0]))
-                            {
-                                wordexp_t exp_cmd;
-                                if (checkCommandExpension(curr_cmd, &exp_cmd) == 0)
-                                {
-                                    if (execvp(exp_cmd.we_wordv[0], exp_cmd.we_wordv) == -1)
-                                        fprintf(stderr, "tsh: execvp error: %s, %d\n", curr_cmd->args[0], errno);
-                                }
-                            }
-                            else
-                            {
-                                fprintf(stderr, "tsh: command not found: %s\n", curr_cmd->args[0]);
-                            }
-                        }
-
-                        // Child process should exit here
-                        exit(0);
-                    }
-                    else if (child_pid > 0) // parent process
+                    // Gather the pieces of a line ending with a backslash
+                    while (slashes < line_len && line[line_len - 1 - slashes] == '\\')
+                        slashes ++;
+                    if (slashes % 2 == 1 || pending != NULL)
                     {
-                        // close pipe
-                        if (cmd_idx != 0)
-                        {
-                            close(prev_pipe[0]);
-                        }
-                        if (cmd_idx != cmd_hdr->cmd_num-1)
+                        pending = (char*) realloc(pending, pending_len + line_len + 2);
+                        memcpy(pending + pending_len, line, line_len + 1);
+                        pending_len += line_len;
+                        if (slashes % 2 == 1)
                         {
-                            close(curr_pipe[1]);
+                            pending[pending_len ++] = '\n';
+                            pending[pending_len] = '\0';
+                            isContinued = 1;
+                            showPrompt();
+                            continue;
                         }
-                        prev_pipe[0] = curr_pipe[0];
-
-                        // wait until the child process set its pgid
-                        while (getpgid(child_pid) == getpgrp());
-
-                        // only set for first command
-                        if (cur_pgid == -1)
-                            cur_pgid = getpgid(child_pid);
-
-                        curr_cmd->pid = child_pid;
+                        line = pending;
+                        isContinued = 0;
                     }
-                }
-            }
 
-            // Create ProcessGroup
-            if (num_system_cmd != 0)
-            {
-                int idxPID;
-                ProcessGroup* curProcGroup = (ProcessGroup*) malloc(sizeof(ProcessGroup));
-                curProcGroup->pgid = cur_pgid;
-                curProcGroup->proc_num = 0;
-                curProcGroup->finish_num = 0;
-                curProcGroup->isRunning = (int*) malloc(sizeof(int) * num_system_cmd);
-                curProcGroup->status = (int*) malloc(sizeof(int) * num_system_cmd);
-                curProcGroup->cmdlines = (char**) malloc(sizeof(char*) * num_system_cmd);
-                curProcGroup->pids = (pid_t*) malloc(sizeof(pid_t) * num_system_cmd);
-                for (idxPID = 0 ; idxPID < cmd_hdr->cmd_num ; idxPID ++)
-                {
-                    if (cmd_hdr->cmds[idxPID]->pid != -1)
-                    {
-                        curProcGroup->pids[curProcGroup->proc_num] = cmd_hdr->cmds[idxPID]->pid;
-                        curProcGroup->cmdlines[curProcGroup->proc_num] = getCommandName(cmd_hdr->cmds[idxPID]);
-                        curProcGroup->status[curProcGroup->proc_num] = 0;
-                        curProcGroup->isRunning[curProcGroup->proc_num] = 1;
-                        curProcGroup->proc_num ++;
-                    }
-                }
+                    // The command gets the terminal in its usual mode
+                    editorStop(&lineEditor);
+                    clock_gettime(CLOCK_REALTIME, &now);
+                    if (getcwd(cwd, sizeof(cwd)) == NULL)
+                        cwd[0] = '\0';
 
-                if (curProcGroup->proc_num == 0)
-                    freeProcessGroup(&curProcGroup, 0);
-                else
-                {
-                    if (cmd_hdr->isBackGround == 1)
+                    // A compound command goes on until it is complete, and
+                    // gets into the history as a whole
+                    if (command.len > 0)
                     {
-                        // Insert into backgroundGroup
-                        insertIntoBackground(curProcGroup, 1);
+                        appendLine(&command, line, strlen(line));
+                        line = command.buf;
                     }
-                    else
+                    if (runLine(line, strlen(line)) == 1)
                     {
-                        int proc_idx;
-
-                        // Move the command to foreground
-                        moveToForeground(curProcGroup);
-
-                        for (proc_idx = 0 ; proc_idx < curProcGroup->proc_num ; proc_idx ++)
-                        {
-                            int status;
-                            waitpid(curProcGroup->pids[proc_idx], &status, WUNTRACED);
-                            setProcessGroupStatus(&curProcGroup, 1, curProcGroup->pids[proc_idx], status, NULL, NULL);
-                        }
-
-                        if (curProcGroup->finish_num != curProcGroup->proc_num)
-                            insertIntoBackground(curProcGroup, 0);
-
-                        // Move the tsh process group to foreground
-                        moveToForeground(shellProcGroup);
+                        if (command.len == 0)
+                            appendLine(&command, line, strlen(line));
+                        appendLine(&command, "\n", 1);
+                        free (pending);
+                        pending = NULL;
+                        pending_len = 0;
+                        isContinued = 1;
+                        showPrompt();
+                        continue;
                     }
+                    isContinued = 0;
+
+                    // Lines starting with a space stay out of the history
+                    if (line[strspn(line, " \t")] != '\0' && line[0] != ' ')
+                        addHistory(line, cwd, now.tv_sec, last_status);
+                    command.len = 0;
+                    reapChildren();
+                    serveControlRequests();
+                    free (pending);
+                    pending = NULL;
+                    pending_len = 0;
+                    showPrompt();
                 }
-            }
-            else if (foregroundGroup != shellProcGroup) // fg command
-            {
-                ProcessGroup* curProcGroup = foregroundGroup;
-                int proc_idx;
-                for (proc_idx = 0 ; proc_idx < curProcGroup->proc_num ; proc_idx ++)
+
+                if (isEOF)
                 {
-                    int status;
-                    waitpid(curProcGroup->pids[proc_idx], &status, WUNTRACED);
-                    setProcessGroupStatus(&curProcGroup, 1, curProcGroup->pids[proc_idx], status, NULL, NULL);
+                    editorStop(&lineEditor);
+                    finishLines(&command);
+                    return last_status;
                 }
-
-                if (curProcGroup->finish_num != curProcGroup->proc_num)
-                    insertIntoBackground(curProcGroup, 0);
-
-                // Move the tsh process group to foreground
-                moveToForeground(shellProcGroup);
             }
+        }
+    }
 
-            // Free the cmd_hdr
-            for (cmd_idx = 0 ; cmd_idx < cmd_hdr->cmd_num ; cmd_idx ++)
-            {
-                Command* curr_cmd = cmd_hdr->cmds[cmd_idx];
-                int arg_idx;
-
-                for (arg_idx = 0 ; arg_idx < curr_cmd->arg_num ; arg_idx ++)
-                    if (curr_cmd->args[arg_idx])
-                        free (curr_cmd->args[arg_idx]);
-                free (curr_cmd->args);
+    editorStop(&lineEditor);
+    return 1;
+}
 
-                if (curr_cmd->inputFile)
-                    free (curr_cmd->inputFile);
-                if (curr_cmd->outputFile)
-                    free (curr_cmd->outputFile);
+// Run every line read from fd, without prompt or job notifications.
+// Return the status of the last command.
+//
+int runScript(int fd)
+{
+    InputReader reader;
+    LineBuffer lines = { NULL, 0, 0 };
+    initInputReader(&reader, fd);
 
-                free (curr_cmd);
-            }
-            free (cmd_hdr->cmds);
-            free (cmd_hdr);
+    while (1)
+    {
+        char* line;
+        size_t len;
+        while ((line = nextLine(&reader, &len)) != NULL)
+        {
+            feedLine(&lines, line, len);
+            reapChildren();
         }
 
-        // Check for the exit status of background process
-        pid_t pid;
-        int status;
-        while ((pid = waitpid(-1, &status, WNOHANG | WCONTINUED | WUNTRACED)) > 0)
+        if (reader.isEOF)
+            break;
+        if (fillInput(&reader) == -1)
         {
-            int idxPG, idxPID;
-            int isFinish = 0;
-            isFinish = setProcessGroupStatus(backgroundGroup, MAX_BG_JOB, pid, status, &idxPG, &idxPID);
-
-            if (idxPG != -1)
-            {
-                if (WIFCONTINUED(status))
-                    continue;
-                else
-                {
-                    if (idxPG != -1)
-                    {
-                        fprintf(stderr, "[%d]", idxPG);
-                        fprintf(stderr, "\t%d\t", pid);
-                        if (WIFEXITED(status))
-                            fprintf(stderr, "exited (%d)", WEXITSTATUS(status));
-                        else if (WIFSIGNALED(status))
-                            fprintf(stderr, "killed (%d)", WTERMSIG(status));
-                        else if (WIFSTOPPED(status))
-                            fprintf(stderr, "stopped (%d)", WSTOPSIG(status));
-
-                        fprintf(stderr, "\t\t%s\n", backgroundGroup[idxPG]->cmdlines[idxPID]);
-                    }
-                    if (isFinish)
-                    {
-                        fprintf(stderr, "[%d]\t[ Finish ]\n", idxPG);
-                        freeProcessGroup(backgroundGroup, idxPG);
-                    }
-                }
-            }
-            else
-            {
-                isFinish = setProcessGroupStatus(&foregroundGroup, 1, pid, status, &idxPG, &idxPID);
-                if ((idxPG != -1) && (isFinish))
-                {
-                    moveToForeground(shellProcGroup);
-                }
-            }
+            perror("tsh: read");
+            break;
         }
     }
-
-    free (backgroundGroup);
+    finishLines(&lines);
+    freeInputReader(&reader);
+    return last_status;
 }
 
-void initTSH()
+// tsh -c: the string may hold several lines
+int runString(const char* cmd_string)
 {
-    stdin_fd = dup(0);
-    stdout_fd = dup(1);
-
-    tsh_cmd_num = sizeof(tsh_cmds) / sizeof(TSH_command);
+    LineBuffer lines = { NULL, 0, 0 };
+    size_t len = strlen(cmd_string);
+    size_t pos = 0;
 
-    backgroundGroup = (ProcessGroup**) malloc(sizeof(ProcessGroup*) * MAX_BG_JOB);
-    memset(backgroundGroup, 0, sizeof(ProcessGroup*) * MAX_BG_JOB);
-
-    // Process group for tsh
-    // TODO: more settings ...?
-    shellProcGroup = (ProcessGroup*) malloc(sizeof(ProcessGroup));
-    shellProcGroup->pgid = getpgrp();
-    foregroundGroup = shellProcGroup;
-
-    // PID of tsh
-    tsh_pid = getpid();
+    while (pos < len)
+    {
+        size_t end = findLineEnd(cmd_string, len, pos, 1);
+        feedLine(&lines, cmd_string + pos, end - pos);
+        reapChildren();
+        pos = end + 1;
+    }
+    finishLines(&lines);
+    return last_status;
 }
 
-int checkCommandExpension(Command* cmd, wordexp_t* result)
+// Shell style exit code of a wait status
+int getExitCode(int status)
 {
-    int idx_arg;
-    if ( wordexp(cmd->args[0], result, 0))
-    {
-        wordfree (result);
-        fprintf(stderr, "tsh: wordexp error\n");
-        return 1;
-    }
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return 0;
+}
 
-    for (idx_arg = 1 ; idx_arg < cmd->arg_num ; idx_arg ++)
+// The line editor redraws the line being typed after the prompt
+void showPrompt()
+{
+    const char* pwd = getVar("PWD");
+    char prompt[4200];
+
+    if (isContinued)
+        snprintf(prompt, sizeof(prompt), "> ");
+    else
+        snprintf(prompt, sizeof(prompt), "0486014 @ tsh [%s] $ ", pwd ? pwd : "");
+    if (useEditor)
+        editorStart(&lineEditor, prompt);
+    else
     {
-        if ( (cmd->args[idx_arg]) && (wordexp(cmd->args[idx_arg], result, WRDE_APPEND)) )
-        {
-            wordfree (result);
-            fprintf(stderr, "tsh: wordexp error\n");
-            return 1;
-        }
+        fputs(prompt, stdout);
+        fflush(stdout);
     }
-    return 0;
+    atPrompt = 1;
 }
 
-// isBackGround = 1 represents that the process group
-// are create to be backgroup.
+// Parse and execute input of one or more lines. Return 1, without
+// running anything, if it ends inside a command which goes on in the
+// next line.
 //
-void insertIntoBackground(ProcessGroup* group, int isBackGround)
+int runLine(const char* input, size_t len)
 {
-    int idxPG;
-    for (idxPG = 0 ; idxPG < MAX_BG_JOB ; idxPG ++)
-    {
-        if (backgroundGroup[idxPG] == NULL)
-        {
-            int idxPID;
-            backgroundGroup[idxPG] = group;
+    static int depth;
+    Node* program;
+    Arena nestedArena;
+    Arena* arena = &lineArena;
+    int ret = 0;
 
-            if (isBackGround == 1)
-            {
-                fprintf(stderr, "[%d]\t[ Start ]\n", idxPG);
-                fprintf(stderr, "\t");
-                for (idxPID = 0 ; idxPID < group->proc_num ; idxPID ++)
-                    fprintf(stderr, "%d ", group->pids[idxPID]);
-                fprintf(stderr, "\n");
-            }
-            else
-            {
-                int status;
-                fprintf(stderr, "\n[%d]\n", idxPG);
-                for (idxPID = 0 ; idxPID < group->proc_num ; idxPID ++)
-                {
-                    fprintf(stderr, "\t%d\t", group->pids[idxPID]);
-                    status = group->status[idxPID];
+    atPrompt = 0;
 
-                    if (WIFEXITED(status))
-                        fprintf(stderr, "exited (%d)", WEXITSTATUS(status));
-                    else if (WIFSIGNALED(status))
-                        fprintf(stderr, "killed (%d)", WTERMSIG(status));
-                    else if (WIFSTOPPED(status))
-                        fprintf(stderr, "stopped (%d)", WSTOPSIG(status));
-
-                    fprintf(stderr, "\t\t%s\n", group->cmdlines[idxPID]);
-                }
-            }
-
-            break;
-        }
-    }
-    if (idxPG == MAX_BG_JOB)
+    // A sourced file runs its lines while the source line is still in
+    // use, they get an arena of their own
+    if (depth > 0)
     {
-        fprintf(stderr, "tsh: Cannot create background process group\n");
-        exit(1);
+        arenaInit(&nestedArena, 4096);
+        arena = &nestedArena;
     }
-}
+    depth ++;
 
-// return 1 if the given process group is finished
-int setProcessGroupStatus(ProcessGroup** group, int num_group, pid_t pid, int status, int* pidxPG, int* pidxPID)
-{
-    int idxPG;
-    for (idxPG = 0 ; idxPG < num_group ; idxPG ++)
+    // Parse all of it, then run it; the words of every pipeline are
+    // expanded once in the shell right before it runs
+    switch (parseProgram(input, len, arena, &program))
     {
-        ProcessGroup* currGroup = group[idxPG];
-        if (currGroup)
-        {
-            int idxPID;
-            for (idxPID = 0 ; idxPID < currGroup->proc_num ; idxPID ++)
+        case 0:
+            if (forceBackground)
             {
-                if (currGroup->pids[idxPID] == pid)
+                forceBackground = 0;
+                if (program == NULL)
                 {
-                    currGroup->status[idxPID] = status;
-                    if (pidxPG)
-                        *pidxPG = idxPG;
-                    if (pidxPID)
-                        *pidxPID = idxPID;
-
-                    if (WIFEXITED(status) || WIFSIGNALED(status))
-                    {
-                        currGroup->isRunning[idxPID] = 0;
-                        currGroup->finish_num ++;
-                        if (currGroup->proc_num == currGroup->finish_num)
-                        {
-                            return 1;
-                        }
-
-                    }
-                    else if (WIFSTOPPED(status))
-                    {
-                        currGroup->isRunning[idxPID] = 0;
-                    }
-                    else if (WIFCONTINUED(status))
-                    {
-                        currGroup->isRunning[idxPID] = 1;
-                    }
-                    return 0;
+                    fprintf(stderr, "tsh: nothing to run as a job\n");
+                    last_status = 2;
+                    break;
                 }
+                program = newBackgroundJob(arena, program, input, input + len);
             }
-        }
+            execProgram(program, arena);
+            break;
+        case 1:
+            ret = 1;
+            break;
+        default:
+            last_status = 2;
+            break;
     }
-    if (pidxPG)
-        *pidxPG = -1;
-    if (pidxPID)
-        *pidxPID = -1;
 
-    return 0;
+    // Release everything parsed from this line
+    depth --;
+    if (arena == &lineArena)
+        arenaReset(&lineArena);
+    else
+        arenaFree(&nestedArena);
+    return ret;
 }
 
-void freeProcessGroup(ProcessGroup** group, int idxPG)
+// Run a line as one background job, a list of commands as if it was
+// { list; } &. Return the group of its processes, NULL if none of them
+// is running.
+//
+ProcessGroup* runBackgroundLine(const char* input, size_t len)
 {
-    int idx;
-    ProcessGroup* currGroup = group[idxPG];
-    free (currGroup->pids);
-    free (currGroup->isRunning);
-    free (currGroup->status);
-
-    for (idx = 0 ; idx < currGroup->proc_num ; idx ++)
-        free (currGroup->cmdlines[idx]);
-    free (currGroup->cmdlines);
-    free (currGroup);
-    group[idxPG] = NULL;
-
+    forceBackground = 1;
+    lastBackground = NULL;
+    if (runLine(input, len) == 1)
+    {
+        fprintf(stderr, "tsh: syntax error: unexpected end of file\n");
+        last_status = 2;
+    }
+    forceBackground = 0;
+    return lastBackground;
 }
 
-void moveToForeground(ProcessGroup* proc)
+// Record the new status of a child which is not part of the foreground
+// job. Return 1 if a notification was printed.
+//
+int handleChildStatus(pid_t pid, int status, struct rusage* usage)
 {
-    signal(SIGTTIN, SIG_IGN);
-    signal(SIGTTOU, SIG_IGN);
-    if (isatty(0)) tcsetpgrp(0, proc->pgid);
-    if (isatty(1)) tcsetpgrp(1, proc->pgid);
-    if (isatty(2)) tcsetpgrp(2, proc->pgid);
-    signal(SIGTTOU, SIG_DFL);
-    signal(SIGTTIN, SIG_DFL);
-    foregroundGroup = proc;
-}
+    ProcessGroup* group;
+    int idxPID;
+    int isFinish = 0;
+    isFinish = setProcessGroupStatus(pid, status, usage, &group, &idxPID);
 
-int findTSHCommand(char* cmd_name)
-{
-    int cmd_idx;
-    for (cmd_idx = 0 ; cmd_idx < tsh_cmd_num ; cmd_idx ++)
+    if (group == NULL || group->jobID == -1 || WIFCONTINUED(status))
+        return 0;
+
+    if (!tsh_interactive)
     {
-        if (strcmp(tsh_cmds[cmd_idx].cmd_name, cmd_name) == 0)
-            return 1;
+        if (isFinish)
+        {
+            if (group->isTimed)
+                printTimeReport(group);
+            freeProcessGroup(group);
+        }
+        return 0;
     }
-    return 0;
-}
 
-int processTSHCommand(Command* cmd)
-{
-    char* cmd_name = cmd->args[0];
-    int cmd_idx;
-    for (cmd_idx = 0 ; cmd_idx < tsh_cmd_num ; cmd_idx ++)
+    // Do not print on the same line as the prompt
+    if (atPrompt)
     {
-        if (strcmp(tsh_cmds[cmd_idx].cmd_name, cmd_name) == 0)
-            return tsh_cmds[cmd_idx].cmd_func(cmd->arg_num, cmd->args);
+        fprintf(stderr, "\n");
+        atPrompt = 0;
     }
 
-    // Should not be here since we would call findTSHCommand first.
-    return 0;
+    fprintf(stderr, "[%d]", group->jobID);
+    fprintf(stderr, "\t%d\t", pid);
+    if (WIFEXITED(status))
+        fprintf(stderr, "exited (%d)", WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        fprintf(stderr, "killed (%d)", WTERMSIG(status));
+    else if (WIFSTOPPED(status))
+        fprintf(stderr, "stopped (%d)", WSTOPSIG(status));
+
+    fprintf(stderr, "\t\t%s\n", group->procs[idxPID].cmdline);
+    if (isFinish)
+    {
+        fprintf(stderr, "[%d]\t[ Finish ]\n", group->jobID);
+        if (group->isTimed)
+            printTimeReport(group);
+        freeProcessGroup(group);
+    }
+    return 1;
 }
 
-int findSystemCommand(char* cmd_name)
+// Reap every child which changed state. Return 1 if anything was printed.
+int reapChildren()
 {
-    char *path = strdup(getenv("PATH"));
-    if (path != NULL)
+    pid_t pid;
+    int status;
+    struct rusage usage;
+    int printed = 0;
+
+    while ((pid = wait4(-1, &status, WNOHANG | WCONTINUED | WUNTRACED, &usage)) > 0)
+        printed |= handleChildStatus(pid, status, &usage);
+    return printed;
+}
+
+// Run one pipeline: a lone foreground builtin inline, other builtins in
+// forked subshells, everything else through the spawn engine, then wait
+// for it unless it is a background job.
+//
+void executeCommandHandler(Command_handler* cmd_hdr)
+{
+    int cmd_idx;
+    pid_t cur_pgid = 0;
+    int prev_pipe[2] = {-1, -1};
+    int curr_pipe[2] = {-1, -1};
+    int num_system_cmd = 0;
+    int status = 0;        // status of the last command if it is not a process
+    int lastIsProcess = 0;
+    int pipeSize = cmd_hdr->pipeSize ? cmd_hdr->pipeSize : tsh_options.pipeSize;
+    int realPipeSize = 0;
+    int cgroup_fd = -1;
+    int cgroupID = 0;
+    int isInShell = 0;
+    Placement* placement = NULL;
+    Priority startPrio;
+    Priority* priority = NULL;
+    int isDemoted = (cmd_hdr->isBackGround && tsh_options.autoPrio != AUTOPRIO_OFF);
+    struct timespec startTime;
+    struct rusage selfStart;
+
+    // A job with limits, a placement or a priority does not run at all if
+    // they can not be applied. A lone builtin in the foreground runs in
+    // the shell, and gets none of them.
+    if (cmd_hdr->cmd_num == 1)
     {
-        char *remainStr;
-        char *subPath;
+        TSH_command* builtin = getStageCommand(cmd_hdr->cmds[0]);
+        isInShell = (builtin != NULL && builtin->cmd_check == NULL && !cmd_hdr->isBackGround);
+    }
+    if (cmd_hdr->cmd_num > 0 && !isInShell)
+    {
+        int hasPrio;
 
-        subPath = strtok_r(path, ":", &remainStr);
-        while (subPath != NULL)
+        if ((hasPrio = getStartPriority(cmd_hdr->priority, isDemoted, &startPrio)) == -1 ||
+            choosePlacement(cmd_hdr, &placement) == -1 ||
+            (cgroup_fd = createJobCgroup(cmd_hdr, &cgroupID)) == -2)
         {
-            DIR* dp;
-            struct dirent* entry;
-
-            if ((dp = opendir(subPath)) != NULL)
-            {
-                while((entry = readdir(dp)) != NULL)
-                {
-                    if (strcmp(entry->d_name, cmd_name) == 0)
-                    {
-                        closedir(dp);
-                        free (path);
-                        return 1;
-                    }
-                }
-            }
-            closedir(dp);
-            subPath = strtok_r(remainStr, ":", &remainStr);
+            releasePlacement(placement);
+            last_status = 1;
+            return;
         }
+        if (hasPrio)
+            priority = &startPrio;
     }
-    free (path);
 
-    return 0;
-}
+    if (cmd_hdr->isTimed)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+        getrusage(RUSAGE_SELF, &selfStart);
+    }
 
-void check_cmd_hdr(Command_handler* cmd_hdr)
-{
-    int cmd_idx;
     for (cmd_idx = 0 ; cmd_idx < cmd_hdr->cmd_num ; cmd_idx ++)
     {
-        Command* cmd = cmd_hdr->cmds[cmd_idx];
-        int arg_idx;
-        for (arg_idx = 0 ; arg_idx < cmd->arg_num ; arg_idx ++)
+        Command* curr_cmd = cmd_hdr->cmds[cmd_idx];
+        int isLast = (cmd_idx == cmd_hdr->cmd_num-1);
+        TSH_command* builtin = getStageCommand(curr_cmd);
+
+        curr_cmd->pid = -1;
+        curr_pipe[0] = curr_pipe[1] = -1;
+        lastIsProcess = 0;
+        if (!isLast)
         {
-            if ((cmd->args[arg_idx] != NULL) && (strcmp(cmd->args[arg_idx], "&") == 0))
+            // Give up the rest of the pipeline. The stages started
+            // already are stopped, then waited for as a job.
+            if (pipe2(curr_pipe, O_CLOEXEC) == -1)
             {
-                free (cmd->args[arg_idx]);
-                cmd->args[arg_idx] = NULL;
-                if (cmd_idx != cmd_hdr->cmd_num - 1)
-                    fprintf(stderr, "tsh: Unrecognized format.\n");
-                else
-                    cmd_hdr->isBackGround = 1;
+                int idx;
+                perror("tsh: pipe");
+                if (cmd_idx != 0)
+                    close(prev_pipe[0]);
+                for (idx = 0 ; idx < cmd_idx ; idx ++)
+                    if (cmd_hdr->cmds[idx]->pid != -1)
+                        kill(cmd_hdr->cmds[idx]->pid, SIGTERM);
+                status = 1;
+                break;
+            }
+            if (pipeSize > 0)
+            {
+                int size = setPipeSize(curr_pipe[1], pipeSize);
+                if (size > 0)
+                    realPipeSize = size;
             }
         }
-    }
-}
 
-Command_handler* parse_cmd_hdr(char* input)
-{
-    char *subStr;
-    char *remainStr;
-    Command_handler* ret = (Command_handler*) malloc(sizeof(Command_handler));
-    int cur_num = 1;
+        // Fast path utilities may leave unsupported options, or a read
+        // from the terminal, to the real command.
+        if (builtin != NULL && builtin->cmd_check != NULL)
+        {
+            int ttyInput = (cmd_idx == 0 && curr_cmd->inputFile == NULL && tsh_interactive && isatty(0));
+            if (!builtin->cmd_check(curr_cmd->arg_num, curr_cmd->args, ttyInput))
+                builtin = NULL;
+        }
 
-    ret->isBackGround = 0;
-    ret->cmd_num = 0;
-    ret->cmds = (Command**) malloc(sizeof(Command*) * cur_num);
+        // Only a lone builtin in the foreground may run in the shell: in
+        // a pipeline or a background job it would block the shell, and
+        // the job would not get the terminal.
+        if (builtin != NULL && cmd_hdr->cmd_num == 1 && !cmd_hdr->isBackGround)
+        {
+            // Run in the shell itself. stdin and stdout are put back as
+            // they were, which is not the terminal in a redirected function.
+            int saved_in = -1, saved_out = -1;
+
+            if (curr_cmd->inputFile != NULL)
+                saved_in = fcntl(0, F_DUPFD_CLOEXEC, 10);
+            if (curr_cmd->outputFile != NULL)
+                saved_out = fcntl(1, F_DUPFD_CLOEXEC, 10);
+            if (redirectFiles(curr_cmd->inputFile, curr_cmd->outputFile) == -1)
+                status = 1;
+            else if (curr_cmd->assign_num > 0)
+            {
+                Var* saved = pushAssignments(curr_cmd->assigns, curr_cmd->assign_num, execArena);
+                status = processTSHCommand(curr_cmd);
+                popAssignments(curr_cmd->assigns, curr_cmd->assign_num, saved);
+            }
+            else
+                status = processTSHCommand(curr_cmd);
+            fflush(stdout);
 
-    subStr = strtok_r(input, "|", &remainStr);
-    while (subStr != NULL)
-    {
-        Command* tmp_cmd;
-        if (ret->cmd_num == cur_num)
+            // Undo the redirections
+            if (saved_in != -1)
+            {
+                dup2(saved_in, 0);
+                close(saved_in);
+            }
+            if (saved_out != -1)
+            {
+                dup2(saved_out, 1);
+                close(saved_out);
+            }
+        }
+        else if (builtin != NULL)
         {
-            Command** tmp = (Command**) malloc(sizeof(Command*) * ret->cmd_num);
-            memcpy (tmp, ret->cmds, ret->cmd_num * sizeof(Command*));
+            SpawnRequest req;
+            pid_t child_pid;
+
+            // A stage of its own, concurrently with the rest of the
+            // pipeline, so it can not block the shell
+            initSpawnRequest(&req);
+            req.in_fd = (cmd_idx != 0) ? prev_pipe[0] : -1;
+            req.out_fd = (!isLast) ? curr_pipe[1] : -1;
+            req.close_fd = curr_pipe[0];
+            req.inputFile = curr_cmd->inputFile;
+            req.outputFile = curr_cmd->outputFile;
+            req.pgid = tsh_interactive ? cur_pgid : -1;
+            req.cgroup_fd = cgroup_fd;
+            req.placement = placement;
+            req.priority = priority;
+
+            status = 1;
+            if ((child_pid = spawnBuiltin(&req, curr_cmd)) == -1)
+                fprintf(stderr, "tsh: fork error: %s\n", strerror(errno));
+            else
+            {
+                if (cur_pgid == 0)
+                    cur_pgid = child_pid;
+                curr_cmd->pid = child_pid;
+                clock_gettime(CLOCK_MONOTONIC, &curr_cmd->startTime);
+                num_system_cmd ++;
+                lastIsProcess = 1;
+            }
 
-            free (ret->cmds);
-            cur_num *= 2;
+            if (cmd_idx != 0)
+                close(prev_pipe[0]);
+            if (!isLast)
+                close(curr_pipe[1]);
+        }
+        else
+        {
+            SpawnRequest req;
+            pid_t child_pid;
+
+            status = 1;
+            initSpawnRequest(&req);
+            req.in_fd = (cmd_idx != 0) ? prev_pipe[0] : -1;
+            req.out_fd = (!isLast) ? curr_pipe[1] : -1;
+            req.inputFile = curr_cmd->inputFile;
+            req.outputFile = curr_cmd->outputFile;
+            req.pgid = tsh_interactive ? cur_pgid : -1;
+            req.cgroup_fd = cgroup_fd;
+            req.placement = placement;
+            req.priority = priority;
+            if (curr_cmd->assign_num > 0)
+                req.envp = overlayEnvp(curr_cmd->assigns, curr_cmd->assign_num);
+
+            child_pid = launchCommand(&req, curr_cmd->args, &status);
+            free (req.envp);
+            if (child_pid != -1)
+            {
+                // The first command leads the process group
+                if (cur_pgid == 0)
+                    cur_pgid = child_pid;
+                curr_cmd->pid = child_pid;
+                clock_gettime(CLOCK_MONOTONIC, &curr_cmd->startTime);
+                num_system_cmd ++;
+                lastIsProcess = 1;
+            }
 
-            ret->cmds = (Command**) malloc(sizeof(Command*) * cur_num);
-            memcpy (ret->cmds, tmp, ret->cmd_num * sizeof(Command*));
+            // close pipe, the next command reads EOF if this one failed
+            if (cmd_idx != 0)
+                close(prev_pipe[0]);
+            if (!isLast)
+                close(curr_pipe[1]);
+        }
+        prev_pipe[0] = curr_pipe[0];
+    }
 
-            free (tmp);
+    // Create ProcessGroup
+    if (num_system_cmd != 0)
+    {
+        ProcessGroup* curProcGroup = newProcessGroup(cmd_hdr);
+        curProcGroup->pipeSize = realPipeSize;
+        curProcGroup->cgroup_fd = cgroup_fd;
+        curProcGroup->cgroupID = cgroupID;
+        curProcGroup->placement = placement;
+        curProcGroup->isDemoted = isDemoted;
+        if (cmd_hdr->priority != NULL)
+        {
+            curProcGroup->priority = (Priority*) malloc(sizeof(Priority));
+            *curProcGroup->priority = *cmd_hdr->priority;
         }
+        cgroup_fd = -1;
+        placement = NULL;
 
-        if ((tmp_cmd = parse_cmd(subStr)) != NULL)
+        if (cmd_hdr->isBackGround == 1)
         {
-            check_cmd_env(tmp_cmd);
-            check_cmd(tmp_cmd);
-            ret->cmds[ret->cmd_num] = tmp_cmd;
-            ret->cmd_num ++;
+            // Insert into the job table
+            insertIntoBackground(curProcGroup, 1);
+            lastBackground = curProcGroup;
+            status = 0;
         }
+        else
+        {
+            int exitCode;
 
-        subStr = strtok_r(remainStr, "|", &remainStr);
+            // Move the command to foreground
+            moveToForeground(curProcGroup);
+            exitCode = waitForeground(curProcGroup);
+            if (lastIsProcess)
+                status = exitCode;
+        }
     }
-
-    if (ret->cmd_num < cur_num)
+    else if (foregroundGroup != shellProcGroup) // fg command
     {
-        Command** tmp = (Command**) malloc(sizeof(Command*) * ret->cmd_num);
-        memcpy (tmp, ret->cmds, ret->cmd_num * sizeof(Command*));
-
-        free (ret->cmds);
-        cur_num = ret->cmd_num;
-
-        ret->cmds = (Command**) malloc(sizeof(Command*) * cur_num);
-        memcpy (ret->cmds, tmp, ret->cmd_num * sizeof(Command*));
-
-        free (tmp);
+        status = waitForeground(foregroundGroup);
+    }
+    else if (cmd_hdr->isTimed)
+    {
+        // Only builtins ran, they used the time of the shell itself
+        struct timespec endTime;
+        struct rusage selfEnd;
+
+        clock_gettime(CLOCK_MONOTONIC, &endTime);
+        getrusage(RUSAGE_SELF, &selfEnd);
+        printTimeSummary(timespecDiff(&endTime, &startTime),
+                         timevalDiff(&selfEnd.ru_utime, &selfStart.ru_utime),
+                         timevalDiff(&selfEnd.ru_stime, &selfStart.ru_stime));
     }
 
-    return ret;
+    // Nothing was started in it
+    if (cgroup_fd != -1)
+        removeJobCgroup(cgroup_fd, cgroupID);
+    releasePlacement(placement);
+    last_status = status;
 }
 
-void check_cmd_env(Command* cmd)
+// Wait until every process of the foreground job exited or stopped.
+// Background children changing state meanwhile are handled too.
+// Return the exit code of the last process.
+//
+int waitForeground(ProcessGroup* curProcGroup)
 {
-    // Check for environment variable
-    //
-    // Does not consider the concatenation of environment variable for now
-    //
-    int arg_idx;
-    char *cur_arg;
-
-    for (arg_idx = 0 ; arg_idx < cmd->arg_num ; arg_idx ++)
+    int proc_idx;
+    int exitCode;
+
+    while (1)
     {
-        char *env = NULL;
-        cur_arg = cmd->args[arg_idx];
+        struct rusage usage;
+        pid_t pid;
+        int status;
 
-        if (cur_arg && (cur_arg[0] == '$'))
-        {
-            env = getenv(cur_arg+1);
-            free (cmd->args[arg_idx]);
-            cmd->args[arg_idx] = NULL;
+        for (proc_idx = 0 ; proc_idx < curProcGroup->proc_num ; proc_idx ++)
+            if (curProcGroup->procs[proc_idx].isRunning)
+                break;
+        if (proc_idx == curProcGroup->proc_num)
+            break;
 
-            if (env)
-            {
-                cmd->args[arg_idx] = strdup(env);
-            }
+        if ((pid = wait4(-1, &status, WUNTRACED, &usage)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
         }
+
+        // Status of other jobs is reported as usual
+        if (findProcessGroup(pid) == curProcGroup)
+            setProcessGroupStatus(pid, status, &usage, NULL, NULL);
+        else
+            handleChildStatus(pid, status, &usage);
     }
-}
 
-void check_cmd(Command* cmd)
-{
-    // Check for redirect
-    int arg_idx;
-    int min_idx = cmd->arg_num;
-    for (arg_idx = 0 ; arg_idx < cmd->arg_num ; arg_idx ++)
+    exitCode = getExitCode(curProcGroup->procs[curProcGroup->proc_num - 1].status);
+    if (curProcGroup->finish_num != curProcGroup->proc_num)
     {
-        if (cmd->args[arg_idx] == NULL)
-            continue;
-        else if (strcmp(cmd->args[arg_idx], ">") == 0)
-        {
-            free (cmd->args[arg_idx]);
-            cmd->args[arg_idx] = NULL;
-            cmd->outputFile = cmd->args[arg_idx + 1];
-            cmd->args[arg_idx + 1] = NULL;
-            arg_idx ++;
-        }
-        else if (strcmp(cmd->args[arg_idx], "<") == 0)
-        {
-            free (cmd->args[arg_idx]);
-            cmd->args[arg_idx] = NULL;
-            cmd->inputFile = cmd->args[arg_idx + 1];
-            cmd->args[arg_idx + 1] = NULL;
-            arg_idx ++;
-        }
+        insertIntoBackground(curProcGroup, 0);
+        setJobDemoted(curProcGroup, 1);
+    }
+    else
+    {
+        if (curProcGroup->isTimed)
+            printTimeReport(curProcGroup);
+        freeProcessGroup(curProcGroup);
     }
 
-    // TODO: Resize
-    //
+    // Move the tsh process group to foreground
+    moveToForeground(shellProcGroup);
+    return exitCode;
 }
 
-Command* parse_cmd(char* input)
+void initTSH()
 {
-    char *subStr;
-    char *remainStr;
-    Command* ret = (Command*) malloc(sizeof(Command));
-    int cur_num = 2;
-    ret->inputFile = NULL;
-    ret->outputFile = NULL;
-    ret->arg_num = 0;
-    ret->isPath = 0;
-    ret->args = (char**) malloc(sizeof(char*) * cur_num);
-
-    subStr = strtok_r(input, " \n", &remainStr);
-    while (subStr != NULL)
-    {
-        // expand the size of the args array
-        if ((ret->arg_num + 1) >= cur_num)
-        {
-            char** tmp = (char**) malloc(sizeof(char*) * ret->arg_num);
-            memcpy (tmp, ret->args, ret->arg_num * sizeof(char*));
+    sigset_t mask;
 
-            free (ret->args);
-            cur_num *= 2;
+    stdin_fd = fcntl(0, F_DUPFD_CLOEXEC, 0);
+    stdout_fd = fcntl(1, F_DUPFD_CLOEXEC, 0);
 
-            ret->args = (char**) malloc(sizeof(char*) * cur_num);
-            memcpy (ret->args, tmp, ret->arg_num * sizeof(char*));
+    tsh_cmd_num = sizeof(tsh_cmds) / sizeof(TSH_command);
 
-            free (tmp);
-        }
+    // Everything parsed from one input line lives in this arena
+    arenaInit(&lineArena, 4096);
 
-        ret->args[ret->arg_num] = strdup(subStr);
-        ret->arg_num ++;
+    // Variables start as the inherited environment, all exported
+    initVars(environ);
 
-        subStr = strtok_r(remainStr, " \n", &remainStr);
-    }
+    initJobTable();
 
-    if (ret->arg_num == 0)
-    {
-        free (ret->args);
-        free (ret);
-        return NULL;
-    }
+    // Process group for tsh
+    // TODO: more settings ...?
+    shellProcGroup = (ProcessGroup*) malloc(sizeof(ProcessGroup));
+    shellProcGroup->pgid = getpgrp();
+    shellProcGroup->jobID = -1;
+    shellProcGroup->proc_num = 0;
+    shellProcGroup->finish_num = 0;
+    shellProcGroup->pipeSize = 0;
+    shellProcGroup->cgroup_fd = -1;
+    shellProcGroup->placement = NULL;
+    shellProcGroup->priority = NULL;
+    shellProcGroup->isDemoted = 0;
+    foregroundGroup = shellProcGroup;
 
-    // TODO use more elegant method ...
-    ret->args[ret->arg_num] = NULL;
-    ret->arg_num ++;
+    // PID of tsh
+    tsh_pid = getpid();
 
-    if (ret->arg_num < cur_num)
-    {
-        char** tmp = (char**) malloc(sizeof(char*) * ret->arg_num);
-        memcpy (tmp, ret->args, ret->arg_num * sizeof(char*));
+    // Child status changes are read from a signalfd by the reactor
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
 
-        free (ret->args);
-        cur_num = ret->arg_num;
+void moveToForeground(ProcessGroup* proc)
+{
+    // Without job control everything stays in the shell's group
+    if (tsh_interactive)
+    {
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+        if (isatty(0)) tcsetpgrp(0, proc->pgid);
+        if (isatty(1)) tcsetpgrp(1, proc->pgid);
+        if (isatty(2)) tcsetpgrp(2, proc->pgid);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+    }
+    foregroundGroup = proc;
+}
 
-        ret->args = (char**) malloc(sizeof(char*) * cur_num);
-        memcpy (ret->args, tmp, ret->arg_num * sizeof(char*));
+// Functions run like builtins which do not change the state of the
+// shell: in it if they are a lone foreground command, else in a forked
+// copy.
+static TSH_command functionCommand = { "function", "Shell function", callFunction };
 
-        free (tmp);
+TSH_command* getTSHCommand(char* cmd_name)
+{
+    int cmd_idx;
+    for (cmd_idx = 0 ; cmd_idx < tsh_cmd_num ; cmd_idx ++)
+    {
+        if (strcmp(tsh_cmds[cmd_idx].cmd_name, cmd_name) == 0)
+            return &tsh_cmds[cmd_idx];
     }
+    if (functionTable.func_num > 0 && findFunction(cmd_name) != NULL)
+        return &functionCommand;
+    return NULL;
+}
 
-    if (strchr(ret->args[0], '/') != NULL)
-        ret->isPath = 1;
+int findTSHCommand(char* cmd_name)
+{
+    return (getTSHCommand(cmd_name) != NULL);
+}
 
-    return ret;
+// A compound stage of a pipeline runs like a function: in the shell if
+// it is a lone foreground command, else in a forked copy.
+static TSH_command compoundCommand = { "compound", "Compound command", NULL };
+
+TSH_command* getStageCommand(Command* cmd)
+{
+    if (cmd->compound != NULL)
+        return &compoundCommand;
+    return getTSHCommand(cmd->args[0]);
 }
 
-char* getCommandName(Command* cmd)
+int processTSHCommand(Command* cmd)
 {
-    char* ret = (char*) malloc(sizeof(char) * 1000);
-    int arg_idx;
-    ret[0] = '\0';
+    TSH_command* builtin;
 
-    for (arg_idx = 0 ; arg_idx < cmd->arg_num ; arg_idx ++)
-    {
-        if (cmd->args[arg_idx] != NULL) // redirect argument would be clear to 0
-        {
-            ret = strcat(ret, cmd->args[arg_idx]);
-            ret = strcat(ret, " ");
-        }
-    }
+    if (cmd->compound != NULL)
+        return execCompound(cmd->compound);
+    builtin = getTSHCommand(cmd->args[0]);
+    if (builtin != NULL)
+        return builtin->cmd_func(cmd->arg_num, cmd->args);
 
-    return ret;
+    // Should not be here since we would call findTSHCommand first.
+    return 0;
 }
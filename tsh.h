@@ -1,59 +1,104 @@
 #ifndef __TSH_H__
 #define __TSH_H__
 
-#include <wordexp.h>
-
-#define CMD_MAX_LEN 1024
-#define MAX_BG_JOB 64
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "tsh_arena.h"
 
 typedef struct Command
 {
     int arg_num;
     char ** args;
+    int assign_num;
+    char ** assigns;  // NAME=value words before the command name
     char *inputFile;
     char *outputFile;
     pid_t pid;
     int isPath;
+    struct timespec startTime;  // when it was spawned
+    struct Node* compound;      // compound command run as this stage, no args then
 
 } Command;
 
+#define CGROUP_LIMIT_NUM 3   // cpu.max, memory.max, io.max
+
 typedef struct Command_handler
 {
     int isBackGround;
     int cmd_num;
     Command** cmds;
+    int pipeSize;     // @pipe=SIZE, 0 to use the shell option
+    int isTimed;      // time keyword
+    const char* cgroupLimits[CGROUP_LIMIT_NUM];  // @cpu.max= etc. as written
+                                                 // to the cgroup, NULL if not set
+    struct Placement* placement;  // @cpus= / @node=, NULL if not set
+    struct Priority* priority;    // @nice= / @sched= / @ioprio=, NULL if not set
 } Command_handler;
 
+typedef struct Process
+{
+    pid_t pid;
+    int isRunning;
+    int status; // store the status when isRunning = 0
+    char* cmdline;
+    struct timespec startTime;  // CLOCK_MONOTONIC
+    struct timespec endTime;    // valid once it exited
+    struct rusage usage;        // from wait4(), valid once it exited
+} Process;
+
 typedef struct ProcessGroup
 {
     pid_t pgid;
+    int jobID;  // -1 if not in the job table
     int proc_num;
     int finish_num;
-    int *isRunning;
-    int *status; // store the status when isRunning = 0
-    pid_t *pids;
-    char** cmdlines;
+    int pipeSize;    // capacity of its pipes, 0 for the kernel default
+    int isTimed;     // report the resource usage when it finishes
+    int controlID;   // job of the control socket, 0 if none
+    int cgroup_fd;   // directory of its cgroup, -1 if none
+    int cgroupID;    // its cgroup is job<cgroupID>
+    struct Placement* placement;  // CPUs and node it runs on, NULL if not placed
+    struct Priority* priority;    // its own priority, NULL: that of the shell
+    int isDemoted;   // runs at background priority (set autoprio)
+    Process procs[]; // followed by the command lines
 
 } ProcessGroup;
 
-extern ProcessGroup** backgroundGroup;
+// Options changed with the set builtin
+typedef struct TSHOptions
+{
+    int pipeSize;     // capacity of pipeline pipes, 0 for the kernel default
+    int spawnHelper;  // launch commands through the spawn helper
+    int cgroup;       // run every job in a cgroup of its own
+    int autoPlace;    // spread background jobs over CPUs or nodes (PLACE_*)
+    int autoPrio;     // lower the priority of background jobs (AUTOPRIO_*)
+} TSHOptions;
+
+extern int tsh_pid;
 extern ProcessGroup* foregroundGroup;
+extern ProcessGroup* shellProcGroup;
+extern TSHOptions tsh_options;
+extern int tsh_interactive;
+extern int last_status;
 
 void initTSH();
-Command_handler* parse_cmd_hdr(char*);
-Command* parse_cmd(char*);
-void check_cmd(Command*);
-void check_cmd_env(Command*);
-void check_cmd_hdr(Command_handler*);
-int findSystemCommand(char*);
+void executeCommandHandler(Command_handler*);
+int waitForeground(ProcessGroup*);
+int runInteractive();
+int runScript(int);
+int runString(const char*);
+int getExitCode(int);
+void showPrompt();
+int runLine(const char*, size_t);
+ProcessGroup* runBackgroundLine(const char*, size_t);
+int handleChildStatus(pid_t, int, struct rusage*);
+int reapChildren();
+struct TSH_command* getTSHCommand(char*);
+struct TSH_command* getStageCommand(Command*);
 int findTSHCommand(char*);
 int processTSHCommand(Command*);
 void moveToForeground(ProcessGroup*);
-int setProcessGroupStatus(ProcessGroup**, int, pid_t, int, int*, int*);
-void freeProcessGroup(ProcessGroup**, int);
-char* getCommandName(Command*);
-void insertIntoBackground(ProcessGroup*, int);
-void signal_handler(int);
-int checkCommandExpension(Command*, wordexp_t*);
 
 #endif
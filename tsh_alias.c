@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tsh_alias.h"
+
+AliasTable aliasTable;
+
+// Return the index of name, or -(insertion point) - 1 if it is missing
+static int searchAlias(const char* name)
+{
+    int low = 0, high = aliasTable.alias_num - 1;
+
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        int cmp = strcmp(aliasTable.aliases[mid].name, name);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return -low - 1;
+}
+
+const char* findAlias(const char* name)
+{
+    int idx = searchAlias(name);
+    return (idx >= 0) ? aliasTable.aliases[idx].value : NULL;
+}
+
+void setAlias(const char* name, const char* value)
+{
+    int idx = searchAlias(name);
+
+    if (idx >= 0)
+    {
+        free (aliasTable.aliases[idx].value);
+        aliasTable.aliases[idx].value = strdup(value);
+        return;
+    }
+
+    idx = -idx - 1;
+    if (aliasTable.alias_num == aliasTable.alias_cap)
+    {
+        aliasTable.alias_cap = aliasTable.alias_cap ? aliasTable.alias_cap * 2 : 16;
+        aliasTable.aliases = (Alias*) realloc(aliasTable.aliases, sizeof(Alias) * aliasTable.alias_cap);
+    }
+    memmove(&aliasTable.aliases[idx + 1], &aliasTable.aliases[idx],
+            sizeof(Alias) * (aliasTable.alias_num - idx));
+    aliasTable.aliases[idx].name = strdup(name);
+    aliasTable.aliases[idx].value = strdup(value);
+    aliasTable.alias_num ++;
+}
+
+// Return -1 if there was no such alias
+int removeAlias(const char* name)
+{
+    int idx = searchAlias(name);
+    if (idx < 0)
+        return -1;
+
+    free (aliasTable.aliases[idx].name);
+    free (aliasTable.aliases[idx].value);
+    aliasTable.alias_num --;
+    memmove(&aliasTable.aliases[idx], &aliasTable.aliases[idx + 1],
+            sizeof(Alias) * (aliasTable.alias_num - idx));
+    return 0;
+}
+
+void clearAliases()
+{
+    int idx;
+    for (idx = 0 ; idx < aliasTable.alias_num ; idx ++)
+    {
+        free (aliasTable.aliases[idx].name);
+        free (aliasTable.aliases[idx].value);
+    }
+    aliasTable.alias_num = 0;
+}
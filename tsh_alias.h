@@ -0,0 +1,25 @@
+#ifndef __TSH_ALIAS_H__
+#define __TSH_ALIAS_H__
+
+typedef struct Alias
+{
+    char* name;
+    char* value;
+} Alias;
+
+// Aliases sorted by name, looked up with a binary search
+typedef struct AliasTable
+{
+    Alias* aliases;
+    int alias_num;
+    int alias_cap;
+} AliasTable;
+
+extern AliasTable aliasTable;
+
+const char* findAlias(const char*);
+void setAlias(const char*, const char*);
+int removeAlias(const char*);
+void clearAliases();
+
+#endif
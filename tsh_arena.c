@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tsh_arena.h"
+
+#define ARENA_ALIGN 16
+
+static ArenaChunk* newChunk(size_t size)
+{
+    ArenaChunk* chunk = (ArenaChunk*) malloc(sizeof(ArenaChunk) + size);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void arenaInit(Arena* arena, size_t chunk_size)
+{
+    arena->head = NULL;
+    arena->spare = NULL;
+    arena->chunk_size = chunk_size;
+}
+
+void* arenaAlloc(Arena* arena, size_t size)
+{
+    ArenaChunk* chunk = arena->head;
+    void* ret;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (chunk == NULL || chunk->used + size > chunk->size)
+    {
+        // Oversized requests get a chunk of their own
+        size_t chunk_size = arena->chunk_size;
+        while (chunk_size < size)
+            chunk_size *= 2;
+
+        if (arena->spare != NULL && arena->spare->size >= chunk_size)
+        {
+            chunk = arena->spare;
+            chunk->used = 0;
+            arena->spare = NULL;
+        }
+        else
+            chunk = newChunk(chunk_size);
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+
+    ret = chunk->data + chunk->used;
+    chunk->used += size;
+    return ret;
+}
+
+char* arenaStrndup(Arena* arena, const char* str, size_t len)
+{
+    char* ret = (char*) arenaAlloc(arena, len + 1);
+    memcpy(ret, str, len);
+    ret[len] = '\0';
+    return ret;
+}
+
+// Release everything but keep the most recent chunk for the next round,
+// so a shell reading one line after another does not touch malloc at all.
+void arenaReset(Arena* arena)
+{
+    ArenaChunk* chunk;
+    if (arena->head == NULL)
+        return;
+
+    chunk = arena->head->next;
+    while (chunk)
+    {
+        ArenaChunk* next = chunk->next;
+        free (chunk);
+        chunk = next;
+    }
+    arena->head->next = NULL;
+    arena->head->used = 0;
+}
+
+ArenaMark arenaMark(Arena* arena)
+{
+    ArenaMark mark;
+    mark.chunk = arena->head;
+    mark.used = arena->head ? arena->head->used : 0;
+    return mark;
+}
+
+// Release everything allocated since the mark. One released chunk is
+// kept as the spare, so that a loop allocating past the end of a chunk
+// on every round does not go through malloc every time.
+void arenaRelease(Arena* arena, ArenaMark mark)
+{
+    while (arena->head != mark.chunk)
+    {
+        ArenaChunk* chunk = arena->head;
+        arena->head = chunk->next;
+        if (arena->spare == NULL || arena->spare->size < chunk->size)
+        {
+            free (arena->spare);
+            arena->spare = chunk;
+        }
+        else
+            free (chunk);
+    }
+    if (mark.chunk != NULL)
+        mark.chunk->used = mark.used;
+}
+
+void arenaFree(Arena* arena)
+{
+    ArenaChunk* chunk = arena->head;
+    while (chunk)
+    {
+        ArenaChunk* next = chunk->next;
+        free (chunk);
+        chunk = next;
+    }
+    free (arena->spare);
+    arena->head = NULL;
+    arena->spare = NULL;
+}
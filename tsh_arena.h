@@ -0,0 +1,38 @@
+#ifndef __TSH_ARENA_H__
+#define __TSH_ARENA_H__
+
+#include <stddef.h>
+
+typedef struct ArenaChunk
+{
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+// Bump allocator: everything allocated from an arena is released
+// together by arenaReset() or arenaFree(), or everything allocated
+// since a mark by arenaRelease().
+typedef struct Arena
+{
+    ArenaChunk* head;
+    ArenaChunk* spare;    // last chunk released, reused before malloc
+    size_t chunk_size;
+} Arena;
+
+typedef struct ArenaMark
+{
+    ArenaChunk* chunk;
+    size_t used;
+} ArenaMark;
+
+void arenaInit(Arena*, size_t);
+void* arenaAlloc(Arena*, size_t);
+char* arenaStrndup(Arena*, const char*, size_t);
+void arenaReset(Arena*);
+ArenaMark arenaMark(Arena*);
+void arenaRelease(Arena*, ArenaMark);
+void arenaFree(Arena*);
+
+#endif
@@ -0,0 +1,530 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "tsh.h"
+#include "tsh_hash.h"
+#include "tsh_parse.h"
+#include "tsh_spawn.h"
+#include "tsh_job.h"
+#include "tsh_expand.h"
+#include "tsh_var.h"
+#include "tsh_zygote.h"
+#include "tsh_cgroup.h"
+#include "tsh_place.h"
+#include "tsh_exec.h"
+
+// Micro-benchmarks for the hot paths of the shell.
+//
+// Usage: tsh_bench [filter]
+//
+// Every result is printed as one JSON object per line:
+//   {"name": "...", "iterations": N, "ns_per_op": X}
+//
+
+static const char* bench_filter = NULL;
+
+static double nowNS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int benchEnabled(const char* name)
+{
+    return (bench_filter == NULL || strstr(name, bench_filter) != NULL);
+}
+
+static void report(const char* name, long iterations, double elapsed)
+{
+    printf("{\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.1f}\n",
+           name, iterations, elapsed / iterations);
+    fflush(stdout);
+}
+
+/* parser */
+
+static char* repeatPattern(const char* head, const char* pattern, int times)
+{
+    size_t len = strlen(head) + strlen(pattern) * times + 1;
+    char* ret = (char*) malloc(len);
+    int idx;
+
+    strcpy(ret, head);
+    for (idx = 0 ; idx < times ; idx ++)
+        strcat(ret, pattern);
+    return ret;
+}
+
+static void benchParseLine(const char* name, const char* line, long iterations)
+{
+    Arena arena;
+    double start;
+    long iter;
+
+    if (!benchEnabled(name))
+        return;
+
+    arenaInit(&arena, 4096);
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter ++)
+    {
+        if (parse_cmd_hdr(line, strlen(line), &arena) == NULL)
+        {
+            fprintf(stderr, "bench: %s does not parse\n", name);
+            break;
+        }
+        arenaReset(&arena);
+    }
+    report(name, iterations, nowNS() - start);
+    arenaFree(&arena);
+}
+
+static void benchParseCommand(const char* name, const char* line, long iterations)
+{
+    Arena arena;
+    Lexer lex;
+    double start;
+    long iter;
+
+    if (!benchEnabled(name))
+        return;
+
+    arenaInit(&arena, 4096);
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter ++)
+    {
+        initLexer(&lex, line, strlen(line), &arena);
+        nextToken(&lex);
+        parse_cmd(&lex);
+        arenaReset(&arena);
+    }
+    report(name, iterations, nowNS() - start);
+    arenaFree(&arena);
+}
+
+static void benchParser()
+{
+    char* many_args = repeatPattern("echo", " argument", 4096);
+    char* long_pipe = repeatPattern("cat file", " | grep -v x", 256);
+    char* quoted = repeatPattern("printf", " \"a b c\" 'd e f' g\\ h", 512);
+
+    benchParseLine("parse_cmd_hdr/simple", "ls -la /tmp", 1000000);
+    benchParseLine("parse_cmd_hdr/realistic",
+                   "cat access.log | grep -v healthcheck | sort | uniq -c | sort -rn > top.txt &", 500000);
+    benchParseLine("parse_cmd_hdr/4096_args", many_args, 2000);
+    benchParseLine("parse_cmd_hdr/256_stages", long_pipe, 2000);
+    benchParseLine("parse_cmd_hdr/quoted", quoted, 2000);
+    benchParseCommand("parse_cmd/simple", "gcc -O2 -Wall -c tsh.c -o tsh.o", 1000000);
+    benchParseCommand("parse_cmd/4096_args", many_args, 2000);
+
+    free (many_args);
+    free (long_pipe);
+    free (quoted);
+}
+
+/* command lookup */
+
+static char* makeFakePath(int dir_num, int file_num)
+{
+    char dir_tmpl[] = "/tmp/tsh_bench.XXXXXX";
+    char* root = mkdtemp(dir_tmpl);
+    size_t path_len = 0;
+    char* path;
+    int idxDir, idxFile;
+
+    if (root == NULL)
+        return NULL;
+
+    path = (char*) malloc((strlen(root) + 16) * (dir_num + 1));
+    path[0] = '\0';
+    for (idxDir = 0 ; idxDir < dir_num ; idxDir ++)
+    {
+        char dir[256];
+        snprintf(dir, sizeof(dir), "%s/d%d", root, idxDir);
+        mkdir(dir, 0755);
+        for (idxFile = 0 ; idxFile < file_num ; idxFile ++)
+        {
+            char file[320];
+            int fd;
+            snprintf(file, sizeof(file), "%s/cmd_%d_%d", dir, idxDir, idxFile);
+            if ((fd = open(file, O_WRONLY | O_CREAT, 0755)) != -1)
+                close(fd);
+        }
+        path_len += sprintf(path + path_len, "%s%s", idxDir ? ":" : "", dir);
+    }
+    return path;
+}
+
+static void removeFakePath(char* path)
+{
+    char cmd[64 + 256];
+    char* slash = strstr(path, "/d0");
+    if (slash)
+    {
+        *slash = '\0';
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", path);
+        if (system(cmd) != 0)
+            fprintf(stderr, "bench: could not remove %s\n", path);
+    }
+    free (path);
+}
+
+static void benchLookup()
+{
+    char* old_path = getVar("PATH") ? strdup(getVar("PATH")) : strdup("");
+    char* fake_path;
+    char name[64];
+    double start;
+    long iter;
+    long iterations;
+    long miss_num = 0;
+
+    if (!benchEnabled("findSystemCommand"))
+    {
+        free (old_path);
+        return;
+    }
+
+    // 32 directories with 1000 entries each
+    if ((fake_path = makeFakePath(32, 1000)) == NULL)
+    {
+        perror("bench: mkdtemp");
+        free (old_path);
+        return;
+    }
+    // The command hash follows the shell variable, not the environment
+    setVar("PATH", fake_path, 1);
+
+    iterations = 20;
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter ++)
+        rehashCommandHash();
+    report("findSystemCommand/rehash_32x1000", iterations, nowNS() - start);
+
+    iterations = 200000;
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter ++)
+    {
+        snprintf(name, sizeof(name), "cmd_31_%ld", iter % 1000);
+        if (findSystemCommand(name) == NULL)
+            miss_num ++;
+    }
+    report("findSystemCommand/hit_last_dir", iterations, nowNS() - start);
+    if (miss_num > 0)
+        fprintf(stderr, "bench: %ld of %ld lookups missed\n", miss_num, iterations);
+
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter ++)
+        findSystemCommand("no_such_command");
+    report("findSystemCommand/miss", iterations, nowNS() - start);
+
+    setVar("PATH", old_path, 1);
+    clearCommandHash();
+    removeFakePath(fake_path);
+    free (old_path);
+}
+
+/* word expansion */
+
+static void benchExpandWords(const char* name, char* word, long iterations)
+{
+    Arena arena;
+    Expander exp;
+    char** words;
+    int word_num = 0;
+    double start;
+    long iter;
+
+    if (!benchEnabled(name))
+        return;
+
+    arenaInit(&arena, 4096);
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter ++)
+    {
+        // A fresh line each time, so globs are not reused
+        initExpander(&exp, &arena);
+        if (expandWords(&exp, &word, 1, &words, &word_num) == -1)
+            fprintf(stderr, "bench: %s does not expand\n", name);
+        freeExpander(&exp);
+        arenaReset(&arena);
+    }
+    report(name, iterations, nowNS() - start);
+    arenaFree(&arena);
+}
+
+static void benchExpand()
+{
+    char* dir;
+    char pattern[512];
+
+    benchExpandWords("expand/variables", "\"$HOME\"/src/${USER}_x'$literal'", 1000000);
+
+    if (!benchEnabled("expand/glob"))
+        return;
+
+    // One directory of 100000 files
+    if ((dir = makeFakePath(1, 100000)) == NULL)
+    {
+        perror("bench: mkdtemp");
+        return;
+    }
+    snprintf(pattern, sizeof(pattern), "%s/*7", dir);
+    benchExpandWords("expand/glob_suffix_100k", pattern, 100);
+    snprintf(pattern, sizeof(pattern), "%s/cmd_0_12?4", dir);
+    benchExpandWords("expand/glob_prefix_100k", pattern, 100000);
+    snprintf(pattern, sizeof(pattern), "%s/*_[1-3]?5", dir);
+    benchExpandWords("expand/glob_class_100k", pattern, 100);
+    removeFakePath(dir);
+}
+
+/* spawn and reap */
+
+// getEnvp() between commands, with and without an exported change
+static void benchEnvp()
+{
+    double start;
+    long iter;
+    char value[32];
+
+    if (benchEnabled("envp/unchanged"))
+    {
+        start = nowNS();
+        for (iter = 0 ; iter < 1000000 ; iter ++)
+        {
+            setVar("BENCH_LOCAL", "x", 0);
+            getEnvp();
+        }
+        report("envp/unchanged", 1000000, nowNS() - start);
+    }
+    if (benchEnabled("envp/exported"))
+    {
+        start = nowNS();
+        for (iter = 0 ; iter < 100000 ; iter ++)
+        {
+            snprintf(value, sizeof(value), "%ld", iter);
+            setVar("BENCH_EXPORTED", value, 1);
+            getEnvp();
+        }
+        report("envp/exported", 100000, nowNS() - start);
+        unsetVar("BENCH_EXPORTED");
+    }
+    unsetVar("BENCH_LOCAL");
+}
+
+static void benchSpawnSingle(const char* name, long iterations, int cgroup_fd, Placement* placement)
+{
+    char* true_argv[] = { "true", NULL };
+    char* true_path;
+    double start;
+    long iter;
+
+    if (!benchEnabled(name) || (true_path = findSystemCommand("true")) == NULL)
+        return;
+
+    true_path = strdup(true_path);
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter ++)
+    {
+        SpawnRequest req;
+        int status;
+        pid_t pid;
+
+        initSpawnRequest(&req);
+        req.path = true_path;
+        req.argv = true_argv;
+        req.pgid = 0;
+        req.cgroup_fd = cgroup_fd;
+        req.placement = placement;
+        if ((pid = spawnCommand(&req)) == -1)
+        {
+            perror("bench: spawn");
+            break;
+        }
+        waitpid(pid, &status, 0);
+    }
+    report(name, iterations, nowNS() - start);
+    free (true_path);
+}
+
+static void benchSpawn()
+{
+    double start;
+    long iter;
+    long iterations = 2000;
+    int stages[] = { 2, 8, 32 };
+    int idx;
+
+    benchSpawnSingle("spawn/single", iterations, -1, NULL);
+    if (benchEnabled("spawn/single_helper") && startZygote() == 0)
+    {
+        benchSpawnSingle("spawn/single_helper", iterations, -1, NULL);
+        stopZygote();
+    }
+
+    // The shell switches its own affinity around posix_spawn()
+    if (benchEnabled("spawn/single_pinned"))
+    {
+        Placement placement;
+        memset(&placement, 0, sizeof(placement));
+        placement.node = -1;
+        if (parseCpuList("0", 1, &placement.cpus) == 0)
+            benchSpawnSingle("spawn/single_pinned", iterations, -1, &placement);
+    }
+
+    // clone3(CLONE_INTO_CGROUP), from the shell and from the helper
+    if (benchEnabled("spawn/single_cgroup") || benchEnabled("spawn/single_cgroup_helper"))
+    {
+        Command_handler cmd_hdr;
+        int cgroup_fd, cgroupID;
+
+        memset(&cmd_hdr, 0, sizeof(cmd_hdr));
+        tsh_options.cgroup = 1;
+        cgroup_fd = createJobCgroup(&cmd_hdr, &cgroupID);
+        tsh_options.cgroup = 0;
+        if (cgroup_fd >= 0)
+        {
+            benchSpawnSingle("spawn/single_cgroup", iterations, cgroup_fd, NULL);
+            if (benchEnabled("spawn/single_cgroup_helper") && startZygote() == 0)
+            {
+                benchSpawnSingle("spawn/single_cgroup_helper", iterations, cgroup_fd, NULL);
+                stopZygote();
+            }
+            removeJobCgroup(cgroup_fd, cgroupID);
+        }
+    }
+
+    // Whole shell path: parse, lookup, spawn every stage and wait
+    for (idx = 0 ; idx < (int) (sizeof(stages) / sizeof(int)) ; idx ++)
+    {
+        char name[64];
+        char* line;
+
+        snprintf(name, sizeof(name), "spawn/pipeline_%d", stages[idx]);
+        if (!benchEnabled(name))
+            continue;
+
+        line = repeatPattern("true", " | cat", stages[idx] - 1);
+        iterations = 2000 / stages[idx];
+        start = nowNS();
+        for (iter = 0 ; iter < iterations ; iter ++)
+            runLine(line, strlen(line));
+        report(name, iterations, nowNS() - start);
+        free (line);
+    }
+}
+
+/* control flow */
+
+// One iteration is one pass through the body of a loop over 1000 words
+static void benchLoop(const char* name, const char* body, long iterations)
+{
+    char* line;
+    char* words = repeatPattern("for i in", " word", 1000);
+    long iter;
+    double start;
+
+    if (!benchEnabled(name))
+    {
+        free (words);
+        return;
+    }
+    line = (char*) malloc(strlen(words) + strlen(body) + 16);
+    sprintf(line, "%s; do %s; done", words, body);
+
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter += 1000)
+        runLine(line, strlen(line));
+    report(name, iterations, nowNS() - start);
+    free (line);
+    free (words);
+}
+
+static void benchControl()
+{
+    const char* func = "f() { y=$1; }";
+
+    runLine(func, strlen(func));
+    benchLoop("loop/assignment", "x=$i", 1000000);
+    benchLoop("loop/if", "if [ $i = word ]; then x=$i; fi", 200000);
+    benchLoop("loop/function", "f $i", 1000000);
+}
+
+/* job table */
+
+static void benchJobStatus(int job_num)
+{
+    Arena arena;
+    ProcessGroup** groups;
+    char name[64];
+    char line[64];
+    double start;
+    long iter;
+    long iterations = 1000000;
+    pid_t base = 100000000;
+    int idx;
+
+    snprintf(name, sizeof(name), "setProcessGroupStatus/%d_jobs", job_num);
+    if (!benchEnabled(name))
+        return;
+
+    // Fake 3-stage jobs, the pids do not exist
+    arenaInit(&arena, 4096);
+    groups = (ProcessGroup**) malloc(sizeof(ProcessGroup*) * job_num);
+    for (idx = 0 ; idx < job_num ; idx ++)
+    {
+        Command_handler* cmd_hdr;
+        int cmd_idx;
+
+        snprintf(line, sizeof(line), "worker %d | filter | sink &", idx);
+        cmd_hdr = parse_cmd_hdr(line, strlen(line), &arena);
+        for (cmd_idx = 0 ; cmd_idx < cmd_hdr->cmd_num ; cmd_idx ++)
+            cmd_hdr->cmds[cmd_idx]->pid = base + idx * 3 + cmd_idx;
+        groups[idx] = newProcessGroup(cmd_hdr);
+        insertIntoBackground(groups[idx], 1);
+        arenaReset(&arena);
+    }
+
+    // Alternate stop/continue so that nothing leaves the table
+    start = nowNS();
+    for (iter = 0 ; iter < iterations ; iter ++)
+    {
+        pid_t pid = base + (pid_t) ((iter * 7919) % (job_num * 3));
+        int status = (iter & 1) ? 0xffff : ((SIGSTOP << 8) | 0x7f);
+        setProcessGroupStatus(pid, status, NULL, NULL, NULL);
+    }
+    report(name, iterations, nowNS() - start);
+
+    for (idx = 0 ; idx < job_num ; idx ++)
+        freeProcessGroup(groups[idx]);
+    free (groups);
+    arenaFree(&arena);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        bench_filter = argv[1];
+
+    // Run the shell without prompt, notifications or job control
+    tsh_interactive = 0;
+    initTSH();
+
+    benchParser();
+    benchLookup();
+    benchExpand();
+    benchEnvp();
+    benchSpawn();
+    benchControl();
+    benchJobStatus(16);
+    benchJobStatus(256);
+    benchJobStatus(4096);
+    return 0;
+}
@@ -0,0 +1,706 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <linux/sched.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include "tsh_cgroup.h"
+#include "tsh_zygote.h"
+
+// Cgroups of jobs
+//
+// A job started with limits (@cpu.max=, @memory.max=, @io.max=), or any
+// job while "set cgroup on", runs in a cgroup v2 of its own:
+//
+//     <cgroup of the shell>/tsh.<pid>/job<n>
+//
+// beside <cgroup of the shell>/tsh.<pid>/shell, which the shell and its
+// spawn helper move to on first use.
+// Its processes are created inside it with clone3(CLONE_INTO_CGROUP),
+// so none of them ever runs outside of its limits, and they are counted
+// in its statistics from their first instruction. The cgroup is removed
+// with the job.
+//
+// Limits need their controller enabled in cgroup.subtree_control of the
+// cgroup the shell was started in and of tsh.<pid>. A controller can
+// only be enabled for the children of a cgroup which holds no processes
+// itself, hence the leaf for the shell. Enabling still fails when the
+// cgroup was not delegated to the user or holds other processes; such
+// limits are then refused with an error. At exit the shell undoes all
+// of it, as far as jobs left running allow.
+//
+Cgroups cgroups = { 0, -1, NULL, NULL, 0, 0 };
+
+static int formatCpuMax(const char*, char*, size_t);
+static int formatMemoryMax(const char*, char*, size_t);
+static int formatIOMax(const char*, char*, size_t);
+
+typedef struct CgroupLimit
+{
+    const char* name;         // interface file
+    const char* controller;
+    int (*format)(const char*, char*, size_t);
+} CgroupLimit;
+
+// Same order as Command_handler.cgroupLimits
+static const CgroupLimit cgroupLimits[CGROUP_LIMIT_NUM] =
+{
+    { "cpu.max", "cpu", formatCpuMax },
+    { "memory.max", "memory", formatMemoryMax },
+    { "io.max", "io", formatIOMax },
+};
+
+static const char* delegated[] = { "cpu", "memory", "io", "pids" };
+
+// Read a whole interface file of a cgroup. Return the length, or -1.
+static ssize_t readCgroupFile(int dir_fd, const char* name, char* buf, size_t size)
+{
+    int fd;
+    ssize_t n;
+
+    if ((fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC)) == -1)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+static int writeCgroupFile(int dir_fd, const char* name, const char* value)
+{
+    int fd;
+    ssize_t n;
+    int err;
+
+    if ((fd = openat(dir_fd, name, O_WRONLY | O_CLOEXEC)) == -1)
+        return -1;
+    n = write(fd, value, strlen(value));
+    err = errno;
+    close(fd);
+    errno = err;
+    return (n == -1) ? -1 : 0;
+}
+
+// Return 1 if a space separated list of controllers has name
+static int hasController(const char* list, const char* name)
+{
+    const char* pos = list;
+    size_t len = strlen(name);
+
+    while ((pos = strstr(pos, name)) != NULL)
+    {
+        if ((pos == list || pos[-1] == ' ') && (pos[len] == ' ' || pos[len] == '\n' || pos[len] == '\0'))
+            return 1;
+        pos += len;
+    }
+    return 0;
+}
+
+// Enable the controllers we set limits with for the children of a
+// cgroup, each on its own, so that one which is missing does not
+// prevent the others. Return a mask of those which were not enabled
+// before, by their index in delegated.
+//
+static int enableControllers(int dir_fd)
+{
+    char available[512];
+    char enabled[512];
+    char request[32];
+    size_t idx;
+    int mask = 0;
+
+    if (readCgroupFile(dir_fd, "cgroup.controllers", available, sizeof(available)) == -1 ||
+        readCgroupFile(dir_fd, "cgroup.subtree_control", enabled, sizeof(enabled)) == -1)
+        return 0;
+    for (idx = 0 ; idx < sizeof(delegated) / sizeof(char*) ; idx ++)
+    {
+        if (!hasController(available, delegated[idx]) || hasController(enabled, delegated[idx]))
+            continue;
+        snprintf(request, sizeof(request), "+%s", delegated[idx]);
+        if (writeCgroupFile(dir_fd, "cgroup.subtree_control", request) == 0)
+            mask |= 1 << idx;
+    }
+    return mask;
+}
+
+static void disableControllers(int dir_fd, int mask)
+{
+    char request[32];
+    size_t idx;
+
+    for (idx = 0 ; idx < sizeof(delegated) / sizeof(char*) ; idx ++)
+    {
+        if (!(mask & (1 << idx)))
+            continue;
+        snprintf(request, sizeof(request), "-%s", delegated[idx]);
+        writeCgroupFile(dir_fd, "cgroup.subtree_control", request);
+    }
+}
+
+// Move the shell and its spawn helper into the cgroup dir_fd
+static int moveShell(int dir_fd)
+{
+    char pid[16];
+
+    snprintf(pid, sizeof(pid), "%d", (int) tsh_pid);
+    if (writeCgroupFile(dir_fd, "cgroup.procs", pid) == -1)
+        return -1;
+    if (zygote.pid != 0)
+    {
+        snprintf(pid, sizeof(pid), "%d", (int) zygote.pid);
+        writeCgroupFile(dir_fd, "cgroup.procs", pid);
+    }
+    return 0;
+}
+
+// Undo initCgroups() at exit: turn off what it turned on, go back and
+// remove tsh.<pid>. Whatever jobs still run in it stays.
+//
+static void removeBase()
+{
+    int own_fd;
+
+    if (getpid() != tsh_pid)
+        return;
+    disableControllers(cgroups.base_fd, -1);
+    if ((own_fd = open(cgroups.own, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1)
+    {
+        disableControllers(own_fd, cgroups.ownEnabled);
+        moveShell(own_fd);
+        close(own_fd);
+    }
+    unlinkat(cgroups.base_fd, "shell", AT_REMOVEDIR);
+    rmdir(cgroups.base);
+}
+
+// Find the cgroup v2 mount, and the cgroup of the shell below it
+static char* findOwnCgroup()
+{
+    char* line = NULL;
+    size_t cap = 0;
+    char* own = NULL;
+    char* mount = NULL;
+    char* root = NULL;
+    char* path = NULL;
+    FILE* fp;
+
+    if ((fp = fopen("/proc/self/cgroup", "re")) == NULL)
+        return NULL;
+    while (getline(&line, &cap, fp) != -1)
+    {
+        if (strncmp(line, "0::", 3) == 0)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            own = strdup(line + 3);
+            break;
+        }
+    }
+    fclose(fp);
+
+    // id parent major:minor root mount-point options [optional...] - type source ...
+    if (own != NULL && (fp = fopen("/proc/self/mountinfo", "re")) != NULL)
+    {
+        while (mount == NULL && getline(&line, &cap, fp) != -1)
+        {
+            char* sep = strstr(line, " - ");
+            char* field[5];
+            char* save;
+            int idx;
+
+            if (sep == NULL || strncmp(sep + 3, "cgroup2 ", 8) != 0)
+                continue;
+            field[0] = strtok_r(line, " ", &save);
+            for (idx = 1 ; idx < 5 && field[idx - 1] ; idx ++)
+                field[idx] = strtok_r(NULL, " ", &save);
+            if (idx == 5 && field[4] != NULL)
+            {
+                root = strdup(field[3]);
+                mount = strdup(field[4]);
+            }
+        }
+        fclose(fp);
+    }
+
+    if (mount != NULL)
+    {
+        // The mount may show a subtree only, e.g. in a container
+        const char* rel = own;
+        size_t root_len = strlen(root);
+        if (strcmp(root, "/") != 0 && strncmp(own, root, root_len) == 0)
+            rel = own + root_len;
+        if (strcmp(rel, "/") == 0)
+            rel = "";
+        if (asprintf(&path, "%s%s", mount, rel) == -1)
+            path = NULL;
+    }
+    free (line);
+    free (own);
+    free (mount);
+    free (root);
+    return path;
+}
+
+// Create the cgroup the jobs of this shell live in. Done on first use,
+// and given up for good if it fails. Return 0, or -1.
+//
+int initCgroups()
+{
+    char* own;
+    int own_fd;
+
+    if (cgroups.isReady != 0)
+        return (cgroups.isReady == 1) ? 0 : -1;
+    cgroups.isReady = -1;
+
+    if ((own = findOwnCgroup()) == NULL)
+    {
+        fprintf(stderr, "tsh: cgroup: no cgroup v2 hierarchy\n");
+        return -1;
+    }
+    if (asprintf(&cgroups.base, "%s/tsh.%d", own, tsh_pid) == -1)
+    {
+        free (own);
+        return -1;
+    }
+    if ((mkdir(cgroups.base, 0755) == -1 && errno != EEXIST) ||
+        (cgroups.base_fd = open(cgroups.base, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    {
+        fprintf(stderr, "tsh: cgroup: %s: %s\n", cgroups.base, strerror(errno));
+        free (cgroups.base);
+        cgroups.base = NULL;
+        free (own);
+        return -1;
+    }
+    cgroups.own = own;
+    atexit(removeBase);
+
+    // Out of the way of the controllers first, then enable them on the
+    // way down to the jobs
+    if ((mkdirat(cgroups.base_fd, "shell", 0755) == -1 && errno != EEXIST) ||
+        (own_fd = openat(cgroups.base_fd, "shell", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+        fprintf(stderr, "tsh: cgroup: %s/shell: %s\n", cgroups.base, strerror(errno));
+    else
+    {
+        if (moveShell(own_fd) == -1)
+            fprintf(stderr, "tsh: cgroup: can not move the shell to %s/shell: %s\n", cgroups.base, strerror(errno));
+        close(own_fd);
+    }
+    if ((own_fd = open(own, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1)
+    {
+        cgroups.ownEnabled = enableControllers(own_fd);
+        close(own_fd);
+    }
+    enableControllers(cgroups.base_fd);
+
+    cgroups.isReady = 1;
+    return 0;
+}
+
+/* Limits */
+
+// Return the index of a limit by the name of its interface file, or -1
+int findCgroupLimit(const char* name, size_t len)
+{
+    int idx;
+    for (idx = 0 ; idx < CGROUP_LIMIT_NUM ; idx ++)
+    {
+        if (strlen(cgroupLimits[idx].name) == len && strncmp(cgroupLimits[idx].name, name, len) == 0)
+            return idx;
+    }
+    return -1;
+}
+
+// A decimal number with an optional K, M, G or T suffix, up to end
+static int parseBytes(const char* str, const char* end, unsigned long long* ret)
+{
+    char* pos;
+
+    if (str == end || *str < '0' || *str > '9')
+        return -1;
+    errno = 0;
+    *ret = strtoull(str, &pos, 10);
+    if (errno != 0)
+        return -1;
+    if (pos < end)
+    {
+        int shift = 0;
+        switch (*pos)
+        {
+            case 'k': case 'K': shift = 10; break;
+            case 'm': case 'M': shift = 20; break;
+            case 'g': case 'G': shift = 30; break;
+            case 't': case 'T': shift = 40; break;
+            default: return -1;
+        }
+        if (*ret > (~0ULL >> shift))
+            return -1;
+        *ret <<= shift;
+        pos ++;
+    }
+    return (pos == end) ? 0 : -1;
+}
+
+// N% of one CPU, QUOTA/PERIOD or QUOTA in microseconds, or max
+static int formatCpuMax(const char* value, char* buf, size_t size)
+{
+    unsigned long long quota, period;
+    const char* slash = strchr(value, '/');
+    size_t len = strlen(value);
+
+    if (strcmp(value, "max") == 0)
+        snprintf(buf, size, "max");
+    else if (len > 1 && value[len - 1] == '%')
+    {
+        if (parseBytes(value, value + len - 1, &quota) == -1 || quota == 0 || quota > 100000)
+            return -1;
+        snprintf(buf, size, "%llu 100000", quota * 1000);
+    }
+    else if (slash != NULL)
+    {
+        if (parseBytes(value, slash, &quota) == -1 || parseBytes(slash + 1, value + len, &period) == -1)
+            return -1;
+        snprintf(buf, size, "%llu %llu", quota, period);
+    }
+    else
+    {
+        if (parseBytes(value, value + len, &quota) == -1)
+            return -1;
+        snprintf(buf, size, "%llu", quota);
+    }
+    return 0;
+}
+
+// A size in bytes with an optional suffix, or max
+static int formatMemoryMax(const char* value, char* buf, size_t size)
+{
+    unsigned long long bytes;
+
+    if (strcmp(value, "max") == 0)
+        snprintf(buf, size, "max");
+    else if (parseBytes(value, value + strlen(value), &bytes) == 0)
+        snprintf(buf, size, "%llu", bytes);
+    else
+        return -1;
+    return 0;
+}
+
+// DEVICE,KEY=VALUE,... where DEVICE is MAJOR:MINOR or a block device
+// and KEY is rbps, wbps, riops or wiops, for "MAJOR:MINOR KEY=VALUE ..."
+//
+static int formatIOMax(const char* value, char* buf, size_t size)
+{
+    static const char* keys[] = { "rbps", "wbps", "riops", "wiops" };
+    const char* comma = strchr(value, ',');
+    char device[256];
+    unsigned int major_num, minor_num;
+    size_t len;
+    int pos;
+    char extra;
+
+    if (comma == NULL || (size_t) (comma - value) >= sizeof(device))
+        return -1;
+    memcpy(device, value, comma - value);
+    device[comma - value] = '\0';
+    if (device[0] == '/')
+    {
+        struct stat st;
+        if (stat(device, &st) == -1 || !S_ISBLK(st.st_mode))
+            return -1;
+        major_num = major(st.st_rdev);
+        minor_num = minor(st.st_rdev);
+    }
+    else if (sscanf(device, "%u:%u%c", &major_num, &minor_num, &extra) != 2)
+        return -1;
+    pos = snprintf(buf, size, "%u:%u", major_num, minor_num);
+
+    while (comma != NULL)
+    {
+        const char* item = comma + 1;
+        const char* end;
+        const char* equal;
+        unsigned long long num;
+        size_t idx;
+
+        comma = strchr(item, ',');
+        end = comma ? comma : item + strlen(item);
+        if ((equal = memchr(item, '=', end - item)) == NULL)
+            return -1;
+        len = equal - item;
+        for (idx = 0 ; idx < sizeof(keys) / sizeof(char*) ; idx ++)
+        {
+            if (strlen(keys[idx]) == len && strncmp(keys[idx], item, len) == 0)
+                break;
+        }
+        if (idx == sizeof(keys) / sizeof(char*))
+            return -1;
+        if (end - equal - 1 == 3 && strncmp(equal + 1, "max", 3) == 0)
+            pos += snprintf(buf + pos, size - pos, " %s=max", keys[idx]);
+        else if (parseBytes(equal + 1, end, &num) == 0)
+            pos += snprintf(buf + pos, size - pos, " %s=%llu", keys[idx], num);
+        else
+            return -1;
+        if ((size_t) pos >= size)
+            return -1;
+    }
+    return 0;
+}
+
+// Turn the value of a limit as written on the command line into what
+// its interface file takes. Return 0, or -1 if it is malformed.
+//
+int formatCgroupLimit(int idx, const char* value, char* buf, size_t size)
+{
+    return cgroupLimits[idx].format(value, buf, size);
+}
+
+// Write a formatted limit into the cgroup of a job. Return 0, or -1
+// after reporting why.
+//
+int setCgroupLimit(int dir_fd, int idx, const char* value)
+{
+    if (writeCgroupFile(dir_fd, cgroupLimits[idx].name, value) == 0)
+        return 0;
+    if (errno == ENOENT)
+        fprintf(stderr, "tsh: cgroup: %s: the %s controller is not enabled for %s\n",
+                cgroupLimits[idx].name, cgroupLimits[idx].controller, cgroups.base);
+    else
+        fprintf(stderr, "tsh: cgroup: %s: %s\n", cgroupLimits[idx].name, strerror(errno));
+    return -1;
+}
+
+/* Job cgroups */
+
+// Create the cgroup of a job about to be launched and apply its limits.
+// Return its directory, with its number in *id, -1 if the job does not
+// get one, or -2 if it asked for limits which could not be applied, in
+// which case it must not run.
+//
+int createJobCgroup(Command_handler* cmd_hdr, int* id)
+{
+    char name[32];
+    int hasLimits = 0;
+    int dir_fd;
+    int idx;
+
+    for (idx = 0 ; idx < CGROUP_LIMIT_NUM ; idx ++)
+        hasLimits |= (cmd_hdr->cgroupLimits[idx] != NULL);
+    if (!hasLimits && !tsh_options.cgroup)
+        return -1;
+    if (initCgroups() == -1)
+        return hasLimits ? -2 : -1;
+
+    *id = ++ cgroups.next_id;
+    snprintf(name, sizeof(name), "job%d", *id);
+    if (mkdirat(cgroups.base_fd, name, 0755) == -1 ||
+        (dir_fd = openat(cgroups.base_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    {
+        fprintf(stderr, "tsh: cgroup: %s/%s: %s\n", cgroups.base, name, strerror(errno));
+        unlinkat(cgroups.base_fd, name, AT_REMOVEDIR);
+        return hasLimits ? -2 : -1;
+    }
+
+    for (idx = 0 ; idx < CGROUP_LIMIT_NUM ; idx ++)
+    {
+        if (cmd_hdr->cgroupLimits[idx] != NULL && setCgroupLimit(dir_fd, idx, cmd_hdr->cgroupLimits[idx]) == -1)
+        {
+            close(dir_fd);
+            unlinkat(cgroups.base_fd, name, AT_REMOVEDIR);
+            return -2;
+        }
+    }
+    return dir_fd;
+}
+
+// Remove the cgroup of a finished job. It stays if processes which
+// left the job, e.g. daemons, still live in it.
+//
+void removeJobCgroup(int dir_fd, int id)
+{
+    char name[32];
+
+    close(dir_fd);
+    snprintf(name, sizeof(name), "job%d", id);
+    unlinkat(cgroups.base_fd, name, AT_REMOVEDIR);
+}
+
+// Move a running process into a cgroup, 0 for the caller itself
+int attachToCgroup(int dir_fd, pid_t pid)
+{
+    char value[32];
+    snprintf(value, sizeof(value), "%d", (int) pid);
+    return writeCgroupFile(dir_fd, "cgroup.procs", value);
+}
+
+// Processes in a cgroup, descendants of the job included. Return them
+// in a malloc'd array, or NULL if they could not be read.
+//
+pid_t* readCgroupProcs(int dir_fd, int* num)
+{
+    pid_t* pids = NULL;
+    int cap = 0;
+    int pid;
+    int fd;
+    FILE* fp;
+
+    *num = 0;
+    if ((fd = openat(dir_fd, "cgroup.procs", O_RDONLY | O_CLOEXEC)) == -1)
+        return NULL;
+    if ((fp = fdopen(fd, "r")) == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    while (fscanf(fp, "%d", &pid) == 1)
+    {
+        if (*num == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            pids = (pid_t*) realloc(pids, sizeof(pid_t) * cap);
+        }
+        pids[(*num) ++] = pid;
+    }
+    fclose(fp);
+    return pids ? pids : (pid_t*) malloc(sizeof(pid_t));
+}
+
+// Start a process inside a cgroup. Without CLONE_VM, clone3() is a
+// fork() whose child starts in the cgroup, so run() executes in a copy
+// of the caller; it only returns the errno of a failed exec, which is
+// sent back through a pipe. Return the pid, -1 with errno set, or -2 if
+// the kernel can not create processes in a cgroup (before 5.7).
+//
+pid_t spawnIntoCgroup(int dir_fd, unsigned long flags, int (*run)(void*), void* data)
+{
+    struct clone_args args;
+    int errPipe[2];
+    int err;
+    pid_t pid;
+    ssize_t n;
+
+    if (pipe2(errPipe, O_CLOEXEC) == -1)
+        return -1;
+
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_INTO_CGROUP | flags;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = dir_fd;
+    pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == 0)
+    {
+        close(errPipe[0]);
+        err = run(data);
+        write(errPipe[1], &err, sizeof(err));
+        _exit(127);
+    }
+
+    err = errno;
+    close(errPipe[1]);
+    if (pid == -1)
+    {
+        close(errPipe[0]);
+        errno = err;
+        return (err == ENOSYS || err == E2BIG || err == EINVAL) ? -2 : -1;
+    }
+
+    // EOF once exec closed the pipe
+    while ((n = read(errPipe[0], &err, sizeof(err))) == -1 && errno == EINTR)
+        ;
+    close(errPipe[0]);
+    if (n == sizeof(err))
+    {
+        // A child of our parent is reaped there
+        if (!(flags & CLONE_PARENT))
+            waitpid(pid, NULL, 0);
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+/* Statistics */
+
+// Value of a "key value" line of a cgroup file, or of its first
+// number if key is NULL. Return 0, or -1 if it is missing.
+//
+static int readCgroupStat(int dir_fd, const char* name, const char* key, unsigned long long* ret)
+{
+    char buf[1024];
+    const char* pos = buf;
+    size_t len = key ? strlen(key) : 0;
+
+    if (readCgroupFile(dir_fd, name, buf, sizeof(buf)) == -1)
+        return -1;
+    if (key != NULL)
+    {
+        while (pos != NULL && !(strncmp(pos, key, len) == 0 && pos[len] == ' '))
+            if ((pos = strchr(pos, '\n')) != NULL)
+                pos ++;
+        if (pos == NULL)
+            return -1;
+        pos += len + 1;
+    }
+    return (sscanf(pos, "%llu", ret) == 1) ? 0 : -1;
+}
+
+static void printBytes(FILE* out, unsigned long long bytes)
+{
+    if (bytes >= (1ULL << 30))
+        fprintf(out, "%.1fG", bytes / (double) (1ULL << 30));
+    else if (bytes >= (1ULL << 20))
+        fprintf(out, "%.1fM", bytes / (double) (1ULL << 20));
+    else
+        fprintf(out, "%lluK", bytes >> 10);
+}
+
+// CPU time, memory use and throttling of the cgroup of a job, as far
+// as its controllers are enabled
+//
+void printCgroupStats(FILE* out, ProcessGroup* group)
+{
+    unsigned long long value;
+
+    if (group->cgroup_fd == -1)
+        return;
+    fprintf(out, "\tcgroup job%d", group->cgroupID);
+    if (readCgroupStat(group->cgroup_fd, "cpu.stat", "usage_usec", &value) == 0)
+        fprintf(out, " cpu %.3fs", value / 1e6);
+    if (readCgroupStat(group->cgroup_fd, "cpu.stat", "nr_throttled", &value) == 0 && value > 0)
+        fprintf(out, " throttled %llu", value);
+    if (readCgroupStat(group->cgroup_fd, "memory.current", NULL, &value) == 0)
+    {
+        fprintf(out, " mem ");
+        printBytes(out, value);
+    }
+    if (readCgroupStat(group->cgroup_fd, "memory.peak", NULL, &value) == 0)
+    {
+        fprintf(out, " peak ");
+        printBytes(out, value);
+    }
+    if (readCgroupStat(group->cgroup_fd, "memory.events", "oom_kill", &value) == 0 && value > 0)
+        fprintf(out, " oom_kill %llu", value);
+}
+
+// Current value of every limit, as far as its controller is enabled
+void printCgroupLimits(FILE* out, int dir_fd)
+{
+    char buf[512];
+    int idx;
+
+    for (idx = 0 ; idx < CGROUP_LIMIT_NUM ; idx ++)
+    {
+        if (readCgroupFile(dir_fd, cgroupLimits[idx].name, buf, sizeof(buf)) == -1)
+            continue;
+        buf[strcspn(buf, "\n")] = '\0';
+        fprintf(out, "%s\t%s\n", cgroupLimits[idx].name, buf[0] ? buf : "-");
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef __TSH_CGROUP_H__
+#define __TSH_CGROUP_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "tsh.h"
+
+// Cgroup v2 hierarchy of the shell. Jobs get a child cgroup of base,
+// which is a cgroup of its own below the one the shell was started in.
+// The shell itself moves to the leaf base/shell.
+typedef struct Cgroups
+{
+    int isReady;          // 1: base exists, -1: cgroups are not usable
+    int base_fd;          // <mount><own path>/tsh.<pid>
+    char* base;
+    char* own;            // cgroup the shell was started in
+    int ownEnabled;       // controllers enabled in own by the shell
+    int next_id;          // job cgroups are named job<id>
+} Cgroups;
+
+extern Cgroups cgroups;
+
+int initCgroups();
+int findCgroupLimit(const char*, size_t);
+int formatCgroupLimit(int, const char*, char*, size_t);
+int setCgroupLimit(int, int, const char*);
+int createJobCgroup(Command_handler*, int*);
+void removeJobCgroup(int, int);
+int attachToCgroup(int, pid_t);
+pid_t* readCgroupProcs(int, int*);
+pid_t spawnIntoCgroup(int, unsigned long, int (*)(void*), void*);
+void printCgroupStats(FILE*, ProcessGroup*);
+void printCgroupLimits(FILE*, int);
+
+#endif
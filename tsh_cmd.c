@@ -4,8 +4,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include "tsh.h"
 #include "tsh_cmd.h"
+#include "tsh_hash.h"
+#include "tsh_job.h"
+#include "tsh_parse.h"
+#include "tsh_alias.h"
+#include "tsh_history.h"
+#include "tsh_input.h"
+#include "tsh_var.h"
+#include "tsh_zygote.h"
+#include "tsh_cgroup.h"
+#include "tsh_place.h"
+#include "tsh_prio.h"
 
 int tsh_help(int argc, char* argv[])
 {
@@ -19,26 +31,28 @@ int tsh_help(int argc, char* argv[])
 
 int tsh_exit(int argc, char* argv[])
 {
-    extern pid_t tsh_pid;
-    kill(tsh_pid, SIGINT);
-    return 0;
+    fflush(stdout);
+    if (argc >= 2 && argv[1])
+        exit(atoi(argv[1]));
+    exit(last_status);
 }
 
 int tsh_cd(int argc, char* argv[])
 {
+    char cwd[4096];
+
     if (argc < 2 || !argv[1])
     {
-        chdir(getenv("HOME"));
-        setenv("PWD", getenv("HOME"), 1);
+        const char* home = getVar("HOME");
+        if (home == NULL || chdir(home) == -1)
+        {
+            fprintf(stderr, "tsh: cd: HOME not set\n");
+            return 1;
+        }
     }
     else
     {
-        if (argv[1][0] == '~')
-        {
-            argv[1][0] = '.';
-            chdir(getenv("HOME"));
-        }
-
+        // ~ was expanded with the rest of the word
         if (chdir(argv[1]) == -1)
         {
             switch (errno)
@@ -50,34 +64,67 @@ int tsh_cd(int argc, char* argv[])
                     fprintf(stderr, "tsh: cd error: %d\n", errno);
                     break;
             }
+            return 1;
         }
-
-        setenv("PWD", getcwd(NULL, 1024), 1);
     }
+
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        setVar("PWD", cwd, 0);
+    return 0;
 }
 
 int tsh_unset(int argc, char* argv[])
 {
+    int arg_idx;
+
     if (argc < 2 || !argv[1])
     {
-        fprintf(stderr, "Usage: unset <ENV_VAR>\n");
+        fprintf(stderr, "Usage: unset <VAR>...\n");
         return 0;
     }
 
-    unsetenv(argv[1]);
+    for (arg_idx = 1 ; arg_idx < argc ; arg_idx ++)
+        unsetVar(argv[arg_idx]);
     return 0;
 }
 
+// export NAME=VAL..., export NAME..., or export alone to list the
+// exported variables. The older export NAME VAL form is still accepted.
 int tsh_export(int argc, char* argv[])
 {
-    if (argc < 3 || !argv[1] || !argv[2])
+    int arg_idx;
+    int status = 0;
+
+    if (argc < 2)
     {
-        fprintf(stderr, "Usage: export <ENV_VAR> <VAL>\n");
+        char** env;
+        for (env = getEnvp() ; *env ; env ++)
+            printf("export %s\n", *env);
         return 0;
     }
 
-    setenv(argv[1], argv[2], 1);
-    return 0;
+    if (argc == 3 && strchr(argv[1], '=') == NULL && isValidName(argv[1], strlen(argv[1])))
+    {
+        setVar(argv[1], argv[2], 1);
+        return 0;
+    }
+
+    for (arg_idx = 1 ; arg_idx < argc ; arg_idx ++)
+    {
+        const char* eq = strchr(argv[arg_idx], '=');
+        int len = eq ? eq - argv[arg_idx] : (int) strlen(argv[arg_idx]);
+
+        if (!isValidName(argv[arg_idx], len))
+        {
+            fprintf(stderr, "tsh: export: '%s': not a valid name\n", argv[arg_idx]);
+            status = 1;
+        }
+        else if (eq != NULL)
+            setAssignment(argv[arg_idx], 1);
+        else if (exportVar(argv[arg_idx]) == -1)
+            setVar(argv[arg_idx], "", 1);
+    }
+    return status;
 }
 
 int tsh_fg(int argc, char* argv[])
@@ -89,29 +136,26 @@ int tsh_fg(int argc, char* argv[])
     }
 
     int jobID = atoi(&(argv[1][1]));
-    if (jobID >= MAX_BG_JOB)
-    {
-        fprintf(stderr, "tsh: fg %%%d: no such job\n", jobID);
-        return 0;
-    }
-
-    ProcessGroup* currGroup = backgroundGroup[jobID];
+    ProcessGroup* currGroup = getJob(jobID);
     if (currGroup == NULL)
         fprintf(stderr, "tsh: fg %%%d: no such job\n", jobID);
     else
     {
         int idxPID;
+
+        // Back to its own priority before it gets the CPU again
+        setJobDemoted(currGroup, 0);
         for (idxPID = 0 ; idxPID < currGroup->proc_num ; idxPID ++)
         {
-            int status = currGroup->status[idxPID];
-            if ((currGroup->isRunning[idxPID] == 0) && WIFSTOPPED(currGroup->status[idxPID]))
+            int status = currGroup->procs[idxPID].status;
+            if ((currGroup->procs[idxPID].isRunning == 0) && WIFSTOPPED(currGroup->procs[idxPID].status))
             {
-                currGroup->isRunning[idxPID] = 1;
-                kill(currGroup->pids[idxPID], SIGCONT);
+                currGroup->procs[idxPID].isRunning = 1;
+                kill(currGroup->procs[idxPID].pid, SIGCONT);
             }
             fprintf(stderr, "[%d]", jobID);
-            fprintf(stderr, "\t%d\t", currGroup->pids[idxPID]);
-            if (currGroup->isRunning[idxPID])
+            fprintf(stderr, "\t%d\t", currGroup->procs[idxPID].pid);
+            if (currGroup->procs[idxPID].isRunning)
                 fprintf(stderr, "running");
             else if (WIFEXITED(status))
                 fprintf(stderr, "exited (%d)", WEXITSTATUS(status));
@@ -119,10 +163,10 @@ int tsh_fg(int argc, char* argv[])
                 fprintf(stderr, "killed (%d)", WTERMSIG(status));
             else if (WIFSTOPPED(status))
                 fprintf(stderr, "stopped (%d)", WSTOPSIG(status));
-            fprintf(stderr, "\t\t%s\n", currGroup->cmdlines[idxPID]);
+            fprintf(stderr, "\t\t%s\n", currGroup->procs[idxPID].cmdline);
         }
         moveToForeground(currGroup);
-        backgroundGroup[jobID] = NULL;
+        detachJob(currGroup);
     }
     return 0;
 }
@@ -136,49 +180,105 @@ int tsh_bg(int argc, char* argv[])
     }
 
     int jobID = atoi(&(argv[1][1]));
-    if (jobID >= MAX_BG_JOB)
-    {
-        fprintf(stderr, "tsh: bg %%%d: no such job\n", jobID);
-        return 0;
-    }
-
-    ProcessGroup* currGroup = backgroundGroup[jobID];
+    ProcessGroup* currGroup = getJob(jobID);
     if (currGroup == NULL)
         fprintf(stderr, "tsh: bg %%%d: no such job\n", jobID);
     else
     {
         int idxPID;
+
+        setJobDemoted(currGroup, 1);
         for (idxPID = 0 ; idxPID < currGroup->proc_num ; idxPID ++)
         {
-            if ((currGroup->isRunning[idxPID] == 0) && WIFSTOPPED(currGroup->status[idxPID]))
+            if ((currGroup->procs[idxPID].isRunning == 0) && WIFSTOPPED(currGroup->procs[idxPID].status))
             {
-                currGroup->isRunning[idxPID] = 1;
-                fprintf(stderr, "[%d]\t%d\tcontinued\t\t%s\n", jobID, currGroup->pids[idxPID], currGroup->cmdlines[idxPID]);
-                kill(currGroup->pids[idxPID], SIGCONT);
+                currGroup->procs[idxPID].isRunning = 1;
+                fprintf(stderr, "[%d]\t%d\tcontinued\t\t%s\n", jobID, currGroup->procs[idxPID].pid, currGroup->procs[idxPID].cmdline);
+                kill(currGroup->procs[idxPID].pid, SIGCONT);
             }
         }
     }
     return 0;
 }
 
+// Wait for jobs to finish: all of them, the given ones, or with -n
+// the first one, for at most -t seconds
+//
+int tsh_wait(int argc, char* argv[])
+{
+    int* ids = (int*) malloc(sizeof(int) * argc);
+    int id_num = 0;
+    int isAny = 0;
+    double timeout = -1;
+    int arg_idx, ret;
+    char* end;
+
+    for (arg_idx = 1 ; arg_idx < argc ; arg_idx ++)
+    {
+        if (strcmp(argv[arg_idx], "-n") == 0)
+            isAny = 1;
+        else if (strcmp(argv[arg_idx], "-t") == 0 && arg_idx + 1 < argc)
+        {
+            timeout = strtod(argv[++ arg_idx], &end);
+            if (end == argv[arg_idx] || *end != '\0' || timeout < 0)
+            {
+                fprintf(stderr, "tsh: wait: %s: bad timeout\n", argv[arg_idx]);
+                free (ids);
+                return 2;
+            }
+        }
+        else if (argv[arg_idx][0] == '%')
+        {
+            // An unknown job finishes at once with 127
+            ids[id_num] = (int) strtol(&argv[arg_idx][1], &end, 10);
+            if (end == &argv[arg_idx][1] || *end != '\0' || !isKnownJob(ids[id_num]))
+            {
+                fprintf(stderr, "tsh: wait %s: no such job\n", argv[arg_idx]);
+                ids[id_num] = INT_MAX;
+            }
+            id_num ++;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: wait [%%<job> ...] [-n] [-t SECONDS]\n");
+            free (ids);
+            return 2;
+        }
+    }
+
+    ret = waitJobs(ids, id_num, isAny, timeout);
+    free (ids);
+    return ret;
+}
+
 int tsh_jobs(int argc, char* argv[])
 {
     int idxPG;
-    for (idxPG = 0 ; idxPG < MAX_BG_JOB ; idxPG ++)
+    int isLong = (argc > 1 && strcmp(argv[1], "-l") == 0);
+
+    if (isLong)
+        printf("\tpid\tstate\treal\tuser\tsys\tmaxrss\tcsw\tcommand\n");
+    for (idxPG = 0 ; idxPG < getJobIDLimit() ; idxPG ++)
     {
-        ProcessGroup* currGroup = backgroundGroup[idxPG];
+        ProcessGroup* currGroup = getJob(idxPG);
         if (currGroup)
         {
             int idxPID;
             int status;
 
-            fprintf(stderr, "[%d]\n", idxPG);
+            printf("[%d]", idxPG);
+            if (currGroup->pipeSize > 0)
+                printf("\tpipe %dK", currGroup->pipeSize / 1024);
+            printPlacement(stdout, currGroup->placement);
+            printPriority(stdout, currGroup);
+            printCgroupStats(stdout, currGroup);
+            printf("\n");
             for (idxPID = 0 ; idxPID < currGroup->proc_num ; idxPID ++)
             {
-                status = currGroup->status[idxPID];
+                status = currGroup->procs[idxPID].status;
 
-                fprintf(stderr, "\t%d\t", currGroup->pids[idxPID]);
-                if (currGroup->isRunning[idxPID])
+                printf("\t%d\t", currGroup->procs[idxPID].pid);
+                if (currGroup->procs[idxPID].isRunning)
                     printf("running");
                 else if (WIFEXITED(status))
                     printf("exited (%d)", WEXITSTATUS(status));
@@ -186,9 +286,399 @@ int tsh_jobs(int argc, char* argv[])
                     printf("killed (%d)", WTERMSIG(status));
                 else if (WIFSTOPPED(status))
                     printf("stopped (%d)", WSTOPSIG(status));
-                printf("\t\t%s\n", currGroup->cmdlines[idxPID]);
+                printf("\t");
+                if (isLong)
+                    printProcessUsage(stdout, &currGroup->procs[idxPID]);
+                printf("\t%s\n", currGroup->procs[idxPID].cmdline);
             }
         }
     }
     return 0;
 }
+
+int tsh_hash(int argc, char* argv[])
+{
+    if (argc < 2 || !argv[1])
+        listCommandHash();
+    else if (strcmp(argv[1], "-r") == 0)
+        clearCommandHash();
+    else if (strcmp(argv[1], "-R") == 0)
+        rehashCommandHash();
+    else
+        fprintf(stderr, "Usage: hash [-r | -R]\n");
+    return 0;
+}
+
+static const char* autoPlaceModes[] = { "off", "cpu", "node" };
+static const char* autoPrioModes[] = { "off", "batch", "idle" };
+
+int tsh_set(int argc, char* argv[])
+{
+    long size;
+
+    if (argc < 2)
+    {
+        printf("pipesize\t%d\n", tsh_options.pipeSize);
+        printf("spawnhelper\t%s\n", tsh_options.spawnHelper ? "on" : "off");
+        printf("cgroup\t%s\n", tsh_options.cgroup ? "on" : "off");
+        printf("autoplace\t%s\n", autoPlaceModes[tsh_options.autoPlace]);
+        printf("autoprio\t%s\n", autoPrioModes[tsh_options.autoPrio]);
+        return 0;
+    }
+    if (strcmp(argv[1], "pipesize") == 0 && argc == 3)
+    {
+        // 0 goes back to the kernel default
+        if ((size = parseSize(argv[2])) < 0)
+        {
+            fprintf(stderr, "tsh: set: %s: invalid size\n", argv[2]);
+            return 1;
+        }
+        tsh_options.pipeSize = (int) size;
+        return 0;
+    }
+    if (strcmp(argv[1], "spawnhelper") == 0 && argc == 3 &&
+        (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0))
+    {
+        tsh_options.spawnHelper = (strcmp(argv[2], "on") == 0);
+        if (!tsh_options.spawnHelper)
+            stopZygote();
+        else if (startZygote() == -1)
+        {
+            fprintf(stderr, "tsh: set: spawn helper: %s\n", strerror(errno));
+            tsh_options.spawnHelper = 0;
+            return 1;
+        }
+        return 0;
+    }
+    if (strcmp(argv[1], "cgroup") == 0 && argc == 3 &&
+        (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0))
+    {
+        tsh_options.cgroup = (strcmp(argv[2], "on") == 0);
+        if (tsh_options.cgroup && initCgroups() == -1)
+        {
+            tsh_options.cgroup = 0;
+            return 1;
+        }
+        return 0;
+    }
+    if (strcmp(argv[1], "autoplace") == 0 && argc == 3)
+    {
+        int mode;
+        for (mode = PLACE_OFF ; mode <= PLACE_NODE ; mode ++)
+        {
+            if (strcmp(argv[2], autoPlaceModes[mode]) == 0)
+            {
+                tsh_options.autoPlace = mode;
+                return 0;
+            }
+        }
+    }
+    if (strcmp(argv[1], "autoprio") == 0 && argc == 3)
+    {
+        int mode;
+        for (mode = AUTOPRIO_OFF ; mode <= AUTOPRIO_IDLE ; mode ++)
+        {
+            if (strcmp(argv[2], autoPrioModes[mode]) == 0)
+            {
+                checkAutoPriority(mode);
+                tsh_options.autoPrio = mode;
+                return 0;
+            }
+        }
+    }
+    fprintf(stderr, "Usage: set [pipesize SIZE | spawnhelper on|off | cgroup on|off | autoplace off|cpu|node | autoprio off|batch|idle]\n");
+    return 2;
+}
+
+// Show the placement of a job, or move it to other CPUs or to the
+// CPUs and memory of a NUMA node
+//
+int tsh_pin(int argc, char* argv[])
+{
+    ProcessGroup* group;
+    Placement* place;
+    int jobID;
+    char* end;
+
+    if (argc < 2 || argv[1][0] != '%' || argc > 4 || (argc == 4 && strcmp(argv[2], "-n") != 0))
+    {
+        fprintf(stderr, "Usage: pin %%<job> [CPULIST | -n NODE]\n");
+        return 2;
+    }
+    jobID = atoi(&argv[1][1]);
+    if ((group = getJob(jobID)) == NULL)
+    {
+        fprintf(stderr, "tsh: pin %%%d: no such job\n", jobID);
+        return 1;
+    }
+    if (argc == 2)
+    {
+        if (group->placement == NULL)
+            printf("[%d]\tnot placed\n", jobID);
+        else
+        {
+            printf("[%d]", jobID);
+            printPlacement(stdout, group->placement);
+            printf("\n");
+        }
+        return 0;
+    }
+
+    place = (Placement*) malloc(sizeof(Placement));
+    memset(place, 0, sizeof(Placement));
+    place->node = -1;
+    if (argc == 4)
+    {
+        place->node = (int) strtol(argv[3], &end, 10);
+        if (end == argv[3] || *end != '\0' || getNodeCpus(place->node, &place->cpus) == -1)
+        {
+            fprintf(stderr, "tsh: pin: %s: no such node\n", argv[3]);
+            free (place);
+            return 1;
+        }
+    }
+    else if (parseCpuList(argv[2], strlen(argv[2]), &place->cpus) == -1 || argv[2][0] == '\0')
+    {
+        fprintf(stderr, "tsh: pin: %s: bad CPU list\n", argv[2]);
+        free (place);
+        return 1;
+    }
+    return (pinJob(group, place) == -1) ? 1 : 0;
+}
+
+// Show or change the priority of a job. Setting it also ends an
+// automatic demotion.
+//
+int tsh_prio(int argc, char* argv[])
+{
+    ProcessGroup* group;
+    Priority prio;
+    int jobID, arg_idx;
+
+    if (argc < 2 || argv[1][0] != '%')
+    {
+        fprintf(stderr, "Usage: prio %%<job> [nice=N] [sched=other|batch|idle] [ioprio=rt:N|be:N|idle]\n");
+        return 2;
+    }
+    jobID = atoi(&argv[1][1]);
+    if ((group = getJob(jobID)) == NULL)
+    {
+        fprintf(stderr, "tsh: prio %%%d: no such job\n", jobID);
+        return 1;
+    }
+    if (argc == 2)
+    {
+        if (group->priority == NULL && !group->isDemoted)
+            printf("[%d]\tpriority of the shell\n", jobID);
+        else
+        {
+            printf("[%d]", jobID);
+            printPriority(stdout, group);
+            printf("\n");
+        }
+        return 0;
+    }
+
+    initPriority(&prio);
+    for (arg_idx = 2 ; arg_idx < argc ; arg_idx ++)
+    {
+        char* equal = strchr(argv[arg_idx], '=');
+        if (equal == NULL || parsePriority(argv[arg_idx], equal - argv[arg_idx], equal + 1, &prio) != 0)
+        {
+            fprintf(stderr, "tsh: prio: bad priority '%s'\n", argv[arg_idx]);
+            return 1;
+        }
+    }
+    return (setJobPriority(group, &prio) == -1) ? 1 : 0;
+}
+
+// Show or change the limits of a job running in a cgroup
+int tsh_limit(int argc, char* argv[])
+{
+    ProcessGroup* group;
+    char value[256];
+    int jobID, arg_idx, idx;
+    int ret = 0;
+
+    if (argc < 2 || argv[1][0] != '%')
+    {
+        fprintf(stderr, "Usage: limit %%<job> [cpu.max=V] [memory.max=V] [io.max=V]\n");
+        return 2;
+    }
+    jobID = atoi(&argv[1][1]);
+    if ((group = getJob(jobID)) == NULL)
+    {
+        fprintf(stderr, "tsh: limit %%%d: no such job\n", jobID);
+        return 1;
+    }
+    if (group->cgroup_fd == -1)
+    {
+        fprintf(stderr, "tsh: limit %%%d: job has no cgroup\n", jobID);
+        return 1;
+    }
+    if (argc == 2)
+    {
+        printCgroupLimits(stdout, group->cgroup_fd);
+        return 0;
+    }
+
+    for (arg_idx = 2 ; arg_idx < argc ; arg_idx ++)
+    {
+        char* equal = strchr(argv[arg_idx], '=');
+        if (equal == NULL || (idx = findCgroupLimit(argv[arg_idx], equal - argv[arg_idx])) == -1 ||
+            formatCgroupLimit(idx, equal + 1, value, sizeof(value)) == -1)
+        {
+            fprintf(stderr, "tsh: limit: bad limit '%s'\n", argv[arg_idx]);
+            ret = 1;
+        }
+        else if (setCgroupLimit(group->cgroup_fd, idx, value) == -1)
+            ret = 1;
+    }
+    return ret;
+}
+
+int tsh_alias(int argc, char* argv[])
+{
+    int arg_idx;
+    int ret = 0;
+
+    if (argc < 2)
+    {
+        for (arg_idx = 0 ; arg_idx < aliasTable.alias_num ; arg_idx ++)
+            printf("alias %s='%s'\n", aliasTable.aliases[arg_idx].name, aliasTable.aliases[arg_idx].value);
+        return 0;
+    }
+
+    for (arg_idx = 1 ; arg_idx < argc ; arg_idx ++)
+    {
+        char* value = strchr(argv[arg_idx], '=');
+        if (value == NULL)
+        {
+            const char* alias = findAlias(argv[arg_idx]);
+            if (alias == NULL)
+            {
+                fprintf(stderr, "tsh: alias: %s: not found\n", argv[arg_idx]);
+                ret = 1;
+            }
+            else
+                printf("alias %s='%s'\n", argv[arg_idx], alias);
+            continue;
+        }
+
+        *value ++ = '\0';
+        if (argv[arg_idx][0] == '\0' || strpbrk(argv[arg_idx], "/$'\"\\ \t") != NULL)
+        {
+            fprintf(stderr, "tsh: alias: %s: invalid alias name\n", argv[arg_idx]);
+            ret = 1;
+        }
+        else
+            setAlias(argv[arg_idx], value);
+    }
+    return ret;
+}
+
+int tsh_unalias(int argc, char* argv[])
+{
+    int arg_idx;
+    int ret = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: unalias [-a] name [name ...]\n");
+        return 2;
+    }
+    if (strcmp(argv[1], "-a") == 0)
+    {
+        clearAliases();
+        return 0;
+    }
+    for (arg_idx = 1 ; arg_idx < argc ; arg_idx ++)
+    {
+        if (removeAlias(argv[arg_idx]) == -1)
+        {
+            fprintf(stderr, "tsh: unalias: %s: not found\n", argv[arg_idx]);
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+// history [-s status] [-d dir] [-g text] [N]: the last N matching entries
+int tsh_history(int argc, char* argv[])
+{
+    const char* dir = NULL;
+    const char* text = NULL;
+    int hasStatus = 0, status = 0;
+    size_t limit = (size_t) -1;
+    size_t* found;
+    size_t found_num = 0;
+    size_t num, idx;
+    int arg_idx;
+
+    for (arg_idx = 1 ; arg_idx < argc ; arg_idx ++)
+    {
+        if (strcmp(argv[arg_idx], "-s") == 0 && arg_idx + 1 < argc)
+        {
+            hasStatus = 1;
+            status = atoi(argv[++ arg_idx]);
+        }
+        else if (strcmp(argv[arg_idx], "-d") == 0 && arg_idx + 1 < argc)
+            dir = argv[++ arg_idx];
+        else if (strcmp(argv[arg_idx], "-g") == 0 && arg_idx + 1 < argc)
+            text = argv[++ arg_idx];
+        else if (argv[arg_idx][0] >= '0' && argv[arg_idx][0] <= '9')
+            limit = strtoul(argv[arg_idx], NULL, 10);
+        else
+        {
+            fprintf(stderr, "Usage: history [-s status] [-d dir] [-g text] [N]\n");
+            return 2;
+        }
+    }
+
+    if (openDefaultHistory() == -1)
+    {
+        fprintf(stderr, "tsh: history: cannot open the history file\n");
+        return 1;
+    }
+
+    // Newest first up to the limit, then printed oldest first
+    num = syncHistory();
+    found = (size_t*) malloc(sizeof(size_t) * (num ? num : 1));
+    for (idx = num ; idx > 0 && found_num < limit ; idx --)
+    {
+        HistEntry entry;
+        if (getHistoryEntry(idx - 1, &entry) == -1)
+            continue;
+        if ((hasStatus && entry.status != status) ||
+            (dir && strcmp(entry.cwd, dir) != 0) ||
+            (text && strstr(entry.cmd, text) == NULL))
+            continue;
+        found[found_num ++] = idx - 1;
+    }
+
+    while (found_num > 0)
+    {
+        HistEntry entry;
+        char date[32];
+        time_t when;
+
+        if (getHistoryEntry(found[-- found_num], &entry) == -1)
+            continue;
+        when = (time_t) entry.time;
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&when));
+        printf("%5llu  %s  %3d  %s\t%s\n", (unsigned long long) entry.seq, date,
+               entry.status, entry.cwd, entry.cmd);
+    }
+    free (found);
+    return 0;
+}
+
+int tsh_source(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: source FILE\n");
+        return 2;
+    }
+    return sourceFile(argv[1]);
+}
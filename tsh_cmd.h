@@ -6,6 +6,7 @@ typedef struct TSH_command
     char* cmd_name;
     char* cmd_info;
     int (*cmd_func)(int, char*[]);
+    int (*cmd_check)(int, char*[], int);  // 0: leave this call to the real command
 } TSH_command;
 
 int tsh_help(int, char*[]);
@@ -15,7 +16,36 @@ int tsh_export(int, char*[]);
 int tsh_unset(int, char*[]);
 int tsh_fg(int, char*[]);
 int tsh_bg(int, char*[]);
+int tsh_wait(int, char*[]);
 int tsh_cd(int, char*[]);
+int tsh_hash(int, char*[]);
+int tsh_set(int, char*[]);
+int tsh_limit(int, char*[]);
+int tsh_pin(int, char*[]);
+int tsh_prio(int, char*[]);
+int tsh_alias(int, char*[]);
+int tsh_unalias(int, char*[]);
+int tsh_history(int, char*[]);
+int tsh_source(int, char*[]);
+
+// Fast path utilities (tsh_util.c)
+int tsh_true(int, char*[]);
+int tsh_false(int, char*[]);
+int tsh_echo(int, char*[]);
+int tsh_printf(int, char*[]);
+int tsh_printf_check(int, char*[], int);
+int tsh_cat(int, char*[]);
+int tsh_cat_check(int, char*[], int);
+int tsh_test(int, char*[]);
+int copyFd(int, int);
+
+int tsh_parallel(int, char*[]);
+
+// Control flow of programs (tsh_exec.c)
+int tsh_break(int, char*[]);
+int tsh_continue(int, char*[]);
+int tsh_return(int, char*[]);
+int tsh_shift(int, char*[]);
 
 extern TSH_command tsh_cmds[]; 
 extern int tsh_cmd_num;
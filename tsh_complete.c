@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tsh.h"
+#include "tsh_cmd.h"
+#include "tsh_hash.h"
+#include "tsh_alias.h"
+#include "tsh_job.h"
+#include "tsh_dircache.h"
+#include "tsh_var.h"
+#include "tsh_complete.h"
+
+// Completion
+//
+// The word under the cursor is completed as a command in command
+// position (builtins, aliases and $PATH), as a %job or a $VARIABLE when it
+// starts like one, and as a file name otherwise. Command names come from
+// the command hash, which only reads again the $PATH directories whose
+// mtime changed; a sorted copy of its names is kept until it is rebuilt.
+// File names come from the directory cache.
+//
+
+static char** commandNames;
+static int commandNum;
+static int commandGeneration;
+
+static int compareMatch(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static void loadCommandNames()
+{
+    int idx;
+
+    validateCommandHash();
+    if (commandNames != NULL && commandGeneration == commandHash.generation)
+        return;
+
+    free (commandNames);
+    commandNames = (char**) malloc(sizeof(char*) * (commandHash.entry_num + 1));
+    commandNum = 0;
+    for (idx = 0 ; idx < commandHash.bucket_num ; idx ++)
+    {
+        CommandEntry* entry;
+        for (entry = commandHash.buckets[idx] ; entry ; entry = entry->next)
+            commandNames[commandNum ++] = entry->name;
+    }
+    qsort(commandNames, commandNum, sizeof(char*), compareMatch);
+    commandGeneration = commandHash.generation;
+}
+
+static void addMatch(Completion* comp, const char* head, size_t head_len, const char* name, const char* tail)
+{
+    size_t name_len = strlen(name), tail_len = strlen(tail);
+    char* match = (char*) malloc(head_len + name_len + tail_len + 1);
+
+    memcpy(match, head, head_len);
+    memcpy(match + head_len, name, name_len);
+    memcpy(match + head_len + name_len, tail, tail_len + 1);
+
+    if (comp->match_num == comp->match_cap)
+    {
+        comp->match_cap = comp->match_cap ? comp->match_cap * 2 : 16;
+        comp->matches = (char**) realloc(comp->matches, sizeof(char*) * comp->match_cap);
+    }
+    comp->matches[comp->match_num ++] = match;
+}
+
+static void completeCommand(Completion* comp, const char* word)
+{
+    size_t len = strlen(word);
+    int idx;
+
+    for (idx = 0 ; idx < tsh_cmd_num ; idx ++)
+        if (strncmp(tsh_cmds[idx].cmd_name, word, len) == 0)
+            addMatch(comp, "", 0, tsh_cmds[idx].cmd_name, "");
+
+    for (idx = 0 ; idx < aliasTable.alias_num ; idx ++)
+        if (strncmp(aliasTable.aliases[idx].name, word, len) == 0)
+            addMatch(comp, "", 0, aliasTable.aliases[idx].name, "");
+
+    loadCommandNames();
+    for (idx = lowerBoundName(commandNames, commandNum, word) ; idx < commandNum ; idx ++)
+    {
+        if (strncmp(commandNames[idx], word, len) != 0)
+            break;
+        addMatch(comp, "", 0, commandNames[idx], "");
+    }
+}
+
+static void completeJob(Completion* comp, const char* word)
+{
+    char id[16];
+    size_t len = strlen(word);
+    int idx;
+
+    for (idx = 0 ; idx < getJobIDLimit() ; idx ++)
+    {
+        if (getJob(idx) == NULL)
+            continue;
+        snprintf(id, sizeof(id), "%%%d", idx);
+        if (strncmp(id, word, len) == 0)
+            addMatch(comp, "", 0, id, "");
+    }
+}
+
+static void completeVariable(Completion* comp, const char* word)
+{
+    size_t len = strlen(word + 1);
+    unsigned int idx;
+
+    // Shell variables too, not only the exported ones
+    for (idx = 0 ; idx < varTable.cap ; idx ++)
+    {
+        Var* var = &varTable.slots[idx];
+        char name[256];
+
+        if (var->entry == NULL || (size_t) var->name_len >= sizeof(name) || (size_t) var->name_len < len)
+            continue;
+        if (strncmp(var->entry, word + 1, len) != 0)
+            continue;
+        memcpy(name, var->entry, var->name_len);
+        name[var->name_len] = '\0';
+        addMatch(comp, "$", 1, name, "");
+    }
+}
+
+static void completeFile(Completion* comp, const char* word)
+{
+    const char* slash = strrchr(word, '/');
+    const char* base = slash ? slash + 1 : word;
+    size_t head_len = base - word;
+    size_t base_len = strlen(base);
+    char dir[4096];
+    DirListing* listing;
+    int idx;
+
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (word[0] == '~' && word + 1 == slash)
+        snprintf(dir, sizeof(dir), "%s/", getVar("HOME") ? getVar("HOME") : "");
+    else if (word[0] == '~' && word[1] == '/')
+        snprintf(dir, sizeof(dir), "%s%.*s", getVar("HOME") ? getVar("HOME") : "", (int) (head_len - 1), word + 1);
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int) head_len, word);
+
+    if ((listing = getDirListing(dir)) == NULL)
+        return;
+
+    comp->display_off = head_len;
+    for (idx = lowerBoundName(listing->names, listing->name_num, base) ; idx < listing->name_num ; idx ++)
+    {
+        const char* name = listing->names[idx];
+        if (strncmp(name, base, base_len) != 0)
+            break;
+        // Dot files only when asked for
+        if (name[0] == '.' && base[0] != '.')
+            continue;
+        addMatch(comp, word, head_len, name, isListedDir(listing, idx) ? "/" : "");
+    }
+}
+
+// Whether the word starting at start is in command position: first in
+// the line or after a '|', skipping the time keyword and @attributes.
+//
+static int isCommandPosition(const char* line, size_t start)
+{
+    size_t pos = start;
+
+    while (1)
+    {
+        size_t end;
+
+        while (pos > 0 && (line[pos - 1] == ' ' || line[pos - 1] == '\t'))
+            pos --;
+        if (pos == 0 || line[pos - 1] == '|')
+            return 1;
+
+        end = pos;
+        while (pos > 0 && line[pos - 1] != ' ' && line[pos - 1] != '\t' && line[pos - 1] != '|')
+            pos --;
+        if (line[pos] != '@' && !(end - pos == 4 && strncmp(line + pos, "time", 4) == 0))
+            return 0;
+    }
+}
+
+// Collect the completions of the word ending at cursor.
+// Return the number of matches.
+//
+int completeWord(const char* line, size_t cursor, Completion* comp)
+{
+    size_t start = cursor;
+    char* word;
+    int idx, num;
+
+    memset(comp, 0, sizeof(Completion));
+    while (start > 0 && strchr(" \t|<>", line[start - 1]) == NULL)
+        start --;
+    comp->start = start;
+
+    word = strndup(line + start, cursor - start);
+    if (word[0] == '%')
+        completeJob(comp, word);
+    else if (word[0] == '$')
+        completeVariable(comp, word);
+    else if (strchr(word, '/') == NULL && isCommandPosition(line, start))
+        completeCommand(comp, word);
+    else
+        completeFile(comp, word);
+    free (word);
+
+    // Builtins, aliases and commands may share names
+    if (comp->match_num > 1)
+        qsort(comp->matches, comp->match_num, sizeof(char*), compareMatch);
+    for (idx = 0, num = 0 ; idx < comp->match_num ; idx ++)
+    {
+        if (num > 0 && strcmp(comp->matches[num - 1], comp->matches[idx]) == 0)
+            free (comp->matches[idx]);
+        else
+            comp->matches[num ++] = comp->matches[idx];
+    }
+    comp->match_num = num;
+    return num;
+}
+
+void freeCompletion(Completion* comp)
+{
+    int idx;
+    for (idx = 0 ; idx < comp->match_num ; idx ++)
+        free (comp->matches[idx]);
+    free (comp->matches);
+    memset(comp, 0, sizeof(Completion));
+}
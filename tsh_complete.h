@@ -0,0 +1,20 @@
+#ifndef __TSH_COMPLETE_H__
+#define __TSH_COMPLETE_H__
+
+#include <stddef.h>
+
+// Candidates for the word under the cursor. Every match replaces the
+// whole word; the listing shows them from display_off on.
+typedef struct Completion
+{
+    size_t start;         // where the word begins in the line
+    size_t display_off;
+    int match_num;
+    int match_cap;
+    char** matches;       // sorted, directories end with '/'
+} Completion;
+
+int completeWord(const char*, size_t, Completion*);
+void freeCompletion(Completion*);
+
+#endif
@@ -0,0 +1,633 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "tsh.h"
+#include "tsh_job.h"
+#include "tsh_parse.h"
+#include "tsh_control.h"
+
+// Control socket
+//
+// A Unix domain socket which lets programs drive the shell without a
+// terminal. Requests and replies are single lines:
+//
+//   RUN <command line>     OK <id>            run it as a background job
+//   STATUS <id>            RUNNING <id> <pgid> <finished>/<processes>
+//                          STOPPED <id> <pgid> <finished>/<processes>
+//                          DONE <id> <exit code>
+//   WAIT <id>              DONE <id> <exit code>, once it finished
+//   KILL <id> [signal]     OK <id>            SIGTERM by default
+//   EVENTS                 OK, then EXIT <id> <exit code> for every job
+//   LIST                   JOB <id> <state> <exit code or -> <command line>
+//                          ... then END
+//
+// Errors are answered with ERR <message>. Requests are handled in order:
+// a client waiting for a job sends nothing more until it finished. The
+// listening socket and the clients share an epoll instance of their own,
+// which the reactor of the shell polls like any other descriptor, so the
+// socket is served at the prompt and by serveControl() without one.
+// Jobs are the ProcessGroup records of the job table; ids are not reused.
+//
+#define CONTROL_LINE_MAX (1 << 20)
+#define CONTROL_JOBS_INITIAL 256
+
+Control control = { -1, -1 };
+
+extern int stdin_fd;
+extern int sigchld_fd;
+extern int atPrompt;
+
+static void closeClient(ControlClient* client);
+
+static void flushClient(ControlClient* client)
+{
+    struct epoll_event ev;
+    size_t done = 0;
+
+    while (done < client->out_len)
+    {
+        ssize_t n = send(client->fd, client->out + done, client->out_len - done, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+            break;
+        if (n == -1)
+        {
+            // The client went away, drop what is left
+            done = client->out_len;
+            client->isClosing = 1;
+            break;
+        }
+        done += n;
+    }
+    memmove(client->out, client->out + done, client->out_len - done);
+    client->out_len -= done;
+
+    // A client at end of file would keep the socket readable
+    ev.events = (client->reader.isEOF ? 0 : EPOLLIN) | (client->out_len > 0 ? EPOLLOUT : 0);
+    ev.data.fd = client->fd;
+    epoll_ctl(control.epfd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+static void reply(ControlClient* client, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void reply(ControlClient* client, const char* format, ...)
+{
+    va_list ap;
+    int len;
+
+    va_start(ap, format);
+    len = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+
+    if (client->out_len + len + 2 > client->out_cap)
+    {
+        while (client->out_len + len + 2 > client->out_cap)
+            client->out_cap = client->out_cap ? client->out_cap * 2 : 256;
+        client->out = (char*) realloc(client->out, client->out_cap);
+    }
+    va_start(ap, format);
+    vsnprintf(client->out + client->out_len, len + 1, format, ap);
+    va_end(ap);
+    client->out_len += len;
+    client->out[client->out_len ++] = '\n';
+    flushClient(client);
+}
+
+/* Job records */
+
+static ControlJob* findControlJob(int id)
+{
+    ControlJob* job;
+    if (id <= 0 || control.jobs == NULL)
+        return NULL;
+    job = &control.jobs[id & (control.job_cap - 1)];
+    return (job->id == id) ? job : NULL;
+}
+
+// The ring only forgets finished jobs: it grows instead of dropping
+// one which is still running.
+static ControlJob* newControlJob()
+{
+    ControlJob* job;
+    int idx;
+
+    if (control.jobs == NULL)
+    {
+        control.job_cap = CONTROL_JOBS_INITIAL;
+        control.jobs = (ControlJob*) calloc(control.job_cap, sizeof(ControlJob));
+    }
+
+    job = &control.jobs[control.next_id & (control.job_cap - 1)];
+    if (job->id != 0 && !job->isDone)
+    {
+        ControlJob* old = control.jobs;
+        int old_cap = control.job_cap;
+
+        control.job_cap *= 2;
+        control.jobs = (ControlJob*) calloc(control.job_cap, sizeof(ControlJob));
+        for (idx = 0 ; idx < old_cap ; idx ++)
+            if (old[idx].id != 0)
+                control.jobs[old[idx].id & (control.job_cap - 1)] = old[idx];
+        free (old);
+        job = &control.jobs[control.next_id & (control.job_cap - 1)];
+    }
+
+    free (job->cmdline);
+    memset(job, 0, sizeof(ControlJob));
+    job->id = control.next_id ++;
+    return job;
+}
+
+static void jobDone(ControlJob* job, int status)
+{
+    int fd;
+
+    job->group = NULL;
+    job->status = status;
+    job->isDone = 1;
+
+    for (fd = 0 ; fd < control.client_cap ; fd ++)
+    {
+        ControlClient* client = control.clients[fd];
+        if (client == NULL)
+            continue;
+        if (client->isEvents)
+            reply(client, "EXIT %d %d", job->id, status);
+        if (client->waitID == job->id)
+        {
+            client->waitID = 0;
+            reply(client, "DONE %d %d", job->id, status);
+        }
+    }
+}
+
+// Called when the record of a job started from the socket is released
+void finishControlJob(ProcessGroup* group)
+{
+    ControlJob* job = findControlJob(group->controlID);
+
+    if (job == NULL || job->group != group)
+        return;
+    jobDone(job, getExitCode(group->procs[group->proc_num - 1].status));
+}
+
+/* Requests */
+
+static void requestRun(ControlClient* client, const char* line)
+{
+    ControlJob* job;
+    ProcessGroup* group;
+    Node* program;
+    Arena arena;
+    int fd;
+    int ret;
+
+    // A line which would not run at all is an error of the request
+    arenaInit(&arena, 4096);
+    ret = parseProgram(line, strlen(line), &arena, &program);
+    arenaFree(&arena);
+    if (ret != 0 || program == NULL)
+    {
+        reply(client, "ERR %s", ret == 1 ? "incomplete command" : ret == 0 ? "empty command" : "syntax error");
+        return;
+    }
+
+    // The job must not read the terminal or the stdin of the server
+    if (tsh_interactive && atPrompt)
+        fprintf(stderr, "\n");
+    if ((fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) != -1)
+    {
+        dup2(fd, 0);
+        close(fd);
+    }
+    group = runBackgroundLine(line, strlen(line));
+    dup2(stdin_fd, 0);
+
+    job = newControlJob();
+    job->cmdline = strdup(line);
+    if (group == NULL)
+    {
+        // Only builtins ran, or nothing could be started
+        reply(client, "OK %d", job->id);
+        jobDone(job, last_status);
+        return;
+    }
+    job->group = group;
+    group->controlID = job->id;
+    reply(client, "OK %d", job->id);
+}
+
+static int parseSignal(const char* name)
+{
+    static const struct { const char* name; int sig; } names[] =
+    {
+        { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+        { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "TERM", SIGTERM },
+        { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP }
+    };
+    char* end;
+    long sig;
+    size_t idx;
+
+    if (strncmp(name, "SIG", 3) == 0)
+        name += 3;
+    for (idx = 0 ; idx < sizeof(names) / sizeof(names[0]) ; idx ++)
+        if (strcmp(name, names[idx].name) == 0)
+            return names[idx].sig;
+    sig = strtol(name, &end, 10);
+    if (*name == '\0' || *end != '\0' || sig <= 0 || sig >= NSIG)
+        return -1;
+    return (int) sig;
+}
+
+static void requestKill(ControlClient* client, ControlJob* job, const char* sigName)
+{
+    ProcessGroup* group = job->group;
+    int sig = SIGTERM;
+    int idx;
+
+    if (*sigName != '\0' && (sig = parseSignal(sigName)) == -1)
+    {
+        reply(client, "ERR bad signal %s", sigName);
+        return;
+    }
+    if (job->isDone)
+    {
+        reply(client, "ERR job %d finished", job->id);
+        return;
+    }
+
+    // Without job control the processes share the group of the shell
+    if (tsh_interactive)
+        kill(-group->pgid, sig);
+    else
+        for (idx = 0 ; idx < group->proc_num ; idx ++)
+            if (group->procs[idx].pid > 0 && (group->procs[idx].isRunning || sig == SIGCONT || sig == SIGKILL))
+                kill(group->procs[idx].pid, sig);
+    reply(client, "OK %d", job->id);
+}
+
+static const char* jobState(ControlJob* job)
+{
+    int idx;
+    if (job->isDone)
+        return "DONE";
+    for (idx = 0 ; idx < job->group->proc_num ; idx ++)
+        if (job->group->procs[idx].isRunning)
+            return "RUNNING";
+    return "STOPPED";
+}
+
+static void requestStatus(ControlClient* client, ControlJob* job)
+{
+    if (job->isDone)
+        reply(client, "DONE %d %d", job->id, job->status);
+    else
+        reply(client, "%s %d %d %d/%d", jobState(job), job->id, (int) job->group->pgid,
+              job->group->finish_num, job->group->proc_num);
+}
+
+static void requestList(ControlClient* client)
+{
+    int idx;
+
+    // Oldest first
+    for (idx = 0 ; control.jobs != NULL && idx < control.job_cap ; idx ++)
+    {
+        int id = control.next_id - control.job_cap + idx;
+        ControlJob* job = findControlJob(id);
+        if (job == NULL)
+            continue;
+        if (job->isDone)
+            reply(client, "JOB %d DONE %d %s", job->id, job->status, job->cmdline);
+        else
+            reply(client, "JOB %d %s - %s", job->id, jobState(job), job->cmdline);
+    }
+    reply(client, "END");
+}
+
+// Handle one request line. Return 0 if the client waits for a job.
+static int handleRequest(ControlClient* client, char* line)
+{
+    char* arg = line + strcspn(line, " ");
+    ControlJob* job = NULL;
+    char* end;
+
+    if (*arg)
+        *arg ++ = '\0';
+    if (strcmp(line, "RUN") == 0)
+    {
+        if (arg[strspn(arg, " \t")] == '\0')
+            reply(client, "ERR empty command");
+        else
+            requestRun(client, arg);
+        return 1;
+    }
+    if (strcmp(line, "EVENTS") == 0)
+    {
+        client->isEvents = 1;
+        reply(client, "OK");
+        return 1;
+    }
+    if (strcmp(line, "LIST") == 0)
+    {
+        requestList(client);
+        return 1;
+    }
+    if (strcmp(line, "STATUS") != 0 && strcmp(line, "WAIT") != 0 && strcmp(line, "KILL") != 0)
+    {
+        reply(client, "ERR unknown request %s", line);
+        return 1;
+    }
+
+    job = findControlJob((int) strtol(arg, &end, 10));
+    if (end == arg || job == NULL)
+    {
+        reply(client, "ERR no such job %.*s", (int) strcspn(arg, " "), arg);
+        return 1;
+    }
+    end += strspn(end, " ");
+
+    if (strcmp(line, "STATUS") == 0)
+        requestStatus(client, job);
+    else if (strcmp(line, "KILL") == 0)
+        requestKill(client, job, end);
+    else if (job->isDone)
+        reply(client, "DONE %d %d", job->id, job->status);
+    else
+    {
+        client->waitID = job->id;
+        return 0;
+    }
+    return 1;
+}
+
+// Handle the buffered requests of a client, up to a blocking WAIT
+static void serveClient(ControlClient* client)
+{
+    char* line;
+    size_t len;
+
+    while (client->waitID == 0 && !client->isClosing &&
+           (line = nextLine(&client->reader, &len)) != NULL)
+    {
+        if (len > 0 && line[len - 1] == '\r')
+            line[-- len] = '\0';
+        if (len > 0)
+            handleRequest(client, line);
+    }
+}
+
+static void acceptClients()
+{
+    int fd;
+
+    while ((fd = accept4(control.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        ControlClient* client = (ControlClient*) calloc(1, sizeof(ControlClient));
+        struct epoll_event ev;
+
+        if (fd >= control.client_cap)
+        {
+            int cap = control.client_cap ? control.client_cap : 16;
+            while (cap <= fd)
+                cap *= 2;
+            control.clients = (ControlClient**) realloc(control.clients, sizeof(ControlClient*) * cap);
+            memset(control.clients + control.client_cap, 0, sizeof(ControlClient*) * (cap - control.client_cap));
+            control.client_cap = cap;
+        }
+        client->fd = fd;
+        initInputReader(&client->reader, fd);
+        client->reader.joinLines = 0;
+        control.clients[fd] = client;
+
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(control.epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+static void closeClient(ControlClient* client)
+{
+    epoll_ctl(control.epfd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    control.clients[client->fd] = NULL;
+    freeInputReader(&client->reader);
+    free (client->out);
+    free (client);
+}
+
+static void readClient(ControlClient* client)
+{
+    ssize_t n;
+
+    while ((n = fillInput(&client->reader)) > 0)
+    {
+        serveClient(client);
+        if (client->reader.len - client->reader.start > CONTROL_LINE_MAX)
+        {
+            reply(client, "ERR line too long");
+            client->isClosing = 1;
+            break;
+        }
+    }
+    if (n == 0)
+    {
+        // Requests sent just before the end are still answered
+        serveClient(client);
+        if (client->waitID == 0)
+            client->isClosing = 1;
+        flushClient(client);
+    }
+    else if (n == -1 && errno != EAGAIN)
+        client->isClosing = 1;
+}
+
+// Serve whatever is ready. Return 0 if fd is not the control socket.
+int handleControlEvent(int fd)
+{
+    struct epoll_event events[16];
+    int ev_num, ev_idx;
+
+    if (control.epfd == -1 || fd != control.epfd)
+        return 0;
+
+    ev_num = epoll_wait(control.epfd, events, 16, 0);
+    for (ev_idx = 0 ; ev_idx < ev_num ; ev_idx ++)
+    {
+        ControlClient* client;
+
+        if (events[ev_idx].data.fd == control.listen_fd)
+        {
+            acceptClients();
+            continue;
+        }
+        if ((client = control.clients[events[ev_idx].data.fd]) == NULL)
+            continue;
+
+        if (events[ev_idx].events & EPOLLOUT)
+            flushClient(client);
+        if (events[ev_idx].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            readClient(client);
+        if (client->isClosing && client->out_len == 0)
+            closeClient(client);
+    }
+    serveControlRequests();
+    return 1;
+}
+
+// Go on with the requests of clients whose WAIT was answered. Called
+// by the reactor once children were reaped, never while a command runs.
+//
+void serveControlRequests()
+{
+    int fd;
+
+    for (fd = 0 ; fd < control.client_cap ; fd ++)
+    {
+        ControlClient* client = control.clients[fd];
+        if (client == NULL || client->waitID != 0)
+            continue;
+        serveClient(client);
+        if (client->reader.isEOF && client->waitID == 0)
+            client->isClosing = 1;
+        if (client->isClosing && client->out_len == 0)
+            closeClient(client);
+    }
+}
+
+// Listen on path. An existing socket nobody answers on is replaced.
+// Return -1 on error.
+//
+int openControl(const char* path)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    mode_t mask;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "tsh: %s: control socket path too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+    {
+        perror("tsh: socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0)
+    {
+        fprintf(stderr, "tsh: %s: another shell is listening\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+
+    // Only the owner may drive the shell
+    mask = umask(0177);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 || listen(fd, 64) == -1)
+    {
+        fprintf(stderr, "tsh: %s: %s\n", path, strerror(errno));
+        umask(mask);
+        close(fd);
+        return -1;
+    }
+    umask(mask);
+
+    control.listen_fd = fd;
+    control.path = strdup(path);
+    control.next_id = 1;
+    control.epfd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(control.epfd, EPOLL_CTL_ADD, fd, &ev);
+    atexit(closeControl);
+    return 0;
+}
+
+void closeControl()
+{
+    if (control.listen_fd == -1)
+        return;
+    close(control.listen_fd);
+    close(control.epfd);
+    unlink(control.path);
+    control.listen_fd = -1;
+    control.epfd = -1;
+}
+
+// Without a terminal, serve the socket until SIGTERM or SIGINT
+int serveControl()
+{
+    struct epoll_event ev;
+    sigset_t mask;
+    int epfd, sig_fd;
+
+    // Read from a signalfd like SIGCHLD, so that the socket is removed
+    // on the way out. Commands are spawned with an empty signal mask.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.fd = sigchld_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+    ev.data.fd = sig_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sig_fd, &ev);
+    ev.data.fd = control.epfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, control.epfd, &ev);
+
+    while (1)
+    {
+        struct epoll_event events[3];
+        int ev_num, ev_idx;
+
+        if ((ev_num = epoll_wait(epfd, events, 3, -1)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("tsh: epoll_wait");
+            return 1;
+        }
+        for (ev_idx = 0 ; ev_idx < ev_num ; ev_idx ++)
+        {
+            struct signalfd_siginfo info;
+
+            if (events[ev_idx].data.fd == sig_fd)
+            {
+                close(sig_fd);
+                close(epfd);
+                return last_status;
+            }
+            if (events[ev_idx].data.fd == sigchld_fd)
+            {
+                while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info));
+                reapChildren();
+                serveControlRequests();
+            }
+            else
+                handleControlEvent(events[ev_idx].data.fd);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef __TSH_CONTROL_H__
+#define __TSH_CONTROL_H__
+
+#include "tsh.h"
+#include "tsh_input.h"
+
+// A job submitted through the control socket. Records stay around after
+// the job finished, so that its status can still be asked for, until
+// newer jobs need the slot.
+typedef struct ControlJob
+{
+    int id;               // 0: free slot
+    ProcessGroup* group;  // NULL once finished
+    int status;           // exit code, valid once finished
+    int isDone;
+    char* cmdline;
+} ControlJob;
+
+typedef struct ControlClient
+{
+    int fd;
+    InputReader reader;
+    char* out;            // replies the socket did not take yet
+    size_t out_len;
+    size_t out_cap;
+    int waitID;           // job a WAIT is blocked on, 0 if none
+    int isEvents;         // gets an EXIT line for every job
+    int isClosing;        // close once out is flushed
+} ControlClient;
+
+typedef struct Control
+{
+    int epfd;             // listening socket and clients, polled by the reactor
+    int listen_fd;
+    char* path;
+    ControlClient** clients;  // indexed by fd
+    int client_cap;
+    ControlJob* jobs;     // ring indexed by id
+    int job_cap;
+    int next_id;
+} Control;
+
+extern Control control;
+
+int openControl(const char*);
+void closeControl();
+int handleControlEvent(int);
+void serveControlRequests();
+void finishControlJob(ProcessGroup*);
+int serveControl();
+
+#endif
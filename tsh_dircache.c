@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "tsh_dircache.h"
+
+// Directory cache
+//
+// Listings of the last few directories completed in. A listing is read
+// again only when the mtime of its directory moved, so repeated TABs in
+// a big directory cost one stat(). Whether an entry is a directory is
+// taken from d_type; file systems which do not fill it in get a stat()
+// per entry only for the entries actually shown.
+//
+#define DIR_CACHE_NUM 16
+
+static DirListing dirCache[DIR_CACHE_NUM];
+static uint64_t useClock;
+
+static int compareName(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Index of the first name not less than key
+int lowerBoundName(char** names, int name_num, const char* key)
+{
+    int low = 0, high = name_num;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (strcmp(names[mid], key) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static void freeListing(DirListing* dir)
+{
+    free (dir->path);
+    free (dir->names);
+    free (dir->types);
+    free (dir->name_pool);
+    memset(dir, 0, sizeof(DirListing));
+}
+
+static int scanListing(DirListing* dir)
+{
+    DIR* dp;
+    struct dirent* entry;
+    size_t pool_len = 0, pool_cap = 4096;
+    int name_cap = 64;
+    size_t* offsets;
+    unsigned char* types;
+    char** sorted;
+    int idx;
+
+    if ((dp = opendir(dir->path)) == NULL)
+        return -1;
+
+    free (dir->names);
+    free (dir->types);
+    free (dir->name_pool);
+    dir->name_num = 0;
+    dir->name_pool = (char*) malloc(pool_cap);
+    offsets = (size_t*) malloc(sizeof(size_t) * name_cap);
+    types = (unsigned char*) malloc(name_cap);
+
+    while ((entry = readdir(dp)) != NULL)
+    {
+        size_t len;
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        len = strlen(entry->d_name) + 1;
+        if (pool_len + len > pool_cap)
+        {
+            while (pool_len + len > pool_cap)
+                pool_cap *= 2;
+            dir->name_pool = (char*) realloc(dir->name_pool, pool_cap);
+        }
+        if (dir->name_num == name_cap)
+        {
+            name_cap *= 2;
+            offsets = (size_t*) realloc(offsets, sizeof(size_t) * name_cap);
+            types = (unsigned char*) realloc(types, name_cap);
+        }
+        memcpy(dir->name_pool + pool_len, entry->d_name, len);
+        offsets[dir->name_num] = pool_len;
+        if (entry->d_type == DT_DIR)
+            types[dir->name_num] = DIR_TYPE_DIR;
+        else if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+            types[dir->name_num] = DIR_TYPE_UNKNOWN;
+        else
+            types[dir->name_num] = DIR_TYPE_FILE;
+        dir->name_num ++;
+        pool_len += len;
+    }
+    closedir(dp);
+
+    // Sort the names, the types follow through the pool offsets
+    sorted = (char**) malloc(sizeof(char*) * (dir->name_num + 1));
+    for (idx = 0 ; idx < dir->name_num ; idx ++)
+        sorted[idx] = dir->name_pool + offsets[idx];
+    qsort(sorted, dir->name_num, sizeof(char*), compareName);
+    sorted[dir->name_num] = NULL;
+
+    dir->types = (unsigned char*) malloc(dir->name_num + 1);
+    for (idx = 0 ; idx < dir->name_num ; idx ++)
+    {
+        // Binary search of the offset, offsets grow with the index
+        size_t off = sorted[idx] - dir->name_pool;
+        int low = 0, high = dir->name_num - 1;
+        while (low < high)
+        {
+            int mid = (low + high) / 2;
+            if (offsets[mid] < off)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        dir->types[idx] = types[low];
+    }
+
+    dir->names = sorted;
+    free (offsets);
+    free (types);
+    return 0;
+}
+
+// Return the listing of path, read again only if it changed since
+// the last call. NULL if it can not be read.
+//
+DirListing* getDirListing(const char* path)
+{
+    DirListing* dir = NULL;
+    struct stat st;
+    int idx;
+
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    for (idx = 0 ; idx < DIR_CACHE_NUM ; idx ++)
+    {
+        if (dirCache[idx].path && strcmp(dirCache[idx].path, path) == 0)
+        {
+            dir = &dirCache[idx];
+            break;
+        }
+    }
+
+    if (dir != NULL && dir->mtime.tv_sec == st.st_mtim.tv_sec &&
+        dir->mtime.tv_nsec == st.st_mtim.tv_nsec)
+    {
+        dir->lastUse = ++ useClock;
+        return dir;
+    }
+
+    if (dir == NULL)
+    {
+        // Replace the least recently used listing
+        dir = &dirCache[0];
+        for (idx = 1 ; idx < DIR_CACHE_NUM ; idx ++)
+            if (dirCache[idx].lastUse < dir->lastUse)
+                dir = &dirCache[idx];
+        freeListing(dir);
+        dir->path = strdup(path);
+    }
+
+    dir->mtime = st.st_mtim;
+    if (scanListing(dir) == -1)
+    {
+        freeListing(dir);
+        return NULL;
+    }
+    dir->lastUse = ++ useClock;
+    return dir;
+}
+
+// Whether entry idx is a directory, following symlinks
+int isListedDir(DirListing* dir, int idx)
+{
+    if (dir->types[idx] == DIR_TYPE_UNKNOWN)
+    {
+        struct stat st;
+        int dfd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int isDir = (dfd != -1 && fstatat(dfd, dir->names[idx], &st, 0) == 0 && S_ISDIR(st.st_mode));
+
+        if (dfd != -1)
+            close(dfd);
+        dir->types[idx] = isDir ? DIR_TYPE_DIR : DIR_TYPE_FILE;
+    }
+    return dir->types[idx] == DIR_TYPE_DIR;
+}
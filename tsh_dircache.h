@@ -0,0 +1,27 @@
+#ifndef __TSH_DIRCACHE_H__
+#define __TSH_DIRCACHE_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define DIR_TYPE_FILE 0
+#define DIR_TYPE_DIR 1
+#define DIR_TYPE_UNKNOWN 2   // resolved with stat() when asked for
+
+// Sorted listing of one directory, as of its mtime
+typedef struct DirListing
+{
+    char* path;
+    struct timespec mtime;
+    int name_num;
+    char** names;
+    unsigned char* types;
+    char* name_pool;
+    uint64_t lastUse;
+} DirListing;
+
+DirListing* getDirListing(const char*);
+int isListedDir(DirListing*, int);
+int lowerBoundName(char**, int, const char*);
+
+#endif
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "tsh_edit.h"
+#include "tsh_history.h"
+#include "tsh_complete.h"
+
+// Line editor
+//
+// Emacs style keys: ^A ^E ^B ^F and the arrows move, ^H ^D ^K ^U ^W
+// delete, ^P ^N and up/down walk the history, ^R searches it backwards,
+// ^L clears the screen, ^C drops the line and TAB completes. The whole line is redrawn
+// after every change, which is plenty fast for a terminal.
+//
+#define KEY_CTRL(c) ((c) & 0x1f)
+
+void initLineEditor(LineEditor* ed, int fd)
+{
+    memset(ed, 0, sizeof(LineEditor));
+    ed->fd = fd;
+    ed->cap = 256;
+    ed->buf = (char*) malloc(ed->cap);
+    ed->buf[0] = '\0';
+    tcgetattr(fd, &ed->cooked);
+}
+
+static void enterRaw(LineEditor* ed)
+{
+    struct termios raw;
+
+    if (ed->isRaw)
+        return;
+    tcgetattr(ed->fd, &ed->cooked);
+    raw = ed->cooked;
+    raw.c_iflag &= ~(ICRNL | IXON | BRKINT | ISTRIP | INPCK);
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(ed->fd, TCSADRAIN, &raw) == 0)
+        ed->isRaw = 1;
+}
+
+void editorStop(LineEditor* ed)
+{
+    if (ed->isRaw)
+        tcsetattr(ed->fd, TCSADRAIN, &ed->cooked);
+    ed->isRaw = 0;
+}
+
+static void writeAll(const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(1, data, len);
+        if (n <= 0)
+            return;
+        data += n;
+        len -= n;
+    }
+}
+
+static void redraw(LineEditor* ed)
+{
+    char* out;
+    size_t size;
+    FILE* fp = open_memstream(&out, &size);
+
+    if (ed->isSearching)
+        fprintf(fp, "\r%s(reverse-i-search)`%.*s': %s\x1b[K",
+                ed->searchFailed ? "failing " : "", (int) ed->searchLen, ed->search,
+                ed->match ? ed->match : "");
+    else
+    {
+        fprintf(fp, "\r%s", ed->prompt ? ed->prompt : "");
+        fwrite(ed->buf, 1, ed->len, fp);
+        fprintf(fp, "\x1b[K");
+        if (ed->len > ed->cursor)
+            fprintf(fp, "\x1b[%zuD", ed->len - ed->cursor);
+    }
+    fclose(fp);
+
+    fflush(stdout);
+    writeAll(out, size);
+    free (out);
+}
+
+// Show the prompt and the line being edited
+void editorStart(LineEditor* ed, const char* prompt)
+{
+    free (ed->prompt);
+    ed->prompt = strdup(prompt);
+    enterRaw(ed);
+    redraw(ed);
+}
+
+static void setLine(LineEditor* ed, const char* text)
+{
+    size_t len = strlen(text);
+    if (len + 1 > ed->cap)
+    {
+        ed->cap = len + 256;
+        ed->buf = (char*) realloc(ed->buf, ed->cap);
+    }
+    memcpy(ed->buf, text, len + 1);
+    ed->len = ed->cursor = len;
+}
+
+static void insertChar(LineEditor* ed, char c)
+{
+    if (ed->len + 2 > ed->cap)
+    {
+        ed->cap *= 2;
+        ed->buf = (char*) realloc(ed->buf, ed->cap);
+    }
+    memmove(ed->buf + ed->cursor + 1, ed->buf + ed->cursor, ed->len - ed->cursor + 1);
+    ed->buf[ed->cursor ++] = c;
+    ed->len ++;
+}
+
+static void deleteRange(LineEditor* ed, size_t from, size_t to)
+{
+    memmove(ed->buf + from, ed->buf + to, ed->len - to + 1);
+    ed->len -= to - from;
+    ed->cursor = from;
+}
+
+/* Completion */
+
+#define COMPLETION_LIST_MAX 500
+
+static void listCompletion(Completion* comp)
+{
+    struct winsize ws;
+    size_t width = 0, cols, idx;
+    size_t num = comp->match_num < COMPLETION_LIST_MAX ? comp->match_num : COMPLETION_LIST_MAX;
+    char* out;
+    size_t size;
+    FILE* fp = open_memstream(&out, &size);
+
+    for (idx = 0 ; idx < num ; idx ++)
+        if (strlen(comp->matches[idx] + comp->display_off) > width)
+            width = strlen(comp->matches[idx] + comp->display_off);
+    width += 2;
+    if (ioctl(1, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+        ws.ws_col = 80;
+    cols = ws.ws_col / width ? ws.ws_col / width : 1;
+
+    fprintf(fp, "\n");
+    for (idx = 0 ; idx < num ; idx ++)
+    {
+        const char* name = comp->matches[idx] + comp->display_off;
+        if ((idx + 1) % cols == 0 || idx + 1 == num)
+            fprintf(fp, "%s\n", name);
+        else
+            fprintf(fp, "%-*s", (int) width, name);
+    }
+    if (num < (size_t) comp->match_num)
+        fprintf(fp, "... %d more\n", comp->match_num - (int) num);
+    fclose(fp);
+
+    writeAll(out, size);
+    free (out);
+}
+
+// Complete the word before the cursor as far as all the matches agree
+static void completeKey(LineEditor* ed, int wasTab)
+{
+    Completion comp;
+    size_t common, word_len;
+    int idx;
+
+    ed->buf[ed->len] = '\0';
+    if (completeWord(ed->buf, ed->cursor, &comp) == 0)
+    {
+        writeAll("\a", 1);
+        freeCompletion(&comp);
+        return;
+    }
+
+    common = strlen(comp.matches[0]);
+    for (idx = 1 ; idx < comp.match_num ; idx ++)
+    {
+        size_t len = 0;
+        while (len < common && comp.matches[idx][len] == comp.matches[0][len])
+            len ++;
+        common = len;
+    }
+
+    word_len = ed->cursor - comp.start;
+    if (common > word_len || comp.match_num == 1)
+    {
+        int isWhole = (comp.match_num == 1 && comp.matches[0][common - 1] != '/');
+        size_t add = common - word_len + isWhole;
+
+        if (ed->len + add + 1 > ed->cap)
+        {
+            ed->cap = ed->len + add + 256;
+            ed->buf = (char*) realloc(ed->buf, ed->cap);
+        }
+        memmove(ed->buf + ed->cursor + add, ed->buf + ed->cursor, ed->len - ed->cursor + 1);
+        memcpy(ed->buf + comp.start, comp.matches[0], common);
+        if (isWhole)
+            ed->buf[comp.start + common] = ' ';
+        ed->len += add;
+        ed->cursor += add;
+    }
+    else if (wasTab)
+        listCompletion(&comp);
+    else
+        writeAll("\a", 1);
+
+    freeCompletion(&comp);
+}
+
+/* History */
+
+static void leaveHistory(LineEditor* ed)
+{
+    free (ed->saved);
+    ed->saved = NULL;
+    ed->histNum = ed->histIdx = 0;
+}
+
+static void moveInHistory(LineEditor* ed, int older)
+{
+    HistEntry entry;
+
+    if (ed->saved == NULL)
+    {
+        ed->histNum = ed->histIdx = syncHistory();
+        ed->saved = strdup(ed->buf);
+    }
+
+    // Entries evicted by other sessions meanwhile are skipped
+    while (1)
+    {
+        if (older)
+        {
+            if (ed->histIdx == 0)
+                return;
+            ed->histIdx --;
+        }
+        else
+        {
+            if (ed->histIdx >= ed->histNum)
+                return;
+            ed->histIdx ++;
+        }
+        if (ed->histIdx == ed->histNum)
+        {
+            setLine(ed, ed->saved);
+            return;
+        }
+        if (getHistoryEntry(ed->histIdx, &entry) == 0)
+        {
+            setLine(ed, entry.cmd);
+            return;
+        }
+    }
+}
+
+static void updateSearch(LineEditor* ed, uint64_t below)
+{
+    HistEntry entry;
+
+    ed->search[ed->searchLen] = '\0';
+    if (ed->searchLen == 0)
+    {
+        ed->searchFailed = 0;
+        return;
+    }
+    if (searchHistory(ed->search, below, &entry) == 0)
+    {
+        free (ed->match);
+        ed->match = strdup(entry.cmd);
+        ed->searchSeq = entry.seq;
+        ed->searchFailed = 0;
+    }
+    else
+        ed->searchFailed = 1;
+}
+
+static void endSearch(LineEditor* ed, int accept)
+{
+    if (accept && ed->match)
+        setLine(ed, ed->match);
+    free (ed->match);
+    ed->match = NULL;
+    ed->isSearching = 0;
+}
+
+// Return 1 if the key was used by the search, 0 if it ends the search
+// and must be handled as usual.
+static int searchKey(LineEditor* ed, unsigned char c)
+{
+    if (c == KEY_CTRL('R'))
+    {
+        if (ed->match)
+            updateSearch(ed, ed->searchSeq);
+        return 1;
+    }
+    if (c == KEY_CTRL('G') || c == KEY_CTRL('C'))
+    {
+        endSearch(ed, 0);
+        return 1;
+    }
+    if (c == 127 || c == KEY_CTRL('H'))
+    {
+        if (ed->searchLen > 0)
+            ed->searchLen --;
+        updateSearch(ed, UINT64_MAX);
+        return 1;
+    }
+    if (c >= 32 && c != 127)
+    {
+        if (ed->searchLen + 1 < sizeof(ed->search))
+            ed->search[ed->searchLen ++] = c;
+        updateSearch(ed, UINT64_MAX);
+        return 1;
+    }
+
+    endSearch(ed, 1);
+    return 0;
+}
+
+// Finish an escape sequence: arrows, Home, End and Delete
+static void escapeKey(LineEditor* ed, char final)
+{
+    ed->escParam[ed->escLen] = '\0';
+    if (final == '~')
+    {
+        switch (atoi(ed->escParam))
+        {
+            case 1: case 7: final = 'H'; break;
+            case 4: case 8: final = 'F'; break;
+            case 3:
+                if (ed->cursor < ed->len)
+                    deleteRange(ed, ed->cursor, ed->cursor + 1);
+                return;
+            default: return;
+        }
+    }
+
+    switch (final)
+    {
+        case 'A': moveInHistory(ed, 1); break;
+        case 'B': moveInHistory(ed, 0); break;
+        case 'C': if (ed->cursor < ed->len) ed->cursor ++; break;
+        case 'D': if (ed->cursor > 0) ed->cursor --; break;
+        case 'H': ed->cursor = 0; break;
+        case 'F': ed->cursor = ed->len; break;
+    }
+}
+
+// Handle one key. Return 1 if the line is complete.
+static int editKey(LineEditor* ed, unsigned char c)
+{
+    int wasTab = ed->lastWasTab;
+
+    ed->lastWasTab = (c == '\t');
+    if (ed->escState == 1)
+    {
+        ed->escState = (c == '[' || c == 'O') ? 2 : 0;
+        ed->escLen = 0;
+        return 0;
+    }
+    if (ed->escState == 2)
+    {
+        if ((c >= '0' && c <= '9') || c == ';')
+        {
+            if (ed->escLen + 1 < (int) sizeof(ed->escParam))
+                ed->escParam[ed->escLen ++] = c;
+            return 0;
+        }
+        ed->escState = 0;
+        escapeKey(ed, c);
+        return 0;
+    }
+
+    if (ed->isSearching && searchKey(ed, c))
+        return 0;
+
+    switch (c)
+    {
+        case '\r':
+        case '\n':
+            return 1;
+        case 27:
+            ed->escState = 1;
+            break;
+        case '\t':
+            completeKey(ed, wasTab);
+            break;
+        case KEY_CTRL('A'): ed->cursor = 0; break;
+        case KEY_CTRL('E'): ed->cursor = ed->len; break;
+        case KEY_CTRL('B'): if (ed->cursor > 0) ed->cursor --; break;
+        case KEY_CTRL('F'): if (ed->cursor < ed->len) ed->cursor ++; break;
+        case KEY_CTRL('P'): moveInHistory(ed, 1); break;
+        case KEY_CTRL('N'): moveInHistory(ed, 0); break;
+        case KEY_CTRL('K'): deleteRange(ed, ed->cursor, ed->len); ed->cursor = ed->len; break;
+        case KEY_CTRL('U'): deleteRange(ed, 0, ed->cursor); break;
+        case 127:
+        case KEY_CTRL('H'):
+            if (ed->cursor > 0)
+                deleteRange(ed, ed->cursor - 1, ed->cursor);
+            break;
+        case KEY_CTRL('W'):
+        {
+            size_t from = ed->cursor;
+            while (from > 0 && ed->buf[from - 1] == ' ')
+                from --;
+            while (from > 0 && ed->buf[from - 1] != ' ')
+                from --;
+            deleteRange(ed, from, ed->cursor);
+            break;
+        }
+        case KEY_CTRL('D'):
+            if (ed->len == 0)
+            {
+                ed->isEOF = 1;
+                return 1;
+            }
+            if (ed->cursor < ed->len)
+                deleteRange(ed, ed->cursor, ed->cursor + 1);
+            break;
+        case KEY_CTRL('C'):
+            writeAll("^C\n", 3);
+            setLine(ed, "");
+            leaveHistory(ed);
+            break;
+        case KEY_CTRL('L'):
+            writeAll("\x1b[H\x1b[2J", 7);
+            break;
+        case KEY_CTRL('R'):
+            ed->isSearching = 1;
+            ed->searchLen = 0;
+            ed->searchFailed = 0;
+            break;
+        default:
+            if (c >= 32)
+                insertChar(ed, c);
+            break;
+    }
+    return 0;
+}
+
+// Feed input to the editor. Return the completed line, or NULL once
+// everything was consumed; data and len are advanced past what was used.
+// The line is valid until the next call.
+//
+char* editorFeed(LineEditor* ed, const char** data, size_t* len)
+{
+    while (*len > 0)
+    {
+        unsigned char c = (unsigned char) **data;
+        (*data) ++;
+        (*len) --;
+
+        if (editKey(ed, c))
+        {
+            size_t size = ed->isEOF ? 1 : ed->len + 1;
+
+            // Leave the cursor after the line
+            ed->cursor = ed->len;
+            redraw(ed);
+            writeAll("\n", 1);
+
+            if (size > ed->line_cap)
+            {
+                ed->line_cap = size + 256;
+                ed->line = (char*) realloc(ed->line, ed->line_cap);
+            }
+            memcpy(ed->line, ed->isEOF ? "" : ed->buf, size);
+            setLine(ed, "");
+            leaveHistory(ed);
+            return ed->line;
+        }
+    }
+
+    if (ed->isRaw)
+        redraw(ed);
+    return NULL;
+}
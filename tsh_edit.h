@@ -0,0 +1,48 @@
+#ifndef __TSH_EDIT_H__
+#define __TSH_EDIT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <termios.h>
+
+// Line editor driven by the reactor: bytes are fed in as they arrive and
+// a complete line comes out when Enter is pressed. The terminal is in raw
+// mode only while a prompt is shown.
+typedef struct LineEditor
+{
+    int fd;
+    int isRaw;
+    int isEOF;
+    struct termios cooked;
+    char* prompt;
+    char* buf;            // line being edited
+    size_t len;
+    size_t cap;
+    size_t cursor;
+    char* line;           // last completed line
+    size_t line_cap;
+
+    int escState;         // 0: none, 1: after ESC, 2: in a CSI / SS3 sequence
+    char escParam[8];
+    int escLen;
+
+    size_t histIdx;       // entry of the history view shown, histNum: none
+    size_t histNum;
+    char* saved;          // the line being edited before moving into history
+
+    int isSearching;      // Ctrl-R
+    char search[256];
+    size_t searchLen;
+    uint64_t searchSeq;   // sequence number of the current match
+    int searchFailed;
+    char* match;
+
+    int lastWasTab;       // a second TAB lists the completions
+} LineEditor;
+
+void initLineEditor(LineEditor*, int);
+void editorStart(LineEditor*, const char*);
+void editorStop(LineEditor*);
+char* editorFeed(LineEditor*, const char**, size_t*);
+
+#endif
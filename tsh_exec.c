@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "tsh.h"
+#include "tsh_cmd.h"
+#include "tsh_exec.h"
+#include "tsh_expand.h"
+#include "tsh_var.h"
+
+// Program executor
+//
+// A line is parsed once into nodes (tsh_parse.c), which are then walked
+// here. A pipeline is never expanded in place: a copy of its commands is
+// expanded in the scratch arena of the line and released as soon as it
+// finished, so the nodes of a loop body run again on the next round
+// without being parsed again, and the arena does not grow with the
+// number of rounds. After the first round, a round allocates nothing
+// but what its commands keep.
+//
+// A function is parsed again from its text into an arena of its own
+// when its definition runs, and called like a builtin: in the shell,
+// or in a forked copy of it when it is piped or in the background.
+// Builtins are found before functions of the same name. A compound
+// command which is piped, redirected or in the background is a stage
+// of a pipeline, and runs the same way.
+//
+// break, continue and return only set how many levels are left to
+// unwind; every list checks that after each of its commands.
+//
+#define FUNC_MAX_DEPTH 1000
+
+FunctionTable functionTable;
+Arena* execArena;            // scratch arena of the running program
+
+static Expander expander;    // buffers reused by every command
+static int execDepth;
+static int callDepth;
+static int loopDepth;        // loops around, in the running function
+static int breakCount;       // loops left to break out of
+static int continueCount;    // loops left to go through, the last one goes on
+static int isReturning;
+static int isAborted;        // ^C killed a command, the rest of the line is skipped
+
+static void execList(Node*);
+
+static int isUnwinding()
+{
+    return (breakCount || continueCount || isReturning || isAborted);
+}
+
+// Copy the commands of a pipeline, which get expanded in place
+static Command_handler* copyPipeline(Command_handler* parsed)
+{
+    Command_handler* ret = (Command_handler*) arenaAlloc(execArena, sizeof(Command_handler));
+    int cmd_idx;
+
+    *ret = *parsed;
+    ret->cmds = (Command**) arenaAlloc(execArena, sizeof(Command*) * parsed->cmd_num);
+    for (cmd_idx = 0 ; cmd_idx < parsed->cmd_num ; cmd_idx ++)
+    {
+        Command* cmd = (Command*) arenaAlloc(execArena, sizeof(Command));
+        *cmd = *parsed->cmds[cmd_idx];
+        if (cmd->assign_num > 0)
+        {
+            cmd->assigns = (char**) arenaAlloc(execArena, sizeof(char*) * (cmd->assign_num + 1));
+            memcpy(cmd->assigns, parsed->cmds[cmd_idx]->assigns, sizeof(char*) * (cmd->assign_num + 1));
+        }
+        ret->cmds[cmd_idx] = cmd;
+    }
+    return ret;
+}
+
+// Expand the words of a pipeline once in the shell, then run it
+static void runPipeline(Command_handler* parsed)
+{
+    ArenaMark mark = arenaMark(execArena);
+    Command_handler* cmd_hdr = copyPipeline(parsed);
+    int cmd_idx;
+
+    resetExpander(&expander, execArena);
+    for (cmd_idx = 0 ; cmd_idx < cmd_hdr->cmd_num ; cmd_idx ++)
+    {
+        Command* cmd = cmd_hdr->cmds[cmd_idx];
+        if (expandCommand(&expander, cmd) == -1)
+            break;
+        if (cmd->arg_num == 0 && cmd->compound == NULL && (cmd->assign_num == 0 || cmd_hdr->cmd_num > 1))
+        {
+            fprintf(stderr, "tsh: empty command\n");
+            break;
+        }
+    }
+
+    if (cmd_idx != cmd_hdr->cmd_num)
+        last_status = (cmd_hdr->cmds[cmd_idx]->arg_num == 0) ? 2 : 1;
+    else if (cmd_hdr->cmd_num == 1 && cmd_hdr->cmds[0]->arg_num == 0 && cmd_hdr->cmds[0]->compound == NULL)
+    {
+        // NAME=value alone sets shell variables
+        Command* cmd = cmd_hdr->cmds[0];
+        for (cmd_idx = 0 ; cmd_idx < cmd->assign_num ; cmd_idx ++)
+            setAssignment(cmd->assigns[cmd_idx], 0);
+        last_status = 0;
+    }
+    else
+    {
+        executeCommandHandler(cmd_hdr);
+
+        // ^C on a command at the terminal stops the whole line, loops
+        // included
+        if (tsh_interactive && !cmd_hdr->isBackGround && last_status == 128 + SIGINT)
+            isAborted = 1;
+    }
+    arenaRelease(execArena, mark);
+}
+
+// After a round of a loop. Return 1 if the loop ends.
+static int endsLoop()
+{
+    if (breakCount > 0)
+    {
+        breakCount --;
+        return 1;
+    }
+    if (continueCount > 1)
+    {
+        continueCount --;
+        return 1;
+    }
+    continueCount = 0;
+    return (isReturning || isAborted);
+}
+
+static void execWhile(Node* node)
+{
+    int status = 0;
+
+    loopDepth ++;
+    while (1)
+    {
+        execList(node->cond);
+        if (isUnwinding())
+        {
+            if (endsLoop())
+                break;
+            continue;
+        }
+        if ((last_status == 0) != (node->type == NODE_WHILE))
+            break;
+        execList(node->body);
+        status = last_status;
+        if (endsLoop())
+            break;
+    }
+    loopDepth --;
+    last_status = status;
+}
+
+static void execFor(Node* node)
+{
+    ArenaMark mark = arenaMark(execArena);
+    char** values;
+    int value_num, idx;
+    int status = 0;
+
+    // The words are expanded once, before the first round. shift in
+    // the body does not change "$@" under the loop.
+    if (node->words == NULL)
+    {
+        value_num = positional.num;
+        values = (char**) arenaAlloc(execArena, sizeof(char*) * (value_num + 1));
+        memcpy(values, positional.args + 1, sizeof(char*) * (value_num + 1));
+    }
+    else
+    {
+        resetExpander(&expander, execArena);
+        if (expandWords(&expander, node->words, node->word_num, &values, &value_num) == -1)
+        {
+            arenaRelease(execArena, mark);
+            last_status = 1;
+            return;
+        }
+    }
+
+    loopDepth ++;
+    for (idx = 0 ; idx < value_num ; idx ++)
+    {
+        setVar(node->name, values[idx], 0);
+        execList(node->body);
+        status = last_status;
+        if (endsLoop())
+            break;
+    }
+    loopDepth --;
+    arenaRelease(execArena, mark);
+    last_status = status;
+}
+
+static void execNode(Node* node)
+{
+    switch (node->type)
+    {
+        case NODE_PIPELINE:
+            runPipeline(node->pipeline);
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            execNode(node->cond);
+            if (!isUnwinding() && (last_status == 0) == (node->type == NODE_AND))
+                execNode(node->body);
+            break;
+        case NODE_IF:
+            execList(node->cond);
+            if (isUnwinding())
+                break;
+            if (last_status == 0)
+                execList(node->body);
+            else if (node->orElse != NULL)
+                execList(node->orElse);
+            else
+                last_status = 0;
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            execWhile(node);
+            break;
+        case NODE_FOR:
+            execFor(node);
+            break;
+        case NODE_GROUP:
+            execList(node->body);
+            break;
+        case NODE_FUNCTION:
+            last_status = (defineFunction(node->text, node->text_len) == -1) ? 1 : 0;
+            break;
+    }
+    if (node->isNegated)
+        last_status = !last_status;
+}
+
+static void execList(Node* list)
+{
+    for ( ; list != NULL && !isUnwinding() ; list = list->next)
+        execNode(list);
+}
+
+// Run a compound command which is a stage of a pipeline, in the shell
+// or in the forked copy running the stage. Return its status.
+//
+int execCompound(Node* node)
+{
+    execNode(node);
+    return last_status;
+}
+
+// Run a parsed program, its commands expanded in the given arena
+void execProgram(Node* program, Arena* arena)
+{
+    Arena* saved = execArena;
+
+    execArena = arena;
+    execDepth ++;
+    execList(program);
+    execDepth --;
+    execArena = saved;
+
+    // Nothing is left to unwind once the line is done
+    if (execDepth == 0)
+    {
+        breakCount = 0;
+        continueCount = 0;
+        isReturning = 0;
+        isAborted = 0;
+    }
+}
+
+/* Functions */
+
+// Return the index of name, or -(insertion point) - 1 if it is missing
+static int searchFunction(const char* name)
+{
+    int low = 0, high = functionTable.func_num - 1;
+
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        int cmp = strcmp(functionTable.funcs[mid]->name, name);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return -low - 1;
+}
+
+Function* findFunction(const char* name)
+{
+    int idx = searchFunction(name);
+    return (idx >= 0) ? functionTable.funcs[idx] : NULL;
+}
+
+static void freeFunction(Function* func)
+{
+    arenaFree(&func->arena);
+    free (func->text);
+    free (func);
+}
+
+// Define a function from its definition as written. Its body is parsed
+// into an arena of its own, which lives as long as the function. Return
+// 0, or -1 if the text is not a function definition.
+//
+int defineFunction(const char* text, size_t len)
+{
+    Function* func = (Function*) malloc(sizeof(Function));
+    Node* program;
+    int idx;
+
+    func->text = (char*) malloc(len + 1);
+    memcpy(func->text, text, len);
+    func->text[len] = '\0';
+    arenaInit(&func->arena, 1024);
+    func->active = 0;
+    func->isRetired = 0;
+    if (parseProgram(func->text, len, &func->arena, &program) != 0 ||
+        program == NULL || program->type != NODE_FUNCTION || program->next != NULL)
+    {
+        fprintf(stderr, "tsh: bad function definition\n");
+        freeFunction(func);
+        return -1;
+    }
+    func->name = program->name;
+    func->body = program->body;
+
+    if ((idx = searchFunction(func->name)) >= 0)
+    {
+        // A function may redefine itself, the old body stays until it returns
+        Function* old = functionTable.funcs[idx];
+        if (old->active > 0)
+            old->isRetired = 1;
+        else
+            freeFunction(old);
+        functionTable.funcs[idx] = func;
+        return 0;
+    }
+
+    idx = -idx - 1;
+    if (functionTable.func_num == functionTable.func_cap)
+    {
+        functionTable.func_cap = functionTable.func_cap ? functionTable.func_cap * 2 : 16;
+        functionTable.funcs = (Function**) realloc(functionTable.funcs, sizeof(Function*) * functionTable.func_cap);
+    }
+    memmove(&functionTable.funcs[idx + 1], &functionTable.funcs[idx],
+            sizeof(Function*) * (functionTable.func_num - idx));
+    functionTable.funcs[idx] = func;
+    functionTable.func_num ++;
+    return 0;
+}
+
+// Run the function argv[0] with the arguments as positional parameters.
+// Return the status of its last command, or the one given to return.
+//
+int callFunction(int argc, char* argv[])
+{
+    Function* func = findFunction(argv[0]);
+    Positional saved = positional;
+    int savedLoops = loopDepth;
+
+    if (func == NULL)
+        return 127;
+    if (callDepth >= FUNC_MAX_DEPTH)
+    {
+        fprintf(stderr, "tsh: %s: too many nested calls\n", argv[0]);
+        return 1;
+    }
+
+    // $0 stays that of the shell
+    positional.num = argc - 1;
+    positional.args = argv;
+    argv[0] = saved.args[0];
+    func->active ++;
+    callDepth ++;
+    loopDepth = 0;
+
+    execNode(func->body);
+    isReturning = 0;
+
+    loopDepth = savedLoops;
+    callDepth --;
+    positional = saved;
+    argv[0] = func->name;
+    if (-- func->active == 0 && func->isRetired)
+        freeFunction(func);
+    return last_status;
+}
+
+/* Builtins */
+
+static int parseLevel(const char* name, int argc, char* argv[], int* level)
+{
+    char* end;
+
+    *level = 1;
+    if (argc > 1)
+    {
+        *level = (int) strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end != '\0' || *level < 1)
+        {
+            fprintf(stderr, "tsh: %s: %s: bad loop count\n", name, argv[1]);
+            return -1;
+        }
+    }
+    if (loopDepth == 0)
+    {
+        fprintf(stderr, "tsh: %s: only meaningful in a loop\n", name);
+        return -1;
+    }
+    if (*level > loopDepth)
+        *level = loopDepth;
+    return 0;
+}
+
+int tsh_break(int argc, char* argv[])
+{
+    int level;
+
+    if (parseLevel("break", argc, argv, &level) == -1)
+        return 1;
+    breakCount = level;
+    return 0;
+}
+
+int tsh_continue(int argc, char* argv[])
+{
+    int level;
+
+    if (parseLevel("continue", argc, argv, &level) == -1)
+        return 1;
+    continueCount = level;
+    return 0;
+}
+
+int tsh_return(int argc, char* argv[])
+{
+    char* end;
+    int status = last_status;
+
+    if (callDepth == 0)
+    {
+        fprintf(stderr, "tsh: return: only meaningful in a function\n");
+        return 1;
+    }
+    if (argc > 1)
+    {
+        status = (int) strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end != '\0')
+        {
+            fprintf(stderr, "tsh: return: %s: numeric argument required\n", argv[1]);
+            status = 2;
+        }
+    }
+    isReturning = 1;
+    return status & 0xff;
+}
+
+// Drop the first N positional parameters
+int tsh_shift(int argc, char* argv[])
+{
+    char* end;
+    long num = 1;
+
+    if (argc > 1)
+    {
+        num = strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end != '\0' || num < 0)
+        {
+            fprintf(stderr, "tsh: shift: %s: bad count\n", argv[1]);
+            return 1;
+        }
+    }
+    if (num > positional.num)
+        return 1;
+
+    // $0 stays where it is
+    if (num > 0)
+    {
+        positional.args[num] = positional.args[0];
+        positional.args += num;
+        positional.num -= num;
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef __TSH_EXEC_H__
+#define __TSH_EXEC_H__
+
+#include "tsh_arena.h"
+#include "tsh_parse.h"
+
+typedef struct Function
+{
+    char* name;
+    char* text;          // definition as written
+    Arena arena;         // holds body
+    Node* body;
+    int active;          // calls of it running now
+    int isRetired;       // replaced while running, freed by its last call
+} Function;
+
+// Functions sorted by name, looked up with a binary search
+typedef struct FunctionTable
+{
+    Function** funcs;
+    int func_num;
+    int func_cap;
+} FunctionTable;
+
+extern FunctionTable functionTable;
+extern Arena* execArena;
+
+void execProgram(Node*, Arena*);
+int execCompound(Node*);
+Function* findFunction(const char*);
+int defineFunction(const char*, size_t);
+int callFunction(int, char*[]);
+
+#endif
@@ -0,0 +1,653 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include "tsh.h"
+#include "tsh_dircache.h"
+#include "tsh_expand.h"
+#include "tsh_var.h"
+
+// Word expansion
+//
+// One pass over each word does tilde expansion, $VAR, ${VAR}, $? and $$,
+// the positional parameters $0 ... $9, ${N}, $#, $@ and $*, quote
+// removal and field splitting of unquoted expansions; every byte of
+// the result remembers whether it was quoted. Fields with unquoted
+// * ? or [ are then globbed. Glob components are matched against the
+// sorted listings of the directory cache: the literal head of a
+// component narrows the candidates by binary search, and a plain
+// "*suffix" is compared directly instead of through fnmatch(). Matches
+// come out in byte order, component by component, without sorting, and
+// a pattern seen before in the same pipeline reuses its result.
+//
+// The value of a NAME=value assignment is one field: it is neither split
+// nor globbed, and a ~ right after the = is expanded.
+//
+// Command substitution is not supported.
+//
+void initExpander(Expander* exp, Arena* arena)
+{
+    memset(exp, 0, sizeof(Expander));
+    exp->arena = arena;
+}
+
+// Start over on another pipeline or for list, keeping the scratch
+// buffers. Glob results are dropped, the directories may have changed
+// since.
+void resetExpander(Expander* exp, Arena* arena)
+{
+    exp->arena = arena;
+    exp->globs = NULL;
+    exp->field_len = 0;
+    exp->word_num = 0;
+}
+
+void freeExpander(Expander* exp)
+{
+    free (exp->field);
+    free (exp->quoted);
+    free (exp->words);
+    memset(exp, 0, sizeof(Expander));
+}
+
+static void appendChar(Expander* exp, char c, int quoted)
+{
+    if (exp->field_len + 2 > exp->field_cap)
+    {
+        exp->field_cap = exp->field_cap ? exp->field_cap * 2 : 256;
+        exp->field = (char*) realloc(exp->field, exp->field_cap);
+        exp->quoted = (unsigned char*) realloc(exp->quoted, exp->field_cap);
+    }
+    if (!quoted && (c == '*' || c == '?' || c == '['))
+        exp->hasGlob = 1;
+    exp->field[exp->field_len] = c;
+    exp->quoted[exp->field_len ++] = quoted;
+}
+
+static void appendText(Expander* exp, const char* text, int quoted)
+{
+    for ( ; *text ; text ++)
+        appendChar(exp, *text, quoted);
+}
+
+static void pushWord(Expander* exp, char* word)
+{
+    if (exp->word_num == exp->word_cap)
+    {
+        exp->word_cap = exp->word_cap ? exp->word_cap * 2 : 16;
+        exp->words = (char**) realloc(exp->words, sizeof(char*) * exp->word_cap);
+    }
+    exp->words[exp->word_num ++] = word;
+}
+
+/* Globbing */
+
+static int isGlobChar(char c)
+{
+    return (c == '*' || c == '?' || c == '[');
+}
+
+// Length of the literal head of an escaped component, unescaped into out
+static size_t literalHead(const char* comp, size_t len, char* out)
+{
+    size_t idx, out_len = 0;
+    for (idx = 0 ; idx < len && !isGlobChar(comp[idx]) ; idx ++)
+    {
+        if (comp[idx] == '\\' && idx + 1 < len)
+            idx ++;
+        out[out_len ++] = comp[idx];
+    }
+    out[out_len] = '\0';
+    return idx;
+}
+
+static char* joinPath(Expander* exp, const char* dir, const char* name, size_t name_len)
+{
+    size_t dir_len = strlen(dir);
+    int slash = (dir_len > 0 && dir[dir_len - 1] != '/');
+    char* path = (char*) arenaAlloc(exp->arena, dir_len + slash + name_len + 1);
+
+    memcpy(path, dir, dir_len);
+    if (slash)
+        path[dir_len] = '/';
+    memcpy(path + dir_len + slash, name, name_len);
+    path[dir_len + slash + name_len] = '\0';
+    return path;
+}
+
+// Match the entries of one directory against one component
+static void globDir(Expander* exp, const char* dir, const char* comp, int needDir,
+                    char*** out, int* out_num, int* out_cap)
+{
+    size_t comp_len = strlen(comp);
+    char* head = (char*) arenaAlloc(exp->arena, comp_len + 1);
+    size_t head_end = literalHead(comp, comp_len, head);
+    size_t head_len = strlen(head);
+    const char* rest = comp + head_end;
+    const char* suffix = NULL;
+    DirListing* listing;
+    int idx;
+
+    if ((listing = getDirListing(*dir ? dir : ".")) == NULL)
+        return;
+
+    // "*" or "*literal" after the head is compared without fnmatch()
+    if (rest[0] == '*' && strpbrk(rest + 1, "*?[\\") == NULL)
+        suffix = rest + 1;
+
+    for (idx = lowerBoundName(listing->names, listing->name_num, head) ; idx < listing->name_num ; idx ++)
+    {
+        const char* name = listing->names[idx];
+        size_t name_len;
+
+        if (strncmp(name, head, head_len) != 0)
+            break;
+        // Dot files only match a literal dot
+        if (name[0] == '.' && head_len == 0)
+            continue;
+
+        name_len = strlen(name);
+        if (suffix != NULL)
+        {
+            size_t suffix_len = strlen(suffix);
+            if (name_len < head_len + suffix_len ||
+                memcmp(name + name_len - suffix_len, suffix, suffix_len) != 0)
+                continue;
+        }
+        else if (fnmatch(comp, name, FNM_PERIOD) != 0)
+            continue;
+        if (needDir && !isListedDir(listing, idx))
+            continue;
+
+        if (*out_num == *out_cap)
+        {
+            *out_cap *= 2;
+            *out = (char**) realloc(*out, sizeof(char*) * *out_cap);
+        }
+        (*out)[(*out_num) ++] = joinPath(exp, dir, name, name_len);
+    }
+}
+
+// Expand an escaped pattern into the matching paths
+static GlobResult* globPattern(Expander* exp, const char* pattern)
+{
+    GlobResult* result;
+    char** paths;
+    int path_num = 1, path_cap = 16;
+    const char* comp = pattern;
+    int isGlobbed = 0;
+
+    for (result = exp->globs ; result ; result = result->next)
+        if (strcmp(result->pattern, pattern) == 0)
+            return result;
+
+    paths = (char**) malloc(sizeof(char*) * path_cap);
+    paths[0] = (pattern[0] == '/') ? "/" : "";
+
+    while (*comp && path_num > 0)
+    {
+        const char* end;
+        char* part;
+        int hasMeta = 0;
+        int isLastDir;
+        int idx;
+
+        while (*comp == '/')
+            comp ++;
+        if (*comp == '\0')
+            break;
+        for (end = comp ; *end && *end != '/' ; end ++)
+        {
+            if (*end == '\\' && end[1])
+                end ++;
+            else if (isGlobChar(*end))
+                hasMeta = 1;
+        }
+        part = arenaStrndup(exp->arena, comp, end - comp);
+        // Inner components, and a last one followed by '/', are directories
+        isLastDir = (*end == '/');
+
+        if (hasMeta)
+        {
+            char** next = (char**) malloc(sizeof(char*) * 16);
+            int next_num = 0, next_cap = 16;
+
+            for (idx = 0 ; idx < path_num ; idx ++)
+                globDir(exp, paths[idx], part, isLastDir, &next, &next_num, &next_cap);
+            free (paths);
+            paths = next;
+            path_num = next_num;
+            path_cap = next_cap;
+            isGlobbed = 1;
+        }
+        else
+        {
+            char* head = (char*) arenaAlloc(exp->arena, end - comp + 1);
+            int num = 0;
+
+            literalHead(part, end - comp, head);
+            for (idx = 0 ; idx < path_num ; idx ++)
+            {
+                struct stat st;
+                char* path = joinPath(exp, paths[idx], head, strlen(head));
+
+                // Names under globbed directories must exist
+                if (isGlobbed && lstat(path, &st) == -1)
+                    continue;
+                paths[num ++] = path;
+            }
+            path_num = num;
+        }
+        comp = end;
+    }
+
+    // A trailing '/' stays on the matches
+    if (pattern[strlen(pattern) - 1] == '/')
+    {
+        int idx;
+        for (idx = 0 ; idx < path_num ; idx ++)
+            paths[idx] = joinPath(exp, paths[idx], "", 0);
+    }
+
+    result = (GlobResult*) arenaAlloc(exp->arena, sizeof(GlobResult));
+    result->pattern = arenaStrndup(exp->arena, pattern, strlen(pattern));
+    result->match_num = path_num;
+    result->matches = (char**) arenaAlloc(exp->arena, sizeof(char*) * (path_num ? path_num : 1));
+    memcpy(result->matches, paths, sizeof(char*) * path_num);
+    result->next = exp->globs;
+    exp->globs = result;
+    free (paths);
+    return result;
+}
+
+// Close the field being built and add it to the word list
+static void finishField(Expander* exp)
+{
+    if (exp->field_len == 0 && !exp->hasQuotes)
+        return;
+
+    if (exp->isAssignment)
+        exp->hasGlob = 0;
+
+    // A '[' without a closing ']' is taken literally, like the [ command
+    if (exp->hasGlob)
+    {
+        size_t idx;
+        int isOpen = 0;
+
+        exp->hasGlob = 0;
+        for (idx = 0 ; idx < exp->field_len && !exp->hasGlob ; idx ++)
+        {
+            if (exp->quoted[idx])
+                continue;
+            if (exp->field[idx] == '*' || exp->field[idx] == '?' || (isOpen && exp->field[idx] == ']'))
+                exp->hasGlob = 1;
+            else if (exp->field[idx] == '[')
+                isOpen = 1;
+        }
+    }
+
+    if (exp->hasGlob)
+    {
+        // Quoted glob characters are escaped for the matcher
+        char* pattern = (char*) malloc(exp->field_len * 2 + 1);
+        size_t idx, len = 0;
+        GlobResult* result;
+
+        for (idx = 0 ; idx < exp->field_len ; idx ++)
+        {
+            if (exp->quoted[idx] && strchr("*?[]\\", exp->field[idx]) != NULL)
+                pattern[len ++] = '\\';
+            pattern[len ++] = exp->field[idx];
+        }
+        pattern[len] = '\0';
+
+        result = globPattern(exp, pattern);
+        free (pattern);
+        if (result->match_num > 0)
+        {
+            for (idx = 0 ; idx < (size_t) result->match_num ; idx ++)
+                pushWord(exp, result->matches[idx]);
+            goto done;
+        }
+    }
+    pushWord(exp, arenaStrndup(exp->arena, exp->field, exp->field_len));
+
+done:
+    exp->field_len = 0;
+    exp->hasQuotes = 0;
+    exp->hasGlob = 0;
+}
+
+/* Parameters */
+
+static int isNameChar(char c, int first)
+{
+    return (c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (!first && c >= '0' && c <= '9'));
+}
+
+// $N, NULL if it is not set
+static const char* getPositional(const char* p, size_t len)
+{
+    long idx = 0;
+    size_t pos;
+
+    for (pos = 0 ; pos < len ; pos ++)
+    {
+        idx = idx * 10 + (p[pos] - '0');
+        if (idx > positional.num)
+            return NULL;
+    }
+    return positional.args[idx];
+}
+
+// Parse a parameter after '$'. Return its value, or NULL if it is unset;
+// *end is set past the parameter, or to NULL on a syntax error.
+//
+static const char* expandParameter(const char* p, const char** end, char* number)
+{
+    char name[256];
+    size_t len = 0;
+
+    if (*p == '?' || *p == '$' || *p == '#')
+    {
+        snprintf(number, 16, "%d", (*p == '?') ? last_status : (*p == '$') ? tsh_pid : positional.num);
+        *end = p + 1;
+        return number;
+    }
+    if (*p >= '0' && *p <= '9')
+    {
+        *end = p + 1;
+        return getPositional(p, 1);
+    }
+
+    if (*p == '{')
+    {
+        const char* close = strchr(p, '}');
+        if (close == NULL || close == p + 1 || (size_t) (close - p - 1) >= sizeof(name))
+        {
+            *end = NULL;
+            return NULL;
+        }
+        if ((p[1] == '?' || p[1] == '$' || p[1] == '#') && close == p + 2)
+        {
+            expandParameter(p + 1, end, number);
+            *end = close + 1;
+            return number;
+        }
+        if (p[1] >= '0' && p[1] <= '9')
+        {
+            for (len = 1 ; p + 1 + len < close ; len ++)
+            {
+                if (p[1 + len] < '0' || p[1 + len] > '9')
+                {
+                    *end = NULL;
+                    return NULL;
+                }
+            }
+            *end = close + 1;
+            return getPositional(p + 1, len);
+        }
+        for (len = 0 ; p + 1 + len < close ; len ++)
+        {
+            if (!isNameChar(p[1 + len], len == 0))
+            {
+                *end = NULL;
+                return NULL;
+            }
+            name[len] = p[1 + len];
+        }
+        name[len] = '\0';
+        *end = close + 1;
+        return getVar(name);
+    }
+
+    while (isNameChar(p[len], len == 0) && len + 1 < sizeof(name))
+    {
+        name[len] = p[len];
+        len ++;
+    }
+    name[len] = '\0';
+    *end = p + len;
+    return getVar(name);
+}
+
+// Append the value of an unquoted expansion, splitting it on blanks
+static void appendSplit(Expander* exp, const char* value)
+{
+    for ( ; *value ; value ++)
+    {
+        if (*value == ' ' || *value == '\t' || *value == '\n')
+            finishField(exp);
+        else
+            appendChar(exp, *value, 0);
+    }
+}
+
+// $@ and $*: "$@" is a field per parameter, "$*" a single field with
+// all of them, and unquoted both are split
+//
+static void expandAllPositional(Expander* exp, int isSeparate, int isQuoted)
+{
+    int idx;
+
+    if (positional.num == 0 && isSeparate && exp->field_len == 0)
+        exp->hasQuotes = 0;
+    for (idx = 1 ; idx <= positional.num ; idx ++)
+    {
+        if (idx > 1)
+        {
+            if (isSeparate)
+            {
+                finishField(exp);
+                exp->hasQuotes = 1;
+            }
+            else if (isQuoted)
+                appendChar(exp, ' ', 1);
+            else
+                finishField(exp);
+        }
+        if (isQuoted)
+            appendText(exp, positional.args[idx], 1);
+        else
+            appendSplit(exp, positional.args[idx]);
+    }
+}
+
+// ~ or ~user at the start of a word, up to the first '/'
+static const char* expandTilde(Expander* exp, const char* word)
+{
+    const char* end = word + 1;
+    const char* home = NULL;
+    char user[256];
+
+    while (*end && *end != '/')
+    {
+        if (!isNameChar(*end, 0) && *end != '-' && *end != '.')
+            return word;
+        end ++;
+    }
+
+    if (end == word + 1)
+        home = getVar("HOME");
+    else if ((size_t) (end - word - 1) < sizeof(user))
+    {
+        struct passwd* pw;
+        memcpy(user, word + 1, end - word - 1);
+        user[end - word - 1] = '\0';
+        if ((pw = getpwnam(user)) != NULL)
+            home = pw->pw_dir;
+    }
+
+    if (home == NULL)
+        return word;
+    appendText(exp, home, 1);
+    return end;
+}
+
+// Expand one word into zero or more fields. Return -1 on error.
+static int expandWord(Expander* exp, const char* word)
+{
+    const char* p = word;
+    int inDouble = 0;
+
+    exp->field_len = 0;
+    exp->hasQuotes = 0;
+    exp->hasGlob = 0;
+
+    if (exp->isAssignment)
+    {
+        const char* eq = strchr(p, '=') + 1;
+        while (p < eq)
+            appendChar(exp, *p ++, 1);
+    }
+    if (*p == '~')
+        p = expandTilde(exp, p);
+
+    while (*p)
+    {
+        if (*p == '\'' && !inDouble)
+        {
+            const char* close = strchr(p + 1, '\'');
+            if (close == NULL)
+                close = p + strlen(p);
+            exp->hasQuotes = 1;
+            for (p ++ ; p < close ; p ++)
+                appendChar(exp, *p, 1);
+            if (*p)
+                p ++;
+        }
+        else if (*p == '"')
+        {
+            // Only the opening quote counts: "$@" with no parameters is
+            // no field at all
+            inDouble = !inDouble;
+            if (inDouble)
+                exp->hasQuotes = 1;
+            p ++;
+        }
+        else if (*p == '\\' && p[1] == '\n')
+            p += 2;  // line continuation
+        else if (*p == '\\' && p[1])
+        {
+            // Inside "" only a few characters are escaped, before the
+            // others the backslash stays
+            if (inDouble && strchr("$`\"\\\n", p[1]) == NULL)
+                appendChar(exp, '\\', 1);
+            p ++;
+            appendChar(exp, *p ++, 1);
+        }
+        else if (*p == '`' || (p[0] == '$' && p[1] == '('))
+        {
+            fprintf(stderr, "tsh: %s: command substitution is not supported\n", word);
+            return -1;
+        }
+        else if (*p == '$' && (p[1] == '@' || p[1] == '*'))
+        {
+            expandAllPositional(exp, p[1] == '@' && inDouble, inDouble || exp->isAssignment);
+            p += 2;
+        }
+        else if (*p == '$' && (p[1] == '{' || p[1] == '?' || p[1] == '$' || p[1] == '#' ||
+                 (p[1] >= '0' && p[1] <= '9') || isNameChar(p[1], 1)))
+        {
+            char number[16];
+            const char* end;
+            const char* value = expandParameter(p + 1, &end, number);
+
+            if (end == NULL)
+            {
+                fprintf(stderr, "tsh: %s: bad substitution\n", word);
+                return -1;
+            }
+            if (value != NULL)
+            {
+                if (inDouble || exp->isAssignment)
+                    appendText(exp, value, 1);
+                else
+                    appendSplit(exp, value);
+            }
+            p = end;
+        }
+        else
+            appendChar(exp, *p ++, inDouble);
+    }
+
+    finishField(exp);
+    return 0;
+}
+
+// Expand a list of words. The result is NULL terminated and lives in
+// the arena. Return -1 on error.
+//
+int expandWords(Expander* exp, char** words, int word_num, char*** result, int* result_num)
+{
+    int idx;
+
+    exp->word_num = 0;
+    for (idx = 0 ; idx < word_num ; idx ++)
+        if (expandWord(exp, words[idx]) == -1)
+            return -1;
+
+    *result = (char**) arenaAlloc(exp->arena, sizeof(char*) * (exp->word_num + 1));
+    memcpy(*result, exp->words, sizeof(char*) * exp->word_num);
+    (*result)[exp->word_num] = NULL;
+    *result_num = exp->word_num;
+    return 0;
+}
+
+// A redirection needs exactly one word
+static int expandFileName(Expander* exp, char** file)
+{
+    char** words;
+    int word_num;
+
+    if (*file == NULL)
+        return 0;
+    if (expandWords(exp, file, 1, &words, &word_num) == -1)
+        return -1;
+    if (word_num != 1)
+    {
+        fprintf(stderr, "tsh: %s: ambiguous redirect\n", *file);
+        return -1;
+    }
+    *file = words[0];
+    return 0;
+}
+
+// Expand NAME=value words in place, one field each
+static int expandAssignments(Expander* exp, char** assigns, int assign_num)
+{
+    int idx;
+
+    exp->isAssignment = 1;
+    for (idx = 0 ; idx < assign_num ; idx ++)
+    {
+        exp->word_num = 0;
+        if (expandWord(exp, assigns[idx]) == -1)
+        {
+            exp->isAssignment = 0;
+            return -1;
+        }
+        assigns[idx] = exp->words[0];
+    }
+    exp->isAssignment = 0;
+    return 0;
+}
+
+// Expand the assignments, the arguments and the redirections of a
+// command in place
+int expandCommand(Expander* exp, Command* cmd)
+{
+    if (expandAssignments(exp, cmd->assigns, cmd->assign_num) == -1 ||
+        expandWords(exp, cmd->args, cmd->arg_num, &cmd->args, &cmd->arg_num) == -1 ||
+        expandFileName(exp, &cmd->inputFile) == -1 ||
+        expandFileName(exp, &cmd->outputFile) == -1)
+        return -1;
+
+    cmd->isPath = (cmd->arg_num > 0 && strchr(cmd->args[0], '/') != NULL);
+    return 0;
+}
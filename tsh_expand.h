@@ -0,0 +1,44 @@
+#ifndef __TSH_EXPAND_H__
+#define __TSH_EXPAND_H__
+
+#include <stddef.h>
+#include "tsh.h"
+#include "tsh_arena.h"
+
+// Result of one glob pattern, kept for the rest of the pipeline
+typedef struct GlobResult
+{
+    char* pattern;
+    int match_num;
+    char** matches;
+    struct GlobResult* next;
+} GlobResult;
+
+// Expansion of the words of one pipeline. Results are allocated from
+// the arena of the line; the scratch buffers are released by
+// freeExpander().
+typedef struct Expander
+{
+    Arena* arena;
+    GlobResult* globs;
+
+    char* field;          // field being built
+    unsigned char* quoted;  // per byte of field: 1 if it came from quotes
+    size_t field_len;
+    size_t field_cap;
+    int hasQuotes;        // "" makes an empty field
+    int hasGlob;
+    int isAssignment;     // expanding the value of NAME=value
+
+    char** words;         // fields of the word list being expanded
+    int word_num;
+    int word_cap;
+} Expander;
+
+void initExpander(Expander*, Arena*);
+void resetExpander(Expander*, Arena*);
+void freeExpander(Expander*);
+int expandWords(Expander*, char**, int, char***, int*);
+int expandCommand(Expander*, Command*);
+
+#endif
@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tsh_hash.h"
+#include "tsh_var.h"
+
+// Command hash
+//
+// Every directory of $PATH is scanned once and its names are kept in
+// memory. The lookup table is built from those lists, with the earlier
+// directory winning like execvp() does. Before each lookup we check that
+// $PATH is unchanged and that no directory has a new mtime; only the
+// directories which really changed are read again.
+//
+CommandHash commandHash;
+
+static unsigned int hashName(const char* name)
+{
+    unsigned int h = 2166136261u;
+    while (*name)
+    {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void freePathDir(PathDir* dir)
+{
+    free (dir->path);
+    free (dir->names);
+    free (dir->name_pool);
+    memset(dir, 0, sizeof(PathDir));
+}
+
+static void freeEntries()
+{
+    int idx;
+    for (idx = 0 ; idx < commandHash.bucket_num ; idx ++)
+    {
+        CommandEntry* entry = commandHash.buckets[idx];
+        while (entry)
+        {
+            CommandEntry* next = entry->next;
+            free (entry->fullPath);
+            free (entry);
+            entry = next;
+        }
+    }
+    free (commandHash.buckets);
+    commandHash.buckets = NULL;
+    commandHash.bucket_num = 0;
+    commandHash.entry_num = 0;
+}
+
+static int getDirMtime(const char* path, struct timespec* mtime)
+{
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+        return -1;
+    *mtime = st.st_mtim;
+    return 0;
+}
+
+static void scanPathDir(PathDir* dir)
+{
+    DIR* dp;
+    struct dirent* entry;
+    int pool_len = 0, pool_cap = 1024;
+    int name_cap = 64;
+    int idx;
+    int* offsets;
+
+    free (dir->names);
+    free (dir->name_pool);
+    dir->names = NULL;
+    dir->name_pool = NULL;
+    dir->name_num = 0;
+    dir->isValid = 0;
+
+    if (getDirMtime(dir->path, &dir->mtime) == -1)
+        return;
+    if ((dp = opendir(dir->path)) == NULL)
+        return;
+
+    dir->name_pool = (char*) malloc(pool_cap);
+    offsets = (int*) malloc(sizeof(int) * name_cap);
+    while ((entry = readdir(dp)) != NULL)
+    {
+        int len;
+        if (entry->d_name[0] == '.')
+            continue;
+        if (entry->d_type == DT_DIR)
+            continue;
+
+        len = strlen(entry->d_name) + 1;
+        if (pool_len + len > pool_cap)
+        {
+            while (pool_len + len > pool_cap)
+                pool_cap *= 2;
+            dir->name_pool = (char*) realloc(dir->name_pool, pool_cap);
+        }
+        if (dir->name_num == name_cap)
+        {
+            name_cap *= 2;
+            offsets = (int*) realloc(offsets, sizeof(int) * name_cap);
+        }
+        memcpy(dir->name_pool + pool_len, entry->d_name, len);
+        offsets[dir->name_num ++] = pool_len;
+        pool_len += len;
+    }
+    closedir(dp);
+
+    // The pool may have moved while growing, so pointers are set at the end
+    dir->names = (char**) malloc(sizeof(char*) * (dir->name_num + 1));
+    for (idx = 0 ; idx < dir->name_num ; idx ++)
+        dir->names[idx] = dir->name_pool + offsets[idx];
+    dir->names[dir->name_num] = NULL;
+    free (offsets);
+    dir->isValid = 1;
+}
+
+static CommandEntry* findEntry(const char* name, unsigned int h)
+{
+    CommandEntry* entry;
+    if (commandHash.bucket_num == 0)
+        return NULL;
+
+    entry = commandHash.buckets[h & (commandHash.bucket_num - 1)];
+    while (entry)
+    {
+        if (strcmp(entry->name, name) == 0)
+            return entry;
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static void buildEntries()
+{
+    int total = 0;
+    int idxDir, idxName;
+
+    freeEntries();
+    commandHash.generation ++;
+
+    for (idxDir = 0 ; idxDir < commandHash.dir_num ; idxDir ++)
+        total += commandHash.dirs[idxDir].name_num;
+
+    commandHash.bucket_num = 64;
+    while (commandHash.bucket_num < total)
+        commandHash.bucket_num *= 2;
+    commandHash.buckets = (CommandEntry**) calloc(commandHash.bucket_num, sizeof(CommandEntry*));
+
+    for (idxDir = 0 ; idxDir < commandHash.dir_num ; idxDir ++)
+    {
+        PathDir* dir = &commandHash.dirs[idxDir];
+        for (idxName = 0 ; idxName < dir->name_num ; idxName ++)
+        {
+            unsigned int h = hashName(dir->names[idxName]);
+            CommandEntry* entry;
+
+            // The first directory in $PATH takes precedence
+            if (findEntry(dir->names[idxName], h) != NULL)
+                continue;
+
+            entry = (CommandEntry*) malloc(sizeof(CommandEntry));
+            entry->name = dir->names[idxName];
+            entry->dir_idx = idxDir;
+            entry->hits = 0;
+            entry->fullPath = NULL;
+            entry->next = commandHash.buckets[h & (commandHash.bucket_num - 1)];
+            commandHash.buckets[h & (commandHash.bucket_num - 1)] = entry;
+            commandHash.entry_num ++;
+        }
+    }
+}
+
+// Split $PATH into directories, reusing the listings of
+// directories which were already part of the old $PATH.
+//
+static void loadPath(const char* path_env)
+{
+    PathDir* old_dirs = commandHash.dirs;
+    int old_num = commandHash.dir_num;
+    char* path = strdup(path_env);
+    char* remainStr;
+    char* subPath;
+    int cap = 8;
+    int idx;
+
+    commandHash.dirs = (PathDir*) calloc(cap, sizeof(PathDir));
+    commandHash.dir_num = 0;
+
+    subPath = strtok_r(path, ":", &remainStr);
+    while (subPath != NULL)
+    {
+        PathDir* dir;
+        if (commandHash.dir_num == cap)
+        {
+            cap *= 2;
+            commandHash.dirs = (PathDir*) realloc(commandHash.dirs, sizeof(PathDir) * cap);
+        }
+        dir = &commandHash.dirs[commandHash.dir_num ++];
+        memset(dir, 0, sizeof(PathDir));
+
+        for (idx = 0 ; idx < old_num ; idx ++)
+        {
+            if (old_dirs[idx].path && strcmp(old_dirs[idx].path, subPath) == 0)
+            {
+                *dir = old_dirs[idx];
+                memset(&old_dirs[idx], 0, sizeof(PathDir));
+                break;
+            }
+        }
+        if (dir->path == NULL)
+        {
+            dir->path = strdup(subPath);
+            scanPathDir(dir);
+        }
+
+        subPath = strtok_r(NULL, ":", &remainStr);
+    }
+
+    for (idx = 0 ; idx < old_num ; idx ++)
+        freePathDir(&old_dirs[idx]);
+    free (old_dirs);
+    free (path);
+
+    free (commandHash.path_env);
+    commandHash.path_env = strdup(path_env);
+}
+
+// return 1 if the table was rebuilt
+int validateCommandHash()
+{
+    const char* path_env = getVar("PATH");
+    int changed = 0;
+    int idx;
+
+    if (path_env == NULL)
+        path_env = "";
+
+    if (commandHash.path_env == NULL || strcmp(commandHash.path_env, path_env) != 0)
+    {
+        loadPath(path_env);
+        changed = 1;
+    }
+    else
+    {
+        for (idx = 0 ; idx < commandHash.dir_num ; idx ++)
+        {
+            PathDir* dir = &commandHash.dirs[idx];
+            struct timespec mtime;
+            int exist = (getDirMtime(dir->path, &mtime) == 0);
+
+            if (exist != dir->isValid ||
+                (exist && (mtime.tv_sec != dir->mtime.tv_sec || mtime.tv_nsec != dir->mtime.tv_nsec)))
+            {
+                scanPathDir(dir);
+                changed = 1;
+            }
+        }
+    }
+
+    // A table loaded from a snapshot has its listings but no entries yet
+    if (changed || commandHash.buckets == NULL)
+        buildEntries();
+    return changed;
+}
+
+static int isExecutable(const char* path)
+{
+    struct stat st;
+    return (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0);
+}
+
+// Return the absolute path of the given command, or NULL if it can
+// not be found in $PATH. The string is valid until the next lookup.
+//
+// Like execvp(), a name which is not an executable file gives way to
+// the same name further in $PATH. If there is none, the first one is
+// returned all the same, and fails to run with EACCES.
+//
+char* findSystemCommand(const char* cmd_name)
+{
+    static char* fallback;
+    CommandEntry* entry;
+    int idx;
+
+    free (fallback);
+    fallback = NULL;
+
+    validateCommandHash();
+    if ((entry = findEntry(cmd_name, hashName(cmd_name))) == NULL)
+        return NULL;
+
+    if (entry->fullPath == NULL)
+    {
+        const char* dir = commandHash.dirs[entry->dir_idx].path;
+        int len = strlen(dir) + strlen(entry->name) + 2;
+        entry->fullPath = (char*) malloc(len);
+        snprintf(entry->fullPath, len, "%s/%s", dir, entry->name);
+    }
+    entry->hits ++;
+    if (isExecutable(entry->fullPath))
+        return entry->fullPath;
+
+    for (idx = entry->dir_idx + 1 ; idx < commandHash.dir_num ; idx ++)
+    {
+        const char* dir = commandHash.dirs[idx].path;
+        int len = strlen(dir) + strlen(cmd_name) + 2;
+        fallback = (char*) realloc(fallback, len);
+        snprintf(fallback, len, "%s/%s", dir, cmd_name);
+        if (isExecutable(fallback))
+            return fallback;
+    }
+    return entry->fullPath;
+}
+
+void clearCommandHash()
+{
+    int generation = commandHash.generation;
+    int idx;
+    freeEntries();
+    for (idx = 0 ; idx < commandHash.dir_num ; idx ++)
+        freePathDir(&commandHash.dirs[idx]);
+    free (commandHash.dirs);
+    free (commandHash.path_env);
+    memset(&commandHash, 0, sizeof(CommandHash));
+    commandHash.generation = generation;
+}
+
+void rehashCommandHash()
+{
+    clearCommandHash();
+    validateCommandHash();
+}
+
+void listCommandHash()
+{
+    int idx;
+    int used = 0;
+
+    validateCommandHash();
+    for (idx = 0 ; idx < commandHash.bucket_num ; idx ++)
+    {
+        CommandEntry* entry;
+        for (entry = commandHash.buckets[idx] ; entry ; entry = entry->next)
+        {
+            if (entry->hits == 0)
+                continue;
+            printf("%d\t%s/%s\n", entry->hits, commandHash.dirs[entry->dir_idx].path, entry->name);
+            used ++;
+        }
+    }
+    printf("tsh: %d commands hashed from %d directories, %d used\n",
+           commandHash.entry_num, commandHash.dir_num, used);
+}
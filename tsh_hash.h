@@ -0,0 +1,46 @@
+#ifndef __TSH_HASH_H__
+#define __TSH_HASH_H__
+
+#include <time.h>
+
+// One directory of $PATH together with the names it contained
+// the last time it was scanned.
+typedef struct PathDir
+{
+    char* path;
+    struct timespec mtime;
+    int isValid;      // 0 if the directory could not be opened
+    int name_num;
+    char** names;
+    char* name_pool;  // all the names in one buffer
+} PathDir;
+
+typedef struct CommandEntry
+{
+    char* name;
+    int dir_idx;
+    int hits;
+    char* fullPath;   // built on the first hit
+    struct CommandEntry* next;
+} CommandEntry;
+
+typedef struct CommandHash
+{
+    char* path_env;   // $PATH the table was built from
+    int dir_num;
+    PathDir* dirs;
+    int bucket_num;
+    CommandEntry** buckets;
+    int entry_num;
+    int generation;   // bumped every time the entries are rebuilt
+} CommandHash;
+
+extern CommandHash commandHash;
+
+char* findSystemCommand(const char*);
+int validateCommandHash();
+void clearCommandHash();
+void rehashCommandHash();
+void listCommandHash();
+
+#endif
@@ -0,0 +1,506 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include "tsh_history.h"
+#include "tsh_var.h"
+
+// Command history
+//
+// Every session appends to the same memory-mapped ring file under an
+// exclusive flock(), and reads it under a shared one. A session keeps the
+// positions of the records it has seen; new records of other sessions are
+// picked up by syncHistory(). Reverse search goes through a trigram index
+// over the distinct commands, which is built on the first search and then
+// kept up to date incrementally.
+//
+#define HIST_MAGIC "TSHHIST1"
+#define HIST_DATA_SIZE ((uint64_t) 64 << 20)
+#define GRAM_EMPTY 0xffffffffu
+
+History history = { .fd = -1 };
+
+static uint64_t alignRecord(uint64_t len)
+{
+    return (len + 7) & ~(uint64_t) 7;
+}
+
+static HistRecord* recordAt(uint64_t pos)
+{
+    return (HistRecord*) (history.data + pos % history.header->cap);
+}
+
+int openHistory(const char* path)
+{
+    HistHeader header;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR)) == -1)
+        return -1;
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) == -1)
+        goto fail;
+
+    if (st.st_size == 0)
+    {
+        // New file, the data area stays sparse until it is written
+        memset(&header, 0, sizeof(HistHeader));
+        memcpy(header.magic, HIST_MAGIC, 8);
+        header.cap = HIST_DATA_SIZE;
+        header.seq = 1;
+        if (ftruncate(fd, sizeof(HistHeader) + header.cap) == -1 ||
+            pwrite(fd, &header, sizeof(HistHeader), 0) != sizeof(HistHeader))
+            goto fail;
+    }
+    else if (pread(fd, &header, sizeof(HistHeader), 0) != sizeof(HistHeader) ||
+             memcmp(header.magic, HIST_MAGIC, 8) != 0 || header.cap % 8 != 0 ||
+             (uint64_t) st.st_size != sizeof(HistHeader) + header.cap)
+    {
+        fprintf(stderr, "tsh: %s: not a history file\n", path);
+        goto fail;
+    }
+
+    history.map_size = sizeof(HistHeader) + header.cap;
+    history.header = (HistHeader*) mmap(NULL, history.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (history.header == MAP_FAILED)
+    {
+        history.header = NULL;
+        goto fail;
+    }
+    history.data = (char*) (history.header + 1);
+    history.fd = fd;
+    history.synced = history.header->head;  // read on the first use
+    flock(fd, LOCK_UN);
+    return 0;
+
+fail:
+    flock(fd, LOCK_UN);
+    close(fd);
+    return -1;
+}
+
+// $TSH_HISTFILE, or ~/.tsh_history
+int openDefaultHistory()
+{
+    char path[4096];
+    const char* file = getVar("TSH_HISTFILE");
+    const char* home = getVar("HOME");
+
+    if (history.header != NULL)
+        return 0;
+    if (file == NULL || *file == '\0')
+    {
+        if (home == NULL)
+            return -1;
+        snprintf(path, sizeof(path), "%s/.tsh_history", home);
+        file = path;
+    }
+    return openHistory(file);
+}
+
+void addHistory(const char* cmd, const char* cwd, int64_t time, int status)
+{
+    HistHeader* header = history.header;
+    HistRecord* rec;
+    uint64_t cmd_len = strlen(cmd), cwd_len = strlen(cwd);
+    uint64_t len = alignRecord(sizeof(HistRecord) + cmd_len + cwd_len + 2);
+    uint64_t pos, end;
+
+    if (header == NULL || len > header->cap / 4)
+        return;
+
+    flock(history.fd, LOCK_EX);
+
+    // A record never wraps around, the rest of the lap is skipped instead
+    pos = header->tail;
+    if (pos % header->cap + len > header->cap)
+        pos += header->cap - pos % header->cap;
+    end = pos + len;
+
+    // Evict the records about to be overwritten
+    while (header->head < header->tail && header->head + header->cap < end)
+    {
+        HistRecord* old = recordAt(header->head);
+        if (old->len == 0)
+            header->head += header->cap - header->head % header->cap;
+        else
+            header->head += old->len;
+    }
+    if (header->head >= header->tail)
+        header->head = pos;
+
+    if (pos != header->tail)
+        recordAt(header->tail)->len = 0;
+
+    rec = recordAt(pos);
+    rec->len = (uint32_t) len;
+    rec->status = status;
+    rec->seq = header->seq ++;
+    rec->time = time;
+    rec->cmd_len = (uint32_t) cmd_len;
+    rec->cwd_len = (uint32_t) cwd_len;
+    memcpy(rec + 1, cmd, cmd_len + 1);
+    memcpy((char*) (rec + 1) + cmd_len + 1, cwd, cwd_len + 1);
+    header->tail = end;
+
+    flock(history.fd, LOCK_UN);
+}
+
+/* Search index */
+
+static uint64_t hashText(const char* text, size_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+    size_t idx;
+    for (idx = 0 ; idx < len ; idx ++)
+    {
+        h ^= (unsigned char) text[idx];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static void freeIndex()
+{
+    uint32_t idx;
+
+    for (idx = 0 ; idx < history.gram_cap ; idx ++)
+        free (history.grams[idx].ids);
+    free (history.grams);
+    free (history.uniq_hash);
+    free (history.uniq_pos);
+    free (history.uniq_seq);
+    free (history.uniq_map);
+    history.grams = NULL;
+    history.gram_num = history.gram_cap = 0;
+    history.uniq_hash = history.uniq_pos = history.uniq_seq = NULL;
+    history.uniq_map = NULL;
+    history.uniq_num = history.uniq_cap = history.uniq_map_cap = 0;
+    history.indexed_num = 0;
+}
+
+static uint32_t* findUniqSlot(uint64_t h)
+{
+    uint32_t mask = history.uniq_map_cap - 1;
+    uint32_t idx = (uint32_t) h & mask;
+
+    while (history.uniq_map[idx] != 0 && history.uniq_hash[history.uniq_map[idx] - 1] != h)
+        idx = (idx + 1) & mask;
+    return &history.uniq_map[idx];
+}
+
+static void growUniqMap()
+{
+    uint32_t idx;
+
+    history.uniq_map_cap = history.uniq_map_cap ? history.uniq_map_cap * 2 : 1024;
+    free (history.uniq_map);
+    history.uniq_map = (uint32_t*) calloc(history.uniq_map_cap, sizeof(uint32_t));
+    for (idx = 0 ; idx < history.uniq_num ; idx ++)
+        *findUniqSlot(history.uniq_hash[idx]) = idx + 1;
+}
+
+static Trigram* findTrigram(uint32_t key, int create)
+{
+    uint32_t mask, idx, slot;
+
+    if (history.gram_cap == 0 || (create && (history.gram_num + 1) * 2 > history.gram_cap))
+    {
+        Trigram* old = history.grams;
+        uint32_t old_cap = history.gram_cap;
+
+        if (!create)
+            return NULL;
+        history.gram_cap = old_cap ? old_cap * 2 : 4096;
+        history.grams = (Trigram*) calloc(history.gram_cap, sizeof(Trigram));
+        for (idx = 0 ; idx < history.gram_cap ; idx ++)
+            history.grams[idx].key = GRAM_EMPTY;
+        for (idx = 0 ; idx < old_cap ; idx ++)
+        {
+            if (old[idx].key == GRAM_EMPTY)
+                continue;
+            mask = history.gram_cap - 1;
+            slot = (old[idx].key * 2654435761u) & mask;
+            while (history.grams[slot].key != GRAM_EMPTY)
+                slot = (slot + 1) & mask;
+            history.grams[slot] = old[idx];
+        }
+        free (old);
+    }
+
+    mask = history.gram_cap - 1;
+    idx = (key * 2654435761u) & mask;
+    while (history.grams[idx].key != GRAM_EMPTY)
+    {
+        if (history.grams[idx].key == key)
+            return &history.grams[idx];
+        idx = (idx + 1) & mask;
+    }
+    if (!create)
+        return NULL;
+
+    history.grams[idx].key = key;
+    history.gram_num ++;
+    return &history.grams[idx];
+}
+
+static uint32_t trigramKey(const char* text)
+{
+    return ((unsigned char) text[0] << 16) | ((unsigned char) text[1] << 8) | (unsigned char) text[2];
+}
+
+// Caller holds the lock
+static void indexRecord(uint64_t pos)
+{
+    HistRecord* rec = recordAt(pos);
+    const char* cmd = (const char*) (rec + 1);
+    uint64_t h = hashText(cmd, rec->cmd_len);
+    uint32_t* slot;
+    uint32_t id;
+    uint32_t idx;
+
+    if ((history.uniq_num + 1) * 2 > history.uniq_map_cap)
+        growUniqMap();
+    slot = findUniqSlot(h);
+    if (*slot != 0)
+    {
+        // Seen before, only remember where it is now
+        id = *slot - 1;
+        history.uniq_pos[id] = pos;
+        history.uniq_seq[id] = rec->seq;
+        return;
+    }
+
+    if (history.uniq_num == history.uniq_cap)
+    {
+        history.uniq_cap = history.uniq_cap ? history.uniq_cap * 2 : 1024;
+        history.uniq_hash = (uint64_t*) realloc(history.uniq_hash, sizeof(uint64_t) * history.uniq_cap);
+        history.uniq_pos = (uint64_t*) realloc(history.uniq_pos, sizeof(uint64_t) * history.uniq_cap);
+        history.uniq_seq = (uint64_t*) realloc(history.uniq_seq, sizeof(uint64_t) * history.uniq_cap);
+    }
+    id = history.uniq_num ++;
+    history.uniq_hash[id] = h;
+    history.uniq_pos[id] = pos;
+    history.uniq_seq[id] = rec->seq;
+    *slot = id + 1;
+
+    for (idx = 0 ; idx + 3 <= rec->cmd_len ; idx ++)
+    {
+        Trigram* gram = findTrigram(trigramKey(cmd + idx), 1);
+        if (gram->id_num != 0 && gram->ids[gram->id_num - 1] == id)
+            continue;
+        if (gram->id_num == gram->id_cap)
+        {
+            gram->id_cap = gram->id_cap ? gram->id_cap * 2 : 4;
+            gram->ids = (uint32_t*) realloc(gram->ids, sizeof(uint32_t) * gram->id_cap);
+        }
+        gram->ids[gram->id_num ++] = id;
+    }
+}
+
+/* Reading */
+
+// Read the records appended since the last call, by any session.
+// Return the number of records in view.
+//
+size_t syncHistory()
+{
+    HistHeader* header = history.header;
+    uint64_t pos;
+    size_t low, high;
+
+    if (header == NULL)
+        return 0;
+
+    flock(history.fd, LOCK_SH);
+
+    // More than a whole ring behind: start over
+    if (history.synced < header->head)
+    {
+        history.pos_num = 0;
+        history.synced = header->head;
+        if (history.isIndexed)
+            freeIndex();
+    }
+
+    // Forget the records evicted meanwhile
+    low = 0;
+    high = history.pos_num;
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (history.pos[mid] < header->head)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low != 0)
+    {
+        memmove(history.pos, history.pos + low, sizeof(uint64_t) * (history.pos_num - low));
+        history.pos_num -= low;
+        history.indexed_num = (history.indexed_num > low) ? history.indexed_num - low : 0;
+    }
+
+    for (pos = history.synced ; pos < header->tail ; )
+    {
+        HistRecord* rec = recordAt(pos);
+        uint64_t offset = pos % header->cap;
+
+        if (rec->len == 0)
+        {
+            pos += header->cap - offset;
+            continue;
+        }
+        if (rec->len < sizeof(HistRecord) || offset + rec->len > header->cap ||
+            sizeof(HistRecord) + (uint64_t) rec->cmd_len + rec->cwd_len + 2 > rec->len)
+        {
+            // Damaged, skip what is left
+            pos = header->tail;
+            break;
+        }
+
+        if (history.pos_num == history.pos_cap)
+        {
+            history.pos_cap = history.pos_cap ? history.pos_cap * 2 : 1024;
+            history.pos = (uint64_t*) realloc(history.pos, sizeof(uint64_t) * history.pos_cap);
+        }
+        history.pos[history.pos_num ++] = pos;
+        pos += rec->len;
+    }
+    history.synced = pos;
+
+    if (history.isIndexed)
+        for ( ; history.indexed_num < history.pos_num ; history.indexed_num ++)
+            indexRecord(history.pos[history.indexed_num]);
+
+    flock(history.fd, LOCK_UN);
+    return history.pos_num;
+}
+
+// Copy a record out of the ring, caller holds the lock
+static void copyEntry(uint64_t pos, HistEntry* entry)
+{
+    HistRecord* rec = recordAt(pos);
+    size_t size = rec->cmd_len + rec->cwd_len + 2;
+
+    if (size > history.scratch_cap)
+    {
+        history.scratch_cap = size * 2;
+        history.scratch = (char*) realloc(history.scratch, history.scratch_cap);
+    }
+    memcpy(history.scratch, rec + 1, size);
+
+    entry->seq = rec->seq;
+    entry->time = rec->time;
+    entry->status = rec->status;
+    entry->cmd = history.scratch;
+    entry->cwd = history.scratch + rec->cmd_len + 1;
+}
+
+// Entry idx of the view, oldest first. Return -1 if it was evicted.
+int getHistoryEntry(size_t idx, HistEntry* entry)
+{
+    int ret = -1;
+
+    if (history.header == NULL || idx >= history.pos_num)
+        return -1;
+
+    flock(history.fd, LOCK_SH);
+    if (history.pos[idx] >= history.header->head)
+    {
+        copyEntry(history.pos[idx], entry);
+        ret = 0;
+    }
+    flock(history.fd, LOCK_UN);
+    return ret;
+}
+
+static int hasId(Trigram* gram, uint32_t id)
+{
+    uint32_t low = 0, high = gram->id_num;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (gram->ids[mid] < id)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return (low < gram->id_num && gram->ids[low] == id);
+}
+
+// Find the newest distinct command older than sequence number below
+// which contains pattern. Return -1 if there is none.
+//
+int searchHistory(const char* pattern, uint64_t below, HistEntry* entry)
+{
+    size_t plen = strlen(pattern);
+    Trigram* grams[64];
+    int gram_num = 0;
+    Trigram* rarest = NULL;
+    uint64_t bestSeq = 0;
+    uint32_t best = 0;
+    uint32_t idx;
+    int found = 0;
+
+    if (history.header == NULL)
+        return -1;
+    if (!history.isIndexed)
+    {
+        history.isIndexed = 1;
+        history.indexed_num = 0;
+    }
+    syncHistory();
+
+    flock(history.fd, LOCK_SH);
+
+    // Every trigram of the pattern must be in the command. A long
+    // pattern is narrowed down by its first 64 trigrams, and verified.
+    for (idx = 0 ; idx + 3 <= plen && gram_num < 64 ; idx ++)
+    {
+        Trigram* gram = findTrigram(trigramKey(pattern + idx), 0);
+        if (gram == NULL)
+        {
+            flock(history.fd, LOCK_UN);
+            return -1;
+        }
+        if (rarest == NULL || gram->id_num < rarest->id_num)
+            rarest = gram;
+        grams[gram_num ++] = gram;
+    }
+
+    for (idx = 0 ; idx < (rarest ? rarest->id_num : history.uniq_num) ; idx ++)
+    {
+        uint32_t id = rarest ? rarest->ids[idx] : idx;
+        HistRecord* rec;
+        int gram_idx;
+
+        if (history.uniq_seq[id] >= below || history.uniq_seq[id] <= bestSeq ||
+            history.uniq_pos[id] < history.header->head)
+            continue;
+        for (gram_idx = 0 ; gram_idx < gram_num ; gram_idx ++)
+            if (grams[gram_idx] != rarest && !hasId(grams[gram_idx], id))
+                break;
+        if (gram_idx != gram_num)
+            continue;
+
+        rec = recordAt(history.uniq_pos[id]);
+        if (memmem(rec + 1, rec->cmd_len, pattern, plen) == NULL)
+            continue;
+        best = id;
+        bestSeq = history.uniq_seq[id];
+        found = 1;
+    }
+
+    if (found)
+        copyEntry(history.uniq_pos[best], entry);
+    flock(history.fd, LOCK_UN);
+    return found ? 0 : -1;
+}
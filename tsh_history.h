@@ -0,0 +1,88 @@
+#ifndef __TSH_HISTORY_H__
+#define __TSH_HISTORY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The history file is a fixed size ring shared by all sessions: a header,
+// then records appended at tail. Positions are absolute byte counts; the
+// record at position p lives at data + p % cap, and is valid while
+// p >= head. Writers evict the oldest records to make room.
+typedef struct HistHeader
+{
+    char magic[8];
+    uint64_t cap;         // bytes in the data area
+    uint64_t head;        // position of the oldest record
+    uint64_t tail;        // position of the next record
+    uint64_t seq;         // sequence number of the next record
+    char pad[24];
+} HistHeader;
+
+typedef struct HistRecord
+{
+    uint32_t len;         // whole record padded to 8 bytes, 0: rest of the lap is unused
+    int32_t status;
+    uint64_t seq;
+    int64_t time;
+    uint32_t cmd_len;
+    uint32_t cwd_len;     // the command and cwd follow, NUL terminated
+} HistRecord;
+
+typedef struct HistEntry
+{
+    uint64_t seq;
+    int64_t time;
+    int status;
+    const char* cmd;      // valid until the next history call
+    const char* cwd;
+} HistEntry;
+
+// Posting list of a trigram: ids of the distinct commands holding it
+typedef struct Trigram
+{
+    uint32_t key;         // 0xffffffff: empty slot
+    uint32_t id_num;
+    uint32_t id_cap;
+    uint32_t* ids;        // ascending
+} Trigram;
+
+typedef struct History
+{
+    int fd;
+    HistHeader* header;
+    char* data;
+    size_t map_size;
+
+    uint64_t* pos;        // records seen so far, oldest first
+    size_t pos_num;
+    size_t pos_cap;
+    uint64_t synced;      // records before this position are in pos
+
+    // Search index over distinct commands, built on the first search
+    int isIndexed;
+    size_t indexed_num;   // entries of pos already indexed
+    uint64_t* uniq_hash;
+    uint64_t* uniq_pos;   // latest occurrence
+    uint64_t* uniq_seq;
+    uint32_t uniq_num;
+    uint32_t uniq_cap;
+    uint32_t* uniq_map;   // open addressing, id + 1
+    uint32_t uniq_map_cap;
+    Trigram* grams;
+    uint32_t gram_num;
+    uint32_t gram_cap;
+
+    char* scratch;        // copies handed out in HistEntry
+    size_t scratch_cap;
+} History;
+
+extern History history;
+
+int openHistory(const char*);
+int openDefaultHistory();
+void addHistory(const char*, const char*, int64_t, int);
+size_t syncHistory();
+int getHistoryEntry(size_t, HistEntry*);
+int searchHistory(const char*, uint64_t, HistEntry*);
+
+#endif
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "tsh.h"
+#include "tsh_input.h"
+
+// Input
+//
+// Lines have no length limit: the reader grows its buffer until a whole
+// line fits, and hands it out in place. A line ending with an odd number
+// of backslashes is continued by the next one; the backslash-newline
+// stays in the text and is dropped by the lexer and the expander, so
+// that a logical line never needs to be copied. Sourced files are
+// mapped and their lines are parsed straight from the mapping. Only the
+// lines of a compound command, or of a line ending with | && or ||, are
+// copied together before it runs.
+//
+#define INPUT_INITIAL_SIZE 4096
+#define SOURCE_MAX_DEPTH 64
+
+void initInputReader(InputReader* reader, int fd)
+{
+    reader->fd = fd;
+    reader->isEOF = 0;
+    reader->joinLines = 1;
+    reader->start = 0;
+    reader->scanned = 0;
+    reader->len = 0;
+    reader->cap = 0;
+    reader->buf = NULL;
+}
+
+void freeInputReader(InputReader* reader)
+{
+    free (reader->buf);
+    reader->buf = NULL;
+    reader->cap = 0;
+}
+
+// Read whatever is available. Return the number of bytes read,
+// 0 at end of file and -1 on error.
+ssize_t fillInput(InputReader* reader)
+{
+    ssize_t n;
+
+    // Move the unfinished line to the front of the buffer
+    if (reader->start != 0)
+    {
+        memmove(reader->buf, reader->buf + reader->start, reader->len - reader->start);
+        reader->len -= reader->start;
+        reader->start = 0;
+    }
+
+    // Room for more input and the terminating NUL
+    if (reader->cap - reader->len < INPUT_INITIAL_SIZE / 2)
+    {
+        reader->cap = reader->cap ? reader->cap * 2 : INPUT_INITIAL_SIZE;
+        reader->buf = (char*) realloc(reader->buf, reader->cap);
+    }
+
+    do
+    {
+        n = read(reader->fd, reader->buf + reader->len, reader->cap - 1 - reader->len);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == 0)
+        reader->isEOF = 1;
+    else if (n > 0)
+        reader->len += n;
+    return n;
+}
+
+// Offset of the newline ending the line which starts at data, looking
+// from offset from on. Return len if the line is not complete.
+//
+size_t findLineEnd(const char* data, size_t len, size_t from, int joinLines)
+{
+    while (from < len)
+    {
+        const char* newline = memchr(data + from, '\n', len - from);
+        size_t end, slashes = 0;
+
+        if (newline == NULL)
+            return len;
+        end = newline - data;
+        if (!joinLines)
+            return end;
+
+        while (slashes < end && data[end - 1 - slashes] == '\\')
+            slashes ++;
+        if (slashes % 2 == 0)
+            return end;
+        from = end + 1;
+    }
+    return len;
+}
+
+// Return the next complete line without its newline, or NULL if none is
+// buffered; its length goes to len if it is not NULL. The line stays
+// valid until the next call to fillInput(). The last line is returned
+// at end of file even without a newline.
+//
+char* nextLine(InputReader* reader, size_t* len)
+{
+    char* line = reader->buf + reader->start;
+    size_t avail = reader->len - reader->start;
+    size_t end;
+
+    if (avail == 0)
+        return NULL;
+
+    end = findLineEnd(line, avail, reader->scanned, reader->joinLines);
+    if (end == avail)
+    {
+        if (!reader->isEOF)
+        {
+            // Do not search the same bytes again
+            reader->scanned = avail;
+            return NULL;
+        }
+        reader->start = reader->len;
+    }
+    else
+        reader->start += end + 1;
+
+    reader->scanned = 0;
+    line[end] = '\0';
+    if (len)
+        *len = end;
+    return line;
+}
+
+void appendLine(LineBuffer* lines, const char* line, size_t len)
+{
+    if (lines->len + len + 2 > lines->cap)
+    {
+        while (lines->len + len + 2 > lines->cap)
+            lines->cap = lines->cap ? lines->cap * 2 : INPUT_INITIAL_SIZE;
+        lines->buf = (char*) realloc(lines->buf, lines->cap);
+    }
+    memcpy(lines->buf + lines->len, line, len);
+    lines->len += len;
+    lines->buf[lines->len] = '\0';
+}
+
+// Run a line, or the unfinished command it completes. Return 1 if the
+// command goes on in the next line.
+//
+int feedLine(LineBuffer* lines, const char* line, size_t len)
+{
+    if (lines->len == 0)
+    {
+        if (runLine(line, len) == 0)
+            return 0;
+        appendLine(lines, line, len);
+    }
+    else
+    {
+        appendLine(lines, line, len);
+        if (runLine(lines->buf, lines->len) == 0)
+        {
+            lines->len = 0;
+            return 0;
+        }
+    }
+    appendLine(lines, "\n", 1);
+    return 1;
+}
+
+// End of the input, with a command maybe still unfinished
+void finishLines(LineBuffer* lines)
+{
+    if (lines->len > 0)
+    {
+        fprintf(stderr, "tsh: syntax error: unexpected end of file\n");
+        last_status = 2;
+    }
+    free (lines->buf);
+    lines->buf = NULL;
+    lines->len = 0;
+    lines->cap = 0;
+}
+
+// Run every line of an open file in the current shell, parsed straight
+// from a mapping of it when it is a regular file. Return the status of
+// the last command.
+//
+int runFile(int fd, const char* path)
+{
+    static int depth;
+    struct stat st;
+    LineBuffer lines = { NULL, 0, 0 };
+    char* map;
+    size_t pos = 0;
+
+    if (depth >= SOURCE_MAX_DEPTH)
+    {
+        fprintf(stderr, "tsh: %s: too many nested sources\n", path);
+        return 1;
+    }
+    if (fstat(fd, &st) == -1)
+    {
+        fprintf(stderr, "tsh: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // Pipes and other unmappable files go through the reader
+    if (!S_ISREG(st.st_mode))
+    {
+        int status;
+        depth ++;
+        status = runScript(fd);
+        depth --;
+        return status;
+    }
+    last_status = 0;
+    if (st.st_size == 0)
+        return 0;
+
+    // A file truncated while it runs faults with SIGBUS past its new
+    // end, which kills the shell. Only source takes that risk, the
+    // script given to tsh is read through an InputReader.
+    map = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "tsh: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    depth ++;
+    while (pos < (size_t) st.st_size)
+    {
+        size_t end = findLineEnd(map, st.st_size, pos, 1);
+        feedLine(&lines, map + pos, end - pos);
+        reapChildren();
+        pos = end + 1;
+    }
+    finishLines(&lines);
+    depth --;
+
+    munmap(map, st.st_size);
+    return last_status;
+}
+
+// source / . : run a file in the current shell
+int sourceFile(const char* path)
+{
+    int status;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+    {
+        fprintf(stderr, "tsh: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    status = runFile(fd, path);
+    close(fd);
+    return status;
+}
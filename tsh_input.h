@@ -0,0 +1,42 @@
+#ifndef __TSH_INPUT_H__
+#define __TSH_INPUT_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Line buffered reader on top of read(2), so that the reactor knows
+// exactly what is buffered (stdio would hide complete lines from epoll).
+// The buffer grows to hold the longest line.
+typedef struct InputReader
+{
+    int fd;
+    int isEOF;
+    int joinLines;  // a line ending with a backslash goes on with the next
+    size_t start;   // first byte not handed out yet
+    size_t scanned; // bytes after start known to hold no line end
+    size_t len;     // bytes in buf
+    size_t cap;
+    char* buf;
+} InputReader;
+
+// Lines of a command going on over several lines, gathered until it
+// is complete
+typedef struct LineBuffer
+{
+    char* buf;
+    size_t len;     // 0 if no command is unfinished
+    size_t cap;
+} LineBuffer;
+
+void initInputReader(InputReader*, int);
+void freeInputReader(InputReader*);
+ssize_t fillInput(InputReader*);
+char* nextLine(InputReader*, size_t*);
+size_t findLineEnd(const char*, size_t, size_t, int);
+void appendLine(LineBuffer*, const char*, size_t);
+int feedLine(LineBuffer*, const char*, size_t);
+void finishLines(LineBuffer*);
+int runFile(int, const char*);
+int sourceFile(const char*);
+
+#endif
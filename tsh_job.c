@@ -0,0 +1,826 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include "tsh_job.h"
+#include "tsh_control.h"
+#include "tsh_cgroup.h"
+#include "tsh_place.h"
+#include "tsh_prio.h"
+#include "tsh_parse.h"
+
+JobTable jobTable;
+
+extern int sigchld_fd;
+
+void initJobTable()
+{
+    memset(&jobTable, 0, sizeof(JobTable));
+    jobTable.job_cap = 16;
+    jobTable.jobs = (ProcessGroup**) calloc(jobTable.job_cap, sizeof(ProcessGroup*));
+    jobTable.free_ids = (int*) malloc(sizeof(int) * jobTable.job_cap);
+    jobTable.exit_codes = (int*) malloc(sizeof(int) * jobTable.job_cap);
+    jobTable.finish_seq = (long*) malloc(sizeof(long) * jobTable.job_cap);
+    jobTable.pidmap_cap = 64;
+    jobTable.pidmap = (PidSlot*) calloc(jobTable.pidmap_cap, sizeof(PidSlot));
+}
+
+/* pid -> (group, index) map */
+
+static unsigned int hashPID(pid_t pid)
+{
+    return (unsigned int) pid * 2654435761u;
+}
+
+static PidSlot* findPidSlot(pid_t pid)
+{
+    unsigned int mask = jobTable.pidmap_cap - 1;
+    unsigned int idx = hashPID(pid) & mask;
+
+    while (jobTable.pidmap[idx].pid != 0)
+    {
+        if (jobTable.pidmap[idx].pid == pid)
+            return &jobTable.pidmap[idx];
+        idx = (idx + 1) & mask;
+    }
+    return NULL;
+}
+
+static void putPidSlot(pid_t pid, ProcessGroup* group, int idxPID);
+
+static void growPidMap()
+{
+    PidSlot* old = jobTable.pidmap;
+    unsigned int old_cap = jobTable.pidmap_cap;
+    unsigned int idx;
+
+    // Only grow if live entries need it, otherwise just drop tombstones
+    int live = 0;
+    for (idx = 0 ; idx < old_cap ; idx ++)
+        if (old[idx].pid > 0)
+            live ++;
+    if (live * 4 >= old_cap)
+        jobTable.pidmap_cap *= 2;
+
+    jobTable.pidmap = (PidSlot*) calloc(jobTable.pidmap_cap, sizeof(PidSlot));
+    jobTable.pidmap_used = 0;
+    for (idx = 0 ; idx < old_cap ; idx ++)
+        if (old[idx].pid > 0)
+            putPidSlot(old[idx].pid, old[idx].group, old[idx].idxPID);
+    free (old);
+}
+
+static void putPidSlot(pid_t pid, ProcessGroup* group, int idxPID)
+{
+    unsigned int mask;
+    unsigned int idx;
+
+    // Keep the load (tombstones included) under 1/2
+    if ((jobTable.pidmap_used + 1) * 2 > jobTable.pidmap_cap)
+        growPidMap();
+
+    mask = jobTable.pidmap_cap - 1;
+    idx = hashPID(pid) & mask;
+    while (jobTable.pidmap[idx].pid > 0 && jobTable.pidmap[idx].pid != pid)
+        idx = (idx + 1) & mask;
+
+    if (jobTable.pidmap[idx].pid == 0)
+        jobTable.pidmap_used ++;
+    jobTable.pidmap[idx].pid = pid;
+    jobTable.pidmap[idx].group = group;
+    jobTable.pidmap[idx].idxPID = idxPID;
+}
+
+static void removePidSlot(pid_t pid)
+{
+    PidSlot* slot = findPidSlot(pid);
+    if (slot)
+    {
+        slot->pid = -1;
+        slot->group = NULL;
+    }
+}
+
+/* job ID allocation */
+
+static void pushFreeID(int id)
+{
+    int idx = jobTable.free_num ++;
+    while (idx > 0 && jobTable.free_ids[(idx - 1) / 2] > id)
+    {
+        jobTable.free_ids[idx] = jobTable.free_ids[(idx - 1) / 2];
+        idx = (idx - 1) / 2;
+    }
+    jobTable.free_ids[idx] = id;
+}
+
+static int popFreeID()
+{
+    int ret = jobTable.free_ids[0];
+    int last = jobTable.free_ids[-- jobTable.free_num];
+    int idx = 0;
+
+    while (1)
+    {
+        int child = idx * 2 + 1;
+        if (child >= jobTable.free_num)
+            break;
+        if (child + 1 < jobTable.free_num && jobTable.free_ids[child + 1] < jobTable.free_ids[child])
+            child ++;
+        if (last <= jobTable.free_ids[child])
+            break;
+        jobTable.free_ids[idx] = jobTable.free_ids[child];
+        idx = child;
+    }
+    jobTable.free_ids[idx] = last;
+    return ret;
+}
+
+// The exit code a finished job left for wait goes with its ID
+static int allocJobID()
+{
+    int id;
+
+    if (jobTable.free_num > 0)
+        id = popFreeID();
+    else
+    {
+        if (jobTable.next_id == jobTable.job_cap)
+        {
+            jobTable.job_cap *= 2;
+            jobTable.jobs = (ProcessGroup**) realloc(jobTable.jobs, sizeof(ProcessGroup*) * jobTable.job_cap);
+            memset(jobTable.jobs + jobTable.next_id, 0, sizeof(ProcessGroup*) * (jobTable.job_cap - jobTable.next_id));
+            jobTable.free_ids = (int*) realloc(jobTable.free_ids, sizeof(int) * jobTable.job_cap);
+            jobTable.exit_codes = (int*) realloc(jobTable.exit_codes, sizeof(int) * jobTable.job_cap);
+            jobTable.finish_seq = (long*) realloc(jobTable.finish_seq, sizeof(long) * jobTable.job_cap);
+        }
+        id = jobTable.next_id ++;
+    }
+    jobTable.exit_codes[id] = -1;
+    return id;
+}
+
+// Create the record of a launched pipeline. Pids, statuses and command
+// lines of all its processes live in a single allocation.
+//
+ProcessGroup* newProcessGroup(Command_handler* cmd_hdr)
+{
+    ProcessGroup* group;
+    size_t size = sizeof(ProcessGroup);
+    int proc_num = 0;
+    int cmd_idx, arg_idx;
+    char* text;
+
+    for (cmd_idx = 0 ; cmd_idx < cmd_hdr->cmd_num ; cmd_idx ++)
+    {
+        Command* cmd = cmd_hdr->cmds[cmd_idx];
+        if (cmd->pid == -1)
+            continue;
+        proc_num ++;
+        size += sizeof(Process);
+        for (arg_idx = 0 ; arg_idx < cmd->arg_num ; arg_idx ++)
+            size += strlen(cmd->args[arg_idx]) + 1;
+        if (cmd->compound != NULL)
+            size += cmd->compound->text_len;
+        size += 1;
+    }
+
+    group = (ProcessGroup*) malloc(size);
+    group->pgid = 0;
+    group->jobID = -1;
+    group->proc_num = 0;
+    group->finish_num = 0;
+    group->pipeSize = 0;
+    group->isTimed = cmd_hdr->isTimed;
+    group->controlID = 0;
+    group->cgroup_fd = -1;
+    group->cgroupID = 0;
+    group->placement = NULL;
+    group->priority = NULL;
+    group->isDemoted = 0;
+    text = (char*) &group->procs[proc_num];
+
+    for (cmd_idx = 0 ; cmd_idx < cmd_hdr->cmd_num ; cmd_idx ++)
+    {
+        Command* cmd = cmd_hdr->cmds[cmd_idx];
+        Process* proc;
+        if (cmd->pid == -1)
+            continue;
+
+        proc = &group->procs[group->proc_num];
+        proc->pid = cmd->pid;
+        proc->status = 0;
+        proc->isRunning = 1;
+        proc->cmdline = text;
+        proc->startTime = cmd->startTime;
+        proc->endTime = cmd->startTime;
+        memset(&proc->usage, 0, sizeof(struct rusage));
+        for (arg_idx = 0 ; arg_idx < cmd->arg_num ; arg_idx ++)
+        {
+            size_t len = strlen(cmd->args[arg_idx]);
+            memcpy(text, cmd->args[arg_idx], len);
+            text += len;
+            *text ++ = ' ';
+        }
+        if (cmd->compound != NULL)
+        {
+            // As written, each line break a space
+            size_t idx;
+            for (idx = 0 ; idx < cmd->compound->text_len ; idx ++)
+                *text ++ = (cmd->compound->text[idx] == '\n') ? ' ' : cmd->compound->text[idx];
+        }
+        *text ++ = '\0';
+
+        if (group->pgid == 0)
+            group->pgid = proc->pid;
+        putPidSlot(proc->pid, group, group->proc_num);
+        group->proc_num ++;
+    }
+
+    return group;
+}
+
+ProcessGroup* findProcessGroup(pid_t pid)
+{
+    PidSlot* slot = findPidSlot(pid);
+    return slot ? slot->group : NULL;
+}
+
+ProcessGroup* getJob(int jobID)
+{
+    if (jobID < 0 || jobID >= jobTable.next_id)
+        return NULL;
+    return jobTable.jobs[jobID];
+}
+
+// Job IDs in use are all below this value
+int getJobIDLimit()
+{
+    return jobTable.next_id;
+}
+
+// Release the job ID of a group, e.g. when it moves to foreground
+void detachJob(ProcessGroup* group)
+{
+    if (group->jobID == -1)
+        return;
+
+    jobTable.jobs[group->jobID] = NULL;
+    pushFreeID(group->jobID);
+    group->jobID = -1;
+    jobTable.job_num --;
+}
+
+// isBackGround = 1 represents that the process group
+// are create to be backgroup.
+//
+// Return the job ID.
+//
+int insertIntoBackground(ProcessGroup* group, int isBackGround)
+{
+    int idxPID;
+    int jobID = allocJobID();
+
+    jobTable.jobs[jobID] = group;
+    jobTable.job_num ++;
+    group->jobID = jobID;
+
+    if (!tsh_interactive)
+        return jobID;
+
+    if (isBackGround == 1)
+    {
+        fprintf(stderr, "[%d]\t[ Start ]\n", jobID);
+        fprintf(stderr, "\t");
+        for (idxPID = 0 ; idxPID < group->proc_num ; idxPID ++)
+            fprintf(stderr, "%d ", group->procs[idxPID].pid);
+        fprintf(stderr, "\n");
+    }
+    else
+    {
+        int status;
+        fprintf(stderr, "\n[%d]\n", jobID);
+        for (idxPID = 0 ; idxPID < group->proc_num ; idxPID ++)
+        {
+            fprintf(stderr, "\t%d\t", group->procs[idxPID].pid);
+            status = group->procs[idxPID].status;
+
+            if (group->procs[idxPID].isRunning)
+                fprintf(stderr, "running");
+            else if (WIFEXITED(status))
+                fprintf(stderr, "exited (%d)", WEXITSTATUS(status));
+            else if (WIFSIGNALED(status))
+                fprintf(stderr, "killed (%d)", WTERMSIG(status));
+            else if (WIFSTOPPED(status))
+                fprintf(stderr, "stopped (%d)", WSTOPSIG(status));
+
+            fprintf(stderr, "\t\t%s\n", group->procs[idxPID].cmdline);
+        }
+    }
+
+    return jobID;
+}
+
+// Record the status of the given pid. The group and the index of the
+// process are returned through pgroup and pidxPID (NULL / -1 if the pid
+// is unknown).
+//
+// return 1 if the given process group is finished
+//
+int setProcessGroupStatus(pid_t pid, int status, struct rusage* usage, ProcessGroup** pgroup, int* pidxPID)
+{
+    PidSlot* slot = findPidSlot(pid);
+    ProcessGroup* currGroup;
+    int idxPID;
+
+    if (slot == NULL)
+    {
+        if (pgroup)
+            *pgroup = NULL;
+        if (pidxPID)
+            *pidxPID = -1;
+        return 0;
+    }
+
+    currGroup = slot->group;
+    idxPID = slot->idxPID;
+    if (pgroup)
+        *pgroup = currGroup;
+    if (pidxPID)
+        *pidxPID = idxPID;
+
+    currGroup->procs[idxPID].status = status;
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+    {
+        // The pid may be reused from now on
+        removePidSlot(pid);
+        currGroup->procs[idxPID].isRunning = 0;
+        clock_gettime(CLOCK_MONOTONIC, &currGroup->procs[idxPID].endTime);
+        if (usage)
+            currGroup->procs[idxPID].usage = *usage;
+        currGroup->finish_num ++;
+        if (currGroup->proc_num == currGroup->finish_num)
+            return 1;
+    }
+    else if (WIFSTOPPED(status))
+    {
+        currGroup->procs[idxPID].isRunning = 0;
+    }
+    else if (WIFCONTINUED(status))
+    {
+        currGroup->procs[idxPID].isRunning = 1;
+    }
+    return 0;
+}
+
+void freeProcessGroup(ProcessGroup* group)
+{
+    int idx;
+
+    for (idx = 0 ; idx < group->proc_num ; idx ++)
+    {
+        PidSlot* slot = findPidSlot(group->procs[idx].pid);
+        if (slot && slot->group == group)
+            removePidSlot(group->procs[idx].pid);
+    }
+    if (group->controlID != 0)
+        finishControlJob(group);
+    if (group->cgroup_fd != -1)
+        removeJobCgroup(group->cgroup_fd, group->cgroupID);
+    releasePlacement(group->placement);
+    free (group->priority);
+
+    // Keep the exit code of a finished job for wait, until its ID is
+    // handed out again
+    if (group->jobID != -1 && group->proc_num > 0 && group->finish_num == group->proc_num)
+    {
+        jobTable.exit_codes[group->jobID] = getExitCode(group->procs[group->proc_num - 1].status);
+        jobTable.finish_seq[group->jobID] = ++ jobTable.finish_count;
+    }
+    detachJob(group);
+    free (group);
+}
+
+// Call fn(pid, tid, data) for every thread of every live process of a
+// job. With a cgroup, the processes the job forked itself are included.
+// Return the number of calls which returned 0, with errno of the last
+// failure if none did.
+//
+int forEachJobThread(ProcessGroup* group, int (*fn)(pid_t, pid_t, void*), void* data)
+{
+    pid_t* pids = NULL;
+    int pid_num = 0;
+    int done = 0;
+    int err = 0;
+    int idx;
+
+    if (group->cgroup_fd == -1 || (pids = readCgroupProcs(group->cgroup_fd, &pid_num)) == NULL)
+    {
+        pids = (pid_t*) malloc(sizeof(pid_t) * (group->proc_num + 1));
+        for (idx = 0 ; idx < group->proc_num ; idx ++)
+            if (group->procs[idx].isRunning || WIFSTOPPED(group->procs[idx].status))
+                pids[pid_num ++] = group->procs[idx].pid;
+    }
+
+    for (idx = 0 ; idx < pid_num ; idx ++)
+    {
+        char path[64];
+        struct dirent* entry;
+        DIR* dir;
+
+        snprintf(path, sizeof(path), "/proc/%d/task", (int) pids[idx]);
+        if ((dir = opendir(path)) == NULL)
+            continue;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (entry->d_name[0] == '.')
+                continue;
+            if (fn(pids[idx], atoi(entry->d_name), data) == 0)
+                done ++;
+            else
+                err = errno;
+        }
+        closedir(dir);
+    }
+    free (pids);
+
+    if (done == 0)
+        errno = err;
+    return done;
+}
+
+/* Resource accounting */
+
+double timespecDiff(const struct timespec* end, const struct timespec* start)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+double timevalDiff(const struct timeval* end, const struct timeval* start)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+// Print real, user and sys time, max RSS and voluntary/involuntary
+// context switches of a process. A running process only has a real time.
+//
+void printProcessUsage(FILE* out, Process* proc)
+{
+    static const struct timeval zero;
+    struct timespec now;
+
+    if (proc->isRunning || (!WIFEXITED(proc->status) && !WIFSIGNALED(proc->status)))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        fprintf(out, "%.3fs\t-\t-\t-\t-", timespecDiff(&now, &proc->startTime));
+        return;
+    }
+    fprintf(out, "%.3fs\t%.3fs\t%.3fs\t%ldK\t%ld/%ld",
+            timespecDiff(&proc->endTime, &proc->startTime),
+            timevalDiff(&proc->usage.ru_utime, &zero),
+            timevalDiff(&proc->usage.ru_stime, &zero),
+            proc->usage.ru_maxrss,
+            proc->usage.ru_nvcsw, proc->usage.ru_nivcsw);
+}
+
+void printTimeSummary(double real, double user, double sys)
+{
+    fprintf(stderr, "\nreal\t%.3fs\nuser\t%.3fs\nsys\t%.3fs\n", real, user, sys);
+}
+
+// Report of the time keyword: totals of the pipeline, then one line
+// per stage so that the slow one stands out.
+//
+void printTimeReport(ProcessGroup* group)
+{
+    static const struct timeval zero;
+    struct timespec start, end;
+    double user = 0, sys = 0;
+    int idx;
+
+    start = group->procs[0].startTime;
+    end = group->procs[0].endTime;
+    for (idx = 0 ; idx < group->proc_num ; idx ++)
+    {
+        Process* proc = &group->procs[idx];
+        if (timespecDiff(&proc->startTime, &start) < 0)
+            start = proc->startTime;
+        if (timespecDiff(&proc->endTime, &end) > 0)
+            end = proc->endTime;
+        user += timevalDiff(&proc->usage.ru_utime, &zero);
+        sys += timevalDiff(&proc->usage.ru_stime, &zero);
+    }
+
+    printTimeSummary(timespecDiff(&end, &start), user, sys);
+    fprintf(stderr, "\tpid\treal\tuser\tsys\tmaxrss\tcsw\tstatus\tcommand\n");
+    for (idx = 0 ; idx < group->proc_num ; idx ++)
+    {
+        fprintf(stderr, "\t%d\t", group->procs[idx].pid);
+        printProcessUsage(stderr, &group->procs[idx]);
+        fprintf(stderr, "\t%d\t%s\n", getExitCode(group->procs[idx].status), group->procs[idx].cmdline);
+    }
+}
+
+/* waiting for jobs */
+
+// Return 1 if wait knows the job: it runs, or finished and was not
+// waited for yet
+int isKnownJob(int jobID)
+{
+    if (jobID < 0 || jobID >= jobTable.next_id)
+        return 0;
+    return (jobTable.jobs[jobID] != NULL || jobTable.exit_codes[jobID] != -1);
+}
+
+// Exit code of a job which finished, forgotten once taken. -1 if it
+// still runs, 127 if there is no such job.
+static int takeExitCode(int jobID)
+{
+    int code;
+
+    if (jobID < 0 || jobID >= jobTable.next_id)
+        return 127;
+    if (jobTable.jobs[jobID] != NULL)
+        return -1;
+    code = jobTable.exit_codes[jobID];
+    jobTable.exit_codes[jobID] = -1;
+    return (code == -1) ? 127 : code;
+}
+
+// Order in which a job finished, 0 for a job wait does not know: such
+// a job finishes at once
+static long finishSeq(int jobID)
+{
+    if (jobID < 0 || jobID >= jobTable.next_id || jobTable.exit_codes[jobID] == -1)
+        return 0;
+    return jobTable.finish_seq[jobID];
+}
+
+// Stop status of a job none of whose processes runs while one is
+// stopped, 0 otherwise. Such a job never finishes by itself.
+static int stoppedStatus(ProcessGroup* group)
+{
+    int idx;
+    int status = 0;
+
+    for (idx = 0 ; idx < group->proc_num ; idx ++)
+    {
+        if (group->procs[idx].isRunning)
+            return 0;
+        if (WIFSTOPPED(group->procs[idx].status))
+            status = group->procs[idx].status;
+    }
+    return status;
+}
+
+// Tell that wait gives up on a stopped job, the way jobs lists it
+static void reportStoppedJob(ProcessGroup* group)
+{
+    int idx;
+
+    fprintf(stderr, "[%d]\n", group->jobID);
+    for (idx = 0 ; idx < group->proc_num ; idx ++)
+    {
+        int status = group->procs[idx].status;
+        fprintf(stderr, "\t%d\t", group->procs[idx].pid);
+        if (WIFEXITED(status))
+            fprintf(stderr, "exited (%d)", WEXITSTATUS(status));
+        else if (WIFSIGNALED(status))
+            fprintf(stderr, "killed (%d)", WTERMSIG(status));
+        else if (WIFSTOPPED(status))
+            fprintf(stderr, "stopped (%d)", WSTOPSIG(status));
+        fprintf(stderr, "\t\t%s\n", group->procs[idx].cmdline);
+    }
+}
+
+// Watch every process of a job which was not reaped yet. Such a pid can
+// not be reused before the shell reaps it, and the shell does not reap
+// while the pidfds are opened, so each pidfd refers to the right
+// process. Return -1 if pidfds are not supported.
+//
+static int watchJob(int epfd, ProcessGroup* group, int** fds, int* fd_num)
+{
+    struct epoll_event ev;
+    int idx, fd;
+
+    for (idx = 0 ; idx < group->proc_num ; idx ++)
+    {
+        Process* proc = &group->procs[idx];
+        if (!proc->isRunning && !WIFSTOPPED(proc->status))
+            continue;
+        if ((fd = (int) syscall(SYS_pidfd_open, proc->pid, 0)) == -1)
+        {
+            if (errno == ESRCH)
+                continue;
+            return -1;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        *fds = (int*) realloc(*fds, sizeof(int) * (*fd_num + 1));
+        (*fds)[(*fd_num) ++] = fd;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    return 0;
+}
+
+// Wait for the jobs of ids, every job in the table if id_num is 0,
+// until all of them finished, or with isAny until one did. A pidfd of
+// each of their processes goes in an epoll set, so that the shell only
+// wakes up when one of them exits; SIGCHLD only tells about stops, and
+// about exits on kernels without pidfds. A stopped job is reported and
+// ends the wait, as it would never finish: with isAny only once every
+// job left is stopped. A timeout below 0 never ends. At an interactive
+// prompt ^C stops the wait instead of the shell.
+//
+// Return the exit code of the last of ids (of the job which finished
+// first with isAny, 127 if there is none), 0 for all jobs, 128 + the
+// signal of a stopped job, WAIT_TIMEOUT if time ran out or 128 + SIGINT
+// if interrupted.
+//
+int waitJobs(const int* ids, int id_num, int isAny, double timeout)
+{
+    struct timespec deadline, now;
+    sigset_t mask, oldMask;
+    int* pending;
+    int* fds = NULL;
+    int pending_num = 0;
+    int fd_num = 0;
+    int epfd, int_fd = -1;
+    int ret = isAny ? 127 : 0;
+    int idx;
+
+    // Unknown IDs were reported by the caller, they finish with 127
+    pending = (int*) malloc(sizeof(int) * (id_num > 0 ? id_num : jobTable.next_id + 1));
+    if (id_num > 0)
+    {
+        for (idx = 0 ; idx < id_num ; idx ++)
+            pending[pending_num ++] = ids[idx];
+    }
+    else
+    {
+        for (idx = 0 ; idx < jobTable.next_id ; idx ++)
+            if (isKnownJob(idx))
+                pending[pending_num ++] = idx;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t) timeout;
+    deadline.tv_nsec += (long) ((timeout - (time_t) timeout) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec ++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (tsh_interactive)
+    {
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigprocmask(SIG_BLOCK, &mask, &oldMask);
+        if ((int_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) != -1)
+        {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = int_fd;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, int_fd, &ev);
+        }
+    }
+
+    // Pick up what changed already, then watch the jobs still running
+    reapChildren();
+    for (idx = 0 ; idx < pending_num ; idx ++)
+    {
+        ProcessGroup* group = getJob(pending[idx]);
+        if (group != NULL)
+            watchJob(epfd, group, &fds, &fd_num);
+    }
+    if (sigchld_fd != -1)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = sigchld_fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+    }
+
+    while (1)
+    {
+        struct epoll_event events[16];
+        int ev_num, ev_idx;
+        int wait_ms = -1;
+        int left = 0;
+        int stopped_num = 0;
+        ProcessGroup* stopped = NULL;
+        int first = -1;
+
+        // Collect the jobs which finished, with isAny only the one which
+        // finished first
+        for (idx = 0 ; idx < pending_num ; idx ++)
+        {
+            ProcessGroup* group;
+            if (pending[idx] == -1)
+                continue;
+            if ((group = getJob(pending[idx])) != NULL)
+            {
+                left ++;
+                if (stoppedStatus(group) != 0)
+                {
+                    if (stopped == NULL)
+                        stopped = group;
+                    stopped_num ++;
+                }
+                continue;
+            }
+            if (isAny)
+            {
+                if (first == -1 || finishSeq(pending[idx]) < finishSeq(pending[first]))
+                    first = idx;
+                continue;
+            }
+            if (id_num > 0 && idx == pending_num - 1)
+                ret = takeExitCode(pending[idx]);
+            else
+                takeExitCode(pending[idx]);
+            pending[idx] = -1;
+        }
+        if (first != -1)
+        {
+            ret = takeExitCode(pending[first]);
+            break;
+        }
+        if (left == 0)
+            break;
+        if (stopped != NULL && (!isAny || stopped_num == left))
+        {
+            reportStoppedJob(stopped);
+            ret = getExitCode(stoppedStatus(stopped));
+            break;
+        }
+
+        if (timeout >= 0)
+        {
+            double remain;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remain = timespecDiff(&deadline, &now);
+            if (remain <= 0)
+            {
+                ret = WAIT_TIMEOUT;
+                break;
+            }
+            wait_ms = (int) (remain * 1000) + 1;
+        }
+
+        ev_num = epoll_wait(epfd, events, 16, wait_ms);
+        if (ev_num == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("tsh: wait: epoll_wait");
+            ret = 1;
+            break;
+        }
+        for (ev_idx = 0 ; ev_idx < ev_num ; ev_idx ++)
+        {
+            int fd = events[ev_idx].data.fd;
+            if (fd == int_fd)
+            {
+                struct signalfd_siginfo info;
+                while (read(int_fd, &info, sizeof(info)) == sizeof(info));
+                ret = 128 + SIGINT;
+            }
+            else if (fd == sigchld_fd)
+            {
+                struct signalfd_siginfo info;
+                while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info));
+            }
+            else
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);  // it exited
+        }
+        if (ret == 128 + SIGINT)
+        {
+            fprintf(stderr, "\n");
+            break;
+        }
+        reapChildren();
+    }
+
+    for (idx = 0 ; idx < fd_num ; idx ++)
+        close(fds[idx]);
+    free (fds);
+    free (pending);
+    if (int_fd != -1)
+        close(int_fd);
+    if (tsh_interactive)
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    close(epfd);
+    return ret;
+}
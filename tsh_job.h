@@ -0,0 +1,59 @@
+#ifndef __TSH_JOB_H__
+#define __TSH_JOB_H__
+
+#include <stdio.h>
+#include "tsh.h"
+
+typedef struct PidSlot
+{
+    pid_t pid;              // 0: empty, -1: deleted
+    ProcessGroup* group;
+    int idxPID;
+} PidSlot;
+
+// Job registry
+//
+// Job IDs index a growable array and are recycled lowest first through
+// a min-heap of released IDs. Every live pid, foreground or background,
+// is in an open addressing hash map to its (group, index).
+typedef struct JobTable
+{
+    ProcessGroup** jobs;
+    int job_cap;
+    int job_num;
+    int next_id;      // IDs >= next_id were never handed out
+    int* free_ids;    // min-heap
+    int free_num;
+    int* exit_codes;  // of finished jobs until waited for, -1 if none
+    long* finish_seq; // order in which those jobs finished
+    long finish_count;
+    PidSlot* pidmap;
+    unsigned int pidmap_cap;
+    int pidmap_used;  // live + deleted slots
+} JobTable;
+
+// Status of a wait which ran out of time, as for timeout(1)
+#define WAIT_TIMEOUT 124
+
+extern JobTable jobTable;
+
+void initJobTable();
+ProcessGroup* newProcessGroup(Command_handler*);
+ProcessGroup* findProcessGroup(pid_t);
+ProcessGroup* getJob(int);
+int getJobIDLimit();
+void detachJob(ProcessGroup*);
+int insertIntoBackground(ProcessGroup*, int);
+int setProcessGroupStatus(pid_t, int, struct rusage*, ProcessGroup**, int*);
+void freeProcessGroup(ProcessGroup*);
+int forEachJobThread(ProcessGroup*, int (*)(pid_t, pid_t, void*), void*);
+int isKnownJob(int);
+int waitJobs(const int*, int, int, double);
+
+double timespecDiff(const struct timespec*, const struct timespec*);
+double timevalDiff(const struct timeval*, const struct timeval*);
+void printProcessUsage(FILE*, Process*);
+void printTimeSummary(double, double, double);
+void printTimeReport(ProcessGroup*);
+
+#endif
@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "tsh.h"
+#include "tsh_cmd.h"
+#include "tsh_arena.h"
+#include "tsh_input.h"
+#include "tsh_job.h"
+#include "tsh_spawn.h"
+
+// Parallel executor
+//
+//     parallel [-j N] [-a file] command [args ...] [::: items ...]
+//
+// The command runs once per item, with every {} in its words replaced by
+// the item, or the item appended if there is no {}. Items follow :::, or
+// come one per line from the -a file or standard input. At most N commands
+// run at once, and a slot is refilled as soon as its command exits. Each
+// command writes into memfds of its own which are copied out in one piece
+// when it finishes, so the output of different items never interleaves.
+//
+typedef struct ParallelSlot
+{
+    ProcessGroup* group;   // NULL if the slot is free
+    int out_fd;
+    int err_fd;
+} ParallelSlot;
+
+typedef struct Parallel
+{
+    char** tmpl;           // command template
+    int tmpl_num;
+    int hasPlaceholder;
+    char** items;          // items given after :::, or NULL
+    int item_num;
+    int item_idx;
+    InputReader reader;    // otherwise items are read from here
+    ParallelSlot* slots;
+    int slot_num;
+    int running;
+    int ownGroup;          // items get a foreground process group
+    pid_t pgid;
+    int failed;
+    Arena arena;           // argv of the item being started
+} Parallel;
+
+static char* nextItem(Parallel* par)
+{
+    char* line;
+
+    if (par->items != NULL)
+        return (par->item_idx < par->item_num) ? par->items[par->item_idx ++] : NULL;
+
+    while (1)
+    {
+        // Empty lines are not items
+        while ((line = nextLine(&par->reader, NULL)) != NULL)
+            if (line[0] != '\0')
+                return line;
+        if (par->reader.isEOF || fillInput(&par->reader) == -1)
+            return NULL;
+    }
+}
+
+static char** buildArgs(Parallel* par, const char* item)
+{
+    char** argv = (char**) arenaAlloc(&par->arena, sizeof(char*) * (par->tmpl_num + 2));
+    size_t item_len = strlen(item);
+    int arg_idx;
+
+    for (arg_idx = 0 ; arg_idx < par->tmpl_num ; arg_idx ++)
+    {
+        const char* word = par->tmpl[arg_idx];
+        const char* mark;
+        char* out;
+        int count = 0;
+
+        for (mark = word ; (mark = strstr(mark, "{}")) != NULL ; mark += 2)
+            count ++;
+        if (count == 0)
+        {
+            argv[arg_idx] = (char*) word;
+            continue;
+        }
+
+        out = (char*) arenaAlloc(&par->arena, strlen(word) + count * item_len + 1);
+        argv[arg_idx] = out;
+        while ((mark = strstr(word, "{}")) != NULL)
+        {
+            memcpy(out, word, mark - word);
+            out += mark - word;
+            memcpy(out, item, item_len);
+            out += item_len;
+            word = mark + 2;
+        }
+        strcpy(out, word);
+    }
+
+    if (!par->hasPlaceholder)
+        argv[arg_idx ++] = (char*) item;
+    argv[arg_idx] = NULL;
+    return argv;
+}
+
+static void startItem(Parallel* par, ParallelSlot* slot, const char* item)
+{
+    Command cmd;
+    Command* cmds[1] = { &cmd };
+    Command_handler cmd_hdr;
+    SpawnRequest req;
+    int status;
+    pid_t pid;
+
+    cmd.args = buildArgs(par, item);
+    for (cmd.arg_num = 0 ; cmd.args[cmd.arg_num] ; cmd.arg_num ++);
+
+    slot->out_fd = memfd_create("tsh-parallel", MFD_CLOEXEC);
+    slot->err_fd = memfd_create("tsh-parallel", MFD_CLOEXEC);
+    if (slot->out_fd == -1 || slot->err_fd == -1)
+    {
+        fprintf(stderr, "tsh: parallel: memfd_create: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    // Items must not eat the input the item list is read from. The
+    // first item leads the process group, the others join it while it
+    // still has a member which has not been reaped.
+    initSpawnRequest(&req);
+    req.inputFile = "/dev/null";
+    req.out_fd = slot->out_fd;
+    req.err_fd = slot->err_fd;
+    if (par->running == 0)
+        par->pgid = 0;
+    req.pgid = par->ownGroup ? par->pgid : -1;
+
+    if ((pid = launchCommand(&req, cmd.args, &status)) == -1)
+        goto fail;
+
+    cmd.pid = pid;
+    clock_gettime(CLOCK_MONOTONIC, &cmd.startTime);
+    cmd_hdr.isBackGround = 0;
+    cmd_hdr.cmd_num = 1;
+    cmd_hdr.cmds = cmds;
+    cmd_hdr.isTimed = 0;
+    cmd_hdr.placement = NULL;
+    cmd_hdr.priority = NULL;
+    slot->group = newProcessGroup(&cmd_hdr);
+    par->running ++;
+
+    if (par->ownGroup)
+    {
+        if (par->pgid == 0)
+        {
+            par->pgid = pid;
+            moveToForeground(slot->group);
+        }
+        slot->group->pgid = par->pgid;
+    }
+    arenaReset(&par->arena);
+    return;
+
+fail:
+    if (slot->out_fd != -1)
+        close(slot->out_fd);
+    if (slot->err_fd != -1)
+        close(slot->err_fd);
+    par->failed ++;
+    arenaReset(&par->arena);
+}
+
+static void finishItem(Parallel* par, ParallelSlot* slot)
+{
+    if (getExitCode(slot->group->procs[0].status) != 0)
+        par->failed ++;
+
+    fflush(stdout);
+    fflush(stderr);
+    lseek(slot->out_fd, 0, SEEK_SET);
+    lseek(slot->err_fd, 0, SEEK_SET);
+    copyFd(slot->out_fd, 1);
+    copyFd(slot->err_fd, 2);
+    close(slot->out_fd);
+    close(slot->err_fd);
+
+    freeProcessGroup(slot->group);
+    slot->group = NULL;
+    par->running --;
+}
+
+// Wait for one item to exit. Other children are reported as usual.
+static void waitItem(Parallel* par)
+{
+    ProcessGroup* group;
+    struct rusage usage;
+    pid_t pid;
+    int status;
+    int slot_idx;
+
+    if ((pid = wait4(-1, &status, 0, &usage)) == -1)
+    {
+        if (errno == EINTR)
+            return;
+
+        // Nothing left to wait for, should not happen
+        for (slot_idx = 0 ; slot_idx < par->slot_num ; slot_idx ++)
+            if (par->slots[slot_idx].group != NULL)
+                finishItem(par, &par->slots[slot_idx]);
+        return;
+    }
+
+    group = findProcessGroup(pid);
+    for (slot_idx = 0 ; slot_idx < par->slot_num ; slot_idx ++)
+    {
+        if (group != NULL && par->slots[slot_idx].group == group)
+        {
+            setProcessGroupStatus(pid, status, &usage, NULL, NULL);
+            finishItem(par, &par->slots[slot_idx]);
+            return;
+        }
+    }
+    handleChildStatus(pid, status, &usage);
+}
+
+// Return 0 if every item succeeded, the number of failed items (at most
+// 101) otherwise, and 255 for a usage error.
+//
+int tsh_parallel(int argc, char* argv[])
+{
+    Parallel par;
+    const char* itemFile = NULL;
+    char* item;
+    long jobs;
+    int arg_idx;
+    int fd = 0;
+
+    memset(&par, 0, sizeof(Parallel));
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (arg_idx = 1 ; arg_idx < argc && argv[arg_idx][0] == '-' ; arg_idx ++)
+    {
+        const char* value;
+        char opt = argv[arg_idx][1];
+
+        if (strcmp(argv[arg_idx], "--") == 0)
+        {
+            arg_idx ++;
+            break;
+        }
+        if (opt != 'j' && opt != 'a')
+            break;
+
+        value = (argv[arg_idx][2] != '\0') ? argv[arg_idx] + 2 : argv[++ arg_idx];
+        if (value == NULL)
+            goto usage;
+        if (opt == 'a')
+            itemFile = value;
+        else
+        {
+            char* end;
+            jobs = strtol(value, &end, 10);
+            if (*end != '\0' || jobs < 1 || jobs > 65536)
+                goto usage;
+        }
+    }
+
+    par.tmpl = argv + arg_idx;
+    for ( ; arg_idx < argc && strcmp(argv[arg_idx], ":::") != 0 ; arg_idx ++)
+    {
+        if (strstr(argv[arg_idx], "{}") != NULL)
+            par.hasPlaceholder = 1;
+        par.tmpl_num ++;
+    }
+    if (par.tmpl_num == 0)
+        goto usage;
+
+    if (arg_idx < argc)
+    {
+        par.items = argv + arg_idx + 1;
+        par.item_num = argc - arg_idx - 1;
+    }
+    else if (itemFile != NULL && (fd = open(itemFile, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        fprintf(stderr, "tsh: parallel: %s: %s\n", itemFile, strerror(errno));
+        return 255;
+    }
+    initInputReader(&par.reader, fd);
+    par.reader.joinLines = 0;
+
+    par.slot_num = (int) jobs;
+    par.slots = (ParallelSlot*) calloc(par.slot_num, sizeof(ParallelSlot));
+    par.ownGroup = (tsh_interactive && getpid() == tsh_pid);
+    arenaInit(&par.arena, 1024);
+
+    while (1)
+    {
+        int slot_idx = 0;
+        while (par.running < par.slot_num && (item = nextItem(&par)) != NULL)
+        {
+            while (par.slots[slot_idx].group != NULL)
+                slot_idx ++;
+            startItem(&par, &par.slots[slot_idx], item);
+        }
+        if (par.running == 0)
+            break;
+        waitItem(&par);
+    }
+
+    if (par.ownGroup)
+        moveToForeground(shellProcGroup);
+    if (fd != 0)
+        close(fd);
+    freeInputReader(&par.reader);
+    arenaFree(&par.arena);
+    free (par.slots);
+    return (par.failed > 101) ? 101 : par.failed;
+
+usage:
+    fprintf(stderr, "Usage: parallel [-j N] [-a file] command [args ...] [::: items ...]\n");
+    return 255;
+}
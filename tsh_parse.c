@@ -0,0 +1,968 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tsh.h"
+#include "tsh_parse.h"
+#include "tsh_alias.h"
+#include "tsh_var.h"
+#include "tsh_cgroup.h"
+#include "tsh_place.h"
+#include "tsh_prio.h"
+
+// Single pass lexer
+//
+// Words keep their quotes, so that the expansion step still sees
+// the text the user typed. Operators are recognized here, outside
+// of quotes, and never show up as words. The input is not NUL
+// terminated; a newline separates commands, and a backslash-newline
+// is a blank between words.
+//
+void initLexer(Lexer* lex, const char* input, size_t len, Arena* arena)
+{
+    lex->pos = input;
+    lex->end = input + len;
+    lex->start = input;
+    lex->arena = arena;
+    lex->type = TOK_END;
+    lex->word = NULL;
+}
+
+static int isBlank(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+static int isOperator(char c)
+{
+    return (c == '|' || c == '<' || c == '>' || c == '&' || c == ';');
+}
+
+TokenType nextToken(Lexer* lex)
+{
+    const char* p = lex->pos;
+    const char* end = lex->end;
+    const char* start;
+
+    while (p < end && ((isBlank(*p) && *p != '\n') || (*p == '\\' && p + 1 < end && p[1] == '\n')))
+        p += (*p == '\\') ? 2 : 1;
+
+    // Comment runs to the end of the line
+    if (p < end && *p == '#')
+        while (p < end && *p != '\n')
+            p ++;
+
+    lex->word = NULL;
+    lex->start = p;
+    if (p == end || *p == '\0')
+    {
+        lex->pos = p;
+        return (lex->type = TOK_END);
+    }
+    switch (*p)
+    {
+        case '\n':
+            lex->pos = p + 1;
+            return (lex->type = TOK_NEWLINE);
+        case ';':
+            lex->pos = p + 1;
+            return (lex->type = TOK_SEMI);
+        case '|':
+            if (p + 1 < end && p[1] == '|')
+            {
+                lex->pos = p + 2;
+                return (lex->type = TOK_OR);
+            }
+            lex->pos = p + 1;
+            return (lex->type = TOK_PIPE);
+        case '<':
+            lex->pos = p + 1;
+            return (lex->type = TOK_IN);
+        case '>':
+            lex->pos = p + 1;
+            return (lex->type = TOK_OUT);
+        case '&':
+            if (p + 1 < end && p[1] == '&')
+            {
+                lex->pos = p + 2;
+                return (lex->type = TOK_AND);
+            }
+            lex->pos = p + 1;
+            return (lex->type = TOK_AMP);
+    }
+
+    start = p;
+    while (p < end && *p && !isBlank(*p) && !isOperator(*p))
+    {
+        if (*p == '\'' || *p == '"')
+        {
+            char quote = *p ++;
+            while (p < end && *p != quote)
+            {
+                if (quote == '"' && *p == '\\' && p + 1 < end)
+                    p ++;
+                p ++;
+            }
+            if (p >= end)
+            {
+                fprintf(stderr, "tsh: unterminated quote\n");
+                lex->pos = end;
+                return (lex->type = TOK_ERROR);
+            }
+            p ++;
+        }
+        else if (*p == '\\' && p + 1 < end)
+            p += 2;
+        else
+            p ++;
+    }
+
+    lex->word = arenaStrndup(lex->arena, start, p - start);
+    lex->pos = p;
+    return (lex->type = TOK_WORD);
+}
+
+typedef struct WordNode
+{
+    char* word;
+    struct WordNode* next;
+} WordNode;
+
+typedef struct CommandNode
+{
+    Command* cmd;
+    struct CommandNode* next;
+} CommandNode;
+
+static const char* tokenName(TokenType type)
+{
+    switch (type)
+    {
+        case TOK_PIPE: return "|";
+        case TOK_IN:   return "<";
+        case TOK_OUT:  return ">";
+        case TOK_AMP:  return "&";
+        case TOK_SEMI: return ";";
+        case TOK_AND:  return "&&";
+        case TOK_OR:   return "||";
+        default:       return "newline";
+    }
+}
+
+// Append the words of an alias to the word list of a command
+static int appendAliasWords(Lexer* lex, const char* alias, WordNode*** tail, int* arg_num)
+{
+    Lexer sub;
+
+    initLexer(&sub, alias, strlen(alias), lex->arena);
+    while (nextToken(&sub) == TOK_WORD)
+    {
+        WordNode* node = (WordNode*) arenaAlloc(lex->arena, sizeof(WordNode));
+        node->word = sub.word;
+        node->next = NULL;
+        **tail = node;
+        *tail = &node->next;
+        (*arg_num) ++;
+    }
+    if (sub.type != TOK_END)
+    {
+        if (sub.type != TOK_ERROR)
+            fprintf(stderr, "tsh: alias '%s' may only hold words\n", lex->word);
+        return -1;
+    }
+    return 0;
+}
+
+// NAME=value, the name unquoted
+static int isAssignmentWord(const char* word)
+{
+    const char* eq = strchr(word, '=');
+    return (eq != NULL && isValidName(word, eq - word));
+}
+
+static char** listWords(Arena* arena, WordNode* head, int num)
+{
+    char** ret = (char**) arenaAlloc(arena, sizeof(char*) * (num + 1));
+    int idx;
+
+    for (idx = 0 ; head ; idx ++, head = head->next)
+        ret[idx] = head->word;
+    ret[num] = NULL;
+    return ret;
+}
+
+// Parse one command of a pipeline. The lexer must be positioned on the
+// first token of the command; on return it is on the token following it.
+// Assignments before the command name are kept apart from the arguments,
+// and a command may consist of assignments only.
+//
+Command* parse_cmd(Lexer* lex)
+{
+    Command* ret = (Command*) arenaAlloc(lex->arena, sizeof(Command));
+    WordNode* head = NULL;
+    WordNode** tail = &head;
+    WordNode* assigns = NULL;
+    WordNode** assign_tail = &assigns;
+
+    ret->inputFile = NULL;
+    ret->outputFile = NULL;
+    ret->arg_num = 0;
+    ret->assign_num = 0;
+    ret->isPath = 0;
+    ret->pid = -1;
+    ret->compound = NULL;
+    memset(&ret->startTime, 0, sizeof(ret->startTime));
+
+    while (1)
+    {
+        const char* alias;
+
+        if (lex->type == TOK_WORD && ret->arg_num == 0 && isAssignmentWord(lex->word))
+        {
+            WordNode* node = (WordNode*) arenaAlloc(lex->arena, sizeof(WordNode));
+            node->word = lex->word;
+            node->next = NULL;
+            *assign_tail = node;
+            assign_tail = &node->next;
+            ret->assign_num ++;
+        }
+        // The command word may be an alias, which is not expanded again
+        else if (lex->type == TOK_WORD && ret->arg_num == 0 && head == NULL &&
+            (alias = findAlias(lex->word)) != NULL)
+        {
+            if (appendAliasWords(lex, alias, &tail, &ret->arg_num) == -1)
+                return NULL;
+        }
+        else if (lex->type == TOK_WORD)
+        {
+            WordNode* node = (WordNode*) arenaAlloc(lex->arena, sizeof(WordNode));
+            node->word = lex->word;
+            node->next = NULL;
+            *tail = node;
+            tail = &node->next;
+            ret->arg_num ++;
+        }
+        else if (lex->type == TOK_IN || lex->type == TOK_OUT)
+        {
+            TokenType redirect = lex->type;
+            if (nextToken(lex) != TOK_WORD)
+            {
+                if (lex->type != TOK_ERROR)
+                    fprintf(stderr, "tsh: syntax error near '%s'\n", tokenName(lex->type));
+                return NULL;
+            }
+            if (redirect == TOK_IN)
+                ret->inputFile = lex->word;
+            else
+                ret->outputFile = lex->word;
+        }
+        else
+            break;
+
+        nextToken(lex);
+    }
+
+    if (lex->type == TOK_ERROR)
+        return NULL;
+    if (ret->arg_num == 0 && ret->assign_num == 0)
+    {
+        fprintf(stderr, "tsh: syntax error near '%s'\n", tokenName(lex->type));
+        return NULL;
+    }
+
+    ret->args = listWords(lex->arena, head, ret->arg_num);
+    ret->assigns = listWords(lex->arena, assigns, ret->assign_num);
+
+    if (ret->arg_num > 0 && strchr(ret->args[0], '/') != NULL)
+        ret->isPath = 1;
+
+    return ret;
+}
+
+// Parse a size like 65536, 512K or 4M. Return -1 if it is not one.
+long parseSize(const char* str)
+{
+    char* end;
+    long size;
+
+    if (*str < '0' || *str > '9')
+        return -1;
+    size = strtol(str, &end, 10);
+    switch (*end)
+    {
+        case 'k': case 'K': size <<= 10; end ++; break;
+        case 'm': case 'M': size <<= 20; end ++; break;
+        case 'g': case 'G': size <<= 30; end ++; break;
+    }
+    if (*end != '\0' || size < 0 || size > 0x7fffffff)
+        return -1;
+    return size;
+}
+
+// A pipeline may start with @name=value words setting attributes
+// of the whole pipeline: @pipe=SIZE, a limit of the cgroup of the job
+// (@cpu.max=, @memory.max=, @io.max=), its placement (@cpus=LIST,
+// @node=N) or its priority (@nice=, @sched=, @ioprio=). Return 0, or
+// -1 for an unknown attribute.
+//
+static int parsePipelineAttr(Command_handler* cmd_hdr, const char* word, Arena* arena)
+{
+    const char* value = strchr(word, '=') + 1;
+    char limit[256];
+    Priority prio;
+    long size;
+    int idx;
+
+    if (strncmp(word, "@pipe=", 6) == 0 && (size = parseSize(value)) >= 0)
+    {
+        cmd_hdr->pipeSize = (int) size;
+        return 0;
+    }
+    if (strncmp(word, "@cpus=", 6) == 0 || strncmp(word, "@node=", 6) == 0)
+    {
+        CpuMask cpus;
+        char* end;
+
+        if (cmd_hdr->placement == NULL)
+        {
+            cmd_hdr->placement = (Placement*) arenaAlloc(arena, sizeof(Placement));
+            memset(cmd_hdr->placement, 0, sizeof(Placement));
+            cmd_hdr->placement->node = -1;
+        }
+        if (word[1] == 'c' && parseCpuList(value, strlen(value), &cpus) == 0 && *value)
+        {
+            cmd_hdr->placement->cpus = cpus;
+            return 0;
+        }
+        if (word[1] == 'n' && (size = strtol(value, &end, 10)) >= 0 && size < PLACE_MAX_NODES &&
+            end != value && *end == '\0')
+        {
+            cmd_hdr->placement->node = (int) size;
+            return 0;
+        }
+    }
+    else if ((idx = parsePriority(word + 1, value - word - 2, value, &prio)) != -2)
+    {
+        if (idx == 0)
+        {
+            if (cmd_hdr->priority == NULL)
+            {
+                cmd_hdr->priority = (Priority*) arenaAlloc(arena, sizeof(Priority));
+                initPriority(cmd_hdr->priority);
+            }
+            if (prio.nice != PRIO_UNSET)
+                cmd_hdr->priority->nice = prio.nice;
+            if (prio.policy != PRIO_UNSET)
+                cmd_hdr->priority->policy = prio.policy;
+            if (prio.ioprio != PRIO_UNSET)
+                cmd_hdr->priority->ioprio = prio.ioprio;
+            return 0;
+        }
+    }
+    else if ((idx = findCgroupLimit(word + 1, value - word - 2)) != -1 &&
+        formatCgroupLimit(idx, value, limit, sizeof(limit)) == 0)
+    {
+        cmd_hdr->cgroupLimits[idx] = arenaStrndup(arena, limit, strlen(limit));
+        return 0;
+    }
+    fprintf(stderr, "tsh: bad pipeline attribute '%s'\n", word);
+    return -1;
+}
+
+// Parser of programs: lists of pipelines joined by ; & && || and
+// newlines, and the compound commands if, while, until, for, { } and
+// function definitions. Reserved words are only reserved where a
+// command starts. The input may end in the middle of a command, after
+// a | && or || or before the fi of an if for instance; that is not an
+// error but a request for more lines.
+//
+typedef struct Parser
+{
+    Lexer lex;
+    int isIncomplete;     // the input ended inside a command
+    const char* end;      // end of the last closing word read
+} Parser;
+
+static Node* parseAndOr(Parser*);
+static Node* parseCompound(Parser*);
+
+static Node* newNode(Arena* arena, NodeType type)
+{
+    Node* node = (Node*) arenaAlloc(arena, sizeof(Node));
+    memset(node, 0, sizeof(Node));
+    node->type = type;
+    return node;
+}
+
+static int isWord(Parser* ps, const char* word)
+{
+    return (ps->lex.type == TOK_WORD && strcmp(ps->lex.word, word) == 0);
+}
+
+// then, do, fi and the others end the list before them
+static int isClosingWord(Parser* ps)
+{
+    static const char* closing[] = { "then", "elif", "else", "fi", "do", "done", "}", NULL };
+    int idx;
+
+    for (idx = 0 ; ps->lex.type == TOK_WORD && closing[idx] ; idx ++)
+        if (strcmp(ps->lex.word, closing[idx]) == 0)
+            return 1;
+    return 0;
+}
+
+static void skipNewlines(Parser* ps)
+{
+    while (ps->lex.type == TOK_NEWLINE)
+        nextToken(&ps->lex);
+}
+
+// Report what was found instead of what the grammar needs, unless the
+// input simply ended there. Return NULL.
+//
+static Node* syntaxError(Parser* ps)
+{
+    if (ps->lex.type == TOK_END)
+        ps->isIncomplete = 1;
+    else if (ps->lex.type == TOK_WORD)
+        fprintf(stderr, "tsh: syntax error near '%s'\n", ps->lex.word);
+    else if (ps->lex.type != TOK_ERROR)
+        fprintf(stderr, "tsh: syntax error near '%s'\n", tokenName(ps->lex.type));
+    return NULL;
+}
+
+// Skip the closing word the lexer is on
+static void closeWord(Parser* ps)
+{
+    ps->end = ps->lex.pos;
+    nextToken(&ps->lex);
+}
+
+static int isCompoundWord(Parser* ps)
+{
+    static const char* opening[] = { "if", "while", "until", "for", "{", NULL };
+    int idx;
+
+    for (idx = 0 ; ps->lex.type == TOK_WORD && opening[idx] ; idx ++)
+        if (strcmp(ps->lex.word, opening[idx]) == 0)
+            return 1;
+    return 0;
+}
+
+static Command_handler* newPipeline(Arena* arena)
+{
+    Command_handler* ret = (Command_handler*) arenaAlloc(arena, sizeof(Command_handler));
+
+    ret->isBackGround = 0;
+    ret->cmd_num = 0;
+    ret->cmds = NULL;
+    ret->pipeSize = 0;
+    ret->isTimed = 0;
+    memset(ret->cgroupLimits, 0, sizeof(ret->cgroupLimits));
+    ret->placement = NULL;
+    ret->priority = NULL;
+    return ret;
+}
+
+// A stage which runs a command list, with no arguments of its own. text
+// runs up to end, it names the stage in the job table.
+//
+static Command* newCompoundStage(Arena* arena, Node* compound, const char* text, const char* end)
+{
+    Command* ret = (Command*) arenaAlloc(arena, sizeof(Command));
+
+    memset(ret, 0, sizeof(Command));
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n'))
+        end --;
+    compound->text = text;
+    compound->text_len = end - text;
+    ret->compound = compound;
+    ret->args = listWords(arena, NULL, 0);
+    ret->assigns = ret->args;
+    ret->pid = -1;
+    return ret;
+}
+
+// Make a list run as one background job. Anything else than a single
+// pipeline becomes the only stage of one, a list of several commands
+// as if it was in { }. text runs up to end, it names the job.
+//
+Node* newBackgroundJob(Arena* arena, Node* list, const char* text, const char* end)
+{
+    Node* job = list;
+
+    if (list->next != NULL)
+    {
+        Node* group = newNode(arena, NODE_GROUP);
+        group->body = list;
+        list = group;
+    }
+    if (list->type != NODE_PIPELINE || list->isNegated)
+    {
+        job = newNode(arena, NODE_PIPELINE);
+        job->pipeline = newPipeline(arena);
+        job->pipeline->cmd_num = 1;
+        job->pipeline->cmds = (Command**) arenaAlloc(arena, sizeof(Command*));
+        job->pipeline->cmds[0] = newCompoundStage(arena, list, text, end);
+    }
+    job->pipeline->isBackGround = 1;
+    return job;
+}
+
+// A compound command as a stage of a pipeline, followed by its
+// redirections. compound is NULL if it is still to be parsed.
+//
+static Command* parseCompoundStage(Parser* ps, Node* compound, const char* start)
+{
+    Lexer* lex = &ps->lex;
+    Command* ret;
+
+    if (compound == NULL && (compound = parseCompound(ps)) == NULL)
+        return NULL;
+    ret = newCompoundStage(lex->arena, compound, start, ps->end);
+    while (lex->type == TOK_IN || lex->type == TOK_OUT)
+    {
+        TokenType redirect = lex->type;
+        if (nextToken(lex) != TOK_WORD)
+        {
+            syntaxError(ps);
+            return NULL;
+        }
+        if (redirect == TOK_IN)
+            ret->inputFile = lex->word;
+        else
+            ret->outputFile = lex->word;
+        nextToken(lex);
+    }
+    if (lex->type == TOK_WORD)
+    {
+        syntaxError(ps);
+        return NULL;
+    }
+    return ret;
+}
+
+// A pipeline with its time keyword and @attributes. Its stages are
+// simple commands or compound commands; first is a compound command
+// already parsed from start, as the first stage. The lexer is left on
+// the token after it, & included.
+//
+static Command_handler* parsePipeline(Parser* ps, Node* first, const char* start)
+{
+    Lexer* lex = &ps->lex;
+    Arena* arena = lex->arena;
+    Command_handler* ret = newPipeline(arena);
+    CommandNode* head = NULL;
+    CommandNode** tail = &head;
+    int hasPrefix = 0;
+    int cmd_idx;
+
+    while (first == NULL && lex->type == TOK_WORD)
+    {
+        if (strcmp(lex->word, "time") == 0)
+            ret->isTimed = 1;
+        else if (lex->word[0] == '@' && strchr(lex->word, '=') != NULL)
+        {
+            if (parsePipelineAttr(ret, lex->word, arena) == -1)
+                return NULL;
+        }
+        else
+            break;
+        hasPrefix = 1;
+        nextToken(lex);
+    }
+    if ((hasPrefix || lex->type == TOK_END) && first == NULL &&
+        lex->type != TOK_WORD && lex->type != TOK_IN && lex->type != TOK_OUT)
+        return ret;
+
+    while (1)
+    {
+        Command* cmd;
+        CommandNode* node;
+
+        if (first != NULL)
+            cmd = parseCompoundStage(ps, first, start);
+        else if (isCompoundWord(ps))
+            cmd = parseCompoundStage(ps, NULL, lex->start);
+        else
+            cmd = parse_cmd(lex);
+        first = NULL;
+        if (cmd == NULL)
+            return NULL;
+
+        node = (CommandNode*) arenaAlloc(arena, sizeof(CommandNode));
+        node->cmd = cmd;
+        node->next = NULL;
+        *tail = node;
+        tail = &node->next;
+        ret->cmd_num ++;
+
+        if (lex->type != TOK_PIPE)
+            break;
+        nextToken(lex);
+        skipNewlines(ps);
+        if (lex->type == TOK_END)
+        {
+            ps->isIncomplete = 1;
+            return NULL;
+        }
+    }
+
+    ret->cmds = (Command**) arenaAlloc(arena, sizeof(Command*) * ret->cmd_num);
+    for (cmd_idx = 0 ; head ; cmd_idx ++, head = head->next)
+        ret->cmds[cmd_idx] = head->cmd;
+
+    return ret;
+}
+
+// Commands up to a closing word or the end of the input, possibly none.
+// Return 0, or -1 on error.
+//
+static int parseList(Parser* ps, Node** list)
+{
+    Node** tail = list;
+
+    *list = NULL;
+    skipNewlines(ps);
+    while (ps->lex.type != TOK_END && !isClosingWord(ps))
+    {
+        const char* start = ps->lex.start;
+        Node* node;
+
+        if ((node = parseAndOr(ps)) == NULL)
+            return -1;
+
+        if (ps->lex.type == TOK_AMP)
+            node = newBackgroundJob(ps->lex.arena, node, start, ps->lex.start);
+        *tail = node;
+        tail = &node->next;
+
+        if (ps->lex.type != TOK_AMP && ps->lex.type != TOK_SEMI && ps->lex.type != TOK_NEWLINE)
+        {
+            if (ps->lex.type == TOK_END || isClosingWord(ps))
+                break;
+            syntaxError(ps);
+            return -1;
+        }
+        nextToken(&ps->lex);
+        skipNewlines(ps);
+    }
+    return 0;
+}
+
+// A list which may not be empty, ending with one of the given words.
+// The lexer is left on that word. Return its index, or -1.
+//
+static int parseBlock(Parser* ps, Node** list, const char** ends)
+{
+    int idx;
+
+    if (parseList(ps, list) == -1)
+        return -1;
+    for (idx = 0 ; ends[idx] ; idx ++)
+    {
+        if (isWord(ps, ends[idx]))
+        {
+            if (*list != NULL)
+                return idx;
+            break;
+        }
+    }
+    syntaxError(ps);
+    return -1;
+}
+
+static Node* parseIf(Parser* ps)
+{
+    static const char* thenWord[] = { "then", NULL };
+    static const char* ifEnds[] = { "elif", "else", "fi", NULL };
+    static const char* fiWord[] = { "fi", NULL };
+    Node* node = newNode(ps->lex.arena, NODE_IF);
+
+    nextToken(&ps->lex);
+    if (parseBlock(ps, &node->cond, thenWord) == -1)
+        return NULL;
+    nextToken(&ps->lex);
+    switch (parseBlock(ps, &node->body, ifEnds))
+    {
+        case 0:
+            if ((node->orElse = parseIf(ps)) == NULL)
+                return NULL;
+            break;
+        case 1:
+            nextToken(&ps->lex);
+            if (parseBlock(ps, &node->orElse, fiWord) == -1)
+                return NULL;
+            closeWord(ps);
+            break;
+        case 2:
+            closeWord(ps);
+            break;
+        default:
+            return NULL;
+    }
+    return node;
+}
+
+static const char* doneWord[] = { "done", NULL };
+
+// while list; do list; done
+static Node* parseWhile(Parser* ps, NodeType type)
+{
+    static const char* doWord[] = { "do", NULL };
+    Node* node = newNode(ps->lex.arena, type);
+
+    nextToken(&ps->lex);
+    if (parseBlock(ps, &node->cond, doWord) == -1)
+        return NULL;
+    nextToken(&ps->lex);
+    if (parseBlock(ps, &node->body, doneWord) == -1)
+        return NULL;
+    closeWord(ps);
+    return node;
+}
+
+// for NAME [in WORD ...]; do list done
+static Node* parseFor(Parser* ps)
+{
+    Lexer* lex = &ps->lex;
+    Node* node = newNode(lex->arena, NODE_FOR);
+
+    if (nextToken(lex) != TOK_WORD || !isValidName(lex->word, strlen(lex->word)))
+        return syntaxError(ps);
+    node->name = lex->word;
+    nextToken(lex);
+    skipNewlines(ps);
+    if (isWord(ps, "in"))
+    {
+        WordNode* head = NULL;
+        WordNode** tail = &head;
+
+        while (nextToken(lex) == TOK_WORD)
+        {
+            WordNode* word = (WordNode*) arenaAlloc(lex->arena, sizeof(WordNode));
+            word->word = lex->word;
+            word->next = NULL;
+            *tail = word;
+            tail = &word->next;
+            node->word_num ++;
+        }
+        if (lex->type != TOK_SEMI && lex->type != TOK_NEWLINE)
+            return syntaxError(ps);
+        node->words = listWords(lex->arena, head, node->word_num);
+        nextToken(lex);
+    }
+    else if (lex->type == TOK_SEMI)
+        nextToken(lex);
+
+    skipNewlines(ps);
+    if (!isWord(ps, "do"))
+        return syntaxError(ps);
+    nextToken(lex);
+    if (parseBlock(ps, &node->body, doneWord) == -1)
+        return NULL;
+    closeWord(ps);
+    return node;
+}
+
+static Node* parseGroup(Parser* ps)
+{
+    static const char* closeBrace[] = { "}", NULL };
+    Node* node = newNode(ps->lex.arena, NODE_GROUP);
+
+    nextToken(&ps->lex);
+    if (parseBlock(ps, &node->body, closeBrace) == -1)
+        return NULL;
+    closeWord(ps);
+    return node;
+}
+
+static Node* parseCompound(Parser* ps)
+{
+    if (isWord(ps, "if"))
+        return parseIf(ps);
+    if (isWord(ps, "while"))
+        return parseWhile(ps, NODE_WHILE);
+    if (isWord(ps, "until"))
+        return parseWhile(ps, NODE_UNTIL);
+    if (isWord(ps, "for"))
+        return parseFor(ps);
+    if (isWord(ps, "{"))
+        return parseGroup(ps);
+    return syntaxError(ps);
+}
+
+// name() compound, name () compound or function name [()] compound.
+// The lexer is on the name, or on function. Return NULL if it is not a
+// function definition after all.
+//
+static Node* parseFunction(Parser* ps, int* isError)
+{
+    Lexer* lex = &ps->lex;
+    const char* start = lex->start;
+    Node* node;
+    char* name = lex->word;
+    size_t len = strlen(name);
+
+    if (strcmp(name, "function") == 0)
+    {
+        if (nextToken(lex) != TOK_WORD)
+            goto error;
+        name = lex->word;
+        len = strlen(name);
+        if (len > 2 && strcmp(name + len - 2, "()") == 0)
+            len -= 2;
+        if (!isValidName(name, len))
+            goto error;
+        if (nextToken(lex) == TOK_WORD && strcmp(lex->word, "()") == 0)
+            nextToken(lex);
+    }
+    else if (len > 2 && strcmp(name + len - 2, "()") == 0 && isValidName(name, len - 2))
+    {
+        len -= 2;
+        nextToken(lex);
+    }
+    else
+    {
+        // Only name () is left, look for the () right away
+        const char* p = lex->pos;
+        while (p < lex->end && (*p == ' ' || *p == '\t'))
+            p ++;
+        if (p + 1 >= lex->end || p[0] != '(' || p[1] != ')' || !isValidName(name, len))
+            return NULL;
+        nextToken(lex);
+        nextToken(lex);
+    }
+
+    skipNewlines(ps);
+    node = newNode(lex->arena, NODE_FUNCTION);
+    node->name = arenaStrndup(lex->arena, name, len);
+    if ((node->body = parseCompound(ps)) == NULL)
+    {
+        *isError = 1;
+        return NULL;
+    }
+    node->text = start;
+    node->text_len = ps->end - start;
+    return node;
+
+error:
+    *isError = 1;
+    return syntaxError(ps);
+}
+
+// [!] pipeline or compound command
+static Node* parseCommand(Parser* ps)
+{
+    Lexer* lex = &ps->lex;
+    Node* node;
+    int isNegated = 0;
+    int isError = 0;
+
+    if (isWord(ps, "!"))
+    {
+        isNegated = 1;
+        nextToken(lex);
+    }
+
+    if (isCompoundWord(ps))
+    {
+        // Piped or redirected, it is the first stage of a pipeline
+        const char* start = lex->start;
+        if ((node = parseCompound(ps)) != NULL &&
+            (lex->type == TOK_PIPE || lex->type == TOK_IN || lex->type == TOK_OUT))
+        {
+            Command_handler* pipeline;
+            if ((pipeline = parsePipeline(ps, node, start)) == NULL)
+                return NULL;
+            node = newNode(lex->arena, NODE_PIPELINE);
+            node->pipeline = pipeline;
+        }
+    }
+    else if (isClosingWord(ps))
+        return syntaxError(ps);
+    else if (lex->type == TOK_WORD && !isNegated &&
+             ((node = parseFunction(ps, &isError)) != NULL || isError))
+        return node;
+    else
+    {
+        Command_handler* pipeline;
+        if (lex->type == TOK_END)
+            return syntaxError(ps);
+        if ((pipeline = parsePipeline(ps, NULL, NULL)) == NULL)
+            return NULL;
+        node = newNode(lex->arena, NODE_PIPELINE);
+        node->pipeline = pipeline;
+    }
+    if (node != NULL)
+        node->isNegated = isNegated;
+    return node;
+}
+
+static Node* parseAndOr(Parser* ps)
+{
+    Node* left;
+
+    if ((left = parseCommand(ps)) == NULL)
+        return NULL;
+    while (ps->lex.type == TOK_AND || ps->lex.type == TOK_OR)
+    {
+        Node* node = newNode(ps->lex.arena, (ps->lex.type == TOK_AND) ? NODE_AND : NODE_OR);
+
+        nextToken(&ps->lex);
+        skipNewlines(ps);
+        node->cond = left;
+        if ((node->body = parseCommand(ps)) == NULL)
+            return NULL;
+        left = node;
+    }
+    return left;
+}
+
+// Parse input of one or more lines into a list of commands, allocated
+// from the arena. Return 0, -1 after reporting a syntax error, or 1 if
+// the input ends inside a command.
+//
+int parseProgram(const char* input, size_t len, Arena* arena, Node** program)
+{
+    Parser ps;
+
+    initLexer(&ps.lex, input, len, arena);
+    ps.isIncomplete = 0;
+    ps.end = input;
+    nextToken(&ps.lex);
+    if (parseList(&ps, program) == -1)
+        return ps.isIncomplete ? 1 : -1;
+    if (ps.lex.type != TOK_END)
+    {
+        syntaxError(&ps);
+        return -1;
+    }
+    return 0;
+}
+
+// Parse a line holding a single pipeline. Everything is allocated from
+// the given arena and is released with it. Return NULL on syntax error.
+//
+Command_handler* parse_cmd_hdr(const char* input, size_t len, Arena* arena)
+{
+    Parser ps;
+    Command_handler* ret;
+
+    initLexer(&ps.lex, input, len, arena);
+    ps.isIncomplete = 0;
+    ps.end = input;
+    nextToken(&ps.lex);
+    if ((ret = parsePipeline(&ps, NULL, NULL)) == NULL)
+        return NULL;
+    if (ps.lex.type == TOK_AMP)
+    {
+        ret->isBackGround = 1;
+        nextToken(&ps.lex);
+    }
+    if (ps.lex.type != TOK_END)
+    {
+        fprintf(stderr, "tsh: Unrecognized format.\n");
+        return NULL;
+    }
+    return ret;
+}
@@ -0,0 +1,74 @@
+#ifndef __TSH_PARSE_H__
+#define __TSH_PARSE_H__
+
+#include "tsh.h"
+#include "tsh_arena.h"
+
+typedef enum TokenType
+{
+    TOK_WORD,
+    TOK_PIPE,   // |
+    TOK_IN,     // <
+    TOK_OUT,    // >
+    TOK_AMP,    // &
+    TOK_SEMI,   // ;
+    TOK_AND,    // &&
+    TOK_OR,     // ||
+    TOK_NEWLINE,
+    TOK_END,
+    TOK_ERROR
+} TokenType;
+
+typedef struct Lexer
+{
+    const char* pos;
+    const char* end;
+    const char* start;  // of the current token
+    Arena* arena;
+    TokenType type;  // current token
+    char* word;      // text of the current TOK_WORD, quotes kept
+} Lexer;
+
+typedef enum NodeType
+{
+    NODE_PIPELINE,
+    NODE_AND,       // cond && body
+    NODE_OR,        // cond || body
+    NODE_IF,        // if cond; then body; else orElse; fi
+    NODE_WHILE,     // while cond; do body; done
+    NODE_UNTIL,
+    NODE_FOR,       // for name in words; do body; done
+    NODE_GROUP,     // { body; }
+    NODE_FUNCTION   // name() body
+} NodeType;
+
+// A command of a parsed program; lists of them are chained by next.
+// Nodes are not changed by running them, so the body of a loop or of a
+// function runs again and again from the same nodes.
+typedef struct Node
+{
+    NodeType type;
+    int isNegated;               // ! in front of it
+    Command_handler* pipeline;   // NODE_PIPELINE
+    struct Node* cond;
+    struct Node* body;
+    struct Node* orElse;         // an elif is a NODE_IF here
+    char* name;                  // variable of a for, name of a function
+    char** words;                // of a for as written, NULL: "$@"
+    int word_num;
+    const char* text;            // whole function definition as written, or
+                                 // the command of a compound pipeline stage
+    size_t text_len;
+    struct Node* next;
+} Node;
+
+void initLexer(Lexer*, const char*, size_t, Arena*);
+TokenType nextToken(Lexer*);
+
+int parseProgram(const char*, size_t, Arena*, Node**);
+Node* newBackgroundJob(Arena*, Node*, const char*, const char*);
+Command_handler* parse_cmd_hdr(const char*, size_t, Arena*);
+long parseSize(const char*);
+Command* parse_cmd(Lexer*);
+
+#endif
@@ -0,0 +1,492 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "tsh_place.h"
+#include "tsh_job.h"
+
+// CPU and memory placement of jobs
+//
+// A job runs on the CPUs given with @cpus=LIST and takes its memory
+// from the NUMA node given with @node=N, or, while "set autoplace cpu"
+// or "set autoplace node", a background job is put on the least loaded
+// CPU or node. The load of a CPU is its busy time since the last look
+// at /proc/stat, plus the jobs of this shell placed on it.
+//
+// Affinity and memory policy are inherited through clone() and kept
+// across exec, so a command gets them before its first instruction:
+// posix_spawn() runs while the shell itself is switched over to the
+// placement (enterPlacement / leavePlacement), and a child started by
+// the spawn helper or by clone3() applies it on itself before exec.
+//
+// Memory of an explicit @node= comes from that node only (MPOL_BIND),
+// automatic placement only prefers the node, and falls back to others
+// when it is full.
+//
+#define MASK_BITS (8 * sizeof(unsigned long))
+#define NODE_MASK_BITS (PLACE_MAX_NODES + 1)   // maxnode of the syscalls
+
+typedef struct Topology
+{
+    int isRead;
+    CpuMask usable;              // affinity of the shell
+    int shellPolicy;             // memory policy of the shell
+    unsigned long shellNodes;
+    int node_num;
+    int nodeIDs[PLACE_MAX_NODES];
+    CpuMask nodeCpus[PLACE_MAX_NODES];
+    double busy[PLACE_MAX_CPUS];     // busy fraction in the last period
+    double jobs[PLACE_MAX_CPUS];     // jobs of the shell placed on it
+    unsigned long long lastBusy[PLACE_MAX_CPUS];
+    unsigned long long lastTotal[PLACE_MAX_CPUS];
+    struct timespec lastSample;
+} Topology;
+
+static Topology topo;
+static const Placement* entered;
+
+static int maskIsSet(const CpuMask* mask, int cpu)
+{
+    return (mask->bits[cpu / MASK_BITS] >> (cpu % MASK_BITS)) & 1;
+}
+
+static void maskSet(CpuMask* mask, int cpu)
+{
+    mask->bits[cpu / MASK_BITS] |= 1UL << (cpu % MASK_BITS);
+}
+
+static int maskCount(const CpuMask* mask)
+{
+    int count = 0;
+    size_t idx;
+    for (idx = 0 ; idx < sizeof(mask->bits) / sizeof(unsigned long) ; idx ++)
+        count += __builtin_popcountl(mask->bits[idx]);
+    return count;
+}
+
+static void maskAnd(CpuMask* mask, const CpuMask* other)
+{
+    size_t idx;
+    for (idx = 0 ; idx < sizeof(mask->bits) / sizeof(unsigned long) ; idx ++)
+        mask->bits[idx] &= other->bits[idx];
+}
+
+// "0-3,8,10-11" as used by taskset and sysfs. Return 0, or -1.
+int parseCpuList(const char* str, size_t len, CpuMask* mask)
+{
+    const char* end = str + len;
+
+    memset(mask, 0, sizeof(CpuMask));
+    while (str < end && *str != '\n')
+    {
+        long first, last;
+        char* pos;
+
+        if (*str < '0' || *str > '9')
+            return -1;
+        first = last = strtol(str, &pos, 10);
+        if (pos < end && *pos == '-')
+        {
+            if (pos + 1 >= end || pos[1] < '0' || pos[1] > '9')
+                return -1;
+            last = strtol(pos + 1, &pos, 10);
+        }
+        if (pos > end || last < first || last >= PLACE_MAX_CPUS)
+            return -1;
+        for ( ; first <= last ; first ++)
+            maskSet(mask, (int) first);
+        str = pos;
+        if (str < end && *str == ',')
+            str ++;
+        else if (str < end && *str != '\n')
+            return -1;
+    }
+    return 0;
+}
+
+int formatCpuList(const CpuMask* mask, char* buf, size_t size)
+{
+    size_t pos = 0;
+    int cpu = 0;
+
+    buf[0] = '\0';
+    while (cpu < PLACE_MAX_CPUS)
+    {
+        int last;
+        if (!maskIsSet(mask, cpu))
+        {
+            cpu ++;
+            continue;
+        }
+        for (last = cpu ; last + 1 < PLACE_MAX_CPUS && maskIsSet(mask, last + 1) ; last ++);
+        if (last == cpu)
+            pos += snprintf(buf + pos, size - pos, "%s%d", pos ? "," : "", cpu);
+        else
+            pos += snprintf(buf + pos, size - pos, "%s%d-%d", pos ? "," : "", cpu, last);
+        if (pos >= size)
+            return -1;
+        cpu = last + 1;
+    }
+    return 0;
+}
+
+static int readMaskFile(const char* path, CpuMask* mask)
+{
+    char buf[4096];
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return -1;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    return parseCpuList(buf, n, mask);
+}
+
+// CPUs and nodes, read once. Without sysfs, everything is node 0.
+static void readTopology()
+{
+    CpuMask online;
+    char path[128];
+    int node;
+
+    if (topo.isRead)
+        return;
+    topo.isRead = 1;
+
+    if (sched_getaffinity(0, sizeof(CpuMask), (cpu_set_t*) &topo.usable) == -1)
+        memset(&topo.usable, 0xff, sizeof(CpuMask));
+    if (syscall(SYS_get_mempolicy, &topo.shellPolicy, &topo.shellNodes, NODE_MASK_BITS, NULL, 0) == -1)
+    {
+        topo.shellPolicy = MPOL_DEFAULT;
+        topo.shellNodes = 0;
+    }
+
+    if (readMaskFile("/sys/devices/system/node/online", &online) == 0)
+    {
+        for (node = 0 ; node < PLACE_MAX_NODES ; node ++)
+        {
+            if (!maskIsSet(&online, node))
+                continue;
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            if (readMaskFile(path, &topo.nodeCpus[topo.node_num]) == -1)
+                continue;
+            maskAnd(&topo.nodeCpus[topo.node_num], &topo.usable);
+            topo.nodeIDs[topo.node_num ++] = node;
+        }
+    }
+    if (topo.node_num == 0)
+    {
+        topo.nodeIDs[0] = 0;
+        topo.nodeCpus[0] = topo.usable;
+        topo.node_num = 1;
+    }
+}
+
+// Return the CPUs of a node the shell may use, or -1 if it is not online
+int getNodeCpus(int node, CpuMask* mask)
+{
+    int idx;
+
+    readTopology();
+    for (idx = 0 ; idx < topo.node_num ; idx ++)
+    {
+        if (topo.nodeIDs[idx] == node)
+        {
+            *mask = topo.nodeCpus[idx];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Busy fraction of every CPU since the previous sample, if that is old
+// enough to tell anything
+//
+static void sampleLoad()
+{
+    struct timespec now;
+    char line[256];
+    FILE* fp;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (topo.lastSample.tv_sec != 0 && timespecDiff(&now, &topo.lastSample) < 0.1)
+        return;
+    if ((fp = fopen("/proc/stat", "re")) == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        unsigned long long val[8] = { 0 };
+        unsigned long long busy, total;
+        int cpu;
+
+        if (strncmp(line, "cpu", 3) != 0 || line[3] < '0' || line[3] > '9')
+            continue;
+        if (sscanf(line + 3, "%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+                   &val[0], &val[1], &val[2], &val[3], &val[4], &val[5], &val[6], &val[7]) < 5 ||
+            cpu < 0 || cpu >= PLACE_MAX_CPUS)
+            continue;
+
+        // idle and iowait are not busy
+        total = val[0] + val[1] + val[2] + val[3] + val[4] + val[5] + val[6] + val[7];
+        busy = total - val[3] - val[4];
+        if (topo.lastTotal[cpu] != 0 && total > topo.lastTotal[cpu])
+            topo.busy[cpu] = (double) (busy - topo.lastBusy[cpu]) / (total - topo.lastTotal[cpu]);
+        topo.lastBusy[cpu] = busy;
+        topo.lastTotal[cpu] = total;
+    }
+    fclose(fp);
+    topo.lastSample = now;
+}
+
+static double cpuLoad(int cpu)
+{
+    return topo.busy[cpu] + topo.jobs[cpu];
+}
+
+static void countPlacement(Placement* place, double sign)
+{
+    int cpu;
+
+    if (place->weight == 0)
+        return;
+    for (cpu = 0 ; cpu < PLACE_MAX_CPUS ; cpu ++)
+        if (maskIsSet(&place->cpus, cpu))
+            topo.jobs[cpu] += sign * place->weight;
+}
+
+// Least loaded CPU the shell may use
+static int pickCpu()
+{
+    double best = 0;
+    int bestCpu = -1;
+    int cpu;
+
+    for (cpu = 0 ; cpu < PLACE_MAX_CPUS ; cpu ++)
+    {
+        if (maskIsSet(&topo.usable, cpu) && (bestCpu == -1 || cpuLoad(cpu) < best))
+        {
+            best = cpuLoad(cpu);
+            bestCpu = cpu;
+        }
+    }
+    return bestCpu;
+}
+
+// Node with the least load per CPU
+static int pickNode()
+{
+    double best = 0;
+    int bestIdx = -1;
+    int idx, cpu;
+
+    for (idx = 0 ; idx < topo.node_num ; idx ++)
+    {
+        double load = 0;
+        int num = maskCount(&topo.nodeCpus[idx]);
+
+        if (num == 0)
+            continue;
+        for (cpu = 0 ; cpu < PLACE_MAX_CPUS ; cpu ++)
+            if (maskIsSet(&topo.nodeCpus[idx], cpu))
+                load += cpuLoad(cpu);
+        if (bestIdx == -1 || load / num < best)
+        {
+            best = load / num;
+            bestIdx = idx;
+        }
+    }
+    return bestIdx;
+}
+
+// Decide where a job about to be launched runs: its @cpus= / @node=,
+// or the automatic placement of background jobs. *ret is NULL if it
+// stays where the shell is. Return 0, or -1 if the requested
+// placement can not be used.
+//
+int choosePlacement(Command_handler* cmd_hdr, Placement** ret)
+{
+    Placement place;
+    char list[64];
+    int cpu, idx;
+
+    *ret = NULL;
+    if (cmd_hdr->placement == NULL && !(cmd_hdr->isBackGround && tsh_options.autoPlace != PLACE_OFF))
+        return 0;
+    readTopology();
+
+    if (cmd_hdr->placement != NULL)
+    {
+        place = *cmd_hdr->placement;
+        if (place.node != -1)
+        {
+            CpuMask nodeCpus;
+            if (getNodeCpus(place.node, &nodeCpus) == -1)
+            {
+                fprintf(stderr, "tsh: @node=%d: no such node\n", place.node);
+                return -1;
+            }
+            if (maskCount(&place.cpus) == 0)
+                place.cpus = nodeCpus;
+            place.isBound = 1;
+        }
+        maskAnd(&place.cpus, &topo.usable);
+        if (maskCount(&place.cpus) == 0)
+        {
+            formatCpuList(&topo.usable, list, sizeof(list));
+            fprintf(stderr, "tsh: none of the CPUs may be used, the shell runs on %s\n", list);
+            return -1;
+        }
+    }
+    else
+    {
+        sampleLoad();
+        memset(&place, 0, sizeof(place));
+        place.node = -1;
+        if (tsh_options.autoPlace == PLACE_NODE)
+        {
+            // A single node has nothing to choose from
+            if (topo.node_num < 2 || (idx = pickNode()) == -1)
+                return 0;
+            place.cpus = topo.nodeCpus[idx];
+            place.node = topo.nodeIDs[idx];
+        }
+        else
+        {
+            if ((cpu = pickCpu()) == -1)
+                return 0;
+            maskSet(&place.cpus, cpu);
+        }
+    }
+
+    place.weight = 1.0 / maskCount(&place.cpus);
+    *ret = (Placement*) malloc(sizeof(Placement));
+    **ret = place;
+    countPlacement(*ret, 1);
+    return 0;
+}
+
+// The job placed there is gone
+void releasePlacement(Placement* place)
+{
+    if (place == NULL)
+        return;
+    countPlacement(place, -1);
+    free (place);
+}
+
+// Move the calling thread. Return 0, or -1 with errno set.
+int applyPlacement(const Placement* place)
+{
+    unsigned long nodes;
+
+    if (maskCount(&place->cpus) > 0 &&
+        sched_setaffinity(0, sizeof(CpuMask), (const cpu_set_t*) &place->cpus) == -1)
+        return -1;
+    if (place->node != -1)
+    {
+        nodes = 1UL << place->node;
+        if (syscall(SYS_set_mempolicy, place->isBound ? MPOL_BIND : MPOL_PREFERRED, &nodes, NODE_MASK_BITS) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+// Switch the shell over to a placement for the children it spawns
+// until leavePlacement(). Return 0, or -1 with errno set.
+//
+int enterPlacement(const Placement* place)
+{
+    readTopology();
+    entered = place;
+    if (applyPlacement(place) == -1)
+    {
+        int err = errno;
+        leavePlacement();
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void leavePlacement()
+{
+    if (entered == NULL)
+        return;
+    if (maskCount(&entered->cpus) > 0)
+        sched_setaffinity(0, sizeof(CpuMask), (const cpu_set_t*) &topo.usable);
+    if (entered->node != -1)
+        syscall(SYS_set_mempolicy, topo.shellPolicy, topo.shellPolicy == MPOL_DEFAULT ? NULL : &topo.shellNodes,
+                NODE_MASK_BITS);
+    entered = NULL;
+}
+
+static int pinThread(pid_t pid, pid_t tid, void* data)
+{
+    Placement* place = (Placement*) data;
+
+    if (sched_setaffinity(tid, sizeof(CpuMask), (const cpu_set_t*) &place->cpus) == -1)
+        return -1;
+
+    // Pages belong to the process, move them once
+    if (tid == pid && place->node != -1)
+    {
+        unsigned long from = ~0UL;
+        unsigned long to = 1UL << place->node;
+        syscall(SYS_migrate_pages, pid, NODE_MASK_BITS, &from, &to);
+    }
+    return 0;
+}
+
+// Move a running job: every thread to the CPUs of the placement, and
+// if it has a node, the memory it already has to that node. The policy
+// for memory it allocates from now on can only be set by a process
+// itself, and stays as it is. The job keeps the placement, and place
+// is taken over. Return 0, or -1 if it could not be moved at all.
+//
+int pinJob(ProcessGroup* group, Placement* place)
+{
+    readTopology();
+    maskAnd(&place->cpus, &topo.usable);
+    if (maskCount(&place->cpus) == 0)
+    {
+        fprintf(stderr, "tsh: pin: none of the CPUs may be used\n");
+        free (place);
+        return -1;
+    }
+    if (forEachJobThread(group, pinThread, place) == 0 && errno != 0)
+    {
+        fprintf(stderr, "tsh: pin: %s\n", strerror(errno));
+        free (place);
+        return -1;
+    }
+
+    place->weight = 1.0 / maskCount(&place->cpus);
+    countPlacement(place, 1);
+    releasePlacement(group->placement);
+    group->placement = place;
+    return 0;
+}
+
+void printPlacement(FILE* out, const Placement* place)
+{
+    char list[256];
+
+    if (place == NULL)
+        return;
+    if (formatCpuList(&place->cpus, list, sizeof(list)) == -1)
+        strcpy(list, "...");
+    fprintf(out, "\tcpus %s", list);
+    if (place->node != -1)
+        fprintf(out, " node %d%s", place->node, place->isBound ? " (bind)" : "");
+}
@@ -0,0 +1,42 @@
+#ifndef __TSH_PLACE_H__
+#define __TSH_PLACE_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "tsh.h"
+
+#define PLACE_MAX_CPUS 1024   // same as cpu_set_t
+#define PLACE_MAX_NODES 64
+
+typedef struct CpuMask
+{
+    unsigned long bits[PLACE_MAX_CPUS / (8 * sizeof(unsigned long))];
+} CpuMask;
+
+// Where the processes of a job run: the CPUs they may use, and the
+// NUMA node their memory comes from
+typedef struct Placement
+{
+    CpuMask cpus;        // empty: those of the shell
+    int node;            // -1: the default policy of the shell
+    int isBound;         // memory from node only (MPOL_BIND), else preferred
+    double weight;       // load it adds to each of its CPUs, 0 if not counted
+} Placement;
+
+// Modes of "set autoplace"
+#define PLACE_OFF  0
+#define PLACE_CPU  1     // every background job on the least loaded CPU
+#define PLACE_NODE 2     // every background job on the least loaded node
+
+int parseCpuList(const char*, size_t, CpuMask*);
+int formatCpuList(const CpuMask*, char*, size_t);
+int choosePlacement(Command_handler*, Placement**);
+void releasePlacement(Placement*);
+int applyPlacement(const Placement*);
+int enterPlacement(const Placement*);
+void leavePlacement();
+int pinJob(ProcessGroup*, Placement*);
+int getNodeCpus(int, CpuMask*);
+void printPlacement(FILE*, const Placement*);
+
+#endif
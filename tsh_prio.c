@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/ioprio.h>
+#include "tsh_prio.h"
+#include "tsh_job.h"
+
+// CPU and I/O priority of jobs
+//
+// A job gets a nice value, a scheduling class and an I/O priority with
+// @nice=N, @sched=other|batch|idle and @ioprio=rt:N|be:N|idle, or later
+// with the prio builtin. While "set autoprio batch" or "set autoprio
+// idle", a job is demoted while it is in the background (started with
+// &, stopped with ^Z, or continued with bg) and gets its own priority
+// back with fg, so that bulk work yields to the interactive one.
+//
+// Like the placement, the priority is set on the command before exec
+// where the child does its own setup (spawn helper, clone3, forked
+// builtin); after posix_spawn() the shell sets it right away.
+//
+// An unprivileged user can not lower the nice value again, nor leave
+// SCHED_IDLE, unless RLIMIT_NICE allows it. A demotion which could not
+// be undone then only changes what can: SCHED_BATCH and the I/O level.
+//
+static Priority shellPrio;
+static int isShellRead;
+static int niceFloor;      // lowest nice value RLIMIT_NICE allows
+static int canRaise;       // the nice value may go back to that of the shell
+
+static const char* policyNames[] = { "other", "fifo", "rr", "batch", "iso", "idle" };
+static const char* ioClassNames[] = { "none", "rt", "be", "idle" };
+
+static void readShellPriority()
+{
+    struct rlimit lim;
+    int policy;
+    long ioprio;
+
+    if (isShellRead)
+        return;
+    isShellRead = 1;
+
+    errno = 0;
+    shellPrio.nice = getpriority(PRIO_PROCESS, 0);
+    if (errno != 0)
+        shellPrio.nice = 0;
+    policy = sched_getscheduler(0);
+    shellPrio.policy = (policy == -1) ? SCHED_OTHER : (policy & ~SCHED_RESET_ON_FORK);
+    ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    shellPrio.ioprio = (ioprio == -1) ? 0 : (int) ioprio;
+
+    if (geteuid() == 0 || getrlimit(RLIMIT_NICE, &lim) == -1 ||
+        lim.rlim_cur == RLIM_INFINITY || lim.rlim_cur >= 40)
+        niceFloor = -20;
+    else
+        niceFloor = 20 - (int) lim.rlim_cur;
+    canRaise = (niceFloor <= shellPrio.nice);
+}
+
+void initPriority(Priority* prio)
+{
+    prio->nice = PRIO_UNSET;
+    prio->policy = PRIO_UNSET;
+    prio->ioprio = PRIO_UNSET;
+}
+
+// One of nice=N, sched=CLASS or ioprio=CLASS[:LEVEL]. Return 0, -1 for
+// a bad value, or -2 if name is none of them.
+//
+int parsePriority(const char* name, size_t len, const char* value, Priority* prio)
+{
+    char* end;
+    long num;
+    int idx;
+
+    if (len == 4 && strncmp(name, "nice", 4) == 0)
+    {
+        num = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || num < -20 || num > 19)
+            return -1;
+        prio->nice = (int) num;
+        return 0;
+    }
+    if (len == 5 && strncmp(name, "sched", 5) == 0)
+    {
+        if (strcmp(value, "other") == 0)
+            prio->policy = SCHED_OTHER;
+        else if (strcmp(value, "batch") == 0)
+            prio->policy = SCHED_BATCH;
+        else if (strcmp(value, "idle") == 0)
+            prio->policy = SCHED_IDLE;
+        else
+            return -1;
+        return 0;
+    }
+    if (len == 6 && strncmp(name, "ioprio", 6) == 0)
+    {
+        if (strcmp(value, "idle") == 0)
+        {
+            prio->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+            return 0;
+        }
+        for (idx = IOPRIO_CLASS_RT ; idx <= IOPRIO_CLASS_BE ; idx ++)
+        {
+            size_t class_len = strlen(ioClassNames[idx]);
+            if (strncmp(value, ioClassNames[idx], class_len) == 0 && value[class_len] == ':')
+            {
+                num = strtol(value + class_len + 1, &end, 10);
+                if (end == value + class_len + 1 || *end != '\0' || num < 0 || num > 7)
+                    return -1;
+                prio->ioprio = IOPRIO_PRIO_VALUE(idx, num);
+                return 0;
+            }
+        }
+        return -1;
+    }
+    return -2;
+}
+
+// Priority a job runs with: its own over that of the shell, lowered
+// while it is demoted
+//
+static void resolvePriority(const Priority* base, int isDemoted, Priority* ret)
+{
+    readShellPriority();
+    *ret = shellPrio;
+    if (base != NULL)
+    {
+        if (base->nice != PRIO_UNSET)
+            ret->nice = base->nice;
+        if (base->policy != PRIO_UNSET)
+            ret->policy = base->policy;
+        if (base->ioprio != PRIO_UNSET)
+            ret->ioprio = base->ioprio;
+    }
+    if (!isDemoted)
+        return;
+
+    if (tsh_options.autoPrio == AUTOPRIO_IDLE && canRaise)
+    {
+        ret->policy = SCHED_IDLE;
+        ret->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+        return;
+    }
+    if (canRaise && ret->nice < 10)
+        ret->nice = 10;
+    if (ret->policy != SCHED_IDLE)
+        ret->policy = SCHED_BATCH;
+    if (IOPRIO_PRIO_CLASS(ret->ioprio) != IOPRIO_CLASS_IDLE)
+        ret->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7);
+}
+
+// Priority a job about to be launched starts with. Return 0 if it is
+// that of the shell, 1 with it in *ret, or -1 after reporting that the
+// shell may not give it.
+//
+int getStartPriority(const Priority* base, int isDemoted, Priority* ret)
+{
+    if (base == NULL && !isDemoted)
+        return 0;
+    resolvePriority(base, isDemoted, ret);
+    if (ret->nice < shellPrio.nice && ret->nice < niceFloor)
+    {
+        fprintf(stderr, "tsh: nice %d: below the limit of %d (RLIMIT_NICE)\n", ret->nice, niceFloor);
+        return -1;
+    }
+    if (IOPRIO_PRIO_CLASS(ret->ioprio) == IOPRIO_CLASS_RT && geteuid() != 0 &&
+        IOPRIO_PRIO_CLASS(shellPrio.ioprio) != IOPRIO_CLASS_RT)
+    {
+        fprintf(stderr, "tsh: ioprio: the real-time class needs root\n");
+        return -1;
+    }
+    return 1;
+}
+
+// Set the priority of a thread, 0 for the calling one. Return 0, or -1
+// with errno set.
+//
+int applyPriority(pid_t tid, const Priority* prio)
+{
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    if (sched_setscheduler(tid, prio->policy, &param) == -1 ||
+        setpriority(PRIO_PROCESS, tid, prio->nice) == -1 ||
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, prio->ioprio) == -1)
+        return -1;
+    return 0;
+}
+
+static int applyToThread(pid_t pid, pid_t tid, void* data)
+{
+    (void) pid;
+    return applyPriority(tid, (const Priority*) data);
+}
+
+static int applyToJob(ProcessGroup* group)
+{
+    Priority prio;
+
+    resolvePriority(group->priority, group->isDemoted, &prio);
+    if (forEachJobThread(group, applyToThread, &prio) == 0 && errno != 0)
+        return -1;
+    return 0;
+}
+
+// Change the own priority of a running job by the fields set in prio.
+// It is not demoted any more. Return 0, or -1 after reporting why.
+//
+int setJobPriority(ProcessGroup* group, const Priority* prio)
+{
+    if (group->priority == NULL)
+    {
+        group->priority = (Priority*) malloc(sizeof(Priority));
+        initPriority(group->priority);
+    }
+    if (prio->nice != PRIO_UNSET)
+        group->priority->nice = prio->nice;
+    if (prio->policy != PRIO_UNSET)
+        group->priority->policy = prio->policy;
+    if (prio->ioprio != PRIO_UNSET)
+        group->priority->ioprio = prio->ioprio;
+    group->isDemoted = 0;
+
+    if (applyToJob(group) == -1)
+    {
+        fprintf(stderr, "tsh: prio: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// A job went to the background, or came back. Demotion only happens
+// with autoprio on, but a demoted job is always restored.
+//
+void setJobDemoted(ProcessGroup* group, int isDemoted)
+{
+    if (group->isDemoted == isDemoted || (isDemoted && tsh_options.autoPrio == AUTOPRIO_OFF))
+        return;
+    group->isDemoted = isDemoted;
+    if (applyToJob(group) == -1)
+        fprintf(stderr, "tsh: can not %s the priority of job %d: %s\n",
+                isDemoted ? "lower" : "restore", group->jobID, strerror(errno));
+}
+
+// Warn when a mode can not be used as it is
+void checkAutoPriority(int mode)
+{
+    readShellPriority();
+    if (mode != AUTOPRIO_OFF && !canRaise)
+        fprintf(stderr, "tsh: autoprio: the nice value could not be restored (RLIMIT_NICE), "
+                        "background jobs only get SCHED_BATCH and low I/O priority\n");
+}
+
+void printPriority(FILE* out, ProcessGroup* group)
+{
+    Priority prio;
+    int ioClass;
+
+    if (group->priority == NULL && !group->isDemoted)
+        return;
+    resolvePriority(group->priority, group->isDemoted, &prio);
+    fprintf(out, "\tnice %d %s io ", prio.nice,
+            (prio.policy >= 0 && prio.policy <= SCHED_IDLE) ? policyNames[prio.policy] : "?");
+    ioClass = IOPRIO_PRIO_CLASS(prio.ioprio);
+    if (ioClass == IOPRIO_CLASS_RT || ioClass == IOPRIO_CLASS_BE)
+        fprintf(out, "%s:%d", ioClassNames[ioClass], (int) IOPRIO_PRIO_DATA(prio.ioprio));
+    else
+        fprintf(out, "%s", ioClassNames[ioClass & 3]);
+    if (group->isDemoted)
+        fprintf(out, " (demoted)");
+}
@@ -0,0 +1,33 @@
+#ifndef __TSH_PRIO_H__
+#define __TSH_PRIO_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "tsh.h"
+
+#define PRIO_UNSET (-1000)
+
+// CPU and I/O priority of a job. Fields left PRIO_UNSET are those of
+// the shell.
+typedef struct Priority
+{
+    int nice;
+    int policy;          // SCHED_OTHER, SCHED_BATCH or SCHED_IDLE
+    int ioprio;          // as for ioprio_set(), class and level
+} Priority;
+
+// Modes of "set autoprio"
+#define AUTOPRIO_OFF   0
+#define AUTOPRIO_BATCH 1  // background jobs: nice 10, SCHED_BATCH, lowest best-effort I/O
+#define AUTOPRIO_IDLE  2  // background jobs: SCHED_IDLE, idle I/O
+
+void initPriority(Priority*);
+int parsePriority(const char*, size_t, const char*, Priority*);
+int getStartPriority(const Priority*, int, Priority*);
+int applyPriority(pid_t, const Priority*);
+int setJobPriority(ProcessGroup*, const Priority*);
+void setJobDemoted(ProcessGroup*, int);
+void checkAutoPriority(int);
+void printPriority(FILE*, ProcessGroup*);
+
+#endif
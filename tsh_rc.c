@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "tsh.h"
+#include "tsh_rc.h"
+#include "tsh_alias.h"
+#include "tsh_hash.h"
+#include "tsh_input.h"
+#include "tsh_parse.h"
+#include "tsh_var.h"
+#include "tsh_exec.h"
+
+// rc file and state snapshot
+//
+// ~/.tshrc is run at startup. When it only changes shell state (variables,
+// aliases, functions, options and the command hash), the resulting state is written
+// to a snapshot, and the next shell maps the snapshot instead of running
+// the rc file again. The snapshot is keyed by the identity, size and mtime
+// of the rc file and by a hash of the inherited environment, since the rc
+// file usually builds on it ($PATH for instance).
+//
+#define SNAPSHOT_MAGIC "TSHSNAP7"
+
+typedef struct SnapshotHeader
+{
+    char magic[8];
+    SnapshotKey key;
+    size_t size;          // of the whole file
+    int var_num;          // each an exported flag byte and NAME=value
+    int alias_num;
+    int dir_num;
+    int function_num;     // each a definition as written
+    TSHOptions options;
+} SnapshotHeader;
+
+// Fixed part of a $PATH directory, followed by its path and its name pool
+typedef struct SnapshotDir
+{
+    struct timespec mtime;
+    int isValid;
+    int name_num;
+    size_t pool_len;
+} SnapshotDir;
+
+typedef struct SnapshotWriter
+{
+    char* buf;
+    size_t len;
+    size_t cap;
+} SnapshotWriter;
+
+typedef struct SnapshotReader
+{
+    char* pos;
+    char* end;
+} SnapshotReader;
+
+// Builtins whose effect is fully captured by the snapshot
+static const char* snapshotSafe[] = { "export", "unset", "alias", "unalias", "set", "hash", NULL };
+
+static void snapPut(SnapshotWriter* writer, const void* data, size_t len)
+{
+    if (writer->len + len > writer->cap)
+    {
+        while (writer->len + len > writer->cap)
+            writer->cap *= 2;
+        writer->buf = (char*) realloc(writer->buf, writer->cap);
+    }
+    memcpy(writer->buf + writer->len, data, len);
+    writer->len += len;
+}
+
+static void snapPutString(SnapshotWriter* writer, const char* str)
+{
+    snapPut(writer, str, strlen(str) + 1);
+}
+
+static int snapGet(SnapshotReader* reader, void* data, size_t len)
+{
+    if ((size_t) (reader->end - reader->pos) < len)
+        return -1;
+    memcpy(data, reader->pos, len);
+    reader->pos += len;
+    return 0;
+}
+
+// Return the string at the current position, NULL if it is cut short
+static char* snapGetString(SnapshotReader* reader)
+{
+    char* str = reader->pos;
+    char* nul = memchr(reader->pos, '\0', reader->end - reader->pos);
+    if (nul == NULL)
+        return NULL;
+    reader->pos = nul + 1;
+    return str;
+}
+
+static unsigned int hashEnvironment()
+{
+    unsigned int h = 2166136261u;
+    char** env;
+    const char* p;
+
+    for (env = getEnvp() ; *env ; env ++)
+    {
+        for (p = *env ; *p ; p ++)
+        {
+            h ^= (unsigned char) *p;
+            h *= 16777619u;
+        }
+        h ^= 0xff;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Everything is copied out of the mapping, which is released afterwards.
+// Return -1 if the snapshot is missing, stale or damaged.
+//
+int loadSnapshot(const char* path, const SnapshotKey* key)
+{
+    SnapshotHeader header;
+    SnapshotReader reader;
+    struct stat st;
+    char* map;
+    int fd, idx;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return -1;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return -1;
+    }
+    map = (char*) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    memcpy(&header, map, sizeof(SnapshotHeader));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, 8) != 0 || header.size != (size_t) st.st_size ||
+        memcmp(&header.key, key, sizeof(SnapshotKey)) != 0)
+    {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    // Check the whole body before anything is changed
+    reader.pos = map + sizeof(SnapshotHeader);
+    reader.end = map + st.st_size;
+    for (idx = 0 ; idx < header.var_num ; idx ++)
+    {
+        char isExported;
+        char* entry;
+        if (snapGet(&reader, &isExported, 1) == -1 || (entry = snapGetString(&reader)) == NULL ||
+            strchr(entry, '=') == NULL)
+            goto damaged;
+    }
+    for (idx = 0 ; idx < header.alias_num * 2 + 1 ; idx ++)
+        if (snapGetString(&reader) == NULL)
+            goto damaged;
+    for (idx = 0 ; idx < header.dir_num ; idx ++)
+    {
+        SnapshotDir dir;
+        if (snapGet(&reader, &dir, sizeof(SnapshotDir)) == -1 || snapGetString(&reader) == NULL ||
+            (size_t) (reader.end - reader.pos) < dir.pool_len)
+            goto damaged;
+        reader.pos += dir.pool_len;
+    }
+    for (idx = 0 ; idx < header.function_num ; idx ++)
+        if (snapGetString(&reader) == NULL)
+            goto damaged;
+
+    reader.pos = map + sizeof(SnapshotHeader);
+    clearVars();
+    for (idx = 0 ; idx < header.var_num ; idx ++)
+    {
+        char isExported = 0;
+        snapGet(&reader, &isExported, 1);
+        setAssignment(snapGetString(&reader), isExported);
+    }
+    getEnvp();
+
+    for (idx = 0 ; idx < header.alias_num ; idx ++)
+    {
+        char* name = snapGetString(&reader);
+        setAlias(name, snapGetString(&reader));
+    }
+    tsh_options = header.options;
+
+    // The lookup table itself is built on the first lookup
+    clearCommandHash();
+    commandHash.path_env = strdup(snapGetString(&reader));
+    commandHash.dir_num = header.dir_num;
+    commandHash.dirs = (PathDir*) calloc(header.dir_num + 1, sizeof(PathDir));
+    for (idx = 0 ; idx < header.dir_num ; idx ++)
+    {
+        PathDir* dir = &commandHash.dirs[idx];
+        SnapshotDir record;
+        char* name;
+        int name_idx;
+
+        snapGet(&reader, &record, sizeof(SnapshotDir));
+        dir->path = strdup(snapGetString(&reader));
+        dir->mtime = record.mtime;
+        dir->isValid = record.isValid;
+        dir->name_num = record.name_num;
+        dir->name_pool = (char*) malloc(record.pool_len + 1);
+        memcpy(dir->name_pool, reader.pos, record.pool_len);
+        reader.pos += record.pool_len;
+
+        dir->names = (char**) malloc(sizeof(char*) * (record.name_num + 1));
+        name = dir->name_pool;
+        for (name_idx = 0 ; name_idx < record.name_num ; name_idx ++)
+        {
+            dir->names[name_idx] = name;
+            name += strlen(name) + 1;
+        }
+        dir->names[record.name_num] = NULL;
+    }
+    for (idx = 0 ; idx < header.function_num ; idx ++)
+    {
+        char* text = snapGetString(&reader);
+        defineFunction(text, strlen(text));
+    }
+    munmap(map, st.st_size);
+    return 0;
+
+damaged:
+    munmap(map, st.st_size);
+    return -1;
+}
+
+// Write the current state, through a temporary file so that a shell
+// starting meanwhile never maps half a snapshot.
+//
+int saveSnapshot(const char* path, const SnapshotKey* key)
+{
+    SnapshotHeader header;
+    SnapshotWriter writer;
+    char tmpPath[PATH_MAX];
+    unsigned int slot;
+    int idx;
+    int fd;
+    int ret = 0;
+
+    memset(&header, 0, sizeof(SnapshotHeader));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.key = *key;
+    header.alias_num = aliasTable.alias_num;
+    header.options = tsh_options;
+
+    writer.cap = 65536;
+    writer.len = 0;
+    writer.buf = (char*) malloc(writer.cap);
+    snapPut(&writer, &header, sizeof(SnapshotHeader));
+
+    for (slot = 0 ; slot < varTable.cap ; slot ++)
+    {
+        Var* var = &varTable.slots[slot];
+        char isExported = (char) var->isExported;
+        if (var->entry == NULL)
+            continue;
+        snapPut(&writer, &isExported, 1);
+        snapPutString(&writer, var->entry);
+        header.var_num ++;
+    }
+    for (idx = 0 ; idx < aliasTable.alias_num ; idx ++)
+    {
+        snapPutString(&writer, aliasTable.aliases[idx].name);
+        snapPutString(&writer, aliasTable.aliases[idx].value);
+    }
+
+    // Scan $PATH now, so that the next shell does not have to
+    validateCommandHash();
+    snapPutString(&writer, commandHash.path_env ? commandHash.path_env : "");
+    header.dir_num = commandHash.dir_num;
+    for (idx = 0 ; idx < commandHash.dir_num ; idx ++)
+    {
+        PathDir* dir = &commandHash.dirs[idx];
+        SnapshotDir record;
+        int name_idx;
+
+        memset(&record, 0, sizeof(SnapshotDir));
+        record.mtime = dir->mtime;
+        record.isValid = dir->isValid;
+        record.name_num = dir->name_num;
+        for (name_idx = 0 ; name_idx < dir->name_num ; name_idx ++)
+            record.pool_len += strlen(dir->names[name_idx]) + 1;
+        snapPut(&writer, &record, sizeof(SnapshotDir));
+        snapPutString(&writer, dir->path);
+        for (name_idx = 0 ; name_idx < dir->name_num ; name_idx ++)
+            snapPutString(&writer, dir->names[name_idx]);
+    }
+    header.function_num = functionTable.func_num;
+    for (idx = 0 ; idx < functionTable.func_num ; idx ++)
+        snapPutString(&writer, functionTable.funcs[idx]->text);
+
+    header.size = writer.len;
+    memcpy(writer.buf, &header, sizeof(SnapshotHeader));
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, (int) getpid());
+    if ((fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR)) == -1)
+        ret = -1;
+    else
+    {
+        if (write(fd, writer.buf, writer.len) != (ssize_t) writer.len)
+            ret = -1;
+        close(fd);
+        if (ret == 0 && rename(tmpPath, path) == -1)
+            ret = -1;
+        if (ret == -1)
+            unlink(tmpPath);
+    }
+    free (writer.buf);
+    return ret;
+}
+
+// Return 1 if every command of the pipeline only changes state the
+// snapshot records.
+//
+static int isPipelineSafe(Command_handler* cmd_hdr)
+{
+    int cmd_idx, safe_idx;
+
+    if (cmd_hdr->isBackGround || cmd_hdr->isTimed)
+        return 0;
+    for (cmd_idx = 0 ; cmd_idx < cmd_hdr->cmd_num ; cmd_idx ++)
+    {
+        Command* cmd = cmd_hdr->cmds[cmd_idx];
+        if (cmd->inputFile || cmd->outputFile || cmd->compound)
+            return 0;
+        if (cmd->arg_num == 0)
+            continue;  // NAME=value
+        for (safe_idx = 0 ; snapshotSafe[safe_idx] ; safe_idx ++)
+            if (strcmp(cmd->args[0], snapshotSafe[safe_idx]) == 0)
+                break;
+        if (snapshotSafe[safe_idx] == NULL)
+            return 0;
+    }
+    return 1;
+}
+
+// The same for a whole program. Function definitions are safe, anything
+// compound is taken as unsafe.
+//
+static int isSnapshotSafe(Node* program)
+{
+    Node* node;
+
+    for (node = program ; node ; node = node->next)
+    {
+        if (node->type == NODE_FUNCTION)
+            continue;
+        if (node->type != NODE_PIPELINE || node->isNegated || !isPipelineSafe(node->pipeline))
+            return 0;
+    }
+    return 1;
+}
+
+// Like runScript(), noting whether anything ran that a snapshot
+// could not replay. Return 1 if the state may be snapshotted.
+//
+static int runRC(int fd)
+{
+    InputReader reader;
+    LineBuffer lines = { NULL, 0, 0 };
+    Arena arena;
+    Node* program;
+    int safe = 1;
+
+    arenaInit(&arena, 1024);
+    initInputReader(&reader, fd);
+    while (1)
+    {
+        char* line;
+        size_t len;
+        while ((line = nextLine(&reader, &len)) != NULL)
+        {
+            // A command may go on over several lines, it is checked whole
+            appendLine(&lines, line, len);
+            if (parseProgram(lines.buf, lines.len, &arena, &program) == 1)
+            {
+                appendLine(&lines, "\n", 1);
+                arenaReset(&arena);
+                continue;
+            }
+            safe &= isSnapshotSafe(program);
+            arenaReset(&arena);
+            runLine(lines.buf, lines.len);
+            lines.len = 0;
+            reapChildren();
+        }
+
+        if (reader.isEOF)
+            break;
+        if (fillInput(&reader) == -1)
+        {
+            perror("tsh: read");
+            safe = 0;
+            break;
+        }
+    }
+    if (lines.len > 0)
+        safe = 0;
+    finishLines(&lines);
+    freeInputReader(&reader);
+    arenaFree(&arena);
+    return safe;
+}
+
+// $XDG_CACHE_HOME/tsh/rc.snapshot, the directories are created on demand
+static void getSnapshotPath(char* path, size_t size, const char* home, int create)
+{
+    const char* cache = getVar("XDG_CACHE_HOME");
+
+    if (cache != NULL && cache[0] == '/')
+        snprintf(path, size, "%s/tsh", cache);
+    else
+    {
+        snprintf(path, size, "%s/.cache", home);
+        if (create)
+            mkdir(path, 0700);
+        snprintf(path, size, "%s/.cache/tsh", home);
+    }
+    if (create)
+        mkdir(path, 0700);
+    strncat(path, "/rc.snapshot", size - strlen(path) - 1);
+}
+
+void loadRC()
+{
+    const char* home = getVar("HOME");
+    char rcPath[PATH_MAX];
+    char snapPath[PATH_MAX];
+    SnapshotKey key;
+    struct stat st;
+    int fd;
+
+    if (home == NULL)
+        return;
+    snprintf(rcPath, sizeof(rcPath), "%s/.tshrc", home);
+    if ((fd = open(rcPath, O_RDONLY | O_CLOEXEC)) == -1)
+        return;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return;
+    }
+
+    memset(&key, 0, sizeof(SnapshotKey));
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.size = st.st_size;
+    key.mtime = st.st_mtim;
+    key.envHash = hashEnvironment();
+
+    getSnapshotPath(snapPath, sizeof(snapPath), home, 0);
+    if (loadSnapshot(snapPath, &key) == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    if (runRC(fd))
+    {
+        getSnapshotPath(snapPath, sizeof(snapPath), home, 1);
+        saveSnapshot(snapPath, &key);
+    }
+    else
+        unlink(snapPath);
+    close(fd);
+}
@@ -0,0 +1,22 @@
+#ifndef __TSH_RC_H__
+#define __TSH_RC_H__
+
+#include <sys/types.h>
+#include <time.h>
+
+// What the snapshot of a rc file depends on. If any of it changes,
+// the rc file is run again.
+typedef struct SnapshotKey
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned int envHash;   // environment inherited by the shell
+} SnapshotKey;
+
+void loadRC();
+int loadSnapshot(const char*, const SnapshotKey*);
+int saveSnapshot(const char*, const SnapshotKey*);
+
+#endif
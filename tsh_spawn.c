@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include "tsh_spawn.h"
+#include "tsh_hash.h"
+#include "tsh_var.h"
+#include "tsh_zygote.h"
+#include "tsh_cgroup.h"
+#include "tsh_place.h"
+#include "tsh_prio.h"
+
+// Spawn engine
+//
+// Commands are started with posix_spawn(). glibc implements it with
+// clone(CLONE_VM|CLONE_VFORK), so the launch cost does not depend on the
+// size of the shell, and by the time it returns the child has already
+// joined its process group and set up its descriptors. The parent never
+// has to wait for the child to call setpgid(). With the spawn helper
+// enabled (set spawnhelper on), the helper launches the command instead.
+//
+// A command of a job with a cgroup is created inside it by clone3(),
+// which posix_spawn() can not do; that is a fork() of the shell, or of
+// the helper if it runs.
+//
+void initSpawnRequest(SpawnRequest* req)
+{
+    memset(req, 0, sizeof(SpawnRequest));
+    req->in_fd = -1;
+    req->out_fd = -1;
+    req->err_fd = -1;
+    req->close_fd = -1;
+    req->cgroup_fd = -1;
+}
+
+// Set up a new child as the request says and exec the command. Only
+// returns, with the errno of the failure, if it could not.
+//
+int execSpawnRequest(SpawnRequest* req, char** envp)
+{
+    static const int defaults[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE };
+    sigset_t mask;
+    size_t idx;
+    int fd;
+
+    if (req->pgid != -1 && setpgid(0, req->pgid) == -1)
+        return errno;
+    if (req->placement != NULL && applyPlacement(req->placement) == -1)
+        return errno;
+    if (req->priority != NULL && applyPriority(0, req->priority) == -1)
+        return errno;
+    if ((req->in_fd != -1 && dup2(req->in_fd, 0) == -1) ||
+        (req->out_fd != -1 && dup2(req->out_fd, 1) == -1) ||
+        (req->err_fd != -1 && dup2(req->err_fd, 2) == -1))
+        return errno;
+
+    // New file would have -rw-rw-r-- permission
+    if (req->inputFile != NULL)
+    {
+        if ((fd = open(req->inputFile, O_RDONLY)) == -1 || dup2(fd, 0) == -1)
+            return errno;
+        close(fd);
+    }
+    if (req->outputFile != NULL)
+    {
+        if ((fd = open(req->outputFile, O_WRONLY | O_CREAT | O_TRUNC,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH)) == -1 || dup2(fd, 1) == -1)
+            return errno;
+        close(fd);
+    }
+
+    for (idx = 0 ; idx < sizeof(defaults) / sizeof(int) ; idx ++)
+        signal(defaults[idx], SIG_DFL);
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    execve(req->path, req->argv, envp);
+    return errno;
+}
+
+typedef struct ExecArgs
+{
+    SpawnRequest* req;
+    char** envp;
+} ExecArgs;
+
+static int execInCgroup(void* data)
+{
+    ExecArgs* args = (ExecArgs*) data;
+    return execSpawnRequest(args->req, args->envp);
+}
+
+// Return the pid of the child, or -1 with errno set
+pid_t spawnCommand(SpawnRequest* req)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    char** envp = req->envp ? req->envp : getEnvp();
+    pid_t pid;
+    int err;
+
+    if ((pid = zygoteSpawn(req, envp)) != -2)
+        return pid;
+    if (req->cgroup_fd != -1)
+    {
+        ExecArgs args = { req, envp };
+        if ((pid = spawnIntoCgroup(req->cgroup_fd, 0, execInCgroup, &args)) != -2)
+            return pid;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    // Pipes are created close-on-exec, only the dup2'ed copies survive
+    if (req->in_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, req->in_fd, 0);
+    if (req->out_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, req->out_fd, 1);
+    if (req->err_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, req->err_fd, 2);
+
+    // New file would have -rw-rw-r-- permission
+    if (req->inputFile != NULL)
+        posix_spawn_file_actions_addopen(&actions, 0, req->inputFile, O_RDONLY, 0);
+    if (req->outputFile != NULL)
+        posix_spawn_file_actions_addopen(&actions, 1, req->outputFile, O_WRONLY | O_CREAT | O_TRUNC,
+                                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+
+    // Join the process group before exec, and do not leak the
+    // shell's signal mask and dispositions into the command.
+    if (req->pgid != -1)
+        posix_spawnattr_setpgroup(&attr, req->pgid);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGTTIN);
+    sigaddset(&mask, SIGTTOU);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    posix_spawnattr_setflags(&attr, (req->pgid != -1 ? POSIX_SPAWN_SETPGROUP : 0) |
+                                    POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    // The child inherits the affinity and memory policy of the shell
+    if (req->placement != NULL && enterPlacement(req->placement) == -1)
+        err = errno;
+    else
+    {
+        err = posix_spawn(&pid, req->path, &actions, &attr, req->argv, envp);
+        if (req->placement != NULL)
+            leavePlacement();
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+
+    // Harmless if the child already did it, and keeps us correct
+    // on a libc whose posix_spawn returns before the child runs.
+    if (req->pgid != -1)
+        setpgid(pid, req->pgid == 0 ? pid : req->pgid);
+
+    // No clone3(): move it right away, it may have run for a moment
+    // outside of the limits of the job
+    if (req->cgroup_fd != -1)
+        attachToCgroup(req->cgroup_fd, pid);
+
+    // No spawn attribute for the nice value or the I/O priority
+    if (req->priority != NULL)
+        applyPriority(pid, req->priority);
+    return pid;
+}
+
+// Open the redirection files of a request in the shell, so that a
+// failure names the file. They take the place of the pipe ends of the
+// request; fds receives them, to be closed once the child is started.
+// Return -1 if one could not be opened.
+//
+static int openRedirections(SpawnRequest* req, int fds[2])
+{
+    fds[0] = fds[1] = -1;
+    if (req->inputFile != NULL)
+    {
+        if ((fds[0] = open(req->inputFile, O_RDONLY | O_CLOEXEC)) == -1)
+        {
+            fprintf(stderr, "tsh: %s: %s\n", req->inputFile, strerror(errno));
+            return -1;
+        }
+        req->in_fd = fds[0];
+        req->inputFile = NULL;
+    }
+    if (req->outputFile != NULL)
+    {
+        // New file would have -rw-rw-r-- permission
+        if ((fds[1] = open(req->outputFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                           S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH)) == -1)
+        {
+            fprintf(stderr, "tsh: %s: %s\n", req->outputFile, strerror(errno));
+            if (fds[0] != -1)
+                close(fds[0]);
+            return -1;
+        }
+        req->out_fd = fds[1];
+        req->outputFile = NULL;
+    }
+    return 0;
+}
+
+// Resolve argv[0] and spawn it, reporting failures the way the command
+// line does. Return the pid, or -1 with *status set to 1 if a
+// redirection failed, 127 if the command could not be found and 126 if
+// it could not be executed.
+//
+pid_t launchCommand(SpawnRequest* req, char** argv, int* status)
+{
+    pid_t pid;
+    int fds[2];
+
+    // Redirections come first, as in sh
+    if (openRedirections(req, fds) == -1)
+    {
+        *status = 1;
+        return -1;
+    }
+
+    // Resolve the command before spawning so that an unknown command
+    // costs nothing, and the child can exec the absolute path without
+    // walking $PATH again.
+    req->argv = argv;
+    req->path = argv[0];
+    if (strchr(argv[0], '/') == NULL && (req->path = findSystemCommand(argv[0])) == NULL)
+    {
+        fprintf(stderr, "tsh: command not found: %s\n", argv[0]);
+        *status = 127;
+        pid = -1;
+    }
+    else if ((pid = spawnCommand(req)) == -1)
+    {
+        *status = 127;
+        switch (errno)
+        {
+            case ENOENT:
+                fprintf(stderr, "tsh: %s: no such file or directory\n", argv[0]);
+                break;
+            case EACCES:
+                fprintf(stderr, "tsh: %s: permission denied\n", argv[0]);
+                *status = 126;
+                break;
+            default:
+                fprintf(stderr, "tsh: spawn error: %s, %d\n", argv[0], errno);
+                break;
+        }
+    }
+
+    if (fds[0] != -1)
+        close(fds[0]);
+    if (fds[1] != -1)
+        close(fds[1]);
+    return pid;
+}
+
+// Run a builtin in a forked copy of the shell. This is a real fork, as
+// the builtin needs the shell's state, so it is only used for builtins
+// which feed a pipe.
+//
+pid_t spawnBuiltin(SpawnRequest* req, Command* cmd)
+{
+    pid_t pid;
+    sigset_t mask;
+
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) == -1)
+        return -1;
+
+    if (pid > 0)
+    {
+        if (req->pgid != -1)
+            setpgid(pid, req->pgid == 0 ? pid : req->pgid);
+        return pid;
+    }
+
+    // child, in the cgroup of the job before it does anything
+    if (req->cgroup_fd != -1)
+        attachToCgroup(req->cgroup_fd, 0);
+    if (req->placement != NULL)
+        applyPlacement(req->placement);
+    if (req->priority != NULL)
+        applyPriority(0, req->priority);
+    if (req->pgid != -1)
+        setpgid(0, req->pgid);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    if (req->close_fd != -1)
+        close(req->close_fd);
+    if (req->in_fd != -1)
+    {
+        dup2(req->in_fd, 0);
+        close(req->in_fd);
+    }
+    if (req->out_fd != -1)
+    {
+        dup2(req->out_fd, 1);
+        close(req->out_fd);
+    }
+    if (redirectFiles(req->inputFile, req->outputFile) == -1)
+        _exit(1);
+
+    // Nothing of the shell state may leak out, skip atexit handlers.
+    // Commands run by a function or a compound command stay in the
+    // process group of the stage, without job control.
+    tsh_interactive = 0;
+    {
+        int status, idx;
+        for (idx = 0 ; idx < cmd->assign_num ; idx ++)
+            setAssignment(cmd->assigns[idx], 1);
+        status = processTSHCommand(cmd);
+        fflush(stdout);
+        _exit(status);
+    }
+}
+
+// Open the < and > files of a command on stdin / stdout
+int redirectFiles(const char* inputFile, const char* outputFile)
+{
+    int fd;
+    if (inputFile != NULL)
+    {
+        if ((fd = open(inputFile, O_RDONLY)) == -1)
+        {
+            fprintf(stderr, "tsh: %s: %s\n", inputFile, strerror(errno));
+            return -1;
+        }
+        dup2(fd, 0);
+        close(fd);
+    }
+    if (outputFile != NULL)
+    {
+        // New file would have -rw-rw-r-- permission
+        if ((fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH)) == -1)
+        {
+            fprintf(stderr, "tsh: %s: %s\n", outputFile, strerror(errno));
+            return -1;
+        }
+        dup2(fd, 1);
+        close(fd);
+    }
+    return 0;
+}
+
+// Upper bound for F_SETPIPE_SZ, read once from procfs
+static int getPipeMaxSize()
+{
+    static int maxSize = 0;
+    FILE* fp;
+
+    if (maxSize == 0)
+    {
+        maxSize = 1024 * 1024;
+        if ((fp = fopen("/proc/sys/fs/pipe-max-size", "re")) != NULL)
+        {
+            if (fscanf(fp, "%d", &maxSize) != 1 || maxSize <= 0)
+                maxSize = 1024 * 1024;
+            fclose(fp);
+        }
+    }
+    return maxSize;
+}
+
+// Resize the pipe behind fd, clamped to the system maximum. Return the
+// capacity it really got, which the kernel rounds up to a power of two
+// pages, or -1 if it could not be changed.
+//
+int setPipeSize(int fd, int size)
+{
+    int ret;
+
+    if (size > getPipeMaxSize())
+        size = getPipeMaxSize();
+
+    // Over the per-user page budget only the default size is allowed
+    while ((ret = fcntl(fd, F_SETPIPE_SZ, size)) == -1 && errno == EPERM && size > 65536)
+        size /= 2;
+    return ret;
+}
@@ -0,0 +1,33 @@
+#ifndef __TSH_SPAWN_H__
+#define __TSH_SPAWN_H__
+
+#include <sys/types.h>
+#include "tsh.h"
+
+typedef struct SpawnRequest
+{
+    const char* path;        // absolute path or path relative to cwd
+    char** argv;
+    int in_fd;               // becomes stdin if != -1
+    int out_fd;              // becomes stdout if != -1
+    int err_fd;              // becomes stderr if != -1
+    int close_fd;            // closed in a forked builtin if != -1
+    const char* inputFile;   // redirections, applied after the pipes
+    const char* outputFile;
+    pid_t pgid;              // 0: new process group, > 0: join it,
+                             // -1: stay in the group of the shell
+    char** envp;             // NULL: the exported variables of the shell
+    int cgroup_fd;           // starts in this cgroup if != -1
+    const struct Placement* placement;  // CPUs and memory node, NULL: those of the shell
+    const struct Priority* priority;    // nice, scheduling class, I/O, NULL: those of the shell
+} SpawnRequest;
+
+void initSpawnRequest(SpawnRequest*);
+pid_t spawnCommand(SpawnRequest*);
+int execSpawnRequest(SpawnRequest*, char**);
+pid_t launchCommand(SpawnRequest*, char**, int*);
+pid_t spawnBuiltin(SpawnRequest*, Command*);
+int redirectFiles(const char*, const char*);
+int setPipeSize(int, int);
+
+#endif
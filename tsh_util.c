@@ -0,0 +1,615 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "tsh.h"
+#include "tsh_cmd.h"
+
+// Fast path utilities
+//
+// In-process versions of the tiny tools scripts call all the time.
+// They save a fork+exec when they run alone in the foreground, and an
+// exec in a pipeline or a background job. Invocations they do not
+// support are left to the real command through their check function.
+//
+
+int tsh_true(int argc, char* argv[])
+{
+    return 0;
+}
+
+int tsh_false(int argc, char* argv[])
+{
+    return 1;
+}
+
+/* echo */
+
+// Print the escape sequence at str, return the number of bytes used
+static int printEscape(const char* str, FILE* out, int* stop)
+{
+    int value = 0;
+    int len = 1;
+
+    switch (str[0])
+    {
+        case 'a': fputc('\a', out); return 1;
+        case 'b': fputc('\b', out); return 1;
+        case 'e': fputc('\033', out); return 1;
+        case 'f': fputc('\f', out); return 1;
+        case 'n': fputc('\n', out); return 1;
+        case 'r': fputc('\r', out); return 1;
+        case 't': fputc('\t', out); return 1;
+        case 'v': fputc('\v', out); return 1;
+        case '\\': fputc('\\', out); return 1;
+        case 'c': *stop = 1; return 1;
+        case '0':
+            // \0NNN, up to three octal digits
+            while (len < 4 && str[len] >= '0' && str[len] <= '7')
+                value = value * 8 + (str[len ++] - '0');
+            fputc(value, out);
+            return len;
+        default:
+            fputc('\\', out);
+            return 0;
+    }
+}
+
+int tsh_echo(int argc, char* argv[])
+{
+    int newline = 1;
+    int escape = 0;
+    int stop = 0;
+    int arg_idx = 1;
+
+    // Options are only recognized before the first operand
+    for ( ; arg_idx < argc ; arg_idx ++)
+    {
+        const char* opt = argv[arg_idx];
+        if (opt[0] != '-' || opt[1] == '\0' || strspn(opt + 1, "neE") != strlen(opt + 1))
+            break;
+        for (opt ++ ; *opt ; opt ++)
+        {
+            if (*opt == 'n')
+                newline = 0;
+            else
+                escape = (*opt == 'e');
+        }
+    }
+
+    for ( ; arg_idx < argc && !stop ; arg_idx ++)
+    {
+        const char* str = argv[arg_idx];
+        if (!escape)
+            fputs(str, stdout);
+        else
+        {
+            while (*str && !stop)
+            {
+                if (*str == '\\' && str[1])
+                    str += 1 + printEscape(str + 1, stdout, &stop);
+                else
+                    fputc(*str ++, stdout);
+            }
+        }
+        if (arg_idx != argc - 1 && !stop)
+            fputc(' ', stdout);
+    }
+    if (newline && !stop)
+        fputc('\n', stdout);
+
+    return (fflush(stdout) == EOF);
+}
+
+/* printf */
+
+static const char* printfConversions = "diouxXeEfFgGcsb%";
+
+int tsh_printf_check(int argc, char* argv[], int ttyInput)
+{
+    const char* fmt;
+    if (argc < 2)
+        return 1;
+
+    // Leave %q, %a, %n, '*' widths and friends to the real printf
+    for (fmt = argv[1] ; *fmt ; fmt ++)
+    {
+        if (*fmt != '%')
+            continue;
+        fmt ++;
+        fmt += strspn(fmt, "-+ #0123456789.");
+        if (*fmt == '\0' || strchr(printfConversions, *fmt) == NULL)
+            return 0;
+    }
+    return 1;
+}
+
+static long long printfNumber(const char* arg, int* err)
+{
+    char* end;
+    long long value;
+
+    if (arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char) arg[1];
+
+    errno = 0;
+    value = strtoll(arg, &end, 0);
+    if (errno || *end)
+    {
+        // Allow values up to ULLONG_MAX for the unsigned conversions
+        errno = 0;
+        value = (long long) strtoull(arg, &end, 0);
+        if (errno || *end)
+        {
+            fprintf(stderr, "tsh: printf: %s: invalid number\n", arg);
+            *err = 1;
+        }
+    }
+    return value;
+}
+
+int tsh_printf(int argc, char* argv[])
+{
+    const char* format;
+    int arg_idx = 2;
+    int err = 0;
+    int stop = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: printf <format> [arguments ...]\n");
+        return 2;
+    }
+    format = argv[1];
+
+    // The format is reused as long as there are arguments left
+    do
+    {
+        const char* fmt = format;
+        int first_arg = arg_idx;
+
+        while (*fmt && !stop)
+        {
+            char spec[64];
+            const char* start;
+            const char* arg;
+            size_t len;
+
+            if (*fmt == '\\' && fmt[1])
+            {
+                fmt += 1 + printEscape(fmt + 1, stdout, &stop);
+                continue;
+            }
+            if (*fmt != '%')
+            {
+                fputc(*fmt ++, stdout);
+                continue;
+            }
+            if (fmt[1] == '%')
+            {
+                fputc('%', stdout);
+                fmt += 2;
+                continue;
+            }
+
+            start = fmt ++;
+            fmt += strspn(fmt, "-+ #0123456789.");
+            len = fmt - start;
+            if (len + 4 > sizeof(spec))
+                len = sizeof(spec) - 4;
+            memcpy(spec, start, len);
+
+            arg = (arg_idx < argc) ? argv[arg_idx ++] : NULL;
+            switch (*fmt)
+            {
+                case 'd': case 'i':
+                    strcpy(spec + len, "lld");
+                    printf(spec, arg ? printfNumber(arg, &err) : 0LL);
+                    break;
+                case 'o': case 'u': case 'x': case 'X':
+                    spec[len] = 'l';
+                    spec[len + 1] = 'l';
+                    spec[len + 2] = *fmt;
+                    spec[len + 3] = '\0';
+                    printf(spec, (unsigned long long) (arg ? printfNumber(arg, &err) : 0));
+                    break;
+                case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+                    spec[len] = *fmt;
+                    spec[len + 1] = '\0';
+                    printf(spec, arg ? strtod(arg, NULL) : 0.0);
+                    break;
+                case 'c':
+                    spec[len] = 'c';
+                    spec[len + 1] = '\0';
+                    printf(spec, arg ? arg[0] : '\0');
+                    break;
+                case 's':
+                    spec[len] = 's';
+                    spec[len + 1] = '\0';
+                    printf(spec, arg ? arg : "");
+                    break;
+                case 'b':
+                    // %b: the argument with its escapes expanded
+                    for (arg = arg ? arg : "" ; *arg && !stop ; )
+                    {
+                        if (*arg == '\\' && arg[1])
+                            arg += 1 + printEscape(arg + 1, stdout, &stop);
+                        else
+                            fputc(*arg ++, stdout);
+                    }
+                    break;
+                default:
+                    fprintf(stderr, "tsh: printf: %%%c: invalid conversion\n", *fmt);
+                    return 1;
+            }
+            fmt ++;
+        }
+
+        // A format without conversions is printed only once
+        if (arg_idx == first_arg)
+            break;
+    } while (arg_idx < argc && !stop);
+
+    if (fflush(stdout) == EOF)
+        err = 1;
+    return err;
+}
+
+/* cat */
+
+// Copy everything from in_fd to out_fd. Regular files are copied inside
+// the kernel with copy_file_range(), anything involving a pipe with
+// splice(), other files to anything with sendfile(). read/write is the
+// last resort.
+//
+int copyFd(int in_fd, int out_fd)
+{
+    struct stat in_st, out_st;
+    char buf[65536];
+    ssize_t n;
+
+    if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1)
+        return -1;
+
+    // The kernel copies refuse to write to an O_APPEND file
+    if (S_ISREG(out_st.st_mode) && (fcntl(out_fd, F_GETFL) & O_APPEND))
+        out_st.st_mode = 0;
+
+    if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode))
+    {
+        while ((n = copy_file_range(in_fd, NULL, out_fd, NULL, 1 << 30, 0)) > 0);
+        if (n == 0)
+            return 0;
+        if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+            return -1;
+    }
+    else if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))
+    {
+        while ((n = splice(in_fd, NULL, out_fd, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0);
+        if (n == 0)
+            return 0;
+        if (errno != EINVAL)
+            return -1;
+    }
+    else if (S_ISREG(in_st.st_mode) && out_st.st_mode != 0)
+    {
+        while ((n = sendfile(out_fd, in_fd, NULL, 1 << 30)) > 0);
+        if (n == 0)
+            return 0;
+        if (errno != EINVAL && errno != ENOSYS)
+            return -1;
+    }
+
+    while ((n = read(in_fd, buf, sizeof(buf))) != 0)
+    {
+        char* pos = buf;
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (n > 0)
+        {
+            ssize_t written = write(out_fd, pos, n);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            pos += written;
+            n -= written;
+        }
+    }
+    return 0;
+}
+
+int tsh_cat_check(int argc, char* argv[], int ttyInput)
+{
+    int arg_idx;
+    int hasFile = 0;
+    int mayBlock = 0;
+
+    for (arg_idx = 1 ; arg_idx < argc ; arg_idx ++)
+    {
+        struct stat st;
+
+        // Only -u (which is a no-op here) is supported
+        if (argv[arg_idx][0] == '-' && argv[arg_idx][1] != '\0' && strcmp(argv[arg_idx], "-u") != 0)
+            return 0;
+        if (strcmp(argv[arg_idx], "-u") == 0)
+            continue;
+        if (strcmp(argv[arg_idx], "-") == 0)
+            mayBlock = 1;
+        else if (stat(argv[arg_idx], &st) == 0 && !S_ISREG(st.st_mode))
+            mayBlock = 1;
+        hasFile = 1;
+    }
+    if (!hasFile)
+        mayBlock = 1;
+
+    // Only regular files are sure to end. At an interactive shell the
+    // others (the terminal, a device, a pipe) are left to the real cat,
+    // as ^C would kill the shell if it ran cat itself.
+    return !(mayBlock && tsh_interactive);
+}
+
+int tsh_cat(int argc, char* argv[])
+{
+    int arg_idx;
+    int ret = 0;
+    int hasFile = 0;
+
+    fflush(stdout);
+    for (arg_idx = 1 ; arg_idx <= argc ; arg_idx ++)
+    {
+        const char* name;
+        int fd;
+
+        if (arg_idx == argc)
+        {
+            // No operand means stdin
+            if (hasFile)
+                break;
+            name = "-";
+        }
+        else if (strcmp(argv[arg_idx], "-u") == 0)
+            continue;
+        else
+            name = argv[arg_idx];
+        hasFile = 1;
+
+        if (strcmp(name, "-") == 0)
+            fd = 0;
+        else if ((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1)
+        {
+            fprintf(stderr, "tsh: cat: %s: %s\n", name, strerror(errno));
+            ret = 1;
+            continue;
+        }
+
+        if (copyFd(fd, 1) == -1)
+        {
+            fprintf(stderr, "tsh: cat: %s: %s\n", name, strerror(errno));
+            ret = 1;
+        }
+        if (fd != 0)
+            close(fd);
+    }
+    return ret;
+}
+
+/* test */
+
+static int testUnary(const char* op, const char* arg)
+{
+    struct stat st;
+
+    switch (op[1])
+    {
+        case 'z': return arg[0] == '\0';
+        case 'n': return arg[0] != '\0';
+        case 'e': return stat(arg, &st) == 0;
+        case 'f': return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+        case 'd': return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+        case 'p': return stat(arg, &st) == 0 && S_ISFIFO(st.st_mode);
+        case 'b': return stat(arg, &st) == 0 && S_ISBLK(st.st_mode);
+        case 'c': return stat(arg, &st) == 0 && S_ISCHR(st.st_mode);
+        case 'S': return stat(arg, &st) == 0 && S_ISSOCK(st.st_mode);
+        case 'L': case 'h': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+        case 's': return stat(arg, &st) == 0 && st.st_size > 0;
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 't': return isatty(atoi(arg));
+    }
+    return -1;
+}
+
+static int isUnaryOp(const char* op)
+{
+    return (op[0] == '-' && op[1] && op[2] == '\0' && strchr("znefdpbcSLhsrwxt", op[1]) != NULL);
+}
+
+static int isBinaryOp(const char* op)
+{
+    static const char* ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", NULL };
+    int idx;
+    for (idx = 0 ; ops[idx] ; idx ++)
+        if (strcmp(op, ops[idx]) == 0)
+            return 1;
+    return 0;
+}
+
+static int testNumber(const char* arg, long long* value)
+{
+    char* end;
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
+    if (errno || end == arg || *end)
+    {
+        fprintf(stderr, "tsh: test: %s: integer expression expected\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+static int testBinary(const char* left, const char* op, const char* right)
+{
+    long long l, r;
+    struct stat lst, rst;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(left, right) != 0;
+    if (strcmp(op, "<") == 0)
+        return strcmp(left, right) < 0;
+    if (strcmp(op, ">") == 0)
+        return strcmp(left, right) > 0;
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0)
+    {
+        int lok = (stat(left, &lst) == 0), rok = (stat(right, &rst) == 0);
+        int cmp;
+        if (!lok || !rok)
+            return (op[1] == 'n') ? (lok && !rok) : (!lok && rok);
+        cmp = (lst.st_mtim.tv_sec != rst.st_mtim.tv_sec) ?
+              (lst.st_mtim.tv_sec > rst.st_mtim.tv_sec ? 1 : -1) :
+              (lst.st_mtim.tv_nsec > rst.st_mtim.tv_nsec) - (lst.st_mtim.tv_nsec < rst.st_mtim.tv_nsec);
+        return (op[1] == 'n') ? (cmp > 0) : (cmp < 0);
+    }
+
+    if (testNumber(left, &l) == -1 || testNumber(right, &r) == -1)
+        return -1;
+    if (strcmp(op, "-eq") == 0) return l == r;
+    if (strcmp(op, "-ne") == 0) return l != r;
+    if (strcmp(op, "-lt") == 0) return l < r;
+    if (strcmp(op, "-le") == 0) return l <= r;
+    if (strcmp(op, "-gt") == 0) return l > r;
+    return l >= r;
+}
+
+// Recursive descent over: expr := and ( -o and )*, and := not ( -a not )*,
+// not := '!' not | '(' expr ')' | primary. Return 1/0, or -1 on error.
+//
+typedef struct TestParser
+{
+    int argc;
+    char** argv;
+    int pos;
+} TestParser;
+
+static int testOr(TestParser*);
+
+static int testPrimary(TestParser* tp)
+{
+    int remain = tp->argc - tp->pos;
+    char** argv = tp->argv + tp->pos;
+
+    if (remain <= 0)
+    {
+        fprintf(stderr, "tsh: test: argument expected\n");
+        return -1;
+    }
+
+    if (strcmp(argv[0], "!") == 0 && remain > 1)
+    {
+        int ret;
+        tp->pos ++;
+        ret = testPrimary(tp);
+        return (ret == -1) ? -1 : !ret;
+    }
+    if (strcmp(argv[0], "(") == 0 && remain > 2)
+    {
+        int ret;
+        tp->pos ++;
+        ret = testOr(tp);
+        if (tp->pos >= tp->argc || strcmp(tp->argv[tp->pos], ")") != 0)
+        {
+            fprintf(stderr, "tsh: test: ')' expected\n");
+            return -1;
+        }
+        tp->pos ++;
+        return ret;
+    }
+    if (remain >= 3 && isBinaryOp(argv[1]))
+    {
+        tp->pos += 3;
+        return testBinary(argv[0], argv[1], argv[2]);
+    }
+    if (remain >= 2 && isUnaryOp(argv[0]))
+    {
+        tp->pos += 2;
+        return testUnary(argv[0], argv[1]);
+    }
+
+    tp->pos ++;
+    return argv[0][0] != '\0';
+}
+
+static int testAnd(TestParser* tp)
+{
+    int ret = testPrimary(tp);
+    while (ret != -1 && tp->pos < tp->argc && strcmp(tp->argv[tp->pos], "-a") == 0)
+    {
+        int rhs;
+        tp->pos ++;
+        if ((rhs = testPrimary(tp)) == -1)
+            return -1;
+        ret = ret && rhs;
+    }
+    return ret;
+}
+
+static int testOr(TestParser* tp)
+{
+    int ret = testAnd(tp);
+    while (ret != -1 && tp->pos < tp->argc && strcmp(tp->argv[tp->pos], "-o") == 0)
+    {
+        int rhs;
+        tp->pos ++;
+        if ((rhs = testAnd(tp)) == -1)
+            return -1;
+        ret = ret || rhs;
+    }
+    return ret;
+}
+
+int tsh_test(int argc, char* argv[])
+{
+    TestParser tp;
+    int ret;
+
+    if (strcmp(argv[0], "[") == 0)
+    {
+        if (strcmp(argv[argc - 1], "]") != 0)
+        {
+            fprintf(stderr, "tsh: [: missing ']'\n");
+            return 2;
+        }
+        argc --;
+    }
+
+    // No expression is false, a single argument is a string test
+    if (argc == 1)
+        return 1;
+    if (argc == 2)
+        return argv[1][0] == '\0';
+
+    tp.argc = argc;
+    tp.argv = argv;
+    tp.pos = 1;
+    ret = testOr(&tp);
+    if (ret != -1 && tp.pos != argc)
+    {
+        fprintf(stderr, "tsh: test: %s: unexpected argument\n", argv[tp.pos]);
+        ret = -1;
+    }
+    return (ret == -1) ? 2 : !ret;
+}
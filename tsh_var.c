@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tsh_var.h"
+
+extern char** environ;
+
+// Variable store
+//
+// Every variable lives in one open addressing table, exported or not,
+// and is kept as a single "name=value" string so that the environment
+// handed to exec is only an array of pointers into the table. That
+// array is rebuilt when an exported variable changed, and reused as is
+// for every command spawned in between: assigning a shell variable, or
+// running a thousand commands without touching the environment, never
+// copies it. environ is kept pointing at the same array for whatever
+// in libc still reads it.
+//
+VarTable varTable;
+
+static char* defaultArgs[] = { "tsh", NULL };
+Positional positional = { 0, defaultArgs };
+
+static unsigned int hashName(const char* name, int len)
+{
+    unsigned int hash = 2166136261u;
+    int idx;
+    for (idx = 0 ; idx < len ; idx ++)
+        hash = (hash ^ (unsigned char) name[idx]) * 16777619u;
+    return hash;
+}
+
+// Find the slot of a variable, NULL if it is not set
+static Var* findVar(const char* name, int len, unsigned int hash)
+{
+    unsigned int mask = varTable.cap - 1;
+    unsigned int idx = hash & mask;
+
+    while (varTable.slots[idx].entry != NULL || varTable.slots[idx].isDeleted)
+    {
+        Var* var = &varTable.slots[idx];
+        if (var->entry != NULL && var->hash == hash && var->name_len == len &&
+            memcmp(var->entry, name, len) == 0)
+            return var;
+        idx = (idx + 1) & mask;
+    }
+    return NULL;
+}
+
+static Var* insertSlot(unsigned int hash);
+
+static void growVars()
+{
+    Var* old = varTable.slots;
+    unsigned int old_cap = varTable.cap;
+    unsigned int idx;
+
+    // Only grow if live entries need it, otherwise just drop tombstones
+    if (varTable.num * 4 >= old_cap)
+        varTable.cap *= 2;
+
+    varTable.slots = (Var*) calloc(varTable.cap, sizeof(Var));
+    varTable.used = 0;
+    for (idx = 0 ; idx < old_cap ; idx ++)
+        if (old[idx].entry != NULL)
+            *insertSlot(old[idx].hash) = old[idx];
+    free (old);
+}
+
+// Return a free slot for a variable which is not in the table
+static Var* insertSlot(unsigned int hash)
+{
+    unsigned int mask;
+    unsigned int idx;
+
+    // Keep the load (tombstones included) under 1/2
+    if ((varTable.used + 1) * 2 > varTable.cap)
+        growVars();
+
+    mask = varTable.cap - 1;
+    idx = hash & mask;
+    while (varTable.slots[idx].entry != NULL)
+        idx = (idx + 1) & mask;
+    if (!varTable.slots[idx].isDeleted)
+        varTable.used ++;
+    varTable.slots[idx].isDeleted = 0;
+    return &varTable.slots[idx];
+}
+
+// envp may still point to an exported entry which is being replaced,
+// keep it alive until envp is rebuilt.
+static void retireEntry(Var* var)
+{
+    if (!var->isExported || var->env_idx == -1)
+    {
+        free (var->entry);
+        return;
+    }
+    if (varTable.retired_num == varTable.retired_cap)
+    {
+        varTable.retired_cap = varTable.retired_cap ? varTable.retired_cap * 2 : 8;
+        varTable.retired = (char**) realloc(varTable.retired, sizeof(char*) * varTable.retired_cap);
+    }
+    varTable.retired[varTable.retired_num ++] = var->entry;
+}
+
+static void putVar(const char* name, int name_len, const char* value, int isExported)
+{
+    unsigned int hash = hashName(name, name_len);
+    Var* var = findVar(name, name_len, hash);
+    size_t value_len = strlen(value);
+    char* entry = (char*) malloc(name_len + value_len + 2);
+
+    memcpy(entry, name, name_len);
+    entry[name_len] = '=';
+    memcpy(entry + name_len + 1, value, value_len + 1);
+
+    if (var != NULL)
+    {
+        retireEntry(var);
+        isExported |= var->isExported;
+    }
+    else
+    {
+        var = insertSlot(hash);
+        var->hash = hash;
+        var->name_len = name_len;
+        var->env_idx = -1;
+        varTable.num ++;
+    }
+    var->entry = entry;
+    var->value = entry + name_len + 1;
+    var->isExported = isExported;
+    if (isExported)
+        varTable.isEnvDirty = 1;
+}
+
+// Import the inherited environment, every variable of it is exported
+void initVars(char** env)
+{
+    clearVars();
+    for ( ; env && *env ; env ++)
+    {
+        const char* eq = strchr(*env, '=');
+        if (eq != NULL && eq != *env)
+            putVar(*env, eq - *env, eq + 1, 1);
+    }
+    getEnvp();
+}
+
+void clearVars()
+{
+    unsigned int idx;
+
+    for (idx = 0 ; idx < varTable.cap ; idx ++)
+        free (varTable.slots[idx].entry);
+    for (idx = 0 ; idx < (unsigned int) varTable.retired_num ; idx ++)
+        free (varTable.retired[idx]);
+    free (varTable.slots);
+    free (varTable.retired);
+
+    // environ is left alone: it may still be the old envp
+    varTable.slots = NULL;
+    varTable.retired = NULL;
+    varTable.retired_num = varTable.retired_cap = 0;
+    varTable.cap = 64;
+    varTable.num = varTable.used = 0;
+    varTable.slots = (Var*) calloc(varTable.cap, sizeof(Var));
+    varTable.envp_num = 0;
+    varTable.isEnvDirty = 1;
+}
+
+// Return the value of a variable, NULL if it is not set
+const char* getVar(const char* name)
+{
+    int len = strlen(name);
+    Var* var = findVar(name, len, hashName(name, len));
+    return var ? var->value : NULL;
+}
+
+int isValidName(const char* name, int len)
+{
+    int idx;
+
+    if (len == 0 || (name[0] >= '0' && name[0] <= '9'))
+        return 0;
+    for (idx = 0 ; idx < len ; idx ++)
+    {
+        char c = name[idx];
+        if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+            return 0;
+    }
+    return 1;
+}
+
+// Set a variable. A variable which is already exported stays exported,
+// isExported only ever adds the flag.
+void setVar(const char* name, const char* value, int isExported)
+{
+    putVar(name, strlen(name), value, isExported);
+}
+
+// Set a variable from a NAME=value word
+void setAssignment(const char* word, int isExported)
+{
+    const char* eq = strchr(word, '=');
+    putVar(word, eq - word, eq + 1, isExported);
+}
+
+// Builtins run by the shell itself see the NAME=value prefixes of their
+// command line as exported variables, for their own duration only.
+// Return what the assignments replaced, for popAssignments().
+//
+Var* pushAssignments(char** assigns, int assign_num, Arena* arena)
+{
+    Var* saved = (Var*) arenaAlloc(arena, sizeof(Var) * assign_num);
+    int idx;
+
+    for (idx = 0 ; idx < assign_num ; idx ++)
+    {
+        int len = strchr(assigns[idx], '=') - assigns[idx];
+        Var* var = findVar(assigns[idx], len, hashName(assigns[idx], len));
+
+        memset(&saved[idx], 0, sizeof(Var));
+        if (var != NULL)
+        {
+            saved[idx] = *var;
+            saved[idx].entry = arenaStrndup(arena, var->entry, strlen(var->entry));
+        }
+        putVar(assigns[idx], len, assigns[idx] + len + 1, 1);
+    }
+    return saved;
+}
+
+void popAssignments(char** assigns, int assign_num, Var* saved)
+{
+    int idx;
+
+    // Backwards, so that FOO=1 FOO=2 restores the value before both
+    for (idx = assign_num - 1 ; idx >= 0 ; idx --)
+    {
+        int len = strchr(assigns[idx], '=') - assigns[idx];
+        Var* var;
+
+        if (saved[idx].entry == NULL)
+        {
+            char name[len + 1];
+            memcpy(name, assigns[idx], len);
+            name[len] = '\0';
+            unsetVar(name);
+            continue;
+        }
+        putVar(saved[idx].entry, len, saved[idx].entry + len + 1, 0);
+        var = findVar(assigns[idx], len, hashName(assigns[idx], len));
+        if (var->isExported != saved[idx].isExported)
+        {
+            var->isExported = saved[idx].isExported;
+            varTable.isEnvDirty = 1;
+        }
+    }
+}
+
+// Mark a variable exported, return -1 if it is not set
+int exportVar(const char* name)
+{
+    int len = strlen(name);
+    Var* var = findVar(name, len, hashName(name, len));
+
+    if (var == NULL)
+        return -1;
+    if (!var->isExported)
+    {
+        var->isExported = 1;
+        varTable.isEnvDirty = 1;
+    }
+    return 0;
+}
+
+// Remove a variable, return -1 if it was not set
+int unsetVar(const char* name)
+{
+    int len = strlen(name);
+    Var* var = findVar(name, len, hashName(name, len));
+
+    if (var == NULL)
+        return -1;
+    if (var->isExported)
+        varTable.isEnvDirty = 1;
+    retireEntry(var);
+    var->entry = NULL;
+    var->value = NULL;
+    var->isDeleted = 1;
+    varTable.num --;
+    return 0;
+}
+
+// The environment of the commands, rebuilt only if it changed
+char** getEnvp()
+{
+    unsigned int idx;
+    int env_idx;
+
+    if (!varTable.isEnvDirty)
+        return varTable.envp;
+
+    if (varTable.envp_cap < (int) varTable.num + 1)
+    {
+        varTable.envp_cap = varTable.num + 1;
+        varTable.envp = (char**) realloc(varTable.envp, sizeof(char*) * varTable.envp_cap);
+    }
+    for (idx = 0, env_idx = 0 ; idx < varTable.cap ; idx ++)
+    {
+        Var* var = &varTable.slots[idx];
+        if (var->entry == NULL)
+            continue;
+        var->env_idx = var->isExported ? env_idx : -1;
+        if (var->isExported)
+            varTable.envp[env_idx ++] = var->entry;
+    }
+    varTable.envp[env_idx] = NULL;
+    varTable.envp_num = env_idx;
+    environ = varTable.envp;
+
+    for (idx = 0 ; idx < (unsigned int) varTable.retired_num ; idx ++)
+        free (varTable.retired[idx]);
+    varTable.retired_num = 0;
+    varTable.isEnvDirty = 0;
+    return varTable.envp;
+}
+
+// The environment of one command run with NAME=value prefixes: the
+// pointers of envp with the assignments overriding or added to them.
+// Nothing is copied but pointers; the array is released with free().
+//
+char** overlayEnvp(char** assigns, int assign_num)
+{
+    char** base = getEnvp();
+    char** ret = (char**) malloc(sizeof(char*) * (varTable.envp_num + assign_num + 1));
+    int num = varTable.envp_num;
+    int idx;
+
+    memcpy(ret, base, sizeof(char*) * num);
+    for (idx = 0 ; idx < assign_num ; idx ++)
+    {
+        int len = strchr(assigns[idx], '=') - assigns[idx];
+        Var* var = findVar(assigns[idx], len, hashName(assigns[idx], len));
+        int prev;
+
+        if (var != NULL && var->env_idx != -1)
+        {
+            ret[var->env_idx] = assigns[idx];
+            continue;
+        }
+
+        // FOO=1 FOO=2 cmd: the last one wins
+        for (prev = varTable.envp_num ; prev < num ; prev ++)
+            if (strncmp(ret[prev], assigns[idx], len + 1) == 0)
+                break;
+        ret[prev] = assigns[idx];
+        if (prev == num)
+            num ++;
+    }
+    ret[num] = NULL;
+    return ret;
+}
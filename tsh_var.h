@@ -0,0 +1,60 @@
+#ifndef __TSH_VAR_H__
+#define __TSH_VAR_H__
+
+#include "tsh_arena.h"
+
+// A shell variable. entry holds "name=value", the form exec wants, and
+// name and value point into it.
+typedef struct Var
+{
+    char* entry;          // NULL: empty slot
+    const char* value;
+    unsigned int hash;
+    int name_len;
+    int isExported;
+    int isDeleted;        // tombstone, entry is NULL
+    int env_idx;          // position in envp, -1 if not in it
+} Var;
+
+// Variables hashed by name. The exec environment is built from the
+// exported ones only when one of them changed since it was last built.
+typedef struct VarTable
+{
+    Var* slots;
+    unsigned int cap;
+    unsigned int num;     // live variables
+    unsigned int used;    // live + deleted slots
+    char** envp;          // exported entries, NULL terminated
+    int envp_num;
+    int envp_cap;
+    int isEnvDirty;       // an exported variable changed since envp was built
+    char** retired;       // replaced exported entries envp may still point to
+    int retired_num;
+    int retired_cap;
+} VarTable;
+
+// $0 and the positional parameters $1 ... of the running function, or
+// of the script
+typedef struct Positional
+{
+    int num;              // $#
+    char** args;          // args[0] is $0, NULL terminated
+} Positional;
+
+extern VarTable varTable;
+extern Positional positional;
+
+void initVars(char**);
+void clearVars();
+const char* getVar(const char*);
+int isValidName(const char*, int);
+void setVar(const char*, const char*, int);
+void setAssignment(const char*, int);
+Var* pushAssignments(char**, int, Arena*);
+void popAssignments(char**, int, Var*);
+int exportVar(const char*);
+int unsetVar(const char*);
+char** getEnvp();
+char** overlayEnvp(char**, int);
+
+#endif
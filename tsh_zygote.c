@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include "tsh.h"
+#include "tsh_zygote.h"
+#include "tsh_cgroup.h"
+
+// Spawn helper
+//
+// A small process forked while the shell is still small, which launches
+// commands on its behalf. A request carries argv, envp, the redirection
+// files, the pgid, the placement and the priority; stdin, stdout,
+// stderr and the current directory of the shell travel along as
+// descriptors (SCM_RIGHTS). The helper starts the command with
+// clone(CLONE_PARENT), so the command is a child of the shell, which
+// waits for it and controls it exactly as if it had spawned it itself.
+// Like with posix_spawn(), the child runs on the memory of the helper
+// until it execs, and an exec failure is reported with the errno
+// posix_spawn() would have returned.
+//
+// The command of a job with a cgroup is started inside it with clone3(),
+// which is a fork() of the helper, still cheap as the helper is small.
+//
+// If the helper goes away, commands are spawned by the shell again.
+//
+#define ZYGOTE_FD_NUM 4   // stdin, stdout, stderr, cwd, then the cgroup if any
+
+Zygote zygote = { 0, -1, NULL, 0 };
+
+static int readAll(int fd, void* data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = read(fd, (char*) data + done, len - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static int writeAll(int fd, const void* data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = send(fd, (const char*) data + done, len - done, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+/* Helper side */
+
+typedef struct LaunchArgs
+{
+    SpawnRequest req;     // descriptors already are those of the shell
+    char** envp;
+    int cwd_fd;
+    int err;              // written by the child if it could not exec
+} LaunchArgs;
+
+// Set up the command and exec it. Return the errno of the failure.
+static int execLaunch(void* data)
+{
+    LaunchArgs* args = (LaunchArgs*) data;
+
+    if (fchdir(args->cwd_fd) == -1)
+        return errno;
+    return execSpawnRequest(&args->req, args->envp);
+}
+
+// Runs in the new command until exec, on the memory of the helper
+// (CLONE_VM), while the helper is suspended (CLONE_VFORK).
+static int launchChild(void* data)
+{
+    LaunchArgs* args = (LaunchArgs*) data;
+    args->err = execLaunch(data);
+    _exit(127);
+}
+
+static void handleRequest(int sock, ZygoteRequest* req, int* fds, char* body)
+{
+    static char stack[65536] __attribute__((aligned(16)));
+    ZygoteReply reply;
+    LaunchArgs args;
+    char** argv = (char**) malloc(sizeof(char*) * (req->argc + req->envc + 2));
+    char* pos = body;
+    pid_t pid;
+    int idx;
+
+    memset(&args, 0, sizeof(args));
+    initSpawnRequest(&args.req);
+    args.req.in_fd = fds[0];
+    args.req.out_fd = fds[1];
+    args.req.err_fd = fds[2];
+    args.cwd_fd = fds[3];
+    args.req.pgid = req->pgid;
+    if (req->hasPlacement)
+        args.req.placement = &req->placement;
+    if (req->hasPriority)
+        args.req.priority = &req->priority;
+    args.req.argv = argv;
+    args.envp = argv + req->argc + 1;
+    args.req.path = pos;
+    pos += strlen(pos) + 1;
+    for (idx = 0 ; idx < req->argc ; idx ++, pos += strlen(pos) + 1)
+        args.req.argv[idx] = pos;
+    args.req.argv[req->argc] = NULL;
+    for (idx = 0 ; idx < req->envc ; idx ++, pos += strlen(pos) + 1)
+        args.envp[idx] = pos;
+    args.envp[req->envc] = NULL;
+    if (req->hasInput)
+    {
+        args.req.inputFile = pos;
+        pos += strlen(pos) + 1;
+    }
+    if (req->hasOutput)
+        args.req.outputFile = pos;
+
+    // A child of the shell, not of the helper. The call returns once it
+    // exec'd or gave up; a child which gave up is reaped by the shell
+    // like any other unknown child.
+    memset(&reply, 0, sizeof(reply));
+    if (req->hasCgroup)
+    {
+        // -2: the shell has to start it itself
+        pid = spawnIntoCgroup(fds[ZYGOTE_FD_NUM], CLONE_PARENT, execLaunch, &args);
+        reply.pid = pid;
+        reply.err = (pid == -1) ? errno : 0;
+        free (argv);
+        writeAll(sock, &reply, sizeof(reply));
+        return;
+    }
+    pid = clone(launchChild, stack + sizeof(stack), CLONE_VM | CLONE_VFORK | CLONE_PARENT | SIGCHLD, &args);
+    if (pid == -1)
+    {
+        reply.pid = -1;
+        reply.err = errno;
+        reply.isBroken = (errno == EINVAL || errno == EPERM);
+    }
+    else if (args.err != 0)
+    {
+        reply.pid = -1;
+        reply.err = args.err;
+    }
+    else
+        reply.pid = pid;
+
+    free (argv);
+    writeAll(sock, &reply, sizeof(reply));
+}
+
+static void runZygote(int sock)
+{
+    char* body = NULL;
+    size_t cap = 0;
+
+    while (1)
+    {
+        ZygoteRequest req;
+        char control[CMSG_SPACE(sizeof(int) * (ZYGOTE_FD_NUM + 1))];
+        struct iovec iov = { &req, sizeof(req) };
+        struct msghdr msg;
+        struct cmsghdr* cmsg;
+        int fds[ZYGOTE_FD_NUM + 1];
+        int fd_num;
+        int idx;
+        ssize_t n;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        n = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n != sizeof(req))
+            _exit(0);  // the shell is gone
+
+        fd_num = ZYGOTE_FD_NUM + (req.hasCgroup ? 1 : 0);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(sizeof(int) * fd_num))
+            _exit(1);
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * fd_num);
+
+        if (req.body_len + 1 > cap)
+        {
+            cap = req.body_len + 1;
+            body = (char*) realloc(body, cap);
+        }
+        if (readAll(sock, body, req.body_len) == -1)
+            _exit(0);
+        body[req.body_len] = '\0';
+
+        handleRequest(sock, &req, fds, body);
+        for (idx = 0 ; idx < fd_num ; idx ++)
+            close(fds[idx]);
+    }
+}
+
+/* Shell side */
+
+// Fork the helper. Return -1 if it could not be started.
+int startZygote()
+{
+    int sv[2];
+    pid_t pid;
+
+    if (zygote.pid != 0)
+        return 0;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+        return -1;
+
+    if ((pid = fork()) == -1)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        int fd;
+
+        // Out of reach of the terminal, gone with the shell
+        setpgid(0, 0);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != tsh_pid)
+            _exit(0);
+        for (fd = 3 ; fd < 1024 ; fd ++)
+            if (fd != sv[1])
+                close(fd);
+        runZygote(sv[1]);
+    }
+
+    close(sv[1]);
+    zygote.pid = pid;
+    zygote.fd = sv[0];
+    return 0;
+}
+
+void stopZygote()
+{
+    if (zygote.pid == 0)
+        return;
+    close(zygote.fd);
+    kill(zygote.pid, SIGKILL);
+    zygote.pid = 0;
+    zygote.fd = -1;
+}
+
+static void appendString(size_t* len, const char* str)
+{
+    size_t str_len = strlen(str) + 1;
+    if (*len + str_len > zygote.cap)
+    {
+        while (*len + str_len > zygote.cap)
+            zygote.cap = zygote.cap ? zygote.cap * 2 : 4096;
+        zygote.buf = (char*) realloc(zygote.buf, zygote.cap);
+    }
+    memcpy(zygote.buf + *len, str, str_len);
+    *len += str_len;
+}
+
+// Launch through the helper. Return the pid, -1 with errno set if the
+// command could not be started, or -2 if the helper is not usable and
+// the caller has to spawn it itself.
+//
+pid_t zygoteSpawn(SpawnRequest* req, char** envp)
+{
+    ZygoteRequest header;
+    ZygoteReply reply;
+    char control[CMSG_SPACE(sizeof(int) * (ZYGOTE_FD_NUM + 1))];
+    struct iovec iov = { &header, sizeof(header) };
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    int fds[ZYGOTE_FD_NUM + 1];
+    int fd_num = ZYGOTE_FD_NUM;
+    size_t len = 0;
+    int idx;
+
+    if (zygote.pid == 0)
+        return -2;
+
+    memset(&header, 0, sizeof(header));
+    appendString(&len, req->path);
+    for (idx = 0 ; req->argv[idx] ; idx ++, header.argc ++)
+        appendString(&len, req->argv[idx]);
+    for (idx = 0 ; envp[idx] ; idx ++, header.envc ++)
+        appendString(&len, envp[idx]);
+    if ((header.hasInput = (req->inputFile != NULL)))
+        appendString(&len, req->inputFile);
+    if ((header.hasOutput = (req->outputFile != NULL)))
+        appendString(&len, req->outputFile);
+    header.body_len = len;
+    header.pgid = (req->pgid == -1) ? getpgrp() : req->pgid;
+    if ((header.hasPlacement = (req->placement != NULL)))
+        header.placement = *req->placement;
+    if ((header.hasPriority = (req->priority != NULL)))
+        header.priority = *req->priority;
+
+    // The descriptors the command would inherit from the shell right now
+    fds[0] = (req->in_fd != -1) ? req->in_fd : 0;
+    fds[1] = (req->out_fd != -1) ? req->out_fd : 1;
+    fds[2] = (req->err_fd != -1) ? req->err_fd : 2;
+    if ((fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)) == -1)
+        return -2;
+    if ((header.hasCgroup = (req->cgroup_fd != -1)))
+        fds[fd_num ++] = req->cgroup_fd;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_num);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_num);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_num);
+
+    while (sendmsg(zygote.fd, &msg, MSG_NOSIGNAL) == -1)
+    {
+        if (errno != EINTR)
+            goto broken;
+    }
+    close(fds[3]);
+    fds[3] = -1;
+    if (writeAll(zygote.fd, zygote.buf, len) == -1 || readAll(zygote.fd, &reply, sizeof(reply)) == -1)
+        goto broken;
+
+    if (reply.isBroken)
+        goto broken;
+    if (reply.pid == -2)
+        return -2;
+    if (reply.pid == -1 || reply.err != 0)
+    {
+        errno = reply.err;
+        return -1;
+    }
+    return reply.pid;
+
+broken:
+    if (fds[3] != -1)
+        close(fds[3]);
+    fprintf(stderr, "tsh: spawn helper stopped working, spawning directly\n");
+    stopZygote();
+    return -2;
+}
@@ -0,0 +1,47 @@
+#ifndef __TSH_ZYGOTE_H__
+#define __TSH_ZYGOTE_H__
+
+#include <sys/types.h>
+#include "tsh_spawn.h"
+#include "tsh_place.h"
+#include "tsh_prio.h"
+
+// Fixed part of a launch request, followed by the strings: path, argv,
+// envp, then the redirection files which are present
+typedef struct ZygoteRequest
+{
+    size_t body_len;
+    int argc;
+    int envc;
+    pid_t pgid;          // 0: new process group, > 0: join it
+    int hasInput;
+    int hasOutput;
+    int hasCgroup;       // its directory is sent as a fifth descriptor
+    int hasPlacement;
+    Placement placement;
+    int hasPriority;
+    Priority priority;
+} ZygoteRequest;
+
+typedef struct ZygoteReply
+{
+    pid_t pid;           // -2: the shell has to launch it itself
+    int err;             // errno of the failed launch, 0 on success
+    int isBroken;        // the helper can not launch anything
+} ZygoteReply;
+
+typedef struct Zygote
+{
+    pid_t pid;           // 0 if not running
+    int fd;              // socket to the helper
+    char* buf;           // request being built
+    size_t cap;
+} Zygote;
+
+extern Zygote zygote;
+
+int startZygote();
+void stopZygote();
+pid_t zygoteSpawn(SpawnRequest*, char**);
+
+#endif